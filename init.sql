@@ -60,6 +60,16 @@ CREATE TABLE IF NOT EXISTS @extschema@.server_map(
 	CONSTRAINT server_map_range_end_check CHECK (range_end >= range_start and range_end <=128)
 );
 
+/*
+ * Read-only replicas of the servers in server_map. Read-only transactions
+ * may be routed to them, see gogudb.replica_routing.
+ */
+CREATE TABLE IF NOT EXISTS @extschema@.server_replicas(
+	server_name		TEXT NOT NULL,
+	replica_name		TEXT NOT NULL,
+	PRIMARY KEY (server_name, replica_name)
+);
+
 CREATE TABLE IF NOT EXISTS @extschema@.table_partition_rule(
 	schema_name		TEXT NOT NULL,
 	table_name              TEXT NOT NULL,
@@ -77,6 +87,59 @@ CREATE TABLE IF NOT EXISTS @extschema@.table_partition_rule(
 	servers         TEXT[] DEFAULT NULL,
 	primary key(schema_name, table_name)
 );
+
+/*
+ * Schedules of precreate_range_partitions(), their workers are started
+ * again when the server restarts.
+ *		partrel			- partitioned table, NULL means all tables
+ *		intervals		- intervals to keep ahead of current time
+ *		period			- seconds between rounds
+ *		owner			- role which runs the worker
+ */
+CREATE TABLE IF NOT EXISTS @extschema@.gogudb_precreate_config (
+	partrel			REGCLASS DEFAULT NULL,
+	intervals		INTEGER NOT NULL,
+	period			INTEGER NOT NULL,
+	owner			REGROLE NOT NULL
+);
+
+/*
+ * Schedule of start_partition_retention(), its worker is started again
+ * when the server restarts.
+ *		action			- 'drop', 'detach' or 'archive'
+ *		batch_size		- max partitions of a table per round
+ *		lock_timeout	- lock_timeout (ms) of a single removal
+ *		period			- seconds between rounds
+ *		owner			- role which runs the worker
+ */
+CREATE TABLE IF NOT EXISTS @extschema@.gogudb_retention_config (
+	action			TEXT NOT NULL,
+	batch_size		INTEGER NOT NULL,
+	lock_timeout	INTEGER NOT NULL,
+	period			INTEGER NOT NULL,
+	owner			REGROLE NOT NULL
+);
+
+/*
+ * Remote tables of partitions removed by the retention worker which
+ * are not dropped (or renamed) on their shards yet.
+ *		server			- foreign server of the removed partition
+ *		owner			- owner of the removed partition
+ *		remote_schema	- schema of the remote table
+ *		remote_table	- name of the remote table
+ *		action			- 'drop' or 'archive'
+ *		attempts		- failed attempts so far
+ */
+CREATE TABLE IF NOT EXISTS @extschema@.gogudb_retention_pending (
+	server			TEXT NOT NULL,
+	owner			REGROLE NOT NULL,
+	remote_schema	TEXT NOT NULL,
+	remote_table	TEXT NOT NULL,
+	action			TEXT NOT NULL,
+	attempts		INTEGER NOT NULL DEFAULT 0,
+	PRIMARY KEY (server, remote_schema, remote_table)
+);
+
 /*
  * Checks that callback function meets specific requirements.
  * Particularly it must have the only JSONB argument and VOID return type.
@@ -97,13 +160,15 @@ LANGUAGE C STRICT;
  *		auto			- enable automatic partition creation
  *		init_callback	- text signature of cb to be executed on partition creation
  *		spawn_using_bgw	- use background worker in order to auto create partitions
+ *		retention		- drop partitions older than this (see start_partition_retention)
  */
 CREATE TABLE IF NOT EXISTS @extschema@.gogudb_config_params (
 	partrel			REGCLASS NOT NULL PRIMARY KEY,
 	enable_parent	BOOLEAN NOT NULL DEFAULT FALSE,
 	auto			BOOLEAN NOT NULL DEFAULT TRUE,
 	init_callback	TEXT DEFAULT NULL,
-	spawn_using_bgw	BOOLEAN NOT NULL DEFAULT FALSE
+	spawn_using_bgw	BOOLEAN NOT NULL DEFAULT FALSE,
+	retention		INTERVAL DEFAULT NULL
 
 	/* check callback's signature */
 	CHECK (@extschema@.validate_part_callback(CASE WHEN init_callback IS NULL
@@ -116,6 +181,8 @@ GRANT SELECT, INSERT, UPDATE, DELETE
 ON @extschema@.gogudb_config, @extschema@.gogudb_config_params, @extschema@.table_partition_rule
 TO public;
 
+GRANT SELECT ON @extschema@.server_replicas TO public;
+
 /*
  * Check if current user can alter/drop specified relation
  */
@@ -162,6 +229,10 @@ FOR EACH ROW EXECUTE PROCEDURE @extschema@.gogudb_config_params_trigger_func();
 SELECT pg_catalog.pg_extension_config_dump('@extschema@.gogudb_config', '');
 SELECT pg_catalog.pg_extension_config_dump('@extschema@.gogudb_config_params', '');
 SELECT pg_catalog.pg_extension_config_dump('@extschema@.table_partition_rule', '');
+SELECT pg_catalog.pg_extension_config_dump('@extschema@.server_replicas', '');
+SELECT pg_catalog.pg_extension_config_dump('@extschema@.gogudb_precreate_config', '');
+SELECT pg_catalog.pg_extension_config_dump('@extschema@.gogudb_retention_config', '');
+SELECT pg_catalog.pg_extension_config_dump('@extschema@.gogudb_retention_pending', '');
 
 
 /*
@@ -245,6 +316,58 @@ BEGIN
 END
 $$ LANGUAGE plpgsql STRICT;
 
+/*
+ * Keep partitions which may contain rows newer than now() - 'older_than'.
+ */
+CREATE OR REPLACE FUNCTION @extschema@.set_retention(
+	relation		REGCLASS,
+	older_than		INTERVAL)
+RETURNS VOID AS $$
+BEGIN
+	PERFORM @extschema@.gogudb_set_param(relation, 'retention', older_than);
+END
+$$ LANGUAGE plpgsql;
+
+/*
+ * Keep all partitions of a table.
+ */
+CREATE OR REPLACE FUNCTION @extschema@.reset_retention(
+	relation		REGCLASS)
+RETURNS VOID AS $$
+BEGIN
+	PERFORM @extschema@.gogudb_set_param(relation, 'retention', NULL::INTERVAL);
+END
+$$ LANGUAGE plpgsql STRICT;
+
+/*
+ * Keep partitions of the last 'keep_intervals' range intervals.
+ */
+CREATE OR REPLACE FUNCTION @extschema@.set_retention(
+	relation		REGCLASS,
+	keep_intervals	INTEGER)
+RETURNS VOID AS $$
+DECLARE
+	v_interval		INTERVAL;
+
+BEGIN
+	IF keep_intervals < 1 THEN
+		RAISE EXCEPTION '''keep_intervals'' should not be less than 1';
+	END IF;
+
+	SELECT range_interval::INTERVAL FROM @extschema@.gogudb_config
+	WHERE partrel = relation AND parttype = 2
+	INTO v_interval;
+
+	IF v_interval IS NULL THEN
+		RAISE EXCEPTION 'table "%" is not partitioned by RANGE with an interval',
+						relation;
+	END IF;
+
+	PERFORM @extschema@.gogudb_set_param(relation, 'retention',
+										 v_interval * keep_intervals);
+END
+$$ LANGUAGE plpgsql STRICT;
+
 /*
  * Set (or reset) default interval for auto created partitions
  */
@@ -309,6 +432,54 @@ LANGUAGE C STRICT;
 CREATE OR REPLACE VIEW @extschema@.gogudb_cache_stats
 AS SELECT * FROM @extschema@.show_cache_stats();
 
+/*
+ * Show cumulative statistics of remote traffic per server.
+ */
+CREATE OR REPLACE FUNCTION @extschema@.show_stat_remote()
+RETURNS TABLE (
+	dbid				OID,
+	serverid			OID,
+	queries				INT8,
+	rows				INT8,
+	bytes_in			INT8,
+	bytes_out			INT8,
+	total_time			FLOAT8,
+	latency				INT8[],
+	latency_bounds		INT4[],
+	errors				INT8,
+	connects			INT8,
+	reconnects			INT8,
+	cursor_scans		INT8,
+	single_row_scans	INT8,
+	commits				INT8,
+	aborts				INT8,
+	stats_reset			TIMESTAMPTZ)
+AS 'MODULE_PATHNAME', 'show_stat_remote_internal'
+LANGUAGE C STRICT;
+
+/*
+ * View for show_stat_remote(), servers of the current database only.
+ */
+CREATE OR REPLACE VIEW @extschema@.gogudb_stat_remote
+AS SELECT s.serverid, srv.srvname, s.queries, s.rows, s.bytes_in, s.bytes_out,
+		  s.total_time, s.latency, s.latency_bounds, s.errors, s.connects,
+		  s.reconnects, s.cursor_scans, s.single_row_scans, s.commits,
+		  s.aborts, s.stats_reset
+FROM @extschema@.show_stat_remote() s
+LEFT JOIN pg_catalog.pg_foreign_server srv ON srv.oid = s.serverid
+WHERE s.dbid = (SELECT oid FROM pg_catalog.pg_database
+				WHERE datname = pg_catalog.current_database());
+
+GRANT SELECT ON @extschema@.gogudb_stat_remote TO PUBLIC;
+
+/*
+ * Reset remote statistics of a server, or of all servers if NULL.
+ */
+CREATE OR REPLACE FUNCTION @extschema@.gogudb_stat_remote_reset(
+	server		OID DEFAULT NULL)
+RETURNS VOID AS 'MODULE_PATHNAME', 'stat_remote_reset'
+LANGUAGE C;
+
 /*
  * Show all existing concurrent partitioning tasks.
  */
@@ -318,7 +489,10 @@ RETURNS TABLE (
 	pid			INT,
 	dbid		OID,
 	relid		REGCLASS,
+	worker		INT,
 	processed	INT,
+	progress	FLOAT8,
+	rows_per_sec	FLOAT8,
 	status		TEXT)
 AS 'MODULE_PATHNAME', 'show_concurrent_part_tasks_internal'
 LANGUAGE C STRICT;
@@ -339,12 +513,14 @@ AS SELECT server.srvname
 
 GRANT SELECT ON @extschema@.fdw_server TO PUBLIC;
 /*
- * Partition table using ConcurrentPartWorker.
+ * Partition table using ConcurrentPartWorker, 'workers' of them split
+ * the table's blocks between themselves.
  */
 CREATE OR REPLACE FUNCTION @extschema@.partition_table_concurrently(
 	relation		REGCLASS,
 	batch_size		INTEGER DEFAULT 1000,
-	sleep_time		FLOAT8 DEFAULT 1.0)
+	sleep_time		FLOAT8 DEFAULT 1.0,
+	workers			INTEGER DEFAULT 1)
 RETURNS VOID AS 'MODULE_PATHNAME', 'partition_table_concurrently'
 LANGUAGE C STRICT;
 
@@ -356,6 +532,202 @@ CREATE OR REPLACE FUNCTION @extschema@.stop_concurrent_part_task(
 RETURNS BOOL AS 'MODULE_PATHNAME', 'stop_concurrent_part_task'
 LANGUAGE C STRICT;
 
+/*
+ * Move remote partition to another server using PartitionMoveWorker.
+ * max_rate limits initial COPY bandwidth (kB/s, 0 means no limit).
+ */
+CREATE OR REPLACE FUNCTION @extschema@.move_partition(
+	partition_relid	REGCLASS,
+	target_server	TEXT,
+	max_rate		INTEGER DEFAULT 0)
+RETURNS VOID AS 'MODULE_PATHNAME', 'move_partition'
+LANGUAGE C STRICT;
+
+/*
+ * Move remote partitions of a table to even out 'size' (bytes) or 'qps'
+ * (scans and modified rows per second) across servers.  At most
+ * max_parallel partitions are moved at a time.
+ */
+CREATE OR REPLACE FUNCTION @extschema@.rebalance(
+	relation		REGCLASS,
+	strategy		TEXT DEFAULT 'size',
+	max_parallel	INTEGER DEFAULT 1,
+	max_rate		INTEGER DEFAULT 0,
+	dry_run			BOOLEAN DEFAULT FALSE)
+RETURNS TABLE (
+	partition		REGCLASS,
+	source_server	TEXT,
+	target_server	TEXT,
+	load			FLOAT8,
+	status			TEXT)
+AS 'MODULE_PATHNAME', 'rebalance'
+LANGUAGE C STRICT;
+
+/*
+ * Show all partition moves in progress.
+ */
+CREATE OR REPLACE FUNCTION @extschema@.show_partition_moves()
+RETURNS TABLE (
+	userid			REGROLE,
+	pid				INT,
+	dbid			OID,
+	partition		REGCLASS,
+	target_server	TEXT,
+	copied			INT8,
+	status			TEXT)
+AS 'MODULE_PATHNAME', 'show_partition_moves_internal'
+LANGUAGE C STRICT;
+
+/*
+ * View for show_partition_moves().
+ */
+CREATE OR REPLACE VIEW @extschema@.gogudb_partition_moves
+AS SELECT * FROM @extschema@.show_partition_moves();
+
+GRANT SELECT ON @extschema@.gogudb_partition_moves TO PUBLIC;
+
+
+/*
+ * Import statistics of remote tables into foreign partitions of a table
+ * (NULL means all partitioned tables).  Repeat every 'period' seconds,
+ * zero means run once.
+ */
+CREATE OR REPLACE FUNCTION @extschema@.import_remote_stats(
+	relation		REGCLASS DEFAULT NULL,
+	period			INTEGER DEFAULT 0)
+RETURNS VOID AS 'MODULE_PATHNAME', 'import_remote_stats'
+LANGUAGE C;
+
+/*
+ * Stop statistics import worker of a table.
+ */
+CREATE OR REPLACE FUNCTION @extschema@.stop_remote_stats_import(
+	relation		REGCLASS DEFAULT NULL)
+RETURNS BOOL AS 'MODULE_PATHNAME', 'stop_remote_stats_import'
+LANGUAGE C;
+
+/*
+ * Show all statistics import workers.
+ */
+CREATE OR REPLACE FUNCTION @extschema@.show_remote_stats_imports()
+RETURNS TABLE (
+	userid			REGROLE,
+	pid				INT,
+	dbid			OID,
+	relid			REGCLASS,
+	period			INT,
+	imported		INT8,
+	last_import		TIMESTAMPTZ,
+	status			TEXT)
+AS 'MODULE_PATHNAME', 'show_remote_stats_imports_internal'
+LANGUAGE C STRICT;
+
+/*
+ * View for show_remote_stats_imports().
+ */
+CREATE OR REPLACE VIEW @extschema@.gogudb_remote_stats_imports
+AS SELECT * FROM @extschema@.show_remote_stats_imports();
+
+GRANT SELECT ON @extschema@.gogudb_remote_stats_imports TO PUBLIC;
+
+
+/*
+ * Keep partitions of a time-series table (NULL means all RANGE tables of
+ * table_partition_rule) created 'intervals' range intervals ahead of the
+ * current time.  Check every 'period' seconds, zero means run once.
+ * Periodic schedules are saved in gogudb_precreate_config.
+ */
+CREATE OR REPLACE FUNCTION @extschema@.precreate_range_partitions(
+	relation		REGCLASS DEFAULT NULL,
+	intervals		INTEGER DEFAULT 3,
+	period			INTEGER DEFAULT 3600)
+RETURNS VOID AS 'MODULE_PATHNAME', 'precreate_range_partitions'
+LANGUAGE C;
+
+/*
+ * Stop partition pre-creation worker of a table.
+ */
+CREATE OR REPLACE FUNCTION @extschema@.stop_partition_precreation(
+	relation		REGCLASS DEFAULT NULL)
+RETURNS BOOL AS 'MODULE_PATHNAME', 'stop_partition_precreation'
+LANGUAGE C;
+
+/*
+ * Show all partition pre-creation workers.
+ */
+CREATE OR REPLACE FUNCTION @extschema@.show_partition_precreations()
+RETURNS TABLE (
+	userid			REGROLE,
+	pid				INT,
+	dbid			OID,
+	relid			REGCLASS,
+	intervals		INT,
+	period			INT,
+	created			INT8,
+	last_round		TIMESTAMPTZ,
+	status			TEXT)
+AS 'MODULE_PATHNAME', 'show_partition_precreations_internal'
+LANGUAGE C STRICT;
+
+/*
+ * View for show_partition_precreations().
+ */
+CREATE OR REPLACE VIEW @extschema@.gogudb_partition_precreations
+AS SELECT * FROM @extschema@.show_partition_precreations();
+
+GRANT SELECT ON @extschema@.gogudb_partition_precreations TO PUBLIC;
+
+
+/*
+ * Remove expired partitions of the tables with a retention (see
+ * set_retention()): 'drop' drops foreign and remote tables, 'detach'
+ * only detaches foreign tables, 'archive' drops foreign tables and
+ * renames remote ones.  At most 'batch_size' partitions of a table are
+ * removed per round, waiting at most 'lock_timeout' ms for locks.
+ * Check every 'period' seconds, zero means run once.
+ */
+CREATE OR REPLACE FUNCTION @extschema@.start_partition_retention(
+	action			TEXT DEFAULT 'drop',
+	batch_size		INTEGER DEFAULT 10,
+	lock_timeout	INTEGER DEFAULT 100,
+	period			INTEGER DEFAULT 3600)
+RETURNS VOID AS 'MODULE_PATHNAME', 'start_partition_retention'
+LANGUAGE C;
+
+/*
+ * Stop partition retention worker of the current database.
+ */
+CREATE OR REPLACE FUNCTION @extschema@.stop_partition_retention()
+RETURNS BOOL AS 'MODULE_PATHNAME', 'stop_partition_retention'
+LANGUAGE C;
+
+/*
+ * Show all partition retention workers.
+ */
+CREATE OR REPLACE FUNCTION @extschema@.show_partition_retentions()
+RETURNS TABLE (
+	userid			REGROLE,
+	pid				INT,
+	dbid			OID,
+	action			TEXT,
+	batch_size		INT,
+	lock_timeout	INT,
+	period			INT,
+	removed			INT8,
+	pending			INT,
+	last_round		TIMESTAMPTZ,
+	status			TEXT)
+AS 'MODULE_PATHNAME', 'show_partition_retentions_internal'
+LANGUAGE C STRICT;
+
+/*
+ * View for show_partition_retentions().
+ */
+CREATE OR REPLACE VIEW @extschema@.gogudb_partition_retentions
+AS SELECT * FROM @extschema@.show_partition_retentions();
+
+GRANT SELECT ON @extschema@.gogudb_partition_retentions TO PUBLIC;
+
 
 /*
  * Copy rows to partitions concurrently.
@@ -506,6 +506,20 @@ $$
 LANGUAGE plpgsql;
 
 
+/*
+ * Move rows of remote partition 'source' which fall into the range of
+ * remote partition 'target' without fetching them.  Returns false if
+ * rows should be moved by the caller.  Internal, see split_range_partition().
+ */
+CREATE OR REPLACE FUNCTION @extschema@._move_remote_partition_data(
+	source			REGCLASS,
+	target			REGCLASS)
+RETURNS BOOL AS 'MODULE_PATHNAME', 'move_remote_partition_data'
+LANGUAGE C;
+
+REVOKE EXECUTE ON FUNCTION @extschema@._move_remote_partition_data(REGCLASS, REGCLASS)
+FROM PUBLIC;
+
 /*
  * Split RANGE partition
  */
@@ -524,6 +538,7 @@ DECLARE
 	check_name		TEXT;
 	check_cond		TEXT;
 	new_partition	TEXT;
+	moved			BOOL := false;
 
 BEGIN
 	parent_relid = @extschema@.get_parent_of_partition(partition_relid);
@@ -571,14 +586,23 @@ BEGIN
 															   partition_name,
 															   tablespace);
 
-	/* Copy data */
-	check_cond := @extschema@.build_range_condition(new_partition::regclass,
-													part_expr, split_value, p_range[2]);
-	EXECUTE format('WITH part_data AS (DELETE FROM %s WHERE %s RETURNING *)
-					INSERT INTO %s SELECT * FROM part_data',
-				   partition_relid::TEXT,
-				   check_cond,
-				   new_partition);
+	/* Copy data (on the shards if both partitions are remote) */
+	IF pg_catalog.has_function_privilege(
+			'@extschema@._move_remote_partition_data(regclass, regclass)',
+			'EXECUTE') THEN
+		moved := @extschema@._move_remote_partition_data(partition_relid,
+														 new_partition::regclass);
+	END IF;
+
+	IF NOT moved THEN
+		check_cond := @extschema@.build_range_condition(new_partition::regclass,
+														part_expr, split_value, p_range[2]);
+		EXECUTE format('WITH part_data AS (DELETE FROM %s WHERE %s RETURNING *)
+						INSERT INTO %s SELECT * FROM part_data',
+					   partition_relid::TEXT,
+					   check_cond,
+					   new_partition);
+	END IF;
 
 	/* Alter original partition */
 	check_cond := @extschema@.build_range_condition(partition_relid::regclass,
@@ -0,0 +1,66 @@
+\set VERBOSITY terse
+
+SET search_path = 'public','_gogu';
+CREATE EXTENSION gogudb;
+DO $d$
+    BEGIN
+        EXECUTE $$CREATE SERVER server_remote1 FOREIGN DATA WRAPPER gogudb_fdw
+            OPTIONS (dbname '$$||current_database()||$$',
+                     port '$$||current_setting('port')||$$'
+            )$$;
+        EXECUTE $$CREATE SERVER server_remote2 FOREIGN DATA WRAPPER gogudb_fdw
+            OPTIONS (dbname '$$||current_database()||$$',
+                     port '$$||current_setting('port')||$$'
+            )$$;
+    END;
+$d$;
+
+CREATE USER MAPPING FOR CURRENT_USER SERVER server_remote1;
+CREATE USER MAPPING FOR CURRENT_USER SERVER server_remote2;
+
+insert into server_map values('server_remote1', 0, 64), ('server_remote2', 64, 128);
+select reload_range_server_set();
+
+SET client_min_messages = WARNING;
+
+/* a partition per server, so that a scan of the table may use COPY */
+insert into table_partition_rule(schema_name, table_name, part_expr, part_type, part_dist, remote_schema)
+	 values('public', 'copy_scan_test', 'id', 1, 2, 'public');
+CREATE TABLE copy_scan_test(id INT NOT NULL, val TEXT);
+INSERT INTO copy_scan_test
+	SELECT id, CASE WHEN id % 10 = 0 THEN NULL ELSE 'row ' || id || E'\t\\\n' END
+	FROM generate_series(1, 5000) id;
+
+SHOW gogudb.copy_scan_threshold;
+
+/* rows read with a cursor and with COPY are the same */
+SET gogudb.copy_scan_threshold = -1;
+SELECT count(*), count(val), sum(id), md5(string_agg(val, ',' ORDER BY id)) FROM copy_scan_test;
+SET gogudb.copy_scan_threshold = 0;
+SELECT count(*), count(val), sum(id), md5(string_agg(val, ',' ORDER BY id)) FROM copy_scan_test;
+
+/* an early end cancels the stream, the connection stays usable */
+SELECT count(*) FROM (SELECT * FROM copy_scan_test LIMIT 10) s;
+SELECT count(*) FROM copy_scan_test;
+
+/* in a remote transaction the rest of the stream is read instead */
+BEGIN;
+INSERT INTO copy_scan_test VALUES (5001, 'new');
+SELECT count(*) FROM (SELECT * FROM copy_scan_test LIMIT 10) s;
+SELECT count(*) FROM copy_scan_test;
+ROLLBACK;
+SELECT count(*) FROM copy_scan_test;
+
+/* scans which share a connection use cursors */
+SELECT count(*) FROM copy_scan_test a JOIN copy_scan_test b USING (id);
+
+/* a query run during a stream reads the rest of the stream ahead */
+CREATE FUNCTION copy_scan_count() RETURNS BIGINT AS
+	'SELECT count(*) FROM copy_scan_test' LANGUAGE sql VOLATILE;
+SELECT sum(copy_scan_count()) FROM (SELECT * FROM copy_scan_test LIMIT 2) s;
+
+/* OK, clean it and quit */
+DROP FUNCTION copy_scan_count();
+RESET gogudb.copy_scan_threshold;
+drop table copy_scan_test cascade;
+DROP EXTENSION gogudb cascade;
@@ -0,0 +1,65 @@
+\set VERBOSITY terse
+
+SET search_path = 'public','_gogu';
+CREATE EXTENSION gogudb;
+DO $d$
+    BEGIN
+        EXECUTE $$CREATE SERVER server_remote1 FOREIGN DATA WRAPPER gogudb_fdw
+            OPTIONS (dbname '$$||current_database()||$$',
+                     port '$$||current_setting('port')||$$'
+            )$$;
+    END;
+$d$;
+
+CREATE USER MAPPING FOR CURRENT_USER SERVER server_remote1;
+
+insert into server_map values('server_remote1', 0, 128);
+select reload_range_server_set();
+
+SET client_min_messages = WARNING;
+
+insert into table_partition_rule(schema_name, table_name, part_expr, part_type, part_dist, remote_schema)
+	 values('public', 'failover_test', 'id', 1, 2, 'public');
+CREATE TABLE failover_test(id INT NOT NULL, val TEXT);
+INSERT INTO failover_test SELECT id, 'v' || id FROM generate_series(1, 10) id;
+
+/* a server which doesn't answer */
+CREATE SERVER dead_server FOREIGN DATA WRAPPER gogudb_fdw
+	OPTIONS (host '127.0.0.1', port '1', dbname 'postgres');
+CREATE USER MAPPING FOR CURRENT_USER SERVER dead_server;
+CREATE FOREIGN TABLE dead_table (id INT) SERVER dead_server;
+
+SHOW gogudb.server_failure_threshold;
+SHOW gogudb.server_down_time;
+
+/* is marked down after server_failure_threshold failures */
+SET gogudb.server_down_time = 600;
+SELECT * FROM dead_table;
+SELECT * FROM dead_table;
+SELECT * FROM dead_table;
+SELECT * FROM dead_table;
+
+/* zero disables the check */
+SET gogudb.server_failure_threshold = 0;
+SELECT * FROM dead_table;
+RESET gogudb.server_failure_threshold;
+
+/* read-only transactions skip replicas which are marked down */
+INSERT INTO server_replicas VALUES ('server_remote1', 'dead_server');
+SET gogudb.replica_routing = 'round_robin';
+BEGIN READ ONLY;
+SELECT count(*) FROM failover_test;
+COMMIT;
+SET gogudb.server_failure_threshold = 0;
+BEGIN READ ONLY;
+SELECT count(*) FROM failover_test;
+ROLLBACK;
+
+/* OK, clean it and quit */
+RESET gogudb.server_failure_threshold;
+RESET gogudb.server_down_time;
+RESET gogudb.replica_routing;
+DELETE FROM server_replicas;
+DROP SERVER dead_server CASCADE;
+drop table failover_test cascade;
+DROP EXTENSION gogudb cascade;
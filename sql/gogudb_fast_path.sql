@@ -0,0 +1,56 @@
+\set VERBOSITY terse
+
+SET search_path = 'public','_gogu';
+CREATE EXTENSION gogudb;
+DO $d$
+    BEGIN
+        EXECUTE $$CREATE SERVER server_remote1 FOREIGN DATA WRAPPER gogudb_fdw
+            OPTIONS (dbname '$$||current_database()||$$',
+                     port '$$||current_setting('port')||$$'
+            )$$;
+    END;
+$d$;
+
+CREATE USER MAPPING FOR CURRENT_USER SERVER server_remote1;
+
+insert into server_map values('server_remote1', 0, 128);
+select reload_range_server_set();
+
+SET client_min_messages = WARNING;
+
+insert into table_partition_rule(schema_name, table_name, part_expr, part_type, part_dist, remote_schema)
+	 values('public', 'fast_path_test', 'id', 1, 4, 'public');
+CREATE TABLE fast_path_test(id INT NOT NULL, val TEXT);
+
+/* single-row inserts go straight to the partition */
+INSERT INTO fast_path_test VALUES (1, 'one') RETURNING *;
+INSERT INTO fast_path_test (val, id) VALUES ('two', 2);
+INSERT INTO fast_path_test SELECT id, 'v' || id FROM generate_series(3, 10) id;
+
+/* so do statements which select a single partition */
+SELECT * FROM fast_path_test WHERE id = 2;
+SELECT fast_path_test.val FROM public."fast_path_test" WHERE fast_path_test.id = 1;
+UPDATE fast_path_test SET val = 'uno' WHERE id = 1 RETURNING val;
+UPDATE fast_path_test SET val = val || '!' WHERE id = 2;
+DELETE FROM fast_path_test WHERE id = 3 RETURNING *;
+SELECT * FROM fast_path_test ORDER BY id;
+
+/* modifications are part of the transaction */
+BEGIN;
+DELETE FROM fast_path_test WHERE id = 4;
+SELECT count(*) FROM fast_path_test WHERE id = 4;
+ROLLBACK;
+SELECT count(*) FROM fast_path_test WHERE id = 4;
+
+/* read-only transactions take the regular path */
+BEGIN READ ONLY;
+DELETE FROM fast_path_test WHERE id = 4;
+ROLLBACK;
+
+/* the partitioning key can't be changed */
+UPDATE fast_path_test SET id = 5 WHERE id = 4;
+SELECT count(*) FROM fast_path_test WHERE id = 4;
+
+/* OK, clean it and quit */
+drop table fast_path_test cascade;
+DROP EXTENSION gogudb cascade;
@@ -0,0 +1,57 @@
+\set VERBOSITY terse
+
+SET search_path = 'public','_gogu';
+CREATE EXTENSION gogudb;
+DO $d$
+    BEGIN
+        EXECUTE $$CREATE SERVER server_remote1 FOREIGN DATA WRAPPER gogudb_fdw
+            OPTIONS (dbname '$$||current_database()||$$',
+                     port '$$||current_setting('port')||$$'
+            )$$;
+        EXECUTE $$CREATE SERVER server_remote2 FOREIGN DATA WRAPPER gogudb_fdw
+            OPTIONS (dbname '$$||current_database()||$$',
+                     port '$$||current_setting('port')||$$'
+            )$$;
+    END;
+$d$;
+
+CREATE USER MAPPING FOR CURRENT_USER SERVER server_remote1;
+CREATE USER MAPPING FOR CURRENT_USER SERVER server_remote2;
+
+/* both partitions are created on the first server */
+insert into server_map values('server_remote1', 0, 128);
+select reload_range_server_set();
+
+SET client_min_messages = WARNING;
+
+insert into table_partition_rule(schema_name, table_name, part_expr, part_type, part_dist, remote_schema)
+	 values('public', 'move_test', 'id', 1, 2, 'public');
+CREATE TABLE move_test(id INT NOT NULL, val INT);
+INSERT INTO move_test SELECT id, id FROM generate_series(1, 100) id;
+
+/* check arguments of move_partition() */
+SELECT move_partition('gogudb_partition_table._public_0_move_test', 'server_remote2', -1);
+SELECT move_partition('move_test', 'server_remote2');
+SELECT move_partition('gogudb_partition_table._public_0_move_test', 'server_remote1');
+SELECT move_partition('gogudb_partition_table._public_0_move_test', 'no_server');
+
+/* check arguments of rebalance() */
+SELECT * FROM rebalance('move_test', 'rows');
+SELECT * FROM rebalance('move_test', max_parallel => 0);
+
+/* an empty server takes one of two partitions of the same size */
+delete from server_map;
+insert into server_map values('server_remote1', 0, 64), ('server_remote2', 64, 128);
+select reload_range_server_set();
+SELECT partition, source_server, target_server, status
+FROM rebalance('move_test', dry_run => true);
+
+/* a dry run moves nothing */
+SELECT count(*) FROM gogudb_partition_moves;
+SELECT srvname FROM pg_foreign_table ft JOIN pg_foreign_server s ON s.oid = ft.ftserver
+WHERE ft.ftrelid = 'gogudb_partition_table._public_0_move_test'::regclass;
+SELECT count(*) FROM move_test;
+
+/* OK, clean it and quit */
+drop table move_test cascade;
+DROP EXTENSION gogudb cascade;
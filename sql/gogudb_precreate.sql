@@ -0,0 +1,77 @@
+\set VERBOSITY terse
+
+SET search_path = 'public','_gogu';
+CREATE EXTENSION gogudb;
+DO $d$
+    BEGIN
+        EXECUTE $$CREATE SERVER server_remote1 FOREIGN DATA WRAPPER gogudb_fdw
+            OPTIONS (dbname '$$||current_database()||$$',
+                     port '$$||current_setting('port')||$$'
+            )$$;
+    END;
+$d$;
+
+CREATE USER MAPPING FOR CURRENT_USER SERVER server_remote1;
+
+insert into server_map values('server_remote1', 0, 128);
+select reload_range_server_set();
+
+/* wait until the pre-creation workers of this database are done or asleep */
+CREATE FUNCTION wait_for_precreation(stopped BOOLEAN) RETURNS VOID AS $$
+BEGIN
+	FOR i IN 1..600 LOOP
+		EXIT WHEN NOT EXISTS (SELECT 1 FROM gogudb_partition_precreations
+							  WHERE dbid = (SELECT oid FROM pg_database
+											WHERE datname = current_database())
+								AND (stopped OR period = 0 OR last_round IS NULL));
+		PERFORM pg_sleep(0.1);
+	END LOOP;
+END
+$$ LANGUAGE plpgsql;
+
+/* yearly partitions of the last and the current year */
+insert into table_partition_rule(schema_name, table_name, part_expr, part_type, range_interval,
+				range_start, part_dist, remote_schema)
+	select 'public', 'precreate_test', 'crt_time', 2, '1 year',
+		   to_char(date_trunc('year', now()) - interval '1 year', 'YYYY-MM-DD HH24:MI:SS'),
+		   2, 'public';
+insert into table_partition_rule(schema_name, table_name, part_expr, part_type, part_dist, remote_schema,
+				range_interval, range_start)
+	values('public', 'precreate_num', 'id', 2, 2, 'public', '100', '0');
+
+CREATE TABLE precreate_test(id int, crt_time timestamp not null);
+CREATE TABLE precreate_num(id int not null);
+SELECT count(*) FROM gogudb_partition_list WHERE parent = 'precreate_test'::REGCLASS;
+
+SET client_min_messages = WARNING;
+
+/* only tables partitioned by time are handled */
+SELECT precreate_range_partitions('precreate_num', 1, 0);
+SELECT precreate_range_partitions('precreate_test', 0, 0);
+
+/* one-off run: partitions up to two years ahead */
+SELECT precreate_range_partitions('precreate_test', 2, 0);
+SELECT wait_for_precreation(false);
+SELECT count(*) FROM gogudb_partition_list WHERE parent = 'precreate_test'::REGCLASS;
+SELECT count(*) FROM gogudb_precreate_config;
+
+/* nothing left to create */
+SELECT precreate_range_partitions('precreate_test', 2, 0);
+SELECT wait_for_precreation(false);
+SELECT count(*) FROM gogudb_partition_list WHERE parent = 'precreate_test'::REGCLASS;
+
+/* periodic runs are remembered */
+SELECT precreate_range_partitions('precreate_test', 3, 3600);
+SELECT precreate_range_partitions('precreate_test', 3, 3600);
+SELECT wait_for_precreation(false);
+SELECT count(*) FROM gogudb_partition_list WHERE parent = 'precreate_test'::REGCLASS;
+SELECT partrel, intervals, period FROM gogudb_precreate_config;
+SELECT stop_partition_precreation('precreate_test');
+SELECT wait_for_precreation(true);
+SELECT count(*) FROM gogudb_precreate_config;
+
+/* OK, clean it and quit */
+drop table precreate_test cascade;
+drop table precreate_num cascade;
+DROP FUNCTION wait_for_precreation(BOOLEAN);
+DROP EXTENSION gogudb cascade;
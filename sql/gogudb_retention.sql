@@ -0,0 +1,121 @@
+\set VERBOSITY terse
+
+SET search_path = 'public','_gogu';
+CREATE EXTENSION gogudb;
+DO $d$
+    BEGIN
+        EXECUTE $$CREATE SERVER server_remote1 FOREIGN DATA WRAPPER gogudb_fdw
+            OPTIONS (dbname '$$||current_database()||$$',
+                     port '$$||current_setting('port')||$$'
+            )$$;
+    END;
+$d$;
+
+CREATE USER MAPPING FOR CURRENT_USER SERVER server_remote1;
+
+insert into server_map values('server_remote1', 0, 128);
+select reload_range_server_set();
+
+/* wait until the retention worker of this database is done */
+CREATE FUNCTION wait_for_retention() RETURNS VOID AS $$
+BEGIN
+	FOR i IN 1..600 LOOP
+		EXIT WHEN NOT EXISTS (SELECT 1 FROM gogudb_partition_retentions
+							  WHERE dbid = (SELECT oid FROM pg_database
+											WHERE datname = current_database()));
+		PERFORM pg_sleep(0.1);
+	END LOOP;
+END
+$$ LANGUAGE plpgsql;
+
+/* yearly partitions of the last 4 years */
+insert into table_partition_rule(schema_name, table_name, part_expr, part_type, range_interval,
+				range_start, part_dist, remote_schema)
+	select 'public', 'retention_test', 'crt_time', 2, '1 year',
+		   to_char(date_trunc('year', now()) - interval '3 years', 'YYYY-MM-DD HH24:MI:SS'),
+		   4, 'public';
+
+CREATE TABLE retention_test(id int, crt_time timestamp not null);
+SELECT count(*) FROM gogudb_partition_list WHERE parent = 'retention_test'::REGCLASS;
+
+SET client_min_messages = WARNING;
+
+SELECT set_retention('retention_test', '1 year'::INTERVAL);
+SELECT retention = '1 year'::INTERVAL FROM gogudb_config_params
+WHERE partrel = 'retention_test'::REGCLASS;
+SELECT reset_retention('retention_test');
+SELECT retention IS NULL FROM gogudb_config_params
+WHERE partrel = 'retention_test'::REGCLASS;
+SELECT set_retention('retention_test', 1);
+SELECT retention = '1 year'::INTERVAL FROM gogudb_config_params
+WHERE partrel = 'retention_test'::REGCLASS;
+
+/* partitions of a rule can't be detached or dropped by hand */
+DO $$
+BEGIN
+	EXECUTE format('ALTER TABLE %s NO INHERIT retention_test',
+				   (SELECT min(partition::TEXT) FROM gogudb_partition_list
+					WHERE parent = 'retention_test'::REGCLASS));
+EXCEPTION WHEN OTHERS THEN
+	RAISE WARNING 'detach failed';
+END
+$$;
+DO $$
+BEGIN
+	EXECUTE format('DROP FOREIGN TABLE %s',
+				   (SELECT min(partition::TEXT) FROM gogudb_partition_list
+					WHERE parent = 'retention_test'::REGCLASS));
+EXCEPTION WHEN OTHERS THEN
+	RAISE WARNING 'drop failed';
+END
+$$;
+
+/* but the retention worker may: detach the oldest one */
+SELECT start_partition_retention('detach', 1, 100, 0);
+SELECT wait_for_retention();
+SELECT count(*) FROM gogudb_partition_list WHERE parent = 'retention_test'::REGCLASS;
+SELECT count(*) FROM pg_class
+WHERE relname LIKE '\_public\__\_retention\_test' AND relkind = 'f';
+SELECT count(*) FROM gogudb_retention_pending;
+
+/* drop the next expired one together with its remote table */
+SELECT start_partition_retention('drop', 10, 100, 0);
+SELECT wait_for_retention();
+SELECT count(*) FROM gogudb_partition_list WHERE parent = 'retention_test'::REGCLASS;
+SELECT count(*) FROM pg_class
+WHERE relname LIKE '\_public\__\_retention\_test' AND relkind = 'f';
+SELECT count(*) FROM pg_class
+WHERE relname LIKE '\_public\__\_retention\_test' AND relkind = 'r';
+SELECT count(*) FROM gogudb_retention_pending;
+
+/* one-off runs are not restarted */
+SELECT count(*) FROM gogudb_retention_config;
+
+/* the last partitions are within the retention */
+SELECT start_partition_retention('drop', 10, 100, 0);
+SELECT wait_for_retention();
+SELECT count(*) FROM gogudb_partition_list WHERE parent = 'retention_test'::REGCLASS;
+
+/* periodic runs are */
+SELECT start_partition_retention('drop', 10, 100, 3600);
+SELECT action, batch_size, lock_timeout, period FROM gogudb_retention_config;
+SELECT stop_partition_retention();
+SELECT wait_for_retention();
+SELECT count(*) FROM gogudb_retention_config;
+
+/* OK, clean it and quit */
+SELECT reset_retention('retention_test');
+drop table retention_test cascade;
+DO $$
+DECLARE
+	r	REGCLASS;
+BEGIN
+	FOR r IN SELECT oid FROM pg_class
+			 WHERE relname LIKE '\_public\__\_retention\_test' AND relkind = 'r'
+	LOOP
+		EXECUTE format('DROP TABLE %s', r);
+	END LOOP;
+END
+$$;
+DROP FUNCTION wait_for_retention();
+DROP EXTENSION gogudb cascade;
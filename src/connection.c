@@ -21,17 +21,28 @@
 #endif
 
 #include "connection_pool.h"
+#include "remote_instr.h"
+#include "remote_log.h"
+#include "stat_remote.h"
 #include "access/htup_details.h"
 #include "catalog/pg_user_mapping.h"
 #include "access/xact.h"
+#include "commands/defrem.h"
 #include "mb/pg_wchar.h"
 #include "miscadmin.h"
 #include "pgstat.h"
+#include "portability/instr_time.h"
 #include "storage/latch.h"
+#include "utils/guc.h"
 #include "utils/hsearch.h"
 #include "utils/inval.h"
 #include "utils/memutils.h"
 #include "utils/syscache.h"
+#include "storage/shmem.h"
+#include "storage/spin.h"
+
+#include <ctype.h>
+#include <poll.h>
 
 
 /*
@@ -66,6 +77,10 @@ typedef struct ConnCacheEntry
 	uint32		server_hashvalue;	/* hash value of foreign server OID */
 	uint32		mapping_hashvalue;	/* hash value of user mapping OID */
 	bool		not_auto_commit;	/* need to commit at clean up call back ? */		
+	Oid			serverid;		/* foreign server of the connection */
+	int			refs;			/* users which haven't released it yet */
+	GoguCopyStream *copy_stream;	/* COPY stream in progress, or NULL */
+	SubTransactionId copy_subid;	/* subxact which began copy_stream */
 } ConnCacheEntry;
 
 /*
@@ -80,8 +95,87 @@ static unsigned int prep_stmt_number = 0;
 /* tracks whether any work is needed in callback functions */
 static bool xact_got_connection = false;
 
+/*
+ * Options of foreign tables (initialized on first use).  Entries and
+ * everything they point to live in TableOptionsContext.  Invalidation
+ * only marks the cache stale, since the planner may still hold pointers
+ * into it; the memory is released at the end of the transaction.
+ */
+static HTAB *TableOptionsHash = NULL;
+static MemoryContext TableOptionsContext = NULL;
+static bool table_options_stale = false;
+static bool table_options_building = false;
+
+/* have pgfdw_inval_callback() and friends been registered? */
+static bool pgfdw_callbacks_registered = false;
+
+/* max number of statements a fan-out runs on one server at a time */
+int gogudb_remote_concurrency = 2;
+
+/* TCP keepalive defaults for servers which don't set them, 0 = system's */
+int gogudb_remote_keepalives_idle = 30;
+int gogudb_remote_keepalives_interval = 10;
+int gogudb_remote_keepalives_count = 3;
+
+/* consecutive failures which mark a server down, 0 disables the breaker */
+int gogudb_server_failure_threshold = 3;
+
+/* how long (seconds) a server stays marked down */
+int gogudb_server_down_time = 10;
+
+/* estimated rows from which scans are streamed with COPY, -1 disables */
+int gogudb_copy_scan_threshold = 10000;
+
+/*
+ * Circuit breaker state of a server, kept in shmem.
+ */
+typedef struct ServerHealth
+{
+	Oid			serverid;		/* InvalidOid if slot is free */
+	int			failures;		/* consecutive failures */
+	TimestampTz	down_until;		/* don't connect until this time */
+} ServerHealth;
+
+typedef struct ServerHealthState
+{
+	slock_t		mutex;
+	ServerHealth servers[SERVER_HEALTH_SLOTS];
+} ServerHealthState;
+
+static ServerHealthState *server_health = NULL;
+
+/*
+ * Statement queued in a fan-out executor.
+ */
+typedef struct FanoutTask
+{
+	UserMapping *user;
+	char	   *sql;
+	char	   *errmsg;			/* NULL unless the statement has failed */
+} FanoutTask;
+
+/*
+ * Connection of a fan-out executor: a private one, or the pooled one of
+ * the user mapping if the fan-out is transactional.
+ */
+typedef struct FanoutConn
+{
+	Oid			serverid;
+	Oid			umid;
+	PGconn	   *conn;
+	FanoutTask *task;			/* statement in progress, or NULL if idle */
+} FanoutConn;
+
+struct GoguFanout
+{
+	List	   *tasks;			/* all FanoutTasks in order of addition */
+	bool		inXact;			/* run in the remote transactions? */
+};
+
 /* prototypes of private functions */
-static PGconn *connect_pg_server(ForeignServer *server, UserMapping *user);
+static PGconn *connect_pg_server(ForeignServer *server, UserMapping *user,
+				  bool replication);
+static bool connect_failure_is_unreachable(PGconn *conn);
 static void disconnect_pg_server(ConnCacheEntry *entry);
 #if PG_VERSION_NUM >= 110000 
 static void check_conn_params(const char **keywords, const char **values, UserMapping *user);
@@ -98,12 +192,33 @@ static void pgfdw_subxact_callback(SubXactEvent event,
 					   SubTransactionId parentSubid,
 					   void *arg);
 static void pgfdw_inval_callback(Datum arg, int cacheid, uint32 hashvalue);
+static void pgfdw_register_inval_callbacks(void);
+static void table_options_xact_callback(XactEvent event, void *arg);
+static void table_options_build(Oid relid, GoguTableOptions *options);
 static void pgfdw_reject_incomplete_xact_state_change(ConnCacheEntry *entry);
 static bool pgfdw_cancel_query(PGconn *conn);
 static bool pgfdw_exec_cleanup_query(PGconn *conn, const char *query,
 						 bool ignore_errors);
 static bool pgfdw_get_cleanup_result(PGconn *conn, TimestampTz endtime,
 						 PGresult **result);
+static bool pgfdw_cleanup_wait(PGconn *conn, TimestampTz endtime);
+static bool pgfdw_conn_is_alive(PGconn *conn);
+static int pgfdw_add_keepalive_options(const char **keywords,
+							const char **values, int n);
+static ConnCacheEntry *pgfdw_find_entry(PGconn *conn);
+static void pgfdw_count_statement(PGconn *conn, const char *query,
+								  PGresult **results, int nresults,
+								  instr_time start, bool log);
+static PGresult *pgfdw_get_result(PGconn *conn, const char *query, bool log);
+static void copy_stream_wait(GoguCopyStream *stream);
+static int copy_stream_receive(GoguCopyStream *stream, char **buf);
+static void copy_stream_park(GoguCopyStream *stream);
+static void copy_stream_forget(GoguCopyStream *stream);
+static int copy_hex_value(char c);
+static int copy_stream_parse(GoguCopyStream *stream);
+static ServerHealth *server_health_slot(Oid serverid);
+static bool server_health_allow(Oid serverid);
+static void server_health_report(Oid serverid, bool success);
 
 
 /*
@@ -143,10 +258,7 @@ GoguGetConnection(UserMapping *user, bool will_prep_stmt, bool inXact)
 		 */
 		RegisterXactCallback(pgfdw_xact_callback, NULL);
 		RegisterSubXactCallback(pgfdw_subxact_callback, NULL);
-		CacheRegisterSyscacheCallback(FOREIGNSERVEROID,
-									  pgfdw_inval_callback, (Datum) 0);
-		CacheRegisterSyscacheCallback(USERMAPPINGOID,
-									  pgfdw_inval_callback, (Datum) 0);
+		pgfdw_register_inval_callbacks();
 	}
 
 	/* Set flag that we did GetConnection during the current transaction */
@@ -168,6 +280,14 @@ GoguGetConnection(UserMapping *user, bool will_prep_stmt, bool inXact)
 		entry->conn = NULL;
 	}
 
+	/*
+	 * A scan which streams with COPY holds the connection, but a query run
+	 * meanwhile (e.g. by a function called by the scanning query) has to
+	 * use it too.  Read the rest of the stream into memory to free it.
+	 */
+	if (entry->conn != NULL && entry->copy_stream != NULL)
+		copy_stream_park(entry->copy_stream);
+
 	/* Reject further use of connections which failed abort cleanup. */
 	pgfdw_reject_incomplete_xact_state_change(entry);
 
@@ -183,10 +303,19 @@ GoguGetConnection(UserMapping *user, bool will_prep_stmt, bool inXact)
 	}
 
 	/*
-	 * We don't check the health of cached connection here, because it would
-	 * require some overhead.  Broken connection will be detected when the
-	 * connection is actually used.
+	 * A restart of the server breaks the cached connection.  Outside of
+	 * remote transactions we can replace it transparently; the check only
+	 * looks at the socket, without a round trip.  Broken connections in a
+	 * transaction will be detected when the connection is actually used.
 	 */
+	if (entry->conn != NULL && entry->xact_depth == 0 &&
+		!pgfdw_conn_is_alive(entry->conn))
+	{
+		elog(DEBUG3, "closing broken connection %p", entry->conn);
+		stat_remote_count(stat_remote_entry(entry->serverid),
+						  STAT_REMOTE_RECONNECTS, 1);
+		disconnect_pg_server(entry);
+	}
 
 	/*
 	 * If cache entry doesn't have a connection, we have to establish a new
@@ -203,6 +332,9 @@ GoguGetConnection(UserMapping *user, bool will_prep_stmt, bool inXact)
 		entry->have_error = false;
 		entry->changing_xact_state = false;
 		entry->invalidated = false;
+		entry->serverid = server->serverid;
+		entry->refs = 0;
+		entry->copy_stream = NULL;
 		entry->server_hashvalue =
 			GetSysCacheHashValue1(FOREIGNSERVEROID,
 								  ObjectIdGetDatum(server->serverid));
@@ -211,7 +343,7 @@ GoguGetConnection(UserMapping *user, bool will_prep_stmt, bool inXact)
 								  ObjectIdGetDatum(user->umid));
 
 		/* Now try to make the connection */
-		entry->conn = connect_pg_server(server, user);
+		entry->conn = connect_pg_server(server, user, false);
 
 		elog(DEBUG3, "new postgres_fdw connection %p for server \"%s\" (user mapping oid %u, userid %u)",
 			 entry->conn, server->servername, user->umid, user->userid);
@@ -224,21 +356,68 @@ GoguGetConnection(UserMapping *user, bool will_prep_stmt, bool inXact)
 		begin_remote_xact(entry);
 		entry->not_auto_commit = true;
 	}
-	else 
+	else if (entry->xact_depth <= 0)
 		entry->not_auto_commit = false;
 	/* Remember if caller will prepare statements */
 	entry->have_prep_stmt |= will_prep_stmt;
 
+	entry->refs++;
+
 	return entry->conn;
 }
 
+/*
+ * Tell whether a failed connection attempt means the server is down, the
+ * way PQping() would, but without connecting once again (which would
+ * double the wait for an unreachable host).
+ *
+ * The server is only down if it doesn't answer at all, or can't accept
+ * connections yet.  Authentication failures and bad options mean it is up
+ * and has rejected us: those are reported by the server itself with a
+ * FATAL error.  libpq doesn't expose the SQLSTATE of a failed connection,
+ * so we look at the message; servers using translated messages are only
+ * recognized by a password request.
+ */
+static bool
+connect_failure_is_unreachable(PGconn *conn)
+{
+	const char *message;
+
+	if (conn == NULL)
+		return false;			/* out of memory */
+
+	if (PQconnectionNeedsPassword(conn))
+		return false;
+
+	message = PQerrorMessage(conn);
+
+	/* Server is starting up, shutting down or in recovery (57P03) */
+	if (strstr(message, "the database system is") != NULL)
+		return true;
+
+	return strstr(message, "FATAL:") == NULL;
+}
+
 /*
  * Connect to remote server using specified server and user mapping properties.
+ *
+ * If replication is true, the session is opened as a logical walsender
+ * ("replication=database"), which still accepts plain SQL on 10+.
  */
 static PGconn *
-connect_pg_server(ForeignServer *server, UserMapping *user)
+connect_pg_server(ForeignServer *server, UserMapping *user, bool replication)
 {
 	PGconn	   *volatile conn = NULL;
+	volatile bool unreachable = false;
+
+	/* Fail fast while the server is marked down */
+	if (!server_health_allow(server->serverid))
+		ereport(ERROR,
+				(errcode(ERRCODE_SQLCLIENT_UNABLE_TO_ESTABLISH_SQLCONNECTION),
+				 errmsg("server \"%s\" is marked down", server->servername),
+				 errdetail("The last %d attempts to use it have failed.",
+						   gogudb_server_failure_threshold),
+				 errhint("It will be retried after gogudb.server_down_time.")));
 
 	/*
 	 * Use PG_TRY block to ensure closing connection on error.
@@ -252,10 +431,11 @@ connect_pg_server(ForeignServer *server, UserMapping *user)
 		/*
 		 * Construct connection params from generic options of ForeignServer
 		 * and UserMapping.  (Some of them might not be libpq options, in
-		 * which case we'll just waste a few array slots.)  Add 3 extra slots
-		 * for fallback_application_name, client_encoding, end marker.
+		 * which case we'll just waste a few array slots.)  Add 7 extra slots
+		 * for keepalive defaults, fallback_application_name, client_encoding,
+		 * replication and end marker.
 		 */
-		n = list_length(server->options) + list_length(user->options) + 3;
+		n = list_length(server->options) + list_length(user->options) + 7;
 		keywords = (const char **) palloc(n * sizeof(char *));
 		values = (const char **) palloc(n * sizeof(char *));
 
@@ -265,6 +445,9 @@ connect_pg_server(ForeignServer *server, UserMapping *user)
 		n += GoguExtractConnectionOptions(user->options,
 									  keywords + n, values + n);
 
+		/* Detect dead servers without waiting for the system's keepalives */
+		n += pgfdw_add_keepalive_options(keywords, values, n);
+
 		/* Use "postgres_fdw" as fallback_application_name. */
 		keywords[n] = "fallback_application_name";
 		values[n] = "postgres_fdw";
@@ -275,6 +458,13 @@ connect_pg_server(ForeignServer *server, UserMapping *user)
 		values[n] = GetDatabaseEncodingName();
 		n++;
 
+		if (replication)
+		{
+			keywords[n] = "replication";
+			values[n] = "database";
+			n++;
+		}
+
 		keywords[n] = values[n] = NULL;
 
 		/* verify connection parameters and make connection */
@@ -286,6 +476,9 @@ connect_pg_server(ForeignServer *server, UserMapping *user)
 
 		conn = PQconnectdbParams(keywords, values, false);
 		if (!conn || PQstatus(conn) != CONNECTION_OK)
+		{
+			unreachable = connect_failure_is_unreachable(conn);
+
 			ereport(ERROR,
 					(errcode(ERRCODE_SQLCLIENT_UNABLE_TO_ESTABLISH_SQLCONNECTION),
 					 errmsg("could not connect to server \"%s\"",
@@ -297,6 +490,7 @@ connect_pg_server(ForeignServer *server, UserMapping *user)
  PQerrorMessage(conn)
 #endif
 )));
+		}
 
 		/*
 		 * Check that non-superuser has used password to establish connection;
@@ -322,6 +516,9 @@ connect_pg_server(ForeignServer *server, UserMapping *user)
 	}
 	PG_CATCH();
 	{
+		if (unreachable)
+			server_health_report(server->serverid, false);
+
 		/* Release PGconn data structure if we managed to create one */
 		if (conn)
 			PQfinish(conn);
@@ -329,6 +526,10 @@ connect_pg_server(ForeignServer *server, UserMapping *user)
 	}
 	PG_END_TRY();
 
+	server_health_report(server->serverid, true);
+	stat_remote_count(stat_remote_entry(server->serverid),
+					  STAT_REMOTE_CONNECTS, 1);
+
 	return conn;
 }
 
@@ -503,11 +704,18 @@ begin_remote_xact(ConnCacheEntry *entry)
 void
 GoguReleaseConnection(PGconn *conn)
 {
+	ConnCacheEntry *entry;
+
 	/*
-	 * Currently, we don't actually track connection references because all
-	 * cleanup is managed on a transaction or subtransaction basis instead. So
-	 * there's nothing to do here.
+	 * All cleanup is managed on a transaction or subtransaction basis.  The
+	 * references are only counted to know whether a scan may hold the
+	 * connection with a COPY stream (see GoguCopyStreamAllowed); callers
+	 * which fail to release it just keep COPY off till the end of the
+	 * transaction.
 	 */
+	entry = pgfdw_find_entry(conn);
+	if (entry != NULL && entry->refs > 0)
+		entry->refs--;
 }
 
 /*
@@ -574,8 +782,44 @@ Gogu_pgfdw_exec_query(PGconn *conn, const char *query)
  */
 PGresult *
 Gogu_pgfdw_get_result(PGconn *conn, const char *query)
+{
+	return pgfdw_get_result(conn, query, true);
+}
+
+/*
+ * Same as Gogu_pgfdw_exec_query(), for the statements (DECLARE, FETCH,
+ * CLOSE) of a cursor scan.  They are counted, but not logged: the scan logs
+ * its query when it ends.
+ */
+PGresult *
+Gogu_pgfdw_exec_cursor_query(PGconn *conn, const char *query)
+{
+	if (!PQsendQuery(conn, query))
+		Gogu_pgfdw_report_error(ERROR, NULL, conn, false, query);
+
+	return pgfdw_get_result(conn, query, false);
+}
+
+/*
+ * Same as Gogu_pgfdw_get_result(), for a statement of a cursor scan.
+ */
+PGresult *
+Gogu_pgfdw_get_cursor_result(PGconn *conn, const char *query)
+{
+	return pgfdw_get_result(conn, query, false);
+}
+
+/*
+ * Wait for the result, see Gogu_pgfdw_get_result().  The statement is
+ * logged if it was slow and 'log' is true.
+ */
+static PGresult *
+pgfdw_get_result(PGconn *conn, const char *query, bool log)
 {
 	PGresult   *volatile last_res = NULL;
+	instr_time	start;
+
+	INSTR_TIME_SET_CURRENT(start);
 
 	/* In what follows, do not leak any PGresults on an error. */
 	PG_TRY();
@@ -624,9 +868,81 @@ Gogu_pgfdw_get_result(PGconn *conn, const char *query)
 	}
 	PG_END_TRY();
 
+	pgfdw_count_statement(conn, query, (PGresult **) &last_res, 1, start,
+						  log);
+
 	return last_res;
 }
 
+/*
+ * Wait for the results of a multi-statement query sent with PQsendQuery,
+ * storing the first 'nresults' of them into 'results' in order (missing
+ * ones are set to NULL, extra ones are discarded).  Caller must PQclear()
+ * the results.
+ */
+void
+Gogu_pgfdw_get_results(PGconn *conn, const char *query,
+					   PGresult **results, int nresults)
+{
+	int			n = 0;
+	instr_time	start;
+
+	INSTR_TIME_SET_CURRENT(start);
+	memset(results, 0, sizeof(PGresult *) * nresults);
+
+	/* In what follows, do not leak any PGresults on an error. */
+	PG_TRY();
+	{
+		for (;;)
+		{
+			PGresult   *res;
+
+			while (PQisBusy(conn))
+			{
+				int			wc;
+
+				/* Sleep until there's something to do */
+				wc = WaitLatchOrSocket(MyLatch,
+									   WL_LATCH_SET | WL_SOCKET_READABLE,
+									   PQsocket(conn),
+									   -1L
+#if PG_VERSION_NUM >= 100000
+	, PG_WAIT_EXTENSION
+#endif
+	);
+				ResetLatch(MyLatch);
+
+				CHECK_FOR_INTERRUPTS();
+
+				/* Data available in socket? */
+				if (wc & WL_SOCKET_READABLE)
+				{
+					if (!PQconsumeInput(conn))
+						Gogu_pgfdw_report_error(ERROR, NULL, conn, false, query);
+				}
+			}
+
+			res = PQgetResult(conn);
+			if (res == NULL)
+				break;			/* query is complete */
+
+			if (n < nresults)
+				results[n++] = res;
+			else
+				PQclear(res);
+		}
+	}
+	PG_CATCH();
+	{
+		while (n > 0)
+			PQclear(results[--n]);
+		PG_RE_THROW();
+	}
+	PG_END_TRY();
+
+	pgfdw_count_statement(conn, query, results, nresults, start, true);
+}
+
 /*
  * Report an error we got from the remote server.
  *
@@ -644,6 +960,21 @@ void
 Gogu_pgfdw_report_error(int elevel, PGresult *res, PGconn *conn,
 				   bool clear, const char *sql)
 {
+	if (conn)
+	{
+		ConnCacheEntry *entry = pgfdw_find_entry(conn);
+
+		if (entry)
+		{
+			stat_remote_count(stat_remote_entry(entry->serverid),
+							  STAT_REMOTE_ERRORS, 1);
+
+			/* Lost connection counts as a failure of the server */
+			if (PQstatus(conn) == CONNECTION_BAD)
+				server_health_report(entry->serverid, false);
+		}
+	}
+
 	/* If requested, PGresult must be released before leaving this function. */
 	PG_TRY();
 	{
@@ -742,7 +1073,11 @@ pgfdw_xact_callback(XactEvent event, void *arg)
 					/* Commit all remote transactions during pre-commit */
 					entry->changing_xact_state = true;
 					if (entry->not_auto_commit)
+					{
 						do_sql_command(entry->conn, "COMMIT TRANSACTION");
+						stat_remote_count(stat_remote_entry(entry->serverid),
+										  STAT_REMOTE_COMMITS, 1);
+					}
 					entry->changing_xact_state = false;
 
 					/*
@@ -815,6 +1150,9 @@ pgfdw_xact_callback(XactEvent event, void *arg)
 					/* Assume we might have lost track of prepared statements */
 					entry->have_error = true;
 
+					stat_remote_count(stat_remote_entry(entry->serverid),
+									  STAT_REMOTE_ABORTS, 1);
+
 					/*
 					 * If a command has been submitted to the remote server by
 					 * using an asynchronous execution function, the command
@@ -857,6 +1195,8 @@ pgfdw_xact_callback(XactEvent event, void *arg)
 
 		/* Reset state to show we're out of a transaction */
 		entry->xact_depth = 0;
+		entry->refs = 0;
+		entry->copy_stream = NULL;
 
 		/*
 		 * If the connection isn't in a good idle state, discard it to
@@ -912,6 +1252,24 @@ pgfdw_subxact_callback(SubXactEvent event, SubTransactionId mySubid,
 	{
 		char		sql[100];
 
+		/*
+		 * The scan of a COPY stream begun in an aborted subtransaction is
+		 * gone.  Outside of remote transactions the query can simply be
+		 * canceled; otherwise it's left to the code below.
+		 */
+		if (event == SUBXACT_EVENT_ABORT_SUB && entry->conn != NULL &&
+			entry->copy_stream != NULL && entry->copy_subid == mySubid)
+		{
+			entry->copy_stream = NULL;
+			if (entry->xact_depth == 0 &&
+				PQtransactionStatus(entry->conn) == PQTRANS_ACTIVE &&
+				!pgfdw_cancel_query(entry->conn))
+			{
+				disconnect_pg_server(entry);
+				continue;
+			}
+		}
+
 		/*
 		 * We only care about connections with open remote subtransactions of
 		 * the current level.
@@ -998,6 +1356,9 @@ pgfdw_subxact_callback(SubXactEvent event, SubTransactionId mySubid,
  *
  * NB: We could avoid unnecessary disconnection more strictly by examining
  * individual option values, but it seems too much effort for the gain.
+ *
+ * Cached options of foreign tables depend on all three catalogs, and
+ * they are cheap to rebuild, so any change marks the whole cache stale.
  */
 static void
 pgfdw_inval_callback(Datum arg, int cacheid, uint32 hashvalue)
@@ -1005,9 +1366,16 @@ pgfdw_inval_callback(Datum arg, int cacheid, uint32 hashvalue)
 	HASH_SEQ_STATUS scan;
 	ConnCacheEntry *entry;
 
-	Assert(cacheid == FOREIGNSERVEROID || cacheid == USERMAPPINGOID);
+	Assert(cacheid == FOREIGNSERVEROID || cacheid == USERMAPPINGOID ||
+		   cacheid == FOREIGNTABLEREL);
+
+	if (TableOptionsHash != NULL)
+		table_options_stale = true;
+
+	/* Connections don't depend on foreign tables */
+	if (ConnectionHash == NULL || cacheid == FOREIGNTABLEREL)
+		return;
 
-	/* ConnectionHash must exist already, if we're registered */
 	hash_seq_init(&scan, ConnectionHash);
 	while ((entry = (ConnCacheEntry *) hash_seq_search(&scan)))
 	{
@@ -1025,6 +1393,241 @@ pgfdw_inval_callback(Datum arg, int cacheid, uint32 hashvalue)
 	}
 }
 
+/*
+ * Register pgfdw_inval_callback() once per backend.
+ */
+static void
+pgfdw_register_inval_callbacks(void)
+{
+	if (pgfdw_callbacks_registered)
+		return;
+
+	CacheRegisterSyscacheCallback(FOREIGNSERVEROID,
+								  pgfdw_inval_callback, (Datum) 0);
+	CacheRegisterSyscacheCallback(USERMAPPINGOID,
+								  pgfdw_inval_callback, (Datum) 0);
+	CacheRegisterSyscacheCallback(FOREIGNTABLEREL,
+								  pgfdw_inval_callback, (Datum) 0);
+	RegisterXactCallback(table_options_xact_callback, NULL);
+
+	pgfdw_callbacks_registered = true;
+}
+
+/*
+ * Release the stale options cache at the end of a transaction.
+ */
+static void
+table_options_xact_callback(XactEvent event, void *arg)
+{
+	switch (event)
+	{
+		case XACT_EVENT_ABORT:
+		case XACT_EVENT_PARALLEL_ABORT:
+			/* We could have failed in the middle of table_options_build() */
+			if (table_options_building)
+				table_options_stale = true;
+			table_options_building = false;
+			/* FALLTHROUGH */
+
+		case XACT_EVENT_COMMIT:
+		case XACT_EVENT_PARALLEL_COMMIT:
+		case XACT_EVENT_PREPARE:
+			if (table_options_stale && TableOptionsContext != NULL)
+			{
+				MemoryContextReset(TableOptionsContext);
+				TableOptionsHash = NULL;
+			}
+			table_options_stale = false;
+			break;
+
+		default:
+			break;
+	}
+}
+
+/*
+ * Look up catalog info of foreign table 'relid' and parse its options.
+ * Allocations are made in the current memory context.
+ *
+ * New options might also require tweaking merge_fdw_options().
+ */
+static void
+table_options_build(Oid relid, GoguTableOptions *options)
+{
+	ListCell   *lc;
+
+	MemSet(options, 0, sizeof(GoguTableOptions));
+
+	options->relid = relid;
+	options->table = GetForeignTable(relid);
+	options->server = GetForeignServer(options->table->serverid);
+
+	/*
+	 * Extract user-settable option values.  Note that per-table setting of
+	 * use_remote_estimate overrides per-server setting.
+	 */
+	options->use_remote_estimate = false;
+	options->fdw_startup_cost = DEFAULT_FDW_STARTUP_COST;
+	options->fdw_tuple_cost = DEFAULT_FDW_TUPLE_COST;
+	options->shippable_extensions = NIL;
+	options->fetch_size = DEFAULT_FDW_FETCH_SIZE;
+
+	foreach(lc, options->server->options)
+	{
+		DefElem    *def = (DefElem *) lfirst(lc);
+
+		if (strcmp(def->defname, "use_remote_estimate") == 0)
+			options->use_remote_estimate = defGetBoolean(def);
+		else if (strcmp(def->defname, "fdw_startup_cost") == 0)
+			options->fdw_startup_cost = strtod(defGetString(def), NULL);
+		else if (strcmp(def->defname, "fdw_tuple_cost") == 0)
+			options->fdw_tuple_cost = strtod(defGetString(def), NULL);
+		else if (strcmp(def->defname, "extensions") == 0)
+			options->shippable_extensions =
+				GoguExtractExtensionList(defGetString(def), false);
+		else if (strcmp(def->defname, "fetch_size") == 0)
+			options->fetch_size = strtol(defGetString(def), NULL, 10);
+	}
+
+	foreach(lc, options->table->options)
+	{
+		DefElem    *def = (DefElem *) lfirst(lc);
+
+		if (strcmp(def->defname, "use_remote_estimate") == 0)
+			options->use_remote_estimate = defGetBoolean(def);
+		else if (strcmp(def->defname, "fetch_size") == 0)
+			options->fetch_size = strtol(defGetString(def), NULL, 10);
+		else if (strcmp(def->defname, "schema_name") == 0)
+			options->remote_schema = defGetString(def);
+		else if (strcmp(def->defname, "table_name") == 0)
+			options->remote_table = defGetString(def);
+	}
+}
+
+/*
+ * Get catalog info and FDW options of foreign table 'relid'.
+ *
+ * Planning a query over a partitioned table asks for the same partitions
+ * again and again, so the result is cached for the rest of the backend's
+ * life, unless pg_foreign_table, pg_foreign_server or pg_user_mapping
+ * change.  While the cache is stale, options are built in the current
+ * memory context instead.
+ */
+GoguTableOptions *
+GoguGetTableOptions(Oid relid)
+{
+	GoguTableOptions	options,
+					   *entry;
+	MemoryContext		old_mcxt;
+	bool				found;
+
+	if (table_options_stale)
+	{
+		entry = (GoguTableOptions *) palloc(sizeof(GoguTableOptions));
+		table_options_build(relid, entry);
+
+		return entry;
+	}
+
+	/* First time through, initialize the cache */
+	if (TableOptionsContext == NULL)
+	{
+		TableOptionsContext = AllocSetContextCreate(CacheMemoryContext,
+													"gogudb table options",
+													ALLOCSET_DEFAULT_SIZES);
+		pgfdw_register_inval_callbacks();
+	}
+
+	if (TableOptionsHash == NULL)
+	{
+		HASHCTL		ctl;
+
+		MemSet(&ctl, 0, sizeof(ctl));
+		ctl.keysize = sizeof(Oid);
+		ctl.entrysize = sizeof(GoguTableOptions);
+		ctl.hcxt = TableOptionsContext;
+		TableOptionsHash = hash_create("gogudb table options", 64, &ctl,
+									   HASH_ELEM | HASH_BLOBS | HASH_CONTEXT);
+	}
+
+	entry = hash_search(TableOptionsHash, &relid, HASH_FIND, NULL);
+	if (entry)
+		return entry;
+
+	/* Cache lookups below may process invalidations */
+	old_mcxt = MemoryContextSwitchTo(TableOptionsContext);
+	table_options_building = true;
+	table_options_build(relid, &options);
+	table_options_building = false;
+	MemoryContextSwitchTo(old_mcxt);
+
+	/* Don't cache options which might be outdated already */
+	if (table_options_stale)
+	{
+		entry = (GoguTableOptions *) palloc(sizeof(GoguTableOptions));
+		memcpy(entry, &options, sizeof(GoguTableOptions));
+
+		return entry;
+	}
+
+	entry = hash_search(TableOptionsHash, &relid, HASH_ENTER, &found);
+	Assert(!found);
+
+	memcpy(entry, &options, sizeof(GoguTableOptions));
+	entry->cached = true;
+
+	return entry;
+}
+
+/*
+ * Get the schema and the name of the remote table of foreign table 'relid'.
+ * Missing schema_name and table_name options default to the local names,
+ * as in deparseRelation().
+ */
+void
+GoguGetRemoteTableName(Oid relid, const char **nspname, const char **relname)
+{
+	GoguTableOptions   *options = GoguGetTableOptions(relid);
+
+	*nspname = options->remote_schema;
+	*relname = options->remote_table;
+
+	if (*nspname == NULL)
+		*nspname = get_namespace_name(get_rel_namespace(relid));
+	if (*relname == NULL)
+		*relname = get_rel_name(relid);
+}
+
+/*
+ * Get the user mapping of 'userid' for the server of a foreign table.
+ * Planning is usually done by the same user, so we remember the last one.
+ */
+UserMapping *
+GoguGetTableUserMapping(GoguTableOptions *options, Oid userid)
+{
+	MemoryContext	old_mcxt;
+	UserMapping	   *user;
+
+	if (options->user != NULL && options->user_oid == userid)
+		return options->user;
+
+	if (!options->cached)
+		return GetUserMapping(userid, options->server->serverid);
+
+	old_mcxt = MemoryContextSwitchTo(TableOptionsContext);
+	user = GetUserMapping(userid, options->server->serverid);
+	MemoryContextSwitchTo(old_mcxt);
+
+	/* Same as above, the cache could become stale meanwhile */
+	if (!table_options_stale)
+	{
+		options->user_oid = userid;
+		options->user = user;
+	}
+
+	return user;
+}
+
 /*
  * Raise an error if the given connection cache entry is marked as being
  * in the middle of an xact state change.  This should be called at which no
@@ -1185,69 +1788,1103 @@ pgfdw_get_cleanup_result(PGconn *conn, TimestampTz endtime, PGresult **result)
 
 			while (PQisBusy(conn))
 			{
-				int			wc;
-				TimestampTz now = GetCurrentTimestamp();
-				long		secs;
-				int			microsecs;
-				long		cur_timeout;
-
-				/* If timeout has expired, give up, else get sleep time. */
-				if (now >= endtime)
+				if (!pgfdw_cleanup_wait(conn, endtime))
 				{
 					timed_out = true;
 					goto exit;
 				}
-				TimestampDifference(now, endtime, &secs, &microsecs);
+			}
 
-				/* To protect against clock skew, limit sleep to one minute. */
-				cur_timeout = Min(60000, secs * USECS_PER_SEC + microsecs);
+			res = PQgetResult(conn);
+			if (res == NULL)
+				break;			/* query is complete */
 
-				/* Sleep until there's something to do */
-				wc = WaitLatchOrSocket(MyLatch,
-									   WL_LATCH_SET | WL_SOCKET_READABLE | WL_TIMEOUT,
-									   PQsocket(conn),
-									   cur_timeout
-#if PG_VERSION_NUM >= 100000
-	, PG_WAIT_EXTENSION
-#endif
-	);
-				ResetLatch(MyLatch);
+			/*
+			 * libpq keeps returning this for an interrupted COPY until its
+			 * data has been read, which a cancel request cuts short.
+			 */
+			if (PQresultStatus(res) == PGRES_COPY_OUT)
+			{
+				PQclear(res);
+				for (;;)
+				{
+					char	   *buf;
+					int			len = PQgetCopyData(conn, &buf, true);
+
+					if (len > 0)
+						PQfreemem(buf);
+					else if (len < 0)
+						break;
+					else if (!pgfdw_cleanup_wait(conn, endtime))
+					{
+						timed_out = true;
+						goto exit;
+					}
+				}
+				continue;
+			}
+
+			PQclear(last_res);
+			last_res = res;
+		}
+exit:	;
+	}
+	PG_CATCH();
+	{
+		PQclear(last_res);
+		PG_RE_THROW();
+	}
+	PG_END_TRY();
+
+	if (timed_out)
+		PQclear(last_res);
+	else
+		*result = last_res;
+	return timed_out;
+}
+
+/*
+ * Wait, during abort cleanup, until there's data on the socket of 'conn' and
+ * read it.  Returns false if endtime has passed or on connection trouble.
+ */
+static bool
+pgfdw_cleanup_wait(PGconn *conn, TimestampTz endtime)
+{
+	int			wc;
+	TimestampTz now = GetCurrentTimestamp();
+	long		secs;
+	int			microsecs;
+	long		cur_timeout;
+
+	/* If timeout has expired, give up, else get sleep time. */
+	if (now >= endtime)
+		return false;
+	TimestampDifference(now, endtime, &secs, &microsecs);
+
+	/* To protect against clock skew, limit sleep to one minute. */
+	cur_timeout = Min(60000, secs * USECS_PER_SEC + microsecs);
+
+	/* Sleep until there's something to do */
+	wc = WaitLatchOrSocket(MyLatch,
+						   WL_LATCH_SET | WL_SOCKET_READABLE | WL_TIMEOUT,
+						   PQsocket(conn),
+						   cur_timeout
+#if PG_VERSION_NUM >= 100000
+						   , PG_WAIT_EXTENSION
+#endif
+						   );
+	ResetLatch(MyLatch);
+
+	CHECK_FOR_INTERRUPTS();
+
+	/* Data available in socket?  Connection trouble counts as a timeout. */
+	if ((wc & WL_SOCKET_READABLE) && !PQconsumeInput(conn))
+		return false;
+
+	return true;
+}
+
+/*
+ * Open a private connection which is not tracked by the connection cache.
+ *
+ * Such connections don't take part in remote transaction management, so
+ * callers are free to run their own BEGIN/COMMIT or COPY on them; they
+ * must close the connection with GoguCloseConnection().
+ */
+PGconn *
+GoguOpenConnection(UserMapping *user, bool replication)
+{
+	ForeignServer *server = GetForeignServer(user->serverid);
+
+	return connect_pg_server(server, user, replication);
+}
+
+/*
+ * Close a connection obtained by GoguOpenConnection().
+ */
+void
+GoguCloseConnection(PGconn *conn)
+{
+	if (conn != NULL)
+		PQfinish(conn);
+}
+
+/*
+ * Run a non-data-returning command on the given connection, raise ERROR
+ * on failure.
+ */
+void
+GoguRunCommand(PGconn *conn, const char *sql)
+{
+	do_sql_command(conn, sql);
+}
+
+/*
+ * Build a libpq connection string for the given user mapping, so that a
+ * remote server can reach the same target (e.g. CREATE SUBSCRIPTION).
+ */
+char *
+GoguBuildConnInfo(UserMapping *user)
+{
+	ForeignServer  *server = GetForeignServer(user->serverid);
+	StringInfoData	buf;
+	const char	  **keywords;
+	const char	  **values;
+	int				n,
+					i;
+
+	n = list_length(server->options) + list_length(user->options) + 1;
+	keywords = (const char **) palloc(n * sizeof(char *));
+	values = (const char **) palloc(n * sizeof(char *));
+
+	n = 0;
+	n += GoguExtractConnectionOptions(server->options,
+									  keywords + n, values + n);
+	n += GoguExtractConnectionOptions(user->options,
+									  keywords + n, values + n);
+
+	initStringInfo(&buf);
+	for (i = 0; i < n; i++)
+	{
+		const char *cp;
+
+		if (i > 0)
+			appendStringInfoChar(&buf, ' ');
+
+		/* Quote each value, escaping backslashes and single quotes */
+		appendStringInfo(&buf, "%s='", keywords[i]);
+		for (cp = values[i]; *cp; cp++)
+		{
+			if (*cp == '\\' || *cp == '\'')
+				appendStringInfoChar(&buf, '\\');
+			appendStringInfoChar(&buf, *cp);
+		}
+		appendStringInfoChar(&buf, '\'');
+	}
+
+	pfree(keywords);
+	pfree(values);
+
+	return buf.data;
+}
+
+/*
+ * Send every query to its server first and only then collect the results,
+ * so that remote servers execute them concurrently.  Each query must use a
+ * distinct user mapping.  Results are returned in the same order as the
+ * queries; caller must PQclear() them.  If 'conns' isn't NULL, it receives
+ * the connection of each query, for error reporting.  If inXact is true,
+ * queries run in the remote transactions (see GoguGetConnection).
+ *
+ * Queries still running when we fail are cancelled, so that no connection
+ * is left busy.
+ */
+PGresult **
+GoguExecParallel(UserMapping **users, const char **queries, int nqueries,
+				 PGconn **conns, bool inXact)
+{
+	PGresult  **results = (PGresult **) palloc0(sizeof(PGresult *) * nqueries);
+	volatile int nsent = 0,
+				i = 0;
+
+	if (conns == NULL)
+		conns = (PGconn **) palloc0(sizeof(PGconn *) * nqueries);
+
+	PG_TRY();
+	{
+		for (nsent = 0; nsent < nqueries; nsent++)
+		{
+			conns[nsent] = GoguGetConnection(users[nsent], false, inXact);
+			if (!PQsendQuery(conns[nsent], queries[nsent]))
+				Gogu_pgfdw_report_error(ERROR, NULL, conns[nsent], false,
+										queries[nsent]);
+		}
+
+		for (i = 0; i < nqueries; i++)
+		{
+			results[i] = Gogu_pgfdw_get_result(conns[i], queries[i]);
+			GoguReleaseConnection(conns[i]);
+		}
+	}
+	PG_CATCH();
+	{
+		int			j;
+
+		for (j = 0; j < i; j++)
+			PQclear(results[j]);
+
+		/* Queries [i, nsent) have been sent, but not collected yet */
+		for (j = i; j < nsent; j++)
+		{
+			GoguAbandonQuery(conns[j]);
+			GoguReleaseConnection(conns[j]);
+		}
+
+		PG_RE_THROW();
+	}
+	PG_END_TRY();
+
+	return results;
+}
+
+/*
+ * Define GUC variables of the connection layer.
+ */
+void
+init_connection_static_data(void)
+{
+	DefineCustomIntVariable("gogudb.remote_concurrency",
+							"Sets the maximum number of statements a fan-out runs "
+							"on one remote server at a time.",
+							"Applies to statements run outside of the remote "
+							"transactions, such as VACUUM or CREATE INDEX "
+							"CONCURRENTLY; the other ones run one at a time "
+							"per user mapping.",
+							&gogudb_remote_concurrency,
+							2,
+							1, 64,
+							PGC_USERSET,
+							0,
+							NULL,
+							NULL,
+							NULL);
+
+	DefineCustomIntVariable("gogudb.remote_keepalives_idle",
+							"Sets keepalives_idle of remote connections.",
+							"Used unless the server sets it. Zero uses the system default.",
+							&gogudb_remote_keepalives_idle,
+							30,
+							0, INT_MAX,
+							PGC_USERSET,
+							GUC_UNIT_S,
+							NULL,
+							NULL,
+							NULL);
+
+	DefineCustomIntVariable("gogudb.remote_keepalives_interval",
+							"Sets keepalives_interval of remote connections.",
+							"Used unless the server sets it. Zero uses the system default.",
+							&gogudb_remote_keepalives_interval,
+							10,
+							0, INT_MAX,
+							PGC_USERSET,
+							GUC_UNIT_S,
+							NULL,
+							NULL,
+							NULL);
+
+	DefineCustomIntVariable("gogudb.remote_keepalives_count",
+							"Sets keepalives_count of remote connections.",
+							"Used unless the server sets it. Zero uses the system default.",
+							&gogudb_remote_keepalives_count,
+							3,
+							0, INT_MAX,
+							PGC_USERSET,
+							0,
+							NULL,
+							NULL,
+							NULL);
+
+	DefineCustomIntVariable("gogudb.server_failure_threshold",
+							"Sets the number of consecutive failures which mark "
+							"a remote server down.",
+							"Zero disables the check.",
+							&gogudb_server_failure_threshold,
+							3,
+							0, INT_MAX,
+							PGC_SUSET,
+							0,
+							NULL,
+							NULL,
+							NULL);
+
+	DefineCustomIntVariable("gogudb.server_down_time",
+							"Sets how long a remote server stays marked down.",
+							NULL,
+							&gogudb_server_down_time,
+							10,
+							1, INT_MAX / 1000,
+							PGC_SUSET,
+							GUC_UNIT_S,
+							NULL,
+							NULL,
+							NULL);
+
+	DefineCustomIntVariable("gogudb.copy_scan_threshold",
+							"Sets the estimated number of rows from which remote "
+							"scans are streamed with COPY.",
+							"-1 disables COPY scans.",
+							&gogudb_copy_scan_threshold,
+							10000,
+							-1, INT_MAX,
+							PGC_USERSET,
+							0,
+							NULL,
+							NULL,
+							NULL);
+}
+
+/*
+ * Start streaming the rows of 'query' with "COPY (query) TO STDOUT".
+ *
+ * Unlike a cursor or single-row mode, the server sends the rows without
+ * waiting for us and with no per-row PGresult, so bulk scans are limited
+ * by the network rather than by round trips.  The statement is only sent
+ * here; GoguCopyStreamNext() waits for the rows.  The connection can't be
+ * used for anything else until the stream is over, so callers first check
+ * GoguCopyStreamAllowed().  The stream must live in a context which lasts
+ * until GoguCopyStreamEnd().
+ */
+void
+GoguCopyStreamBegin(GoguCopyStream *stream, PGconn *conn, const char *query)
+{
+	ConnCacheEntry *entry = pgfdw_find_entry(conn);
+
+	stream->conn = conn;
+	stream->sql = psprintf("COPY (%s) TO STDOUT", query);
+	stream->started = false;
+	stream->done = false;
+	stream->bytes = 0;
+	stream->rows = 0;
+	stream->parked = NIL;
+	stream->mcxt = CurrentMemoryContext;
+
+	if (stream->row.data == NULL)
+	{
+		initStringInfo(&stream->row);
+		stream->maxfields = 16;
+		stream->fields = (char **) palloc(stream->maxfields * sizeof(char *));
+	}
+
+	if (!PQsendQuery(conn, stream->sql))
+		Gogu_pgfdw_report_error(ERROR, NULL, conn, false, stream->sql);
+
+	/* Let the next user of the connection find the stream */
+	if (entry != NULL)
+	{
+		entry->copy_stream = stream;
+		entry->copy_subid = GetCurrentSubTransactionId();
+	}
+}
+
+/*
+ * May a scan stream its rows with COPY on 'conn'?  Only if it's the only
+ * user of the connection, as known once the executor has begun all scans
+ * of the query, and no other stream is in progress.
+ */
+bool
+GoguCopyStreamAllowed(PGconn *conn)
+{
+	ConnCacheEntry *entry = pgfdw_find_entry(conn);
+
+	return entry != NULL && entry->refs <= 1 && entry->copy_stream == NULL;
+}
+
+/*
+ * Receive the next row of a COPY stream.  Returns the number of fields,
+ * which are left in stream->fields, or -1 if there are no more rows.
+ * Fields stay valid until the next call.
+ */
+int
+GoguCopyStreamNext(GoguCopyStream *stream)
+{
+	char	   *buf;
+	int			len;
+
+	/* Rows read ahead come first */
+	if (stream->parked != NIL)
+	{
+		char	   *row = (char *) linitial(stream->parked);
+
+		stream->parked = list_delete_first(stream->parked);
+		resetStringInfo(&stream->row);
+		appendStringInfoString(&stream->row, row);
+		pfree(row);
+
+		return copy_stream_parse(stream);
+	}
+
+	if (stream->done)
+		return -1;
+
+	len = copy_stream_receive(stream, &buf);
+	if (len < 0)
+		return -1;
+
+	/* Server sends exactly one row per message */
+	resetStringInfo(&stream->row);
+	appendBinaryStringInfo(&stream->row, buf, len);
+	PQfreemem(buf);
+
+	return copy_stream_parse(stream);
+}
+
+/*
+ * Finish a COPY stream, skipping the rows which haven't been read.
+ *
+ * 'rows' is the number of rows the stream was expected to return.  If more
+ * than COPY_STREAM_DRAIN_ROWS are left, by that estimate or once as many
+ * have been skipped, the remote query is canceled instead, which is much
+ * cheaper for an early end of a big scan (LIMIT, a join which runs out of
+ * outer rows).  A cancel would abort the remote transaction, though, so
+ * streams run in one are always read to the end.
+ */
+void
+GoguCopyStreamEnd(GoguCopyStream *stream, double rows)
+{
+	ConnCacheEntry *entry;
+	bool		cancel;
+	int			skipped = 0;
+	char	   *buf;
+	int			len;
+
+	list_free_deep(stream->parked);
+	stream->parked = NIL;
+
+	if (stream->done)
+		return;
+
+	entry = pgfdw_find_entry(stream->conn);
+	cancel = entry != NULL && entry->xact_depth == 0;
+
+	while (!cancel ||
+		   (rows - stream->rows <= COPY_STREAM_DRAIN_ROWS &&
+			skipped++ < COPY_STREAM_DRAIN_ROWS))
+	{
+		len = copy_stream_receive(stream, &buf);
+		if (len < 0)
+			return;
+		PQfreemem(buf);
+
+		CHECK_FOR_INTERRUPTS();
+	}
+
+	copy_stream_forget(stream);
+
+	if (!pgfdw_cancel_query(stream->conn))
+	{
+		elog(DEBUG3, "discarding connection %p", stream->conn);
+		disconnect_pg_server(entry);
+	}
+}
+
+/*
+ * Receive the next message of a COPY stream, which is one row.  Returns its
+ * length, with the data in *buf to be freed with PQfreemem(), or -1 at the
+ * end of the stream.
+ */
+static int
+copy_stream_receive(GoguCopyStream *stream, char **buf)
+{
+	PGconn	   *conn = stream->conn;
+	PGresult   *res;
+
+	/* The server has to accept the COPY first */
+	if (!stream->started)
+	{
+		while (PQisBusy(conn))
+			copy_stream_wait(stream);
+
+		res = PQgetResult(conn);
+		if (PQresultStatus(res) != PGRES_COPY_OUT)
+		{
+			copy_stream_forget(stream);
+			Gogu_pgfdw_report_error(ERROR, res, conn, true, stream->sql);
+		}
+		PQclear(res);
+
+		stream->started = true;
+	}
+
+	for (;;)
+	{
+		int			len;
+
+		len = PQgetCopyData(conn, buf, true);
+
+		/* Nothing to read yet, wait for the socket */
+		if (len == 0)
+		{
+			copy_stream_wait(stream);
+			continue;
+		}
+
+		/* COPY is done, check how it has ended */
+		if (len == -1)
+		{
+			copy_stream_forget(stream);
+
+			res = Gogu_pgfdw_get_result(conn, stream->sql);
+			if (PQresultStatus(res) != PGRES_COMMAND_OK)
+				Gogu_pgfdw_report_error(ERROR, res, conn, true, stream->sql);
+			PQclear(res);
+
+			return -1;
+		}
+
+		if (len < 0)
+			Gogu_pgfdw_report_error(ERROR, NULL, conn, false, stream->sql);
+
+		stream->bytes += len;
+		stream->rows++;
+
+		return len;
+	}
+}
+
+/*
+ * Read the rest of a COPY stream into memory, so that the connection can
+ * run other queries while the scan of the stream goes on.
+ */
+static void
+copy_stream_park(GoguCopyStream *stream)
+{
+	MemoryContext oldcxt = MemoryContextSwitchTo(stream->mcxt);
+	char	   *buf;
+	int			len;
+
+	elog(DEBUG3, "reading ahead COPY stream on connection %p", stream->conn);
+
+	while ((len = copy_stream_receive(stream, &buf)) >= 0)
+	{
+		/* COPY text never contains a zero byte */
+		stream->parked = lappend(stream->parked, pnstrdup(buf, len));
+		PQfreemem(buf);
+
+		CHECK_FOR_INTERRUPTS();
+	}
+
+	MemoryContextSwitchTo(oldcxt);
+}
+
+/*
+ * Mark a COPY stream as over, which frees its connection.
+ */
+static void
+copy_stream_forget(GoguCopyStream *stream)
+{
+	ConnCacheEntry *entry = pgfdw_find_entry(stream->conn);
+
+	if (entry != NULL && entry->copy_stream == stream)
+		entry->copy_stream = NULL;
+	stream->done = true;
+}
+
+/*
+ * Sleep until there's data on the socket of a COPY stream.
+ */
+static void
+copy_stream_wait(GoguCopyStream *stream)
+{
+	int			wc;
+
+	wc = WaitLatchOrSocket(MyLatch,
+						   WL_LATCH_SET | WL_SOCKET_READABLE,
+						   PQsocket(stream->conn),
+						   -1L
+#if PG_VERSION_NUM >= 100000
+						   , PG_WAIT_EXTENSION
+#endif
+						   );
+	ResetLatch(MyLatch);
+
+	CHECK_FOR_INTERRUPTS();
+
+	if ((wc & WL_SOCKET_READABLE) && !PQconsumeInput(stream->conn))
+		Gogu_pgfdw_report_error(ERROR, NULL, stream->conn, false, stream->sql);
+}
+
+/*
+ * Value of a hexadecimal digit.
+ */
+static int
+copy_hex_value(char c)
+{
+	if (c >= '0' && c <= '9')
+		return c - '0';
+	if (c >= 'a' && c <= 'f')
+		return c - 'a' + 10;
+	return c - 'A' + 10;
+}
+
+/*
+ * Split a row of COPY text format into fields and undo the escaping.
+ * Unescaped fields are never longer than escaped ones, so this is done
+ * in place.
+ */
+static int
+copy_stream_parse(GoguCopyStream *stream)
+{
+	char	   *src = stream->row.data,
+			   *end = src + stream->row.len;
+	int			nfields = 0;
+
+	/* Drop the row terminator */
+	if (end > src && end[-1] == '\n')
+		*--end = '\0';
+
+	for (;;)
+	{
+		char	   *dst = src;
+
+		if (nfields >= stream->maxfields)
+		{
+			stream->maxfields *= 2;
+			stream->fields = (char **) repalloc(stream->fields,
+												stream->maxfields * sizeof(char *));
+		}
+
+		/* Unquoted \N is a NULL, backslashes of data are always escaped */
+		if (end - src >= 2 && src[0] == '\\' && src[1] == 'N' &&
+			(end - src == 2 || src[2] == '\t'))
+		{
+			stream->fields[nfields++] = NULL;
+			src += 2;
+		}
+		else
+		{
+			stream->fields[nfields++] = dst;
+
+			while (src < end && *src != '\t')
+			{
+				char		c = *src++;
+
+				if (c == '\\' && src < end)
+				{
+					c = *src++;
+
+					switch (c)
+					{
+						case 'b':
+							c = '\b';
+							break;
+						case 'f':
+							c = '\f';
+							break;
+						case 'n':
+							c = '\n';
+							break;
+						case 'r':
+							c = '\r';
+							break;
+						case 't':
+							c = '\t';
+							break;
+						case 'v':
+							c = '\v';
+							break;
+						case '0': case '1': case '2': case '3':
+						case '4': case '5': case '6': case '7':
+							{
+								int			val = c - '0';
+
+								if (src < end && *src >= '0' && *src <= '7')
+								{
+									val = (val << 3) + (*src++ - '0');
+									if (src < end && *src >= '0' && *src <= '7')
+										val = (val << 3) + (*src++ - '0');
+								}
+								c = (char) val;
+							}
+							break;
+						case 'x':
+							if (src < end && isxdigit((unsigned char) *src))
+							{
+								int			val = copy_hex_value(*src++);
+
+								if (src < end && isxdigit((unsigned char) *src))
+									val = (val << 4) + copy_hex_value(*src++);
+								c = (char) val;
+							}
+							break;
+						default:
+							/* Any other character stands for itself */
+							break;
+					}
+				}
+
+				*dst++ = c;
+			}
+		}
+
+		if (src >= end)
+		{
+			*dst = '\0';
+			break;
+		}
+
+		/* Skip the delimiter */
+		*dst = '\0';
+		src++;
+	}
+
+	return nfields;
+}
+
+/*
+ * Create an empty fan-out executor.
+ *
+ * Fan-out runs independent statements (one per partition, typically)
+ * concurrently on different servers and reports all failures together.
+ *
+ * If inXact is true, statements run on the pooled connections inside the
+ * remote transactions (see GoguGetConnection), so they are committed or
+ * rolled back along with the local transaction.  Statements of the same
+ * user mapping run one after another then, as there's only one remote
+ * transaction per user mapping; gogudb.remote_concurrency doesn't apply.
+ *
+ * Otherwise statements run on private connections, at most
+ * gogudb.remote_concurrency statements per server at a time.  Each one is
+ * sent with the simple query protocol, so it runs in its own implicit
+ * transaction, which is what VACUUM or CREATE INDEX CONCURRENTLY need.
+ */
+GoguFanout *
+GoguFanoutCreate(bool inXact)
+{
+	GoguFanout *fanout = (GoguFanout *) palloc0(sizeof(GoguFanout));
+
+	fanout->inXact = inXact;
+
+	return fanout;
+}
+
+/*
+ * Queue a statement to be run on the server of 'user'.
+ */
+void
+GoguFanoutAdd(GoguFanout *fanout, UserMapping *user, const char *sql)
+{
+	FanoutTask *task = (FanoutTask *) palloc0(sizeof(FanoutTask));
+
+	task->user = user;
+	task->sql = pstrdup(sql);
+
+	fanout->tasks = lappend(fanout->tasks, task);
+}
+
+/* Remember why 'task' failed */
+static void
+fanout_task_failed(FanoutTask *task, PGconn *conn, PGresult *res)
+{
+	char *message = NULL;
+
+	if (task->errmsg)
+		return;
+
+	if (res)
+		message = PQresultErrorField(res, PG_DIAG_MESSAGE_PRIMARY);
+	if (message == NULL && conn)
+		message = PQerrorMessage(conn);
+
+	task->errmsg = pstrdup(message ? message : "unknown error");
+}
+
+/* Fetch all pending results of a connection, return true if idle */
+static bool
+fanout_collect(FanoutConn *fc)
+{
+	while (!PQisBusy(fc->conn))
+	{
+		PGresult *res = PQgetResult(fc->conn);
+
+		/* Statement is complete */
+		if (res == NULL)
+		{
+			fc->task = NULL;
+			return true;
+		}
+
+		if (PQresultStatus(res) != PGRES_COMMAND_OK &&
+			PQresultStatus(res) != PGRES_TUPLES_OK)
+			fanout_task_failed(fc->task, fc->conn, res);
+
+		PQclear(res);
+	}
+
+	return false;
+}
+
+/*
+ * Give a connection back when its statement is done.  A pooled connection
+ * is leased again by the next statement of its user mapping, so that it
+ * isn't held by the fan-out in between (see GoguCopyStreamAllowed).
+ */
+static void
+fanout_release_conn(GoguFanout *fanout, FanoutConn *fc)
+{
+	if (fanout->inXact)
+		GoguReleaseConnection(fc->conn);
+	else
+		GoguCloseConnection(fc->conn);
+
+	fc->conn = NULL;
+}
+
+/*
+ * Close all private connections, cancelling statements still in progress.
+ * Pooled connections are only released, they are cleaned up at the end of
+ * the transaction.
+ */
+static void
+fanout_close_all(GoguFanout *fanout, FanoutConn *conns, int nconns)
+{
+	int i;
+
+	for (i = 0; i < nconns; i++)
+	{
+		if (conns[i].conn == NULL)
+			continue;
+
+		if (fanout->inXact)
+		{
+			fanout_release_conn(fanout, &conns[i]);
+			continue;
+		}
+
+		if (conns[i].task)
+		{
+			PGcancel   *cancel = PQgetCancel(conns[i].conn);
+			char		errbuf[256];
+
+			if (cancel)
+			{
+				(void) PQcancel(cancel, errbuf, sizeof(errbuf));
+				PQfreeCancel(cancel);
+			}
+		}
+
+		GoguCloseConnection(conns[i].conn);
+		conns[i].conn = NULL;
+	}
+}
+
+/*
+ * Find a connection for 'task', opening one if the server has spare
+ * capacity.  Return NULL if the server is saturated.
+ */
+static FanoutConn *
+fanout_get_conn(GoguFanout *fanout, FanoutConn *conns, int *nconns,
+				FanoutTask *task)
+{
+	FanoutConn *idle_other = NULL;
+	int			busy = 0,
+				total = 0,
+				i;
 
-				CHECK_FOR_INTERRUPTS();
+	/* There's just one pooled connection per user mapping */
+	if (fanout->inXact)
+	{
+		for (i = 0; i < *nconns; i++)
+		{
+			if (conns[i].umid == task->user->umid)
+				return conns[i].task ? NULL : &conns[i];
+		}
 
-				/* Data available in socket? */
-				if (wc & WL_SOCKET_READABLE)
+		return &conns[(*nconns)++];
+	}
+
+	for (i = 0; i < *nconns; i++)
+	{
+		FanoutConn *fc = &conns[i];
+
+		if (fc->conn == NULL || fc->serverid != task->user->serverid)
+			continue;
+
+		total++;
+
+		if (fc->task)
+			busy++;
+		else if (fc->umid == task->user->umid)
+			return fc;
+		else
+			idle_other = fc;
+	}
+
+	if (busy >= gogudb_remote_concurrency)
+		return NULL;
+
+	/* Reuse a slot of this server held by another user mapping */
+	if (total >= gogudb_remote_concurrency && idle_other)
+	{
+		fanout_release_conn(fanout, idle_other);
+		return idle_other;
+	}
+
+	return &conns[(*nconns)++];
+}
+
+/*
+ * Run all queued statements and wait for them.  Raise an ERROR listing
+ * every failed statement, if any.
+ */
+void
+GoguFanoutRun(GoguFanout *fanout)
+{
+	int				ntasks = list_length(fanout->tasks);
+	FanoutConn	   *conns;
+	int				nconns = 0,
+					nfailed = 0;
+	ListCell	   *next_task;
+	StringInfoData	details;
+
+	if (ntasks == 0)
+		return;
+
+	/* There can't be more connections than statements */
+	conns = (FanoutConn *) palloc0(sizeof(FanoutConn) * ntasks);
+
+	PG_TRY();
+	{
+		List	   *waiting = list_copy(fanout->tasks);
+
+		for (;;)
+		{
+			WaitEventSet   *wes;
+			WaitEvent		event;
+			ListCell	   *lc,
+						   *prev = NULL;
+			int				nrunning = 0,
+							i;
+
+			CHECK_FOR_INTERRUPTS();
+
+			/* Start whatever we can, keeping the order per server */
+			for (lc = list_head(waiting); lc; )
+			{
+				FanoutTask *task = (FanoutTask *) lfirst(lc);
+				FanoutConn *fc = fanout_get_conn(fanout, conns, &nconns, task);
+				ListCell   *next = lnext(lc);
+
+				if (fc == NULL)
 				{
-					if (!PQconsumeInput(conn))
+					prev = lc;
+					lc = next;
+					continue;
+				}
+
+				waiting = list_delete_cell(waiting, lc, prev);
+				lc = next;
+
+				if (fc->conn == NULL)
+				{
+					MemoryContext	mcxt = CurrentMemoryContext;
+
+					fc->serverid = task->user->serverid;
+					fc->umid = task->user->umid;
+
+					/* Can't connect, report it along with other failures */
+					PG_TRY();
 					{
-						/* connection trouble; treat the same as a timeout */
-						timed_out = true;
-						goto exit;
+						if (fanout->inXact)
+							fc->conn = GoguGetConnection(task->user, false, true);
+						else
+							fc->conn = GoguOpenConnection(task->user, false);
+					}
+					PG_CATCH();
+					{
+						ErrorData *edata;
+
+						MemoryContextSwitchTo(mcxt);
+						edata = CopyErrorData();
+						FlushErrorState();
+
+						task->errmsg = edata->message;
 					}
+					PG_END_TRY();
+
+					if (fc->conn == NULL)
+						continue;
+				}
+
+				if (!PQsendQuery(fc->conn, task->sql))
+				{
+					fanout_task_failed(task, fc->conn, NULL);
+					if (fanout->inXact)
+						fanout_release_conn(fanout, fc);
+					continue;
 				}
+
+				fc->task = task;
 			}
 
-			res = PQgetResult(conn);
-			if (res == NULL)
-				break;			/* query is complete */
+			/* Wait for any running statement */
+			wes = CreateWaitEventSet(CurrentMemoryContext, nconns + 1);
+			AddWaitEventToSet(wes, WL_LATCH_SET, PGINVALID_SOCKET, MyLatch, NULL);
 
-			PQclear(last_res);
-			last_res = res;
+			for (i = 0; i < nconns; i++)
+			{
+				if (conns[i].conn && conns[i].task)
+				{
+					AddWaitEventToSet(wes, WL_SOCKET_READABLE,
+									  PQsocket(conns[i].conn), NULL, &conns[i]);
+					nrunning++;
+				}
+			}
+
+			if (nrunning == 0)
+			{
+				FreeWaitEventSet(wes);
+
+				/* Everything is done */
+				if (waiting == NIL)
+					break;
+				continue;
+			}
+
+			if (WaitEventSetWait(wes, -1L, &event, 1
+#if PG_VERSION_NUM >= 100000
+								 , PG_WAIT_EXTENSION
+#endif
+								 ) > 0 && (event.events & WL_SOCKET_READABLE))
+			{
+				FanoutConn *fc = (FanoutConn *) event.user_data;
+
+				if (!PQconsumeInput(fc->conn))
+				{
+					/* Connection is broken, forget it */
+					fanout_task_failed(fc->task, fc->conn, NULL);
+					fc->task = NULL;
+					fanout_release_conn(fanout, fc);
+				}
+				else if (fanout_collect(fc) && fanout->inXact)
+					fanout_release_conn(fanout, fc);
+			}
+
+			FreeWaitEventSet(wes);
+			ResetLatch(MyLatch);
 		}
-exit:	;
 	}
 	PG_CATCH();
 	{
-		PQclear(last_res);
+		fanout_close_all(fanout, conns, nconns);
 		PG_RE_THROW();
 	}
 	PG_END_TRY();
 
-	if (timed_out)
-		PQclear(last_res);
-	else
-		*result = last_res;
-	return timed_out;
+	fanout_close_all(fanout, conns, nconns);
+
+	/* Report all failures at once */
+	initStringInfo(&details);
+	foreach(next_task, fanout->tasks)
+	{
+		FanoutTask *task = (FanoutTask *) lfirst(next_task);
+
+		if (task->errmsg == NULL)
+			continue;
+
+		if (nfailed++ > 0)
+			appendStringInfoChar(&details, '\n');
+
+		appendStringInfo(&details, "server \"%s\": %s (statement: %s)",
+						 GetForeignServer(task->user->serverid)->servername,
+						 task->errmsg, task->sql);
+	}
+
+	if (nfailed > 0)
+		ereport(ERROR,
+				(errcode(ERRCODE_FDW_ERROR),
+				 errmsg("%d of %d remote statements failed", nfailed, ntasks),
+				 errdetail_internal("%s", details.data)));
 }
 
 void connectionPoolRunSQL(UserMapping *user, const char *query, bool inXact)
@@ -1260,3 +2897,349 @@ void connectionPoolRunSQL(UserMapping *user, const char *query, bool inXact)
 		do_sql_command(conn, "COMMIT TRANSACTION");
 	GoguReleaseConnection(conn);
 }
+
+
+/*
+ * Check the socket of an idle connection.  An idle connection has nothing
+ * to read unless the server has sent an error and closed it, or is gone.
+ */
+static bool
+pgfdw_conn_is_alive(PGconn *conn)
+{
+	struct pollfd	pfd;
+
+	if (PQstatus(conn) != CONNECTION_OK)
+		return false;
+
+	/* Statement in progress, its results are not ours to read */
+	if (PQtransactionStatus(conn) != PQTRANS_IDLE)
+		return true;
+
+	pfd.fd = PQsocket(conn);
+	pfd.events = POLLIN;
+	pfd.revents = 0;
+
+	while (poll(&pfd, 1, 0) > 0)
+	{
+		if (pfd.revents & (POLLERR | POLLHUP | POLLNVAL))
+			return false;
+
+		/* Read the data; libpq will notice EOF and mark connection bad */
+		if (!PQconsumeInput(conn) || PQstatus(conn) != CONNECTION_OK)
+			return false;
+
+		pfd.revents = 0;
+	}
+
+	return true;
+}
+
+/*
+ * Find the cache entry which owns the connection.  Entries are never
+ * removed from the cache, so the last one found can be remembered.
+ */
+static ConnCacheEntry *
+pgfdw_find_entry(PGconn *conn)
+{
+	static ConnCacheEntry *last_found = NULL;
+	HASH_SEQ_STATUS scan;
+	ConnCacheEntry *entry;
+
+	if (ConnectionHash == NULL || conn == NULL)
+		return NULL;
+
+	if (last_found != NULL && last_found->conn == conn)
+		return last_found;
+
+	hash_seq_init(&scan, ConnectionHash);
+	while ((entry = (ConnCacheEntry *) hash_seq_search(&scan)))
+	{
+		if (entry->conn == conn)
+		{
+			hash_seq_term(&scan);
+			last_found = entry;
+			return entry;
+		}
+	}
+
+	return NULL;
+}
+
+/*
+ * Add a statement completed on a cached connection to gogudb_stat_remote,
+ * and log it if it was slow and 'log' is true.  'start' is when we began
+ * to wait for its results.
+ */
+static void
+pgfdw_count_statement(PGconn *conn, const char *query,
+					  PGresult **results, int nresults, instr_time start,
+					  bool log)
+{
+	ConnCacheEntry	   *entry = pgfdw_find_entry(conn);
+	StatRemoteEntry	   *stats;
+	instr_time			elapsed;
+	double				wait_ms;
+	uint64				rows = 0,
+						bytes = 0;
+	int					i;
+
+	if (entry == NULL)
+		return;
+
+	stats = stat_remote_entry(entry->serverid);
+
+	INSTR_TIME_SET_CURRENT(elapsed);
+	INSTR_TIME_SUBTRACT(elapsed, start);
+	wait_ms = INSTR_TIME_GET_MILLISEC(elapsed);
+
+	for (i = 0; i < nresults; i++)
+	{
+		if (results[i] == NULL)
+			continue;
+
+		rows += PQntuples(results[i]);
+		bytes += remote_result_bytes(results[i]);
+	}
+
+	stat_remote_count(stats, STAT_REMOTE_QUERIES, 1);
+	stat_remote_latency(stats, wait_ms);
+	stat_remote_count(stats, STAT_REMOTE_ROWS, rows);
+	stat_remote_count(stats, STAT_REMOTE_BYTES_IN, bytes);
+	if (query)
+		stat_remote_count(stats, STAT_REMOTE_BYTES_OUT, strlen(query));
+
+	if (log)
+		remote_log_statement(entry->serverid, query, rows, wait_ms);
+}
+
+/*
+ * Drop a cached connection which has been lost, so that the next
+ * GoguGetConnection() reconnects.  Returns false if the connection is
+ * alive, or is in a remote transaction which has to be aborted anyway;
+ * only then is it safe for caller to retry the statement.
+ */
+bool
+GoguDiscardBrokenConnection(PGconn *conn)
+{
+	ConnCacheEntry *entry;
+
+	if (PQstatus(conn) != CONNECTION_BAD)
+		return false;
+
+	entry = pgfdw_find_entry(conn);
+	if (entry == NULL || entry->xact_depth > 0)
+		return false;
+
+	server_health_report(entry->serverid, false);
+	stat_remote_count(stat_remote_entry(entry->serverid),
+					  STAT_REMOTE_RECONNECTS, 1);
+
+	elog(DEBUG3, "closing lost connection %p", entry->conn);
+	disconnect_pg_server(entry);
+
+	return true;
+}
+
+/*
+ * Cancel the query still running on a cached connection, when we error out
+ * before reading all its results.  If that fails, the connection is closed,
+ * unless it is in a remote transaction, which is cleaned up at abort.
+ */
+void
+GoguAbandonQuery(PGconn *conn)
+{
+	ConnCacheEntry *entry;
+
+	if (PQtransactionStatus(conn) != PQTRANS_ACTIVE ||
+		pgfdw_cancel_query(conn))
+		return;
+
+	entry = pgfdw_find_entry(conn);
+	if (entry && entry->xact_depth == 0)
+		disconnect_pg_server(entry);
+}
+
+/*
+ * Add TCP keepalive options (gogudb.remote_keepalives_*) to the connection
+ * params unless the server or user mapping sets them.  Caller must have
+ * allocated 3 extra slots.  Returns number of options added.
+ */
+static int
+pgfdw_add_keepalive_options(const char **keywords, const char **values, int n)
+{
+	static const char *names[] = {
+		"keepalives_idle", "keepalives_interval", "keepalives_count"
+	};
+	int		settings[3];
+	int		added = 0,
+			i,
+			j;
+
+	settings[0] = gogudb_remote_keepalives_idle;
+	settings[1] = gogudb_remote_keepalives_interval;
+	settings[2] = gogudb_remote_keepalives_count;
+
+	for (i = 0; i < lengthof(names); i++)
+	{
+		if (settings[i] <= 0)
+			continue;
+
+		for (j = 0; j < n; j++)
+		{
+			if (strcmp(keywords[j], names[i]) == 0)
+				break;
+		}
+
+		if (j < n)
+			continue;
+
+		keywords[n + added] = names[i];
+		values[n + added] = psprintf("%d", settings[i]);
+		added++;
+	}
+
+	return added;
+}
+
+
+Size
+estimate_server_health_size(void)
+{
+	return MAXALIGN(sizeof(ServerHealthState));
+}
+
+/*
+ * Initialize shared memory needed for the circuit breaker.
+ */
+void
+init_server_health_state(void)
+{
+	bool	found;
+
+	server_health = ShmemInitStruct("gogudb server health",
+									estimate_server_health_size(),
+									&found);
+	if (!found)
+	{
+		memset(server_health, 0, sizeof(ServerHealthState));
+		SpinLockInit(&server_health->mutex);
+	}
+}
+
+/*
+ * Find the state of a server, take a free slot if it has none.
+ * Caller must hold the mutex.
+ */
+static ServerHealth *
+server_health_slot(Oid serverid)
+{
+	ServerHealth   *free_slot = NULL;
+	int				i;
+
+	for (i = 0; i < SERVER_HEALTH_SLOTS; i++)
+	{
+		ServerHealth *health = &server_health->servers[i];
+
+		if (health->serverid == serverid)
+			return health;
+
+		if (health->serverid == InvalidOid && free_slot == NULL)
+			free_slot = health;
+	}
+
+	if (free_slot)
+	{
+		free_slot->serverid = serverid;
+		free_slot->failures = 0;
+		free_slot->down_until = 0;
+	}
+
+	return free_slot;
+}
+
+/*
+ * May we connect to the server?  Once its down time is over, one backend
+ * gets to try, the others keep failing fast until it succeeds.
+ */
+static bool
+server_health_allow(Oid serverid)
+{
+	ServerHealth   *health;
+	TimestampTz		now;
+	bool			result = true;
+
+	if (server_health == NULL || gogudb_server_failure_threshold <= 0)
+		return true;
+
+	now = GetCurrentTimestamp();
+
+	SpinLockAcquire(&server_health->mutex);
+	health = server_health_slot(serverid);
+	if (health && health->failures >= gogudb_server_failure_threshold)
+	{
+		if (health->down_until > now)
+			result = false;
+		else
+			health->down_until = TimestampTzPlusMilliseconds(now,
+									gogudb_server_down_time * 1000);
+	}
+	SpinLockRelease(&server_health->mutex);
+
+	return result;
+}
+
+/*
+ * Record a successful connection to the server, or a failure.
+ */
+static void
+server_health_report(Oid serverid, bool success)
+{
+	ServerHealth   *health;
+	TimestampTz		down_until;
+
+	if (server_health == NULL || gogudb_server_failure_threshold <= 0)
+		return;
+
+	down_until = TimestampTzPlusMilliseconds(GetCurrentTimestamp(),
+											 gogudb_server_down_time * 1000);
+
+	SpinLockAcquire(&server_health->mutex);
+	health = server_health_slot(serverid);
+	if (health && success)
+		health->failures = 0;
+	else if (health && ++health->failures >= gogudb_server_failure_threshold)
+		health->down_until = down_until;
+	SpinLockRelease(&server_health->mutex);
+}
+
+/*
+ * Is the server marked down by the circuit breaker?
+ */
+bool
+GoguServerIsDown(Oid serverid)
+{
+	ServerHealth   *health;
+	TimestampTz		now;
+	bool			result = false;
+	int				i;
+
+	if (server_health == NULL || gogudb_server_failure_threshold <= 0)
+		return false;
+
+	now = GetCurrentTimestamp();
+
+	SpinLockAcquire(&server_health->mutex);
+	for (i = 0; i < SERVER_HEALTH_SLOTS; i++)
+	{
+		health = &server_health->servers[i];
+		if (health->serverid == serverid)
+		{
+			result = health->failures >= gogudb_server_failure_threshold &&
+					 health->down_until > now;
+			break;
+		}
+	}
+	SpinLockRelease(&server_health->mutex);
+
+	return result;
+}
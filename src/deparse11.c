@@ -1982,14 +1982,37 @@ GogudeparseAnalyzeSizeSql(StringInfo buf, Relation rel)
 	appendStringInfo(buf, "::pg_catalog.regclass) / %d", BLCKSZ);
 }
 
+/*
+ * Construct SELECT statement to get the planner's idea of the number of
+ * rows in given relation.
+ */
+void
+GogudeparseAnalyzeTuplesSql(StringInfo buf, Relation rel)
+{
+	StringInfoData relname;
+
+	/* We'll need the remote relation name as a literal. */
+	initStringInfo(&relname);
+	deparseRelation(&relname, rel);
+
+	appendStringInfoString(buf, "SELECT reltuples FROM pg_catalog.pg_class WHERE oid = ");
+	GogudeparseStringLiteral(buf, relname.data);
+	appendStringInfoString(buf, "::pg_catalog.regclass");
+}
+
 /*
  * Construct SELECT statement to acquire sample rows of given relation.
  *
+ * If sample_method is not ANALYZE_SAMPLE_OFF, the remote server returns
+ * only about sample_frac of the rows.
+ *
  * SELECT command is appended to buf, and list of columns retrieved
  * is returned to *retrieved_attrs.
  */
 void
-GogudeparseAnalyzeSql(StringInfo buf, Relation rel, List **retrieved_attrs)
+GogudeparseAnalyzeSql(StringInfo buf, Relation rel,
+					  PgFdwSamplingMethod sample_method, double sample_frac,
+					  List **retrieved_attrs)
 {
 	Oid			relid = RelationGetRelid(rel);
 	TupleDesc	tupdesc = RelationGetDescr(rel);
@@ -2041,6 +2064,28 @@ GogudeparseAnalyzeSql(StringInfo buf, Relation rel, List **retrieved_attrs)
 	 */
 	appendStringInfoString(buf, " FROM ");
 	deparseRelation(buf, rel);
+
+	/* Let the remote server do the sampling */
+	switch (sample_method)
+	{
+		case ANALYZE_SAMPLE_OFF:
+			break;
+
+		case ANALYZE_SAMPLE_RANDOM:
+			appendStringInfo(buf, " WHERE pg_catalog.random() < %.17g", sample_frac);
+			break;
+
+		case ANALYZE_SAMPLE_SYSTEM:
+			appendStringInfo(buf, " TABLESAMPLE SYSTEM(%.17g)", 100.0 * sample_frac);
+			break;
+
+		case ANALYZE_SAMPLE_BERNOULLI:
+			appendStringInfo(buf, " TABLESAMPLE BERNOULLI(%.17g)", 100.0 * sample_frac);
+			break;
+
+		default:
+			elog(ERROR, "unexpected sampling method %d", (int) sample_method);
+	}
 }
 
 /*
@@ -2186,26 +2231,18 @@ deparseColumnRef(StringInfo buf, int varno, int varattno, RangeTblEntry *rte,
 static void
 deparseRelation(StringInfo buf, Relation rel)
 {
-	ForeignTable *table;
-	const char *nspname = NULL;
-	const char *relname = NULL;
-	ListCell   *lc;
+	GoguTableOptions *options;
+	const char *nspname;
+	const char *relname;
 
 	/* obtain additional catalog information. */
-	table = GetForeignTable(RelationGetRelid(rel));
+	options = GoguGetTableOptions(RelationGetRelid(rel));
 
 	/*
 	 * Use value of FDW options if any, instead of the name of object itself.
 	 */
-	foreach(lc, table->options)
-	{
-		DefElem    *def = (DefElem *) lfirst(lc);
-
-		if (strcmp(def->defname, "schema_name") == 0)
-			nspname = defGetString(def);
-		else if (strcmp(def->defname, "table_name") == 0)
-			relname = defGetString(def);
-	}
+	nspname = options->remote_schema;
+	relname = options->remote_table;
 
 	/*
 	 * Note: we could skip printing the schema name if it's pg_catalog, but
@@ -18,6 +18,14 @@
 #include "init.h"
 #include "partition_filter.h"
 #include "pathman_workers.h"
+#include "partition_move.h"
+#include "partition_precreate.h"
+#include "partition_retention.h"
+#include "remote_stats.h"
+#include "remote_estimate.h"
+#include "remote_log.h"
+#include "replica_routing.h"
+#include "stat_remote.h"
 #include "planner_tree_modification.h"
 #include "runtimeappend.h"
 #include "runtime_merge_append.h"
@@ -30,6 +38,7 @@
 #include "access/transam.h"
 #include "access/stratnum.h"
 #include "access/htup_details.h"
+#include "access/xact.h"
 
 #include "catalog/pg_inherits.h"
 #include "catalog/pg_authid.h"
@@ -45,9 +54,11 @@
 #include "parser/parse_type.h"
 #include "parser/parse_coerce.h"
 #include "parser/parse_relation.h"
+#include "parser/parser.h"
 #include "foreign/foreign.h"
 #include "commands/defrem.h"
 #include "lib/stringinfo.h"
+#include "storage/lmgr.h"
 #include "utils/builtins.h"
 #include "miscadmin.h"
 #include "optimizer/cost.h"
@@ -60,6 +71,7 @@
 #include "utils/lsyscache.h"
 #include "utils/fmgroids.h"
 #include "utils/syscache.h"
+#include "executor/executor.h"
 #include "executor/spi.h"
 #include "funcapi.h"
 
@@ -80,6 +92,9 @@
 
 static RangeVar* get_parent_rangevar(RangeVar*child_rv); 
 
+static bool is_removed_rule_partition(RangeVar *rv);
+static void removed_rule_partition_xact_callback(XactEvent event, void *arg);
+
 static List* get_remote_meta_4_child_foreign_table(RangeVar *rv);
  
 static void handle_before_hook(Node* parsetree); 
@@ -143,6 +158,14 @@ post_parse_analyze_hook_type	post_parse_analyze_hook_next = NULL;
 shmem_startup_hook_type			shmem_startup_hook_next = NULL;
 ProcessUtility_hook_type		process_utility_hook_next = NULL;
 
+/*
+ * Set by PartitionRetentionWorker while it removes an expired partition
+ * of a table managed by table_partition_rule, see handle_before_hook().
+ * Cleared at the end of the transaction, even if it fails.
+ */
+static Oid						removed_rule_partition = InvalidOid;
+static bool						removed_rule_callback_registered = false;
+
 
 /* Take care of joins */
 void
@@ -909,6 +932,15 @@ pathman_shmem_startup_hook(void)
 	/* Allocate shared memory objects */
 	LWLockAcquire(AddinShmemInitLock, LW_EXCLUSIVE);
 	init_concurrent_part_task_slots();
+	init_partition_move_slots();
+	init_partition_precreate_slots();
+	init_partition_retention_slots();
+	init_remote_estimate_cache();
+	init_remote_stats_slots();
+	init_replica_routing_state();
+	init_server_health_state();
+	init_stat_remote();
+	init_spawner_state();
 	LWLockRelease(AddinShmemInitLock);
 }
 
@@ -1150,6 +1182,49 @@ static RangeVar  *get_parent_rangevar( RangeVar  *child_rv)
 	return parent_rv;
 }
 
+/*
+ *	Let the current transaction drop or detach partition 'relid' although
+ *	its table has a table_partition_rule.
+ * */
+void allow_rule_partition_removal(Oid relid)
+{
+	if (!removed_rule_callback_registered)
+	{
+		RegisterXactCallback(removed_rule_partition_xact_callback, NULL);
+		removed_rule_callback_registered = true;
+	}
+
+	removed_rule_partition = relid;
+}
+
+static void removed_rule_partition_xact_callback(XactEvent event, void *arg)
+{
+	switch (event)
+	{
+		case XACT_EVENT_ABORT:
+		case XACT_EVENT_PARALLEL_ABORT:
+		case XACT_EVENT_COMMIT:
+		case XACT_EVENT_PARALLEL_COMMIT:
+		case XACT_EVENT_PREPARE:
+			removed_rule_partition = InvalidOid;
+			break;
+
+		default:
+			break;
+	}
+}
+
+/*
+ *	Is 'rv' the partition being removed by PartitionRetentionWorker?
+ * */
+static bool is_removed_rule_partition(RangeVar *rv)
+{
+	if (!OidIsValid(removed_rule_partition))
+		return false;
+
+	return RangeVarGetRelid(rv, NoLock, true) == removed_rule_partition;
+}
+
 /*
  *	Do some work before standard_ProcessUtility
  * */
@@ -1177,6 +1252,10 @@ static void handle_before_hook(Node *parsetree)
 						if (cmd->subtype == AT_GenericOptions)
 							return ;
 
+						/* NO INHERIT etc. of a partition being detached */
+						if (is_removed_rule_partition(rv))
+							return ;
+
 						parent_rv = get_parent_rangevar(rv);			
 						if (parent_rv && 
 							read_table_partition_rule_params(parent_rv->schemaname,
@@ -1487,9 +1566,12 @@ static void handle_createstmt(Node *parsetree, const char *queryString)
  	* create tables on remote server via connections pool and modify foreign tables' options
  	*/
 	{
-		ListCell *meta_cell;
+		ListCell *meta_cell, *batch_cell;
 		char *tmp_start, *tmp_end;
 		List *meta_list = get_remote_meta_4_child_foreign_table(rv);
+		List *batch_users = NIL,
+			 *batch_sqls = NIL;
+		GoguFanout *fanout = GoguFanoutCreate(true);
 		/* Create remote table */
 		tmp_start = strcasestr(queryString, "table");
 		tmp_start += 5;
@@ -1505,16 +1587,51 @@ static void handle_createstmt(Node *parsetree, const char *queryString)
 			tmp_end++;
 		}
 
+		/*
+		 * Batch the CREATE TABLEs of each user mapping into a single
+		 * multi-statement query, so every server gets one round trip, and
+		 * send all batches at once.  They run in the remote transactions,
+		 * so a local rollback doesn't leave orphaned remote tables.
+		 */
 		foreach(meta_cell, meta_list) {
 			Remote_meta *meta = lfirst(meta_cell);
-			resetStringInfo(&sql);
-			resetStringInfo(&sql);
-			appendBinaryStringInfo(&sql, queryString, tmp_start-queryString);
-			appendStringInfo(&sql, " %s.%s ", meta->remote_schema, meta->remote_table);
-			appendBinaryStringInfo(&sql, tmp_end, queryString+strlen(queryString)-tmp_end);
-			connectionPoolRunSQL(meta->user, sql.data, true);
+			StringInfo	batch = NULL;
+			ListCell   *user_cell;
+			int			i = 0;
+
+			foreach(user_cell, batch_users)
+			{
+				if (((UserMapping *) lfirst(user_cell))->umid == meta->user->umid)
+				{
+					batch = (StringInfo) list_nth(batch_sqls, i);
+					break;
+				}
+				i++;
+			}
+
+			if (batch == NULL)
+			{
+				batch = makeStringInfo();
+				batch_users = lappend(batch_users, meta->user);
+				batch_sqls = lappend(batch_sqls, batch);
+			}
+
+			appendBinaryStringInfo(batch, queryString, tmp_start-queryString);
+			appendStringInfo(batch, " %s.%s ", meta->remote_schema, meta->remote_table);
+			appendBinaryStringInfo(batch, tmp_end, queryString+strlen(queryString)-tmp_end);
+			appendStringInfoString(batch, ";\n");
+		}
+
+		forboth(meta_cell, batch_users, batch_cell, batch_sqls)
+		{
+			UserMapping *user = (UserMapping *) lfirst(meta_cell);
+			StringInfo	batch = (StringInfo) lfirst(batch_cell);
+
+			elog(DEBUG3, " Try to run %s on %d", batch->data, user->serverid);
+			GoguFanoutAdd(fanout, user, batch->data);
 		}
 
+		GoguFanoutRun(fanout);
 	}
 
 }
@@ -1574,6 +1691,7 @@ static void handle_truncatestmt(Node *parsetree)
 		if (read_table_partition_rule_params(rv->schemaname, rv->relname, NULL, NULL)) {
 			ListCell* meta_cell;
 			StringInfoData sql;
+			GoguFanout *fanout = GoguFanoutCreate(true);
 	
 			List *remote_meta_list = get_remote_meta_4_child_foreign_table(rv);
 			initStringInfo(&sql);
@@ -1588,9 +1706,11 @@ static void handle_truncatestmt(Node *parsetree)
 					appendStringInfo(&sql, " cascade"); 
 
 				elog(DEBUG3, " Try to run %s on %d", sql.data, meta->user->serverid);
-				connectionPoolRunSQL(meta->user, sql.data, true);
+				GoguFanoutAdd(fanout, meta->user, sql.data);
 				resetStringInfo(&sql);
 			}
+
+			GoguFanoutRun(fanout);
 		}
 	}
 }
@@ -1616,6 +1736,8 @@ static void handle_create_index(Node *parsetree, const char* queryString)
 		StringInfoData sql_head, create_index_sql;
 		const char *body = queryString + rv->location;
 		List *remote_meta_list =  get_remote_meta_4_child_foreign_table(rv);
+		/* CONCURRENTLY can't run inside the remote transaction */
+		GoguFanout *fanout = GoguFanoutCreate(!stmt->concurrent);
 
 		initStringInfo(&sql_head);
 		initStringInfo(&create_index_sql);
@@ -1645,9 +1767,11 @@ static void handle_create_index(Node *parsetree, const char* queryString)
 								meta->remote_table, stmt->idxname, meta->remote_schema,
 								meta->remote_table, body);
 			elog(DEBUG3, " Try to run  %s on %d", create_index_sql.data, meta->user->serverid);
-			connectionPoolRunSQL(meta->user, create_index_sql.data, true);
+			GoguFanoutAdd(fanout, meta->user, create_index_sql.data);
 			resetStringInfo(&create_index_sql);
 		}
+
+		GoguFanoutRun(fanout);
 	}
 }
 
@@ -1710,6 +1834,9 @@ static void handle_dropstmt(Node   *parsetree)
 		foreach(cell, stmt->objects)
 		{
 			rv = makeRangeVarFromNameList((List *) lfirst(cell));
+			if (is_removed_rule_partition(rv))
+				continue ;
+
 			parent_rv = get_parent_rangevar(rv);
 			if (parent_rv) {
 				if (parent_rv->schemaname == NULL) {
@@ -1818,6 +1945,7 @@ static void handle_clusterstmt(Node *parsetree)
 		List *remote_meta_list =  get_remote_meta_4_child_foreign_table(rv);
 		ListCell *meta_cell;
 		StringInfoData cluster_sql;
+		GoguFanout *fanout = GoguFanoutCreate(true);
 		initStringInfo(&cluster_sql);
 
 		foreach(meta_cell, remote_meta_list) 
@@ -1830,13 +1958,15 @@ static void handle_clusterstmt(Node *parsetree)
 				appendStringInfo(&cluster_sql, "USING %s_%s", 
 							meta->remote_table, stmt->indexname);
 
-			appendStringInfo(&cluster_sql, ";"),
-			connectionPoolRunSQL(meta->user, cluster_sql.data, true);
+			appendStringInfo(&cluster_sql, ";");
+			GoguFanoutAdd(fanout, meta->user, cluster_sql.data);
 			elog(DEBUG3, " Try to run %s on %d", cluster_sql.data,
 				 meta->user->serverid);
 
 			resetStringInfo(&cluster_sql);
 		}
+
+		GoguFanoutRun(fanout);
 	}
 
 }
@@ -1850,12 +1980,13 @@ static void handle_vacuumstmt(Node *parsetree, const char* queryString)
 	RangeVar   *rv = NULL;
 	char	   *schemaname = NULL;
 	VacuumStmt *stmt = (VacuumStmt *) parsetree;
+
 #if PG_VERSION_NUM >= 110000
 	if (list_length(stmt->rels) != 1) {
 		ListCell *rv_cell = NULL;
 		foreach(rv_cell, stmt->rels)
 		{
-			rv = (RangeVar *) lfirst(rv_cell);
+			rv = ((VacuumRelation *) lfirst(rv_cell))->relation;
 			schemaname = rv->schemaname;
 
 			if (schemaname == NULL) {
@@ -1875,8 +2006,7 @@ static void handle_vacuumstmt(Node *parsetree, const char* queryString)
 		return;
 	}
 
-	rv = (RangeVar *)lfirst(list_head(stmt->rels));
-	return;
+	rv = ((VacuumRelation *) linitial(stmt->rels))->relation;
 #else 
 	rv = stmt->relation;
 #endif
@@ -1896,6 +2026,8 @@ static void handle_vacuumstmt(Node *parsetree, const char* queryString)
 		List 		*remote_meta_list = NIL;
 		ListCell 	*meta_cell = NULL;
 		const char	*tail_start = NULL;
+		/* VACUUM can't run inside a transaction block */
+		GoguFanout	*fanout = GoguFanoutCreate(false);
 
 		StringInfoData vacuum_head_sql, vacuum_sql;
 		initStringInfo(&vacuum_head_sql);
@@ -1922,9 +2054,21 @@ static void handle_vacuumstmt(Node *parsetree, const char* queryString)
 			elog(DEBUG3, " Try to run %s on %d", vacuum_sql.data,
 				 meta->user->serverid);
 
-			connectionPoolRunSQL(meta->user, vacuum_sql.data, false);
+			GoguFanoutAdd(fanout, meta->user, vacuum_sql.data);
 			resetStringInfo(&vacuum_sql);
 		}
+
+		GoguFanoutRun(fanout);
+
+		/* Remote statistics have changed, forget cached estimates */
+		if (stmt->options & VACOPT_ANALYZE)
+		{
+			List *children = find_inheritance_children(RangeVarGetRelid(rv, NoLock, false),
+													   NoLock);
+
+			if (children != NIL)
+				remote_estimate_invalidate(children);
+		}
 	}
 
 }
@@ -1951,6 +2095,7 @@ static void handle_reindexstmt(Node* parsetree, const char* queryString)
 											 indexed_rv->relname, NULL, NULL)) {
 			ListCell *meta_cell;
 			StringInfoData reindex_sql;
+			GoguFanout *fanout = GoguFanoutCreate(true);
 
 			List *remote_meta_list =  get_remote_meta_4_child_foreign_table(indexed_rv);
 			initStringInfo(&reindex_sql);
@@ -1965,10 +2110,12 @@ static void handle_reindexstmt(Node* parsetree, const char* queryString)
 
 				appendStringInfo(&reindex_sql, " %s.%s_%s;", meta->remote_schema, 
 								meta->remote_table, rv->relname);
-				connectionPoolRunSQL(meta->user, reindex_sql.data, true);
+				GoguFanoutAdd(fanout, meta->user, reindex_sql.data);
 				elog(DEBUG3, " Try to run %s on %d", reindex_sql.data,  meta->user->serverid);
 				resetStringInfo(&reindex_sql);
 			}
+
+			GoguFanoutRun(fanout);
 		}
 	
 	} else if (stmt->kind == REINDEX_OBJECT_TABLE) {
@@ -1983,6 +2130,7 @@ static void handle_reindexstmt(Node* parsetree, const char* queryString)
 			ListCell *meta_cell;
 			List *remote_meta_list =  get_remote_meta_4_child_foreign_table(rv);
 			StringInfoData reindex_sql;
+			GoguFanout *fanout = GoguFanoutCreate(true);
 			initStringInfo(&reindex_sql);
 			foreach(meta_cell, remote_meta_list) 
 			{
@@ -1993,10 +2141,12 @@ static void handle_reindexstmt(Node* parsetree, const char* queryString)
 					appendBinaryStringInfo(&reindex_sql, queryString, rv->location);
 				}
 				appendStringInfo(&reindex_sql, " %s.%s;", meta->remote_schema, meta->remote_table);
-				connectionPoolRunSQL(meta->user, reindex_sql.data, true);
+				GoguFanoutAdd(fanout, meta->user, reindex_sql.data);
 				elog(DEBUG3, " Try to run %s on %d", reindex_sql.data,  meta->user->serverid);
 				resetStringInfo(&reindex_sql);
 			}
+
+			GoguFanoutRun(fanout);
 		}
 	}
 }
@@ -2245,63 +2395,32 @@ static void handle_after_hook(Node *parsetree, const char *queryString)
 	}	
 }
 
-List* pg_plan_queries_hook(List *querytrees, int cursorOptions,
-							ParamListInfo boundParams)
+/*
+ * Find the only partition touched by the quals of a SELECT, UPDATE
+ * or DELETE, return InvalidOid if there's no such partition.
+ */
+static Oid
+fast_path_scan_partition(PlannerInfo *root, Query *parse,
+						 const PartRelationInfo *prel)
 {
-	Query			*parse;
-	RangeTblEntry	*parent_rte;
-	Relation 		parent_rel;
-	char 			*parent_relname,
-					*parent_schemaname; 
-	const PartRelationInfo *prel;
 	FromExpr  		*jtnode;
 	Node			*qual_expr;
 	List			*ranges, *wrappers, *quals;	
 	WalkerContext	context;
 	Node		  	*part_expr;
-	//List		   	*part_clauses;
 	ListCell	   	*lc;
-	Oid            	*children, child_oid;
 	IndexRange 		irange;
-	PlannedStmt		*plan_stmt;
-
-	if (!IsPathmanReady() || (list_length(querytrees)>1))
-		return NULL;
-
-	parse = lfirst_node(Query, list_head(querytrees)); 
-
-	if (!((parse->commandType == CMD_SELECT) && parse->rtable &&
-            (list_length(parse->rtable)==1) && !(parse->hasSubLinks)))
-		return NULL;
 
 	jtnode = (FromExpr *)(parse->jointree);
 	if (jtnode == NULL || !IsA(jtnode, FromExpr))
-		return NULL;
-
-	
-	parent_rte = lfirst_node(RangeTblEntry, list_head(parse->rtable));
-	if (parent_rte->rtekind != RTE_RELATION)
-		return NULL;
+		return InvalidOid;
 
-	parent_rel = heap_open(parent_rte->relid, AccessShareLock);
-	parent_relname = RelationGetRelationName(parent_rel);
-	parent_schemaname = get_namespace_name(RelationGetNamespace(parent_rel));
-	heap_close(parent_rel, AccessShareLock);   
-
-	if (!read_table_partition_rule_params(parent_schemaname, parent_relname, NULL, NULL))
-		return NULL;
-
-	prel = get_pathman_relation_info(parent_rte->relid);
-	if (prel == NULL)
-		return NULL;
-
-	children = PrelGetChildrenArray(prel);
-	
 	qual_expr = ((jtnode))->quals;
 	if (qual_expr == NULL)
-		return NULL;
+		return InvalidOid;
 
-	qual_expr = eval_const_expressions(NULL, qual_expr);
+	/* Bound parameters are folded into constants here */
+	qual_expr = eval_const_expressions(root, qual_expr);
 	qual_expr = (Node *) canonicalize_qual((Expr *) qual_expr
 #if PG_VERSION_NUM >= 110000
 											,false
@@ -2312,11 +2431,6 @@ List* pg_plan_queries_hook(List *querytrees, int cursorOptions,
 	ranges = list_make1_irange_full(prel, IR_COMPLETE);
 
 	part_expr = PrelExpressionForRelid(prel, 1);
-	/*
- 	 * part_clauses = get_partitioning_clauses(quals, prel, 1);
-	if (clause_contains_params((Node *) part_clauses))
-		return NULL;
-	TBD LATER */
 
 	/* Make wrappers over restrictions and collect final rangeset */
 	InitWalkerContext(&context, part_expr, prel, NULL);
@@ -2332,26 +2446,216 @@ List* pg_plan_queries_hook(List *querytrees, int cursorOptions,
 	}
 
 	if (irange_list_length(ranges) != 1)
-		return NULL;
+		return InvalidOid;
 
 	irange = lfirst_irange(list_head(ranges));
 	if (irange_lower(irange) != irange_upper(irange))
+		return InvalidOid;
+
+	return PrelGetChildrenArray(prel)[irange_lower(irange)];
+}
+
+/*
+ * Find the partition of a single-row INSERT ... VALUES,
+ * return InvalidOid if it's not known yet.
+ */
+static Oid
+fast_path_insert_partition(PlannerInfo *root, Query *parse,
+						   const PartRelationInfo *prel)
+{
+	Node		   *value;
+	Const		   *value_const;
+	Oid			   *parts;
+	int				nparts;
+
+	/*
+	 * The rewriter has added local column defaults to the target list,
+	 * don't let the remote server compute nextval() & friends again.
+	 */
+	if (contain_volatile_functions((Node *) parse->targetList))
+		return InvalidOid;
+
+	/* Compute the partitioning expression from the inserted values */
+	value = ReplaceVarsFromTargetList(PrelExpressionForRelid(prel, parse->resultRelation),
+									  parse->resultRelation, 0,
+									  rt_fetch(parse->resultRelation, parse->rtable),
+									  parse->targetList,
+									  REPLACEVARS_SUBSTITUTE_NULL, 0,
+									  NULL);
+	value = eval_const_expressions(root, value);
+
+	if (!IsA(value, Const))
+		return InvalidOid;
+
+	value_const = (Const *) value;
+	if (value_const->constisnull)
+		return InvalidOid;
+
+	/* Let PartitionFilter create missing partitions */
+	parts = find_partitions_for_value(value_const->constvalue,
+									  value_const->consttype,
+									  prel, &nparts);
+	if (nparts != 1)
+		return InvalidOid;
+
+	return parts[0];
+}
+
+/*
+ * Can the statement be sent to the partition as is?  Everything the
+ * remote server is going to evaluate must pass the same checks as the
+ * quals pushed down by the FDW.
+ */
+static bool
+fast_path_is_shippable(PlannerInfo *root, Query *parse, Oid child_oid)
+{
+	List	   *exprs = NIL;
+	ListCell   *lc;
+
+	foreach(lc, parse->targetList)
+		exprs = lappend(exprs, ((TargetEntry *) lfirst(lc))->expr);
+
+	foreach(lc, parse->returningList)
+		exprs = lappend(exprs, ((TargetEntry *) lfirst(lc))->expr);
+
+	if (parse->jointree && parse->jointree->quals)
+		exprs = lappend(exprs, parse->jointree->quals);
+
+	if (parse->havingQual)
+		exprs = lappend(exprs, parse->havingQual);
+
+	return GoguExprsAreShippable(root, 1, child_oid, exprs);
+}
+
+/*
+ * Lock taken on the partition by a fast-path statement, the same one
+ * the executor would take.
+ */
+static LOCKMODE
+fast_path_lockmode(CmdType command)
+{
+	return command == CMD_SELECT ? AccessShareLock : RowExclusiveLock;
+}
+
+/*
+ * Single-partition fast path: SELECT, UPDATE and DELETE whose quals pick
+ * exactly one remote partition, and single-row INSERT ... VALUES, are
+ * sent to the owning server as is (see PortalRun_hook), bypassing the
+ * planner and the executor.
+ */
+List* pg_plan_queries_hook(List *querytrees, int cursorOptions,
+							ParamListInfo boundParams)
+{
+	Query			*parse;
+	RangeTblEntry	*parent_rte;
+	Relation 		parent_rel;
+	char 			*parent_relname,
+					*parent_schemaname; 
+	const PartRelationInfo *prel;
+	Oid				parent_oid,
+					child_oid;
+	PlannerGlobal	*glob;
+	PlannerInfo		*root;
+	PlannedStmt		*plan_stmt;
+	List			*tlist;
+
+	if (!IsPathmanReady() || (list_length(querytrees)>1))
+		return NULL;
+
+	parse = lfirst_node(Query, list_head(querytrees)); 
+
+	if (!(parse->rtable && (list_length(parse->rtable)==1) &&
+		  !(parse->hasSubLinks) && parse->cteList == NIL))
+		return NULL;
+
+	switch (parse->commandType)
+	{
+		case CMD_SELECT:
+			break;
+
+		case CMD_INSERT:
+		case CMD_UPDATE:
+		case CMD_DELETE:
+			/* Let the executor complain about read-only transactions */
+			if (parse->resultRelation != 1 || parse->onConflict || XactReadOnly)
+				return NULL;
+			break;
+
+		default:
+			return NULL;
+	}
+
+	parent_rte = lfirst_node(RangeTblEntry, list_head(parse->rtable));
+	if (parent_rte->rtekind != RTE_RELATION || parent_rte->securityQuals != NIL)
+		return NULL;
+
+	parent_rel = heap_open(parent_rte->relid, AccessShareLock);
+	parent_relname = RelationGetRelationName(parent_rel);
+	parent_schemaname = get_namespace_name(RelationGetNamespace(parent_rel));
+	heap_close(parent_rel, AccessShareLock);   
+
+	if (!read_table_partition_rule_params(parent_schemaname, parent_relname, NULL, NULL))
+		return NULL;
+
+	/* The planner hook is bypassed, so complain about the key here */
+	if (parse->commandType == CMD_UPDATE)
+		handle_updatestmt(parse);
+
+	prel = get_pathman_relation_info(parent_rte->relid);
+	if (prel == NULL)
+		return NULL;
+
+	/* Values of bound parameters are known, use them for pruning */
+	glob = makeNode(PlannerGlobal);
+	glob->boundParams = boundParams;
+	root = makeNode(PlannerInfo);
+	root->parse = parse;
+	root->glob = glob;
+
+	if (parse->commandType == CMD_INSERT)
+		child_oid = fast_path_insert_partition(root, parse, prel);
+	else
+		child_oid = fast_path_scan_partition(root, parse, prel);
+
+	if (!OidIsValid(child_oid) ||
+		get_rel_relkind(child_oid) != RELKIND_FOREIGN_TABLE)
+		return NULL;
+
+	if (!fast_path_is_shippable(root, parse, child_oid))
 		return NULL;
 
-	child_oid = children[irange_lower(irange)];
+	/* The executor won't see the parent, check permissions now */
+	ExecCheckRTPerms(parse->rtable, true);
+
+	/* The executor won't lock the partition either */
+	LockRelationOid(child_oid, fast_path_lockmode(parse->commandType));
+
+	parent_oid = parent_rte->relid;
 	parent_rte->relid = child_oid;
 	parent_rte->rtekind |= CMD_SPECIAL_BIT;
+
+	/* Rows to be sent to the client */
+	tlist = (parse->commandType == CMD_SELECT) ?
+				parse->targetList :
+				parse->returningList;
 	
 	plan_stmt = makeNode(PlannedStmt);
-	plan_stmt->commandType = CMD_SELECT;
+	plan_stmt->commandType = parse->commandType;
 	plan_stmt->queryId = parse->queryId;
+	plan_stmt->hasReturning = (parse->returningList != NIL);
 	plan_stmt->dependsOnRole = false;
-	plan_stmt->planTree = (Plan*)make_foreignscan(parse->targetList, NULL, child_oid, NULL,
+	plan_stmt->planTree = (Plan*)make_foreignscan(tlist, NULL, child_oid, NULL,
 												NULL, NULL, NULL, NULL);
 	plan_stmt->rtable = parse->rtable;
 	plan_stmt->resultRelations = NULL;
 	plan_stmt->subplans = NULL;
 	plan_stmt->canSetTag = true;
+	/* Let cached plans be invalidated by changes of both tables */
+	plan_stmt->relationOids = list_make2_oid(parent_oid, child_oid);
+#if PG_VERSION_NUM >= 100000
+	plan_stmt->stmt_location = parse->stmt_location;
+	plan_stmt->stmt_len = parse->stmt_len;
+#endif
 	return list_make1(plan_stmt);
 }
 
@@ -2370,17 +2674,26 @@ bool PortalStart_hook(Portal portal, ParamListInfo params,
 
 	plan = lfirst_node(PlannedStmt, list_head(portal->stmts)); 
 	
-	if (plan->commandType != CMD_SELECT)
-		return false;
-
 	if (plan->rtable == NIL)
 		return false;
 
 	rte = lfirst_node(RangeTblEntry, list_head(plan->rtable));
 	if (!is_cmd_special(rte->rtekind))
 		return false;
+
+	/* A cached plan is reused without calling pg_plan_queries_hook() */
+	LockRelationOid(rte->relid, fast_path_lockmode(plan->commandType));
  
-	portal->tupDesc = ExecTypeFromTL(plan->planTree->targetlist, false);
+	if (plan->commandType == CMD_SELECT || plan->hasReturning)
+		portal->tupDesc = ExecTypeFromTL(plan->planTree->targetlist, false);
+	else
+		portal->tupDesc = NULL;
+
+	if (plan->commandType != CMD_SELECT)
+		portal->strategy = plan->hasReturning ?
+							PORTAL_ONE_RETURNING :
+							PORTAL_MULTI_QUERY;
+
 	portal->atStart = true;
 	portal->atEnd = false;  /* allow fetches */
 	portal->portalPos = 0;
@@ -2388,6 +2701,184 @@ bool PortalStart_hook(Portal portal, ParamListInfo params,
 	return true;
 }
 
+/*
+ * Skip a possibly qualified and quoted relation name.
+ */
+static const char *
+skip_qualified_name(const char *p)
+{
+	const char *next;
+
+	for (;;)
+	{
+		if (*p == '"')
+		{
+			/* "" inside a quoted identifier stands for a quote */
+			for (p++; *p; p++)
+			{
+				if (*p != '"')
+					continue;
+
+				if (p[1] != '"')
+				{
+					p++;
+					break;
+				}
+				p++;
+			}
+		}
+		else
+		{
+			while (*p && (IS_HIGHBIT_SET(*p) || isalnum((unsigned char) *p) ||
+						  *p == '_' || *p == '$'))
+				p++;
+		}
+
+		next = p;
+		while (isspace((unsigned char) *next))
+			next++;
+
+		if (*next != '.')
+			return p;
+
+		for (p = next + 1; isspace((unsigned char) *p); p++)
+			;
+	}
+}
+
+/*
+ * Build the remote statement: the client's one, with the parent table
+ * replaced by the remote table of the partition.  The parent's name is
+ * kept as an alias, so that qualified column references remain valid.
+ */
+static char *
+build_fast_path_sql(Portal portal, PlannedStmt *plan,
+					const char *child_schename, const char *child_relname)
+{
+	const char		*sql = portal->sourceText;
+	int				sql_len = strlen(sql);
+	List			*raw_parsetree_list;
+	Node			*stmt;
+	RangeVar		*rv = NULL;
+	const char		*name_end;
+	StringInfoData	remote_sql;
+
+#if PG_VERSION_NUM >= 100000
+	/* Source text may contain several statements */
+	if (plan->stmt_location >= 0)
+	{
+		sql += plan->stmt_location;
+		sql_len = (plan->stmt_len > 0) ?
+					plan->stmt_len :
+					(int) strlen(sql);
+	}
+#endif
+	sql = pnstrdup(sql, sql_len);
+
+	raw_parsetree_list = raw_parser(sql);
+	if (list_length(raw_parsetree_list) != 1)
+		elog(ERROR, "cannot find the statement to be sent in \"%s\"", sql);
+
+#if PG_VERSION_NUM >= 100000
+	stmt = linitial_node(RawStmt, raw_parsetree_list)->stmt;
+#else
+	stmt = (Node *) linitial(raw_parsetree_list);
+#endif
+
+	switch (nodeTag(stmt))
+	{
+		case T_SelectStmt:
+			{
+				List *from = ((SelectStmt *) stmt)->fromClause;
+
+				if (list_length(from) == 1 && IsA(linitial(from), RangeVar))
+					rv = (RangeVar *) linitial(from);
+			}
+			break;
+
+		case T_InsertStmt:
+			rv = ((InsertStmt *) stmt)->relation;
+			break;
+
+		case T_UpdateStmt:
+			rv = ((UpdateStmt *) stmt)->relation;
+			break;
+
+		case T_DeleteStmt:
+			rv = ((DeleteStmt *) stmt)->relation;
+			break;
+
+		default:
+			break;
+	}
+
+	if (rv == NULL || rv->location < 0)
+		elog(ERROR, "cannot find the partitioned table in \"%s\"", sql);
+
+	name_end = skip_qualified_name(sql + rv->location);
+
+	initStringInfo(&remote_sql);
+	appendBinaryStringInfo(&remote_sql, sql, rv->location);
+	appendStringInfo(&remote_sql, "%s.%s",
+					 quote_identifier(child_schename),
+					 quote_identifier(child_relname));
+	if (rv->alias == NULL)
+		appendStringInfo(&remote_sql, " AS %s", quote_identifier(rv->relname));
+	appendStringInfoString(&remote_sql, name_end);
+
+	return remote_sql.data;
+}
+
+/*
+ * Convert bound parameters of the portal to text.
+ */
+static void
+fast_path_params(ParamListInfo params, int *nparams,
+				 Oid **types, const char ***values)
+{
+	int		i;
+
+	*nparams = params ? params->numParams : 0;
+	*types = NULL;
+	*values = NULL;
+
+	if (*nparams == 0)
+		return;
+
+	*types = (Oid *) palloc0(sizeof(Oid) * (*nparams));
+	*values = (const char **) palloc0(sizeof(char *) * (*nparams));
+
+	for (i = 0; i < *nparams; i++)
+	{
+		ParamExternData *prm;
+#if PG_VERSION_NUM >= 110000
+		ParamExternData	prmdata;
+
+		if (params->paramFetch != NULL)
+			prm = params->paramFetch(params, i + 1, false, &prmdata);
+		else
+			prm = &params->params[i];
+#else
+		prm = &params->params[i];
+		if (!OidIsValid(prm->ptype) && params->paramFetch != NULL)
+			params->paramFetch(params, i + 1);
+#endif
+
+		/* Remote server may have different oids for non built-in types */
+		if (prm->ptype < FirstBootstrapObjectId)
+			(*types)[i] = prm->ptype;
+
+		if (!prm->isnull && OidIsValid(prm->ptype))
+		{
+			Oid		typoutput;
+			bool	typisvarlena;
+
+			getTypeOutputInfo(prm->ptype, &typoutput, &typisvarlena);
+			(*values)[i] = OidOutputFunctionCall(typoutput, prm->value);
+		}
+	}
+}
+
 bool PortalRun_hook(Portal portal, long count, bool isTopLevel,
 #if PG_VERSION_NUM >= 100000
 					bool run_once,
@@ -2397,24 +2888,34 @@ bool PortalRun_hook(Portal portal, long count, bool isTopLevel,
 {
 	const char		*child_relname = NULL;
 	const char		*child_schename = NULL;
-	const char 		*sql = NULL;
-	char			*index;
-	StringInfoData	remote_sql;
+	char			*remote_sql;
 	Oid				userid;
 	UserMapping 	*user;
 	PGconn			*conn;
 	PGresult		*cur_res;
 
-	ForeignTable 	*ftable;
+	GoguTableOptions *options;
+	Oid				serverid;
 	PlannedStmt		*plan;
 	RangeTblEntry	*rte;
 	HeapTuple       tuple; 
 	TupleDesc       tupdesc;
-	char			**values;
-	AttInMetadata 	*attinmeta;
-	TupleTableSlot	*slot;
+	char			**values = NULL;
+	AttInMetadata 	*attinmeta = NULL;
+	TupleTableSlot	*slot = NULL;
+	bool			send_tuples;
+	bool			can_retry;
+	bool			resend;
+	bool			done = false;
+	uint64			nprocessed = 0;
+	uint64			nreceived = 0,
+					bytes_in = 0;
+	instr_time		sent_at;
+	double			latency;
+	int				nparams;
+	Oid				*param_types;
+	const char		**param_values;
 	int				i;
-	ListCell	   	*lc;
 
 	if (!portal->stmts)
 		return false;
@@ -2424,110 +2925,217 @@ bool PortalRun_hook(Portal portal, long count, bool isTopLevel,
 	if (plan->rtable == NIL)
 		return false;
 
-	if (plan->commandType != CMD_SELECT)
-		return false;
-
 	rte = lfirst_node(RangeTblEntry, list_head(plan->rtable));
 	if (!is_cmd_special(rte->rtekind))
 		return false;
 
 	portal->status = PORTAL_ACTIVE;
-	slot = MakeTupleTableSlot(
+
+	/* Same as the executor: only SELECT and RETURNING produce rows */
+	send_tuples = (plan->commandType == CMD_SELECT || plan->hasReturning);
+	tupdesc = portal->tupDesc;
+	if (send_tuples)
+	{
+		slot = MakeTupleTableSlot(
 #if PG_VERSION_NUM >= 110000
-							  NULL
+								  NULL
 #endif	
-							  );
-	tupdesc = portal->tupDesc;
-	ExecSetSlotDescriptor(slot, tupdesc);
-	(*dest->rStartup) (dest, CMD_SELECT, tupdesc);
-	ftable = GetForeignTable(rte->relid);
-	if (ftable == NULL) {
-		elog( ERROR, "FATAL when handle %s", portal->sourceText);
-		return false;
+								  );
+		ExecSetSlotDescriptor(slot, tupdesc);
+		(*dest->rStartup) (dest, plan->commandType, tupdesc);
 	}
 
-	foreach(lc, ftable->options)
-	{
-		DefElem    *def = (DefElem *) lfirst(lc);
+	/* Same cached options as the planner used */
+	options = GoguGetTableOptions(rte->relid);
+	GoguGetRemoteTableName(rte->relid, &child_schename, &child_relname);
 
-		if (strcmp(def->defname, "schema_name") == 0)
-			child_schename = defGetString(def);
-		else if (strcmp(def->defname, "table_name") == 0)
-			child_relname = defGetString(def);
-	}
+	remote_sql = build_fast_path_sql(portal, plan, child_schename, child_relname);
+	fast_path_params(portal->portalParams, &nparams, &param_types, &param_values);
 
-	if (child_relname == NULL) {
-		elog( ERROR, "Failed to get table_name option for %d", rte->relid);
-		return false;
-	}
+	/* Modifications must commit or abort together with our transaction */
+	userid = rte->checkAsUser ? rte->checkAsUser : GetUserId();
+	serverid = options->server->serverid;
+	if (plan->commandType == CMD_SELECT)
+		serverid = replica_route_server(serverid, userid);
+
+	if (serverid == options->server->serverid)
+		user = GoguGetTableUserMapping(options, userid);
+	else
+		user = GetUserMapping(userid, serverid);
 
-	if (child_schename == NULL)
-		child_schename = "public";
+	/* SELECT can be resent if the server was lost before any rows came */
+	can_retry = (plan->commandType == CMD_SELECT);
 
-	// OK, to replace the table name, later use get_query_def instead
-	sql = portal->sourceText;
-	index = strstr(sql, rte->eref->aliasname);
-	initStringInfo(&remote_sql);
-	appendBinaryStringInfo(&remote_sql, sql, index-sql);
-	appendStringInfo(&remote_sql, " %s.%s ", child_schename, child_relname);
-	index += strlen(rte->eref->aliasname);
-	appendBinaryStringInfo(&remote_sql, index, sql+strlen(sql)-index);
+retry:
+	resend = false;
+	conn = GoguGetConnection(user, false, plan->commandType != CMD_SELECT);
+	if (!PQsendQueryParams(conn, remote_sql, nparams, param_types,
+						   param_values, NULL, NULL, 0)) {
+		if (can_retry && GoguDiscardBrokenConnection(conn))
+		{
+			can_retry = false;
+			goto retry;
+		}
 
-	userid = rte->checkAsUser ? rte->checkAsUser : GetUserId();
-	user = GetUserMapping(userid, ftable->serverid);
-	conn = GoguGetConnection(user, false, false);
-	if (!PQsendQuery(conn, remote_sql.data)) {
-		elog(ERROR, "Failed to run SQL %s", remote_sql.data);
+		Gogu_pgfdw_report_error(ERROR, NULL, conn, false, remote_sql);
 		return false;
 	}
 
-	if (!PQsetSingleRowMode(conn)) {
-		elog(ERROR, "Failed to set single row mode for %s", remote_sql.data);
+	INSTR_TIME_SET_CURRENT(sent_at);
+	latency = -1;
+
+	if (send_tuples && !PQsetSingleRowMode(conn)) {
+		elog(ERROR, "Failed to set single row mode for %s", remote_sql);
 		return false;
 	}
 
-	attinmeta = TupleDescGetAttInMetadata(tupdesc);
-	values = (char**) palloc0(tupdesc->natts * sizeof(char*));
+	if (send_tuples)
+	{
+		attinmeta = TupleDescGetAttInMetadata(tupdesc);
+		values = (char**) palloc0(tupdesc->natts * sizeof(char*));
+	}
 
-	for(; ;) {
-		CHECK_FOR_INTERRUPTS();
-		cur_res = PQgetResult(conn);
-		if (PQresultStatus(cur_res) == PGRES_TUPLES_OK)
-		{
-			PQclear(cur_res);
-			do {
-					cur_res = PQgetResult(conn);
-			} while (cur_res != NULL);
+	/* Don't leave the connection busy if we fail half way */
+	PG_TRY();
+	{
+		for(; ;) {
+			CHECK_FOR_INTERRUPTS();
+			cur_res = PQgetResult(conn);
 
-			break;
-		}
+			/* Latency of the statement is the wait for its first result */
+			if (latency < 0)
+			{
+				instr_time	now;
 
-		if (PQresultStatus(cur_res) != PGRES_SINGLE_TUPLE)
-		{
-			elog(ERROR, "Failed to fetch row for %s", remote_sql.data);
-			return false;
+				INSTR_TIME_SET_CURRENT(now);
+				INSTR_TIME_SUBTRACT(now, sent_at);
+				latency = INSTR_TIME_GET_MILLISEC(now);
+			}
+
+			if (PQresultStatus(cur_res) == PGRES_TUPLES_OK ||
+				PQresultStatus(cur_res) == PGRES_COMMAND_OK)
+			{
+				/* Remote server knows how many rows were modified */
+				if (plan->commandType != CMD_SELECT)
+					nprocessed = strtoul(PQcmdTuples(cur_res), NULL, 10);
+
+				PQclear(cur_res);
+				do {
+						cur_res = PQgetResult(conn);
+						PQclear(cur_res);
+				} while (cur_res != NULL);
+
+				break;
+			}
+
+			if (PQresultStatus(cur_res) != PGRES_SINGLE_TUPLE)
+			{
+				if (can_retry && nprocessed == 0 &&
+					GoguDiscardBrokenConnection(conn))
+				{
+					elog(DEBUG1, "connection lost, resending %s", remote_sql);
+					PQclear(cur_res);
+					resend = true;
+					break;
+				}
+
+				Gogu_pgfdw_report_error(ERROR, cur_res, conn, true, remote_sql);
+			}
+
+			nreceived++;
+			for (i = 0; i < PQnfields(cur_res); i++)
+				bytes_in += PQgetlength(cur_res, 0, i);
+
+			/* Receiver doesn't want more rows, but we must read them anyway */
+			if (!done)
+			{
+				memset(values, 0, tupdesc->natts * sizeof(char*));
+
+				for (i=0; i < tupdesc->natts; i++) 
+				{
+					if (PQgetisnull(cur_res, 0, i))
+						values[i] = NULL;
+					else
+						values[i] = PQgetvalue(cur_res, 0, i);	
+				}
+
+				tuple = BuildTupleFromCStrings(attinmeta, values);
+				ExecStoreTuple(tuple, slot, InvalidBuffer, true);
+
+				if (plan->commandType == CMD_SELECT)
+					nprocessed++;
+
+				if (!((*dest->receiveSlot) (slot, dest)))
+					done = true;
+			}
+
+			PQclear(cur_res);
 		}
+	}
+	PG_CATCH();
+	{
+		GoguAbandonQuery(conn);
+		PG_RE_THROW();
+	}
+	PG_END_TRY();
 
-		memset(values, 0, tupdesc->natts * sizeof(char*));
+	if (resend)
+	{
+		can_retry = false;
+		goto retry;
+	}
 
-		for (i=0; i < tupdesc->natts; i++) 
+	{
+		StatRemoteEntry *stats = stat_remote_entry(user->serverid);
+		instr_time		now;
+
+		stat_remote_count(stats, STAT_REMOTE_QUERIES, 1);
+		stat_remote_latency(stats, latency);
+		stat_remote_count(stats, STAT_REMOTE_ROWS, nreceived);
+		stat_remote_count(stats, STAT_REMOTE_BYTES_IN, bytes_in);
+		stat_remote_count(stats, STAT_REMOTE_BYTES_OUT, strlen(remote_sql));
+
+		/* Rows are streamed to the client, so log the whole wait */
+		INSTR_TIME_SET_CURRENT(now);
+		INSTR_TIME_SUBTRACT(now, sent_at);
+		remote_log_statement(user->serverid, remote_sql, nprocessed,
+							 INSTR_TIME_GET_MILLISEC(now));
+	}
+
+	GoguReleaseConnection(conn);
+
+	if (send_tuples)
+		(*dest->rShutdown) (dest);
+
+	if (completionTag)
+	{
+		switch (plan->commandType)
 		{
-			if (PQgetisnull(cur_res, 0, i))
-				values[i] = NULL;
-			else
-				values[i] = PQgetvalue(cur_res, 0, i);	
-		}
+			case CMD_SELECT:
+				snprintf(completionTag, COMPLETION_TAG_BUFSIZE,
+						 "SELECT " UINT64_FORMAT, nprocessed);
+				break;
 
-		tuple = BuildTupleFromCStrings(attinmeta, values);
-		ExecStoreTuple(tuple, slot, InvalidBuffer, false);
+			case CMD_INSERT:
+				snprintf(completionTag, COMPLETION_TAG_BUFSIZE,
+						 "INSERT %u " UINT64_FORMAT, InvalidOid, nprocessed);
+				break;
 
-		if (!((*dest->receiveSlot) (slot, dest)))
-			break;
+			case CMD_UPDATE:
+				snprintf(completionTag, COMPLETION_TAG_BUFSIZE,
+						 "UPDATE " UINT64_FORMAT, nprocessed);
+				break;
+
+			case CMD_DELETE:
+				snprintf(completionTag, COMPLETION_TAG_BUFSIZE,
+						 "DELETE " UINT64_FORMAT, nprocessed);
+				break;
 
+			default:
+				break;
+		}
 	}
 
-	GoguReleaseConnection(conn);
-	(*dest->rShutdown) (dest);
 	portal->status = PORTAL_READY;
 	return true;
 }
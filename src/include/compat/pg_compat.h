@@ -338,6 +338,19 @@ static inline void mult_result_handler() { elog(ERROR, ERR_PART_ATTR_MULTIPLE_RE
 #endif
 
 
+/*
+ * ExplainPropertyFloat(), ExplainPropertyInteger()
+ * NOTE: 'unit' is shown since 11 only.
+ */
+#if PG_VERSION_NUM >= 110000
+#define ExplainPropertyFloatCompat(qlabel, unit, value, ndigits, es) 		ExplainPropertyFloat((qlabel), (unit), (value), (ndigits), (es))
+#define ExplainPropertyInt64Compat(qlabel, unit, value, es) 		ExplainPropertyInteger((qlabel), (unit), (value), (es))
+#else
+#define ExplainPropertyFloatCompat(qlabel, unit, value, ndigits, es) 		ExplainPropertyFloat((qlabel), (value), (ndigits), (es))
+#define ExplainPropertyInt64Compat(qlabel, unit, value, es) 		ExplainPropertyLong((qlabel), (long) (value), (es))
+#endif
+
+
 /*
  * get_all_actual_clauses()
  */
@@ -580,6 +593,17 @@ extern void set_rel_consider_parallel(PlannerInfo *root,
 #endif
 
 
+/*
+ * TupleDescAttr()
+ *
+ * older minor releases don't have it
+ */
+#if PG_VERSION_NUM < 110000 && !defined(TupleDescAttr)
+#define TupleDescAttr(tupdesc, i) \
+		((tupdesc)->attrs[(i)])
+#endif
+
+
 /*
  * convert_tuples_by_name_map()
  */
@@ -3,15 +3,124 @@
 
 #include "catalog/pg_user_mapping.h"
 #include "foreign/foreign.h"
+#include "lib/stringinfo.h"
+#include "nodes/relation.h"
 #include "libpq-fe.h"
+
+typedef struct GoguFanout GoguFanout;
+
+/*
+ * Rows of a remote SELECT streamed with "COPY (...) TO STDOUT" in text
+ * format (see GoguCopyStreamNext).
+ */
+typedef struct GoguCopyStream
+{
+	PGconn	   *conn;
+	char	   *sql;			/* COPY statement */
+	bool		started;		/* has the server started sending rows? */
+	bool		done;			/* have all rows been received? */
+	StringInfoData row;			/* current row, unescaped in place */
+	char	  **fields;			/* fields of current row, NULL if null */
+	int			maxfields;		/* allocated length of 'fields' */
+	int64		bytes;			/* bytes of data received */
+	int64		rows;			/* rows received */
+	List	   *parked;			/* rows read ahead to free the connection */
+	MemoryContext mcxt;			/* context of parked rows */
+} GoguCopyStream;
+
+/*
+ * Unread rows beyond which ending a COPY stream early cancels the remote
+ * query rather than reading the rows to the end.
+ */
+#define COPY_STREAM_DRAIN_ROWS		1000
+
+/* Default CPU cost to start up a foreign query. */
+#define DEFAULT_FDW_STARTUP_COST	100.0
+
+/* Default CPU cost to process 1 row (above and beyond cpu_tuple_cost). */
+#define DEFAULT_FDW_TUPLE_COST		0.01
+
+/* Default number of rows fetched by a remote cursor at a time */
+#define DEFAULT_FDW_FETCH_SIZE		100
+
+/*
+ * Catalog info and parsed FDW options of a foreign table, cached per backend
+ * (see GoguGetTableOptions).  Everything here is read-only for callers.
+ */
+typedef struct GoguTableOptions
+{
+	Oid			relid;			/* OID of foreign table (hash key) */
+	bool		cached;			/* entry belongs to the cache */
+
+	ForeignTable *table;
+	ForeignServer *server;
+
+	/* Options of the server, overridden by those of the table */
+	bool		use_remote_estimate;
+	Cost		fdw_startup_cost;
+	Cost		fdw_tuple_cost;
+	List	   *shippable_extensions;	/* OIDs of whitelisted extensions */
+	int			fetch_size;
+
+	/* Remote name, NULL if it's the same as the local one */
+	char	   *remote_schema;
+	char	   *remote_table;
+
+	/* User mapping of the last user which asked for it */
+	Oid			user_oid;
+	UserMapping *user;
+} GoguTableOptions;
+
+/* Max number of servers tracked by the circuit breaker */
+#define SERVER_HEALTH_SLOTS 256
+
+extern int gogudb_remote_concurrency;
+extern int gogudb_remote_keepalives_idle;
+extern int gogudb_remote_keepalives_interval;
+extern int gogudb_remote_keepalives_count;
+extern int gogudb_server_failure_threshold;
+extern int gogudb_server_down_time;
+extern int gogudb_copy_scan_threshold;
+
 /* in connection_pool.c */
 extern PGconn *GoguGetConnection(UserMapping *user, bool will_prep_stmt, bool in_axct);
 extern void GoguReleaseConnection(PGconn *conn);
 extern unsigned int GoguGetCursorNumber(PGconn *conn);
 extern unsigned int GoguGetPrepStmtNumber(PGconn *conn);
 extern PGresult *Gogu_pgfdw_get_result(PGconn *conn, const char *query);
+extern void Gogu_pgfdw_get_results(PGconn *conn, const char *query,
+								   PGresult **results, int nresults);
 extern PGresult *Gogu_pgfdw_exec_query(PGconn *conn, const char *query);
+extern PGresult *Gogu_pgfdw_exec_cursor_query(PGconn *conn, const char *query);
+extern PGresult *Gogu_pgfdw_get_cursor_result(PGconn *conn, const char *query);
 extern void Gogu_pgfdw_report_error(int elevel, PGresult *res, PGconn *conn,
                                    bool clear, const char *sql);
 extern void connectionPoolRunSQL(UserMapping *user,const char *query, bool inXact);
+extern PGconn *GoguOpenConnection(UserMapping *user, bool replication);
+extern void GoguCloseConnection(PGconn *conn);
+extern void GoguRunCommand(PGconn *conn, const char *sql);
+extern char *GoguBuildConnInfo(UserMapping *user);
+extern PGresult **GoguExecParallel(UserMapping **users, const char **queries,
+								   int nqueries, PGconn **conns,
+								   bool inXact);
+extern void init_connection_static_data(void);
+extern GoguFanout *GoguFanoutCreate(bool inXact);
+extern void GoguFanoutAdd(GoguFanout *fanout, UserMapping *user, const char *sql);
+extern void GoguFanoutRun(GoguFanout *fanout);
+extern bool GoguDiscardBrokenConnection(PGconn *conn);
+extern void GoguAbandonQuery(PGconn *conn);
+extern Size estimate_server_health_size(void);
+extern void init_server_health_state(void);
+extern bool GoguServerIsDown(Oid serverid);
+extern void GoguCopyStreamBegin(GoguCopyStream *stream, PGconn *conn,
+								const char *query);
+extern int GoguCopyStreamNext(GoguCopyStream *stream);
+extern void GoguCopyStreamEnd(GoguCopyStream *stream, double rows);
+extern bool GoguCopyStreamAllowed(PGconn *conn);
+extern GoguTableOptions *GoguGetTableOptions(Oid relid);
+extern void GoguGetRemoteTableName(Oid relid, const char **nspname,
+								   const char **relname);
+extern UserMapping *GoguGetTableUserMapping(GoguTableOptions *options, Oid userid);
+extern bool GoguExprsAreShippable(PlannerInfo *root, Index relid,
+								  Oid foreigntableid, List *exprs);
 #endif
@@ -53,6 +53,9 @@ void pathman_shmem_startup_hook(void);
 
 void pathman_relcache_hook(Datum arg, Oid relid);
 
+/* Partition which may be dropped or detached despite its table's rule */
+void allow_rule_partition_removal(Oid relid);
+
 #if PG_VERSION_NUM >= 100000
 void pathman_process_utility_hook(PlannedStmt *pstmt,
 								  const char *queryString,
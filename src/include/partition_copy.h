@@ -0,0 +1,29 @@
+/*-------------------------------------------------------------------------
+ *
+ * partition_copy.h
+ *		Relocation of rows to remote partitions via COPY
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#ifndef PARTITION_COPY_H
+#define PARTITION_COPY_H
+
+
+#include "postgres.h"
+#include "storage/itemptr.h"
+
+
+/*
+ * Move the given rows of the parent to their partitions
+ * (caller must be connected to SPI).
+ */
+int64 partition_copy_batch(Oid relid, ItemPointer tids, int ntids);
+
+/*
+ * Move rows between foreign partitions without fetching them.
+ */
+bool partition_copy_remote_rows(Oid source, Oid target, const char *condition);
+
+
+#endif /* PARTITION_COPY_H */
@@ -61,6 +61,13 @@ Oid create_single_fdw_hash_partition_internal(Oid parent_relid,
 										  char *tablespace,
 										  char *remote_schema);
 
+/* Create all fdw HASH partitions */
+void create_fdw_hash_partitions_internal(Oid parent_relid,
+										 uint32 part_count,
+										 RangeVar **rangevars,
+										 char **tablespaces,
+										 char *remote_schema);
+
 
 /* RANGE constraints */
 Constraint * build_range_check_constraint(Oid child_relid,
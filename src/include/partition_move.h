@@ -0,0 +1,160 @@
+/*-------------------------------------------------------------------------
+ *
+ * partition_move.h
+ *		Online relocation of a remote partition to another foreign server
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#ifndef PARTITION_MOVE_H
+#define PARTITION_MOVE_H
+
+
+#include "postgres.h"
+#include "pathman_workers.h"
+#include "storage/spin.h"
+
+
+/*
+ * Status of PartitionMoveWorker, stored in WorkerSlot's 'worker_status'.
+ */
+typedef enum
+{
+	PMS_FREE = 0,		/* slot is empty, same as WS_FREE */
+	PMS_PREPARING,		/* worker is resolving the partition */
+	PMS_COPYING,		/* initial COPY into the target server */
+	PMS_CATCHING_UP,	/* subscription replays concurrent changes */
+	PMS_SWITCHING,		/* partition is locked, waiting to flip server */
+	PMS_CLEANUP			/* dropping replication objects */
+
+} PartitionMoveSlotStatus;
+
+/*
+ * Store args and execution status of a single PartitionMoveWorker.
+ */
+typedef struct
+{
+	WorkerSlot	head;		/* status, database and foreign table to be moved */
+
+	Oid		target_server;	/* foreign server to move the data to */
+	NameData target_name;	/* name of target server, for the view */
+	int32	max_rate;		/* COPY bandwidth limit in kB/s, 0 = none */
+	int64	bytes_copied;	/* amount of COPY data streamed so far */
+} PartitionMoveSlot;
+
+#define InitPartitionMoveSlot(slot, server, rate) \
+	do { \
+		(slot)->target_server = (server); \
+		(slot)->max_rate = (rate); \
+		(slot)->bytes_copied = 0; \
+	} while (0)
+
+static inline PartitionMoveSlotStatus
+pms_check_status(PartitionMoveSlot *slot)
+{
+	PartitionMoveSlotStatus status;
+
+	SpinLockAcquire(&slot->head.mutex);
+	status = (PartitionMoveSlotStatus) slot->head.worker_status;
+	SpinLockRelease(&slot->head.mutex);
+
+	return status;
+}
+
+static inline void
+pms_set_status(PartitionMoveSlot *slot, PartitionMoveSlotStatus status)
+{
+	SpinLockAcquire(&slot->head.mutex);
+	slot->head.worker_status = status;
+	SpinLockRelease(&slot->head.mutex);
+}
+
+static inline const char *
+pms_print_status(PartitionMoveSlotStatus status)
+{
+	switch(status)
+	{
+		case PMS_FREE:
+			return "free";
+
+		case PMS_PREPARING:
+			return "preparing";
+
+		case PMS_COPYING:
+			return "copying";
+
+		case PMS_CATCHING_UP:
+			return "catching up";
+
+		case PMS_SWITCHING:
+			return "switching";
+
+		case PMS_CLEANUP:
+			return "cleanup";
+
+		default:
+			return "[unknown]";
+	}
+}
+
+
+/* Number of worker slots for partition moves */
+#define PARTITION_MOVE_SLOTS		max_worker_processes
+
+/* Stream progress is published (and throttled) every this many bytes */
+#define PARTITION_MOVE_CHUNK		(64 * 1024)
+
+/* Replication lag (bytes) below which we try to switch the server */
+#define PARTITION_MOVE_MAX_LAG		(1024 * 1024)
+
+/* How long (ms) the coordinator partition may stay locked per attempt */
+#define PARTITION_MOVE_LOCK_TIMEOUT	5000
+
+/* Max number of attempts to switch the server */
+#define PARTITION_MOVE_MAX_ATTEMPTS	60
+
+
+/*
+ * Definitions for the "gogudb_partition_moves" view.
+ */
+#define Natts_partition_moves				7
+#define Anum_partition_moves_userid			1
+#define Anum_partition_moves_pid			2
+#define Anum_partition_moves_dbid			3
+#define Anum_partition_moves_partition		4
+#define Anum_partition_moves_target			5
+#define Anum_partition_moves_copied			6
+#define Anum_partition_moves_status			7
+
+
+/*
+ * Definitions for the rebalance() result set.
+ */
+#define Natts_rebalance_plan				5
+#define Anum_rebalance_plan_partition		1
+#define Anum_rebalance_plan_source			2
+#define Anum_rebalance_plan_target			3
+#define Anum_rebalance_plan_load			4
+#define Anum_rebalance_plan_status			5
+
+/* Servers within this fraction of the average load are left alone */
+#define REBALANCE_TOLERANCE			0.05
+
+/* Interval (ms) between two samples of pg_stat_user_tables for 'qps' */
+#define REBALANCE_SAMPLE_INTERVAL	10000
+
+
+/*
+ * Partition move slots are stored in shmem.
+ */
+Size estimate_partition_move_slots_size(void);
+void init_partition_move_slots(void);
+
+/*
+ * Start PartitionMoveWorker, returns index of its slot.
+ */
+int start_partition_move(Oid relid, Oid target_server, int32 max_rate);
+bool partition_move_is_active(int slot_idx, Oid relid);
+
+
+#endif /* PARTITION_MOVE_H */
@@ -0,0 +1,72 @@
+/*-------------------------------------------------------------------------
+ *
+ * partition_precreate.h
+ *		Scheduled pre-creation of RANGE partitions of time-series tables
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#ifndef PARTITION_PRECREATE_H
+#define PARTITION_PRECREATE_H
+
+
+#include "postgres.h"
+#include "pathman_workers.h"
+#include "storage/spin.h"
+#include "utils/timestamp.h"
+
+
+/*
+ * Store args and execution status of a single PartitionPrecreateWorker.
+ */
+typedef struct
+{
+	WorkerSlot	head;		/* status, database and table (or all tables) */
+
+	int32	intervals;		/* intervals to keep ahead of current time */
+	int32	period;			/* seconds between rounds */
+	int64	created;		/* partitions created by the last round */
+	TimestampTz	last_round;	/* end of the last round */
+} PrecreateSlot;
+
+#define InitPrecreateSlot(slot, ahead, secs) \
+	do { \
+		(slot)->intervals = (ahead); \
+		(slot)->period = (secs); \
+		(slot)->created = 0; \
+		(slot)->last_round = 0; \
+	} while (0)
+
+
+/* Number of worker slots for partition pre-creation */
+#define PRECREATE_SLOTS				max_worker_processes
+
+
+/*
+ * Definitions for the "gogudb_partition_precreations" view.
+ */
+#define Natts_partition_precreations			9
+#define Anum_partition_precreations_userid		1
+#define Anum_partition_precreations_pid			2
+#define Anum_partition_precreations_dbid		3
+#define Anum_partition_precreations_relid		4
+#define Anum_partition_precreations_intervals	5
+#define Anum_partition_precreations_period		6
+#define Anum_partition_precreations_created		7
+#define Anum_partition_precreations_last		8
+#define Anum_partition_precreations_status		9
+
+
+/*
+ * Pre-creation slots are stored in shmem.
+ */
+Size estimate_partition_precreate_slots_size(void);
+void init_partition_precreate_slots(void);
+
+/*
+ * Start the workers of PRECREATE_CONFIG after a restart.
+ */
+void restart_partition_precreations(void);
+
+
+#endif /* PARTITION_PRECREATE_H */
@@ -0,0 +1,116 @@
+/*-------------------------------------------------------------------------
+ *
+ * partition_retention.h
+ *		Scheduled removal of expired RANGE partitions of time-series tables
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#ifndef PARTITION_RETENTION_H
+#define PARTITION_RETENTION_H
+
+
+#include "postgres.h"
+#include "pathman_workers.h"
+#include "storage/spin.h"
+#include "utils/timestamp.h"
+
+
+/*
+ * What happens to an expired partition.
+ */
+typedef enum
+{
+	RETENTION_DROP = 0,	/* drop foreign table and remote table */
+	RETENTION_DETACH,	/* detach foreign table, keep remote table */
+	RETENTION_ARCHIVE	/* drop foreign table, rename remote table */
+
+} RetentionAction;
+
+/*
+ * Store args and execution status of a single PartitionRetentionWorker.
+ */
+typedef struct
+{
+	WorkerSlot	head;		/* status and database, relid is not used */
+
+	RetentionAction action;	/* what to do with expired partitions */
+	int32	batch_size;		/* max partitions per table in a round */
+	int32	lock_timeout;	/* lock_timeout (ms) of a single removal */
+	int32	period;			/* seconds between rounds */
+	int64	removed;		/* partitions removed by the last round */
+	int32	pending;		/* remote tables left in RETENTION_PENDING */
+	TimestampTz	last_round;	/* end of the last round */
+} RetentionSlot;
+
+#define InitRetentionSlot(slot, act, batch_sz, timeout, secs) \
+	do { \
+		(slot)->action = (act); \
+		(slot)->batch_size = (batch_sz); \
+		(slot)->lock_timeout = (timeout); \
+		(slot)->period = (secs); \
+		(slot)->removed = 0; \
+		(slot)->pending = 0; \
+		(slot)->last_round = 0; \
+	} while (0)
+
+static inline const char *
+prs_print_action(RetentionAction action)
+{
+	switch(action)
+	{
+		case RETENTION_DROP:
+			return "drop";
+
+		case RETENTION_DETACH:
+			return "detach";
+
+		case RETENTION_ARCHIVE:
+			return "archive";
+
+		default:
+			return "[unknown]";
+	}
+}
+
+
+/* Number of worker slots for partition retention */
+#define RETENTION_SLOTS				max_worker_processes
+
+/* Failed attempts to remove a remote table before a warning */
+#define RETENTION_WARN_ATTEMPTS		10
+
+/* Suffix of remote tables kept by the 'archive' action */
+#define RETENTION_ARCHIVE_SUFFIX	"_archive"
+
+
+/*
+ * Definitions for the "gogudb_partition_retentions" view.
+ */
+#define Natts_partition_retentions				11
+#define Anum_partition_retentions_userid		1
+#define Anum_partition_retentions_pid			2
+#define Anum_partition_retentions_dbid			3
+#define Anum_partition_retentions_action		4
+#define Anum_partition_retentions_batch_size	5
+#define Anum_partition_retentions_lock_timeout	6
+#define Anum_partition_retentions_period		7
+#define Anum_partition_retentions_removed		8
+#define Anum_partition_retentions_pending		9
+#define Anum_partition_retentions_last			10
+#define Anum_partition_retentions_status		11
+
+
+/*
+ * Retention slots are stored in shmem.
+ */
+Size estimate_partition_retention_slots_size(void);
+void init_partition_retention_slots(void);
+
+/*
+ * Start the worker of RETENTION_CONFIG after a restart.
+ */
+void restart_partition_retention(void);
+
+
+#endif /* PARTITION_RETENTION_H */
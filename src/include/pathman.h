@@ -78,6 +78,40 @@
 #define Anum_server_map_range_end			3	/* range end (int4) */
 
 
+/*
+ * Definitions for the "gogudb_precreate_config" table.
+ */
+#define PRECREATE_CONFIG					"gogudb_precreate_config"
+#define Natts_precreate_config				4
+#define Anum_precreate_config_partrel		1	/* partitioned relation, NULL = all */
+#define Anum_precreate_config_intervals		2	/* intervals to keep ahead (int4) */
+#define Anum_precreate_config_period		3	/* seconds between rounds (int4) */
+#define Anum_precreate_config_owner			4	/* run the worker as (regrole) */
+
+/*
+ * Definitions for the "gogudb_retention_config" table.
+ */
+#define RETENTION_CONFIG					"gogudb_retention_config"
+#define Natts_retention_config				5
+#define Anum_retention_config_action		1	/* drop|detach|archive (text) */
+#define Anum_retention_config_batch_size	2	/* max partitions per table (int4) */
+#define Anum_retention_config_lock_timeout	3	/* lock_timeout in ms (int4) */
+#define Anum_retention_config_period		4	/* seconds between rounds (int4) */
+#define Anum_retention_config_owner			5	/* run the worker as (regrole) */
+
+/*
+ * Definitions for the "gogudb_retention_pending" table.
+ */
+#define RETENTION_PENDING					"gogudb_retention_pending"
+#define Natts_retention_pending				6
+#define Anum_retention_pending_server		1	/* foreign server (text) */
+#define Anum_retention_pending_owner		2	/* owner of the partition (regrole) */
+#define Anum_retention_pending_schema		3	/* remote schema (text) */
+#define Anum_retention_pending_table		4	/* remote table (text) */
+#define Anum_retention_pending_action		5	/* drop|archive (text) */
+#define Anum_retention_pending_attempts		6	/* failed attempts (int4) */
+
+
 /* type modifier (typmod) for 'range_interval' */
 #define PATHMAN_CONFIG_interval_typmod		-1
 
@@ -85,12 +119,13 @@
  * Definitions for the "pathman_config_params" table.
  */
 #define PATHMAN_CONFIG_PARAMS						"gogudb_config_params"
-#define Natts_pathman_config_params					5
+#define Natts_pathman_config_params					6
 #define Anum_pathman_config_params_partrel			1	/* primary key */
 #define Anum_pathman_config_params_enable_parent	2	/* include parent into plan */
 #define Anum_pathman_config_params_auto				3	/* auto partitions creation */
 #define Anum_pathman_config_params_init_callback	4	/* partition action callback */
 #define Anum_pathman_config_params_spawn_using_bgw	5	/* should we use spawn BGW? */
+#define Anum_pathman_config_params_retention		6	/* drop older partitions */
 
 /*
  * Definitions for the "pathman_partition_list" view.
@@ -19,7 +19,12 @@
 
 
 #include "postgres.h"
+#include "postmaster/bgworker.h"
+#include "storage/block.h"
+#include "storage/itemptr.h"
+#include "storage/latch.h"
 #include "storage/spin.h"
+#include "utils/timestamp.h"
 
 #if PG_VERSION_NUM >= 90600
 #include "storage/lock.h"
@@ -53,6 +58,93 @@ typedef struct
 } SpawnPartitionArgs;
 
 
+/* Max number of databases served by SpawnerWorkers at a time */
+#define SPAWNER_SLOTS				16
+
+/* Max number of spawn requests in the queue */
+#define SPAWN_REQUEST_SLOTS			64
+
+/* Max size of a packed value, larger ones get a worker of their own */
+#define SPAWN_VALUE_MAXLEN			64
+
+/* Max number of waiters woken up by their latches, others poll */
+#define SPAWN_REQUEST_LATCHES		8
+
+/* Poll interval (ms) of a waiting backend */
+#define SPAWN_POLL_INTERVAL			10
+
+/* SpawnerWorker exits after being idle for this many seconds */
+#define SPAWNER_IDLE_TIMEOUT		600
+
+/* lock_timeout (ms) of a request if its backend has none */
+#define SPAWN_LOCK_TIMEOUT			5000
+
+/* A backend stops waiting for its request after this many ms */
+#define SPAWN_WAIT_TIMEOUT			(2 * SPAWN_LOCK_TIMEOUT)
+
+
+typedef enum
+{
+	SPS_FREE = 0,		/* slot is empty */
+	SPS_STARTING,		/* worker has been launched */
+	SPS_RUNNING			/* worker serves requests */
+} SpawnerSlotStatus;
+
+/*
+ * SpawnerWorker of a database.
+ */
+typedef struct
+{
+	SpawnerSlotStatus status;
+	Oid		dbid;			/* database served by the worker */
+	pid_t	pid;			/* worker's PID */
+	Latch  *latch;			/* set it to wake the worker up */
+} SpawnerSlot;
+
+typedef enum
+{
+	SRS_FREE = 0,		/* slot is empty */
+	SRS_PENDING,		/* waits for the spawner */
+	SRS_WORKING,		/* spawner creates partitions */
+	SRS_DONE			/* 'result' is ready */
+} SpawnRequestStatus;
+
+/*
+ * Request to create partitions for a value.  Backends asking for the same
+ * value of the same table wait for one request.
+ */
+typedef struct
+{
+	SpawnRequestStatus status;
+
+	Oid		userid;			/* create partitions as this user */
+	Oid		dbid;			/* database which stores 'partitioned_table' */
+	Oid		partitioned_table;
+
+	/* Needed to decode Datum from 'values' */
+	Oid		value_type;
+	Size	value_size;
+	bool	value_byval;
+	uint8	value[SPAWN_VALUE_MAXLEN];
+
+	int		lock_timeout;	/* spawner waits this many ms for locks */
+
+	int		nwaiters;		/* backends waiting for the result */
+	int		nlatches;		/* latches of the first waiters */
+	Latch  *latches[SPAWN_REQUEST_LATCHES];
+
+	bool	served;			/* false if spawner has gone, use a BGW */
+	Oid		result;			/* target partition */
+} SpawnRequest;
+
+typedef struct
+{
+	slock_t			mutex;	/* protects all slots */
+	SpawnerSlot		spawners[SPAWNER_SLOTS];
+	SpawnRequest	requests[SPAWN_REQUEST_SLOTS];
+} SpawnerState;
+
+
 typedef enum
 {
 	CPS_FREE = 0,	/* slot is empty */
@@ -78,9 +170,21 @@ typedef struct
 
 	int32	batch_size;		/* number of rows in a batch */
 	float8	sleep_time;		/* how long should we sleep in case of error? */
+
+	int32	worker_num;		/* number of this worker within the task */
+	int32	nworkers;		/* number of workers of the task */
+	BlockNumber	start_block;	/* first block of the parent's range */
+	BlockNumber	end_block;		/* end of the range, InvalidBlockNumber
+								 * means the end of the relation */
+	BlockNumber	scan_end;		/* end of the range seen by the last batch,
+								 * InvalidBlockNumber before the first one */
+	bool	range_done;		/* a pass over the range has moved nothing */
+	ItemPointerData	position;	/* next row to be relocated */
+	TimestampTz	started;		/* when the worker has started */
 } ConcurrentPartSlot;
 
-#define InitConcurrentPartSlot(slot, user, w_status, db, rel, batch_sz, sleep_t) \
+#define InitConcurrentPartSlot(slot, user, w_status, db, rel, batch_sz, sleep_t, \
+							   w_num, n_workers, start_blk, end_blk) \
 	do { \
 		(slot)->userid = (user); \
 		(slot)->worker_status = (w_status); \
@@ -90,6 +194,14 @@ typedef struct
 		(slot)->total_rows = 0; \
 		(slot)->batch_size = (batch_sz); \
 		(slot)->sleep_time = (sleep_t); \
+		(slot)->worker_num = (w_num); \
+		(slot)->nworkers = (n_workers); \
+		(slot)->start_block = (start_blk); \
+		(slot)->end_block = (end_blk); \
+		(slot)->scan_end = InvalidBlockNumber; \
+		(slot)->range_done = false; \
+		ItemPointerSet(&(slot)->position, (start_blk), FirstOffsetNumber); \
+		(slot)->started = 0; \
 	} while (0)
 
 static inline ConcurrentPartSlotStatus
@@ -131,6 +243,99 @@ cps_print_status(ConcurrentPartSlotStatus status)
 	}
 }
 
+/* Percentage of the worker's range passed by the current pass */
+static inline double
+cps_progress(ConcurrentPartSlot *slot)
+{
+	BlockNumber	position = ItemPointerGetBlockNumber(&slot->position);
+
+	if (slot->scan_end == InvalidBlockNumber)
+		return 0.0;
+
+	if (slot->scan_end <= slot->start_block || position >= slot->scan_end)
+		return 100.0;
+
+	return 100.0 * (position - slot->start_block) /
+				   (slot->scan_end - slot->start_block);
+}
+
+
+
+/*
+ * Head of the slot of a worker started by an SQL function
+ * (PartitionMoveWorker, RemoteStatsWorker, PartitionPrecreateWorker,
+ * PartitionRetentionWorker).  It must be the first member of the slot.
+ */
+typedef struct
+{
+	slock_t	mutex;			/* protect slot from race conditions */
+
+	int		worker_status;	/* status of a particular worker, 0 = free */
+
+	Oid		userid;			/* connect as a specified user */
+	pid_t	pid;			/* worker's PID */
+	Oid		dbid;			/* database of the worker */
+	Oid		relid;			/* table, or InvalidOid for all tables */
+} WorkerSlot;
+
+/*
+ * Status of the workers which run in rounds.
+ */
+typedef enum
+{
+	WS_FREE = 0,		/* slot is empty */
+	WS_WORKING,			/* worker is in a round */
+	WS_SLEEPING,		/* worker waits for the next round */
+	WS_STOPPING			/* worker is asked to stop */
+
+} WorkerSlotStatus;
+
+#define WorkerSlotAt(slots, slot_size, i) \
+	((WorkerSlot *) ((char *) (slots) + (Size) (i) * (slot_size)))
+
+static inline WorkerSlotStatus
+ws_check_status(WorkerSlot *slot)
+{
+	WorkerSlotStatus status;
+
+	SpinLockAcquire(&slot->mutex);
+	status = (WorkerSlotStatus) slot->worker_status;
+	SpinLockRelease(&slot->mutex);
+
+	return status;
+}
+
+static inline void
+ws_set_status(WorkerSlot *slot, WorkerSlotStatus status)
+{
+	SpinLockAcquire(&slot->mutex);
+	/* Don't forget that we were asked to stop */
+	if (slot->worker_status != WS_STOPPING || status == WS_FREE)
+		slot->worker_status = status;
+	SpinLockRelease(&slot->mutex);
+}
+
+static inline const char *
+ws_print_status(WorkerSlotStatus status)
+{
+	switch(status)
+	{
+		case WS_FREE:
+			return "free";
+
+		case WS_WORKING:
+			return "working";
+
+		case WS_SLEEPING:
+			return "sleeping";
+
+		case WS_STOPPING:
+			return "stopping";
+
+		default:
+			return "[unknown]";
+	}
+}
 
 
 /* Number of worker slots for concurrent partitioning */
@@ -139,18 +344,24 @@ cps_print_status(ConcurrentPartSlotStatus status)
 /* Max number of attempts per batch */
 #define PART_WORKER_MAX_ATTEMPTS	60
 
+/* Max number of workers per table */
+#define PART_WORKER_MAX_WORKERS		64
+
 
 /*
  * Definitions for the "pathman_concurrent_part_tasks" view.
  */
 #define PATHMAN_CONCURRENT_PART_TASKS		"gogudb_concurrent_part_tasks"
-#define Natts_pathman_cp_tasks				6
+#define Natts_pathman_cp_tasks				9
 #define Anum_pathman_cp_tasks_userid		1
 #define Anum_pathman_cp_tasks_pid			2
 #define Anum_pathman_cp_tasks_dbid			3
 #define Anum_pathman_cp_tasks_relid			4
-#define Anum_pathman_cp_tasks_processed		5
-#define Anum_pathman_cp_tasks_status		6
+#define Anum_pathman_cp_tasks_worker		5
+#define Anum_pathman_cp_tasks_processed		6
+#define Anum_pathman_cp_tasks_progress		7
+#define Anum_pathman_cp_tasks_rows_per_sec	8
+#define Anum_pathman_cp_tasks_status		9
 
 
 /*
@@ -159,6 +370,12 @@ cps_print_status(ConcurrentPartSlotStatus status)
 Size estimate_concurrent_part_task_slots_size(void);
 void init_concurrent_part_task_slots(void);
 
+/*
+ * Spawn request queue is stored in shmem.
+ */
+Size estimate_spawner_state_size(void);
+void init_spawner_state(void);
+
 
 /*
  * Useful datum packing\unpacking functions for BGW.
@@ -208,6 +425,44 @@ UnpackDatumFromByteArray(Datum *datum, Size datum_size, bool typbyval,
 	return ((uint8 *) byte_array) + datum_size;
 }
 
+/*
+ * Common routines shared by all gogudb background workers.
+ */
+void handle_sigterm(SIGNAL_ARGS);
+void bg_worker_load_config(const char *bgw_name);
+bool start_bgworker(const char bgworker_name[BGW_MAXLEN],
+					const char bgworker_proc[BGW_MAXLEN],
+					Datum bgw_arg, bool wait_for_shutdown);
+
+/*
+ * Slots of the workers started by SQL functions.
+ */
+void init_worker_slots(WorkerSlot *slots, Size slot_size, int nslots);
+int claim_worker_slot(WorkerSlot *slots, Size slot_size, int nslots,
+					  Oid userid, Oid relid, int status);
+void launch_worker(WorkerSlot *slot, int slot_idx,
+				   const char *bgw_name, const char *bgw_proc);
+void attach_worker_slot(WorkerSlot *slot, const char *bgw_name);
+bool stop_worker_slot(WorkerSlot *slots, Size slot_size, int nslots, Oid relid);
+bool sleep_worker_slot(WorkerSlot *slot, int period);
+bool next_worker_slot(WorkerSlot *slots, Size slot_size, int nslots,
+					  int *cur_idx, WorkerSlot *copy);
+
+/*
+ * Relaunch of scheduled workers when the server starts.
+ */
+void register_worker_launcher(void);
+
+/*
+ * Show generic error message if we failed to start bgworker.
+ */
+static inline void
+start_bgworker_errmsg(const char *bgworker_name)
+{
+	ereport(ERROR, (errmsg("could not start %s", bgworker_name),
+					errhint("consider increasing max_worker_processes")));
+}
+
 /*
  * Create partition to store 'value' using specific BGW.
  */
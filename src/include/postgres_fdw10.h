@@ -110,6 +110,18 @@ typedef struct PgFdwRelationInfo
 	int			relation_index;
 } PgFdwRelationInfo;
 
+/*
+ * How ANALYZE samples a remote table ("analyze_sampling" option).
+ */
+typedef enum PgFdwSamplingMethod
+{
+	ANALYZE_SAMPLE_OFF,			/* fetch the whole table */
+	ANALYZE_SAMPLE_AUTO,		/* choose by remote version and reltuples */
+	ANALYZE_SAMPLE_RANDOM,		/* WHERE random() < frac */
+	ANALYZE_SAMPLE_SYSTEM,		/* TABLESAMPLE SYSTEM */
+	ANALYZE_SAMPLE_BERNOULLI	/* TABLESAMPLE BERNOULLI */
+} PgFdwSamplingMethod;
+
 /* in postgres_fdw.c */
 extern int	Gogu_set_transmission_modes(void);
 extern void Gogu_reset_transmission_modes(int nestlevel);
@@ -167,7 +179,10 @@ extern void GogudeparseDirectDeleteSql(StringInfo buf, PlannerInfo *root,
 					   List *returningList,
 					   List **retrieved_attrs);
 extern void GogudeparseAnalyzeSizeSql(StringInfo buf, Relation rel);
+extern void GogudeparseAnalyzeTuplesSql(StringInfo buf, Relation rel);
 extern void GogudeparseAnalyzeSql(StringInfo buf, Relation rel,
+				  PgFdwSamplingMethod sample_method,
+				  double sample_frac,
 				  List **retrieved_attrs);
 extern void GogudeparseStringLiteral(StringInfo buf, const char *val);
 extern Expr *Gogu_find_em_expr_for_rel(EquivalenceClass *ec, RelOptInfo *rel);
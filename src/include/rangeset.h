@@ -167,4 +167,47 @@ List *irange_list_set_lossiness(List *ranges, bool lossy);
 int irange_list_length(List *rangeset);
 bool irange_list_find(List *rangeset, int index, bool *lossy);
 
+
+/* Rangesets of tables with more children stay lists of IndexRanges */
+#define IRANGE_BITMAP_MAX_CHILDREN	4096
+
+/*
+ * IndexRangeBitmap is a set of selected partitions of a small table,
+ * used to combine many rangesets without allocating list cells.
+ */
+typedef struct
+{
+	uint32	nbits;		/* number of partitions */
+	uint32	nwords;		/* number of words in each bitmap */
+	uint64 *present;	/* selected partitions */
+	uint64 *complete;	/* selected partitions which don't need quals */
+} IndexRangeBitmap;
+
+/* Operations on IndexRangeBitmaps */
+IndexRangeBitmap *irange_bitmap_create(uint32 nbits, bool full);
+void irange_bitmap_union_list(IndexRangeBitmap *bitmap, List *rangeset);
+void irange_bitmap_intersect_list(IndexRangeBitmap *bitmap, List *rangeset);
+bool irange_bitmap_is_empty(const IndexRangeBitmap *bitmap);
+int irange_bitmap_length(const IndexRangeBitmap *bitmap);
+List *irange_bitmap_to_list(const IndexRangeBitmap *bitmap);
+
+
+/*
+ * IndexRangeCombiner unites (OR) or intersects (AND) a series of rangesets,
+ * using IndexRangeBitmap for tables with few enough children.
+ */
+typedef struct
+{
+	bool				use_or;		/* union or intersection? */
+	List			   *ranges;		/* result if 'bitmap' is NULL */
+	IndexRangeBitmap   *bitmap;		/* result for small tables */
+} IndexRangeCombiner;
+
+void irange_combiner_init(IndexRangeCombiner *combiner,
+						  uint32 nchildren, bool use_or);
+void irange_combiner_add(IndexRangeCombiner *combiner, List *rangeset);
+bool irange_combiner_is_empty(const IndexRangeCombiner *combiner);
+int irange_combiner_length(const IndexRangeCombiner *combiner);
+List *irange_combiner_result(IndexRangeCombiner *combiner);
+
 #endif /* PATHMAN_RANGESET_H */
@@ -0,0 +1,98 @@
+/*-------------------------------------------------------------------------
+ *
+ * remote_estimate.h
+ *		Shared cache of remote EXPLAIN estimates
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#ifndef REMOTE_ESTIMATE_H
+#define REMOTE_ESTIMATE_H
+
+
+#include "postgres.h"
+#include "foreign/foreign.h"
+#include "nodes/nodes.h"
+#include "nodes/relation.h"
+#include "utils/timestamp.h"
+
+
+/*
+ * Cost numbers of the topmost node of a remote EXPLAIN.
+ */
+typedef struct
+{
+	double	rows;
+	int		width;
+	Cost	startup_cost;
+	Cost	total_cost;
+} RemoteEstimate;
+
+/*
+ * Estimates are keyed by database, user, server and deparsed EXPLAIN text
+ * (remote privileges and RLS may differ between users).  We store only a
+ * hash of the text, together with its length to make collisions less
+ * likely.
+ */
+/* Max number of foreign tables an estimate is tracked for */
+#define REMOTE_ESTIMATE_MAX_RELS		4
+
+typedef struct
+{
+	Oid		dbid;
+	Oid		userid;
+	Oid		serverid;
+	uint32	sql_hash;
+	uint32	sql_len;
+} RemoteEstimateKey;
+
+typedef struct
+{
+	RemoteEstimateKey	key;			/* hash key, must be first */
+	TimestampTz			stored_at;		/* when the EXPLAIN was run */
+	RemoteEstimate		estimate;
+
+	/* foreign tables scanned by the EXPLAIN, nrels is -1 if unknown */
+	int					nrels;
+	Oid					relids[REMOTE_ESTIMATE_MAX_RELS];
+} RemoteEstimateEntry;
+
+
+/* Max number of cached estimates */
+#define REMOTE_ESTIMATE_CACHE_SIZE		8192
+
+
+extern int gogudb_remote_estimate_ttl;
+extern bool gogudb_clone_sibling_paths;
+
+
+/*
+ * The cache is stored in shmem.
+ */
+Size estimate_remote_estimate_cache_size(void);
+void request_remote_estimate_lock(void);
+void init_remote_estimate_cache(void);
+void init_remote_estimate_static_data(void);
+
+List *remote_estimate_relids(PlannerInfo *root, Relids relids);
+bool remote_estimate_lookup(UserMapping *user, const char *sql,
+							List *relids, RemoteEstimate *estimate);
+void remote_estimate_store(UserMapping *user, const char *sql,
+						   List *relids, const RemoteEstimate *estimate);
+void remote_estimate_invalidate(List *relids);
+
+/*
+ * Batches of EXPLAINs sent to all servers at once.
+ */
+bool remote_estimate_batch_enabled(void);
+void remote_estimate_begin_batch(void);
+void remote_estimate_end_batch(bool run);
+
+/*
+ * Planning of foreign partitions by copying a sibling (postgres_fdw*.c).
+ */
+bool GoguCloneForeignRel(PlannerInfo *root, RelOptInfo *source,
+						 RelOptInfo *baserel);
+
+
+#endif /* REMOTE_ESTIMATE_H */
@@ -0,0 +1,76 @@
+/*-------------------------------------------------------------------------
+ *
+ * remote_instr.h
+ *		EXPLAIN ANALYZE instrumentation of remote scans
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#ifndef REMOTE_INSTR_H
+#define REMOTE_INSTR_H
+
+
+#include "postgres.h"
+#include "commands/explain.h"
+#include "libpq-fe.h"
+#include "nodes/execnodes.h"
+#include "portability/instr_time.h"
+
+
+/*
+ * What a foreign scan has spent on its server.
+ */
+typedef struct
+{
+	bool		enabled;		/* collect timings (EXPLAIN ANALYZE)? */
+	bool		timed;			/* measure the waits (EXPLAIN ANALYZE or
+								 * gogudb.log_remote_min_duration)? */
+	bool		cursor;			/* does the scan use a cursor? */
+	bool		awaiting;		/* waiting for the first result? */
+	Oid			serverid;		/* server the scan has run on */
+	const char *query;			/* statement of the scan, logged at its end */
+	instr_time	started;		/* start of the scan */
+	instr_time	wait_start;		/* start of the current remote call */
+	double		connect_time;	/* getting the connection (ms) */
+	double		first_row_time;	/* start of the scan till first row (ms),
+								 * negative if no rows have come */
+	double		remote_time;	/* waiting for the server (ms) */
+	int64		round_trips;	/* statements sent */
+	int64		bytes_out;		/* bytes of statements sent */
+	int64		bytes;			/* bytes of data received (estimated) */
+	int64		rows;			/* rows received */
+} GoguScanInstr;
+
+
+void remote_instr_begin(GoguScanInstr *instr, PlanState *ps, Oid serverid);
+void remote_instr_connected(GoguScanInstr *instr, bool cursor);
+void remote_instr_statement(GoguScanInstr *instr, const char *query);
+void remote_instr_sent(GoguScanInstr *instr, const char *sql);
+void remote_instr_received(GoguScanInstr *instr, PGresult *res);
+void remote_instr_received_rows(GoguScanInstr *instr, int64 nrows, int64 nbytes);
+void remote_instr_end(GoguScanInstr *instr);
+
+int64 remote_result_bytes(PGresult *res);
+
+void remote_instr_explain(GoguScanInstr *instr, ExplainState *es);
+void remote_instr_explain_servers(List *planstates, ExplainState *es);
+
+/*
+ * Instrumentation of a postgres_fdw scan, NULL for other nodes
+ * (postgres_fdw*.c).
+ */
+GoguScanInstr *GoguGetScanInstr(ForeignScanState *node);
+
+
+/*
+ * Start waiting for the server.
+ */
+static inline void
+remote_instr_wait(GoguScanInstr *instr)
+{
+	if (instr->timed)
+		INSTR_TIME_SET_CURRENT(instr->wait_start);
+}
+
+
+#endif /* REMOTE_INSTR_H */
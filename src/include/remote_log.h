@@ -0,0 +1,29 @@
+/*-------------------------------------------------------------------------
+ *
+ * remote_log.h
+ *		Logging of slow remote statements
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#ifndef REMOTE_LOG_H
+#define REMOTE_LOG_H
+
+
+#include "postgres.h"
+#include "utils/portal.h"
+
+
+/* GUC variables */
+extern int		gogudb_log_remote_min_duration;
+extern double	gogudb_log_remote_sample_rate;
+
+
+void init_remote_log_static_data(void);
+
+void remote_log_start_query(Portal portal);
+void remote_log_statement(Oid serverid, const char *sql,
+						  uint64 rows, double wait_ms);
+
+
+#endif /* REMOTE_LOG_H */
@@ -0,0 +1,64 @@
+/*-------------------------------------------------------------------------
+ *
+ * remote_stats.h
+ *		Import of shard statistics into local foreign partitions
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#ifndef REMOTE_STATS_H
+#define REMOTE_STATS_H
+
+
+#include "postgres.h"
+#include "pathman_workers.h"
+#include "storage/spin.h"
+#include "utils/timestamp.h"
+
+
+/*
+ * Store args and execution status of a single RemoteStatsWorker.
+ */
+typedef struct
+{
+	WorkerSlot	head;		/* status, database and table (or all tables) */
+
+	int32	period;			/* seconds between rounds, 0 = run once */
+	int64	imported;		/* partitions updated by the last round */
+	TimestampTz	last_import;	/* end of the last round */
+} RemoteStatsSlot;
+
+#define InitRemoteStatsSlot(slot, secs) \
+	do { \
+		(slot)->period = (secs); \
+		(slot)->imported = 0; \
+		(slot)->last_import = 0; \
+	} while (0)
+
+
+/* Number of worker slots for statistics import */
+#define REMOTE_STATS_SLOTS			max_worker_processes
+
+
+/*
+ * Definitions for the "gogudb_remote_stats_imports" view.
+ */
+#define Natts_remote_stats_imports				8
+#define Anum_remote_stats_imports_userid		1
+#define Anum_remote_stats_imports_pid			2
+#define Anum_remote_stats_imports_dbid			3
+#define Anum_remote_stats_imports_relid			4
+#define Anum_remote_stats_imports_period		5
+#define Anum_remote_stats_imports_imported		6
+#define Anum_remote_stats_imports_last			7
+#define Anum_remote_stats_imports_status		8
+
+
+/*
+ * Statistics import slots are stored in shmem.
+ */
+Size estimate_remote_stats_slots_size(void);
+void init_remote_stats_slots(void);
+
+
+#endif /* REMOTE_STATS_H */
@@ -0,0 +1,73 @@
+/*-------------------------------------------------------------------------
+ *
+ * replica_routing.h
+ *		Routing of read-only transactions to replicas of the shards
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#ifndef REPLICA_ROUTING_H
+#define REPLICA_ROUTING_H
+
+
+#include "postgres.h"
+#include "storage/spin.h"
+#include "utils/timestamp.h"
+
+
+#define SERVER_REPLICAS					"server_replicas"
+
+/*
+ * Definitions for the "server_replicas" table.
+ */
+#define Natts_server_replicas			2
+#define Anum_server_replicas_srvname	1	/* primary server name (text) */
+#define Anum_server_replicas_replica	2	/* replica server name (text) */
+
+
+/* Max number of replicas whose state is tracked */
+#define REPLICA_STATE_SLOTS				128
+
+/* Replication lag is rechecked after this many milliseconds */
+#define REPLICA_LAG_RECHECK_MS			1000
+
+
+typedef enum
+{
+	REPLICA_ROUTING_OFF = 0,
+	REPLICA_ROUTING_ROUND_ROBIN,
+	REPLICA_ROUTING_LEAST_OUTSTANDING
+} ReplicaRoutingMode;
+
+/*
+ * Shared state of a replica.
+ */
+typedef struct
+{
+	Oid			serverid;		/* replica, InvalidOid if slot is free */
+	uint32		outstanding;	/* transactions currently routed to it */
+	int64		lag;			/* replication lag (ms), -1 if unreachable */
+	TimestampTz	checked_at;		/* start of the last lag check */
+	TimestampTz	used_at;		/* last time a transaction looked it up */
+} ReplicaState;
+
+typedef struct
+{
+	slock_t			mutex;		/* protects everything below */
+	uint32			next;		/* round-robin counter */
+	ReplicaState	replicas[REPLICA_STATE_SLOTS];
+} ReplicaRoutingState;
+
+
+extern int gogudb_replica_routing;
+extern int gogudb_replica_max_lag;
+
+
+Size estimate_replica_routing_size(void);
+void init_replica_routing_state(void);
+void init_replica_routing_static_data(void);
+
+Oid replica_route_server(Oid serverid, Oid userid);
+
+
+#endif /* REPLICA_ROUTING_H */
@@ -0,0 +1,99 @@
+/*-------------------------------------------------------------------------
+ *
+ * stat_remote.h
+ *		Cumulative statistics of remote traffic per server
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#ifndef STAT_REMOTE_H
+#define STAT_REMOTE_H
+
+
+#include "postgres.h"
+#include "port/atomics.h"
+#include "storage/spin.h"
+#include "utils/timestamp.h"
+
+
+/* Max number of servers (of all databases) with statistics */
+#define STAT_REMOTE_SLOTS			256
+
+/* Upper bounds (ms) of latency buckets, the last bucket has none */
+#define STAT_REMOTE_BUCKET_BOUNDS	{ 1, 2, 5, 10, 20, 50, 100, 200, 500, \
+									  1000, 2000, 5000 }
+#define STAT_REMOTE_NBUCKETS		13
+
+
+typedef enum
+{
+	STAT_REMOTE_QUERIES = 0,		/* statements completed */
+	STAT_REMOTE_ROWS,				/* rows received */
+	STAT_REMOTE_BYTES_IN,			/* bytes of data received */
+	STAT_REMOTE_BYTES_OUT,			/* bytes of statements sent */
+	STAT_REMOTE_TIME,				/* time of statements (us) */
+	STAT_REMOTE_ERRORS,				/* errors reported */
+	STAT_REMOTE_CONNECTS,			/* connections made */
+	STAT_REMOTE_RECONNECTS,			/* broken connections replaced */
+	STAT_REMOTE_CURSOR_SCANS,		/* scans using a cursor */
+	STAT_REMOTE_SINGLE_ROW_SCANS,	/* scans using single-row mode */
+	STAT_REMOTE_COMMITS,			/* remote transactions committed */
+	STAT_REMOTE_ABORTS,				/* remote transactions aborted */
+
+	STAT_REMOTE_NCOUNTERS
+} StatRemoteCounter;
+
+/*
+ * Statistics of a server.  Counters are updated without locks, the mutex
+ * only protects the assignment of slots and stats_reset.
+ */
+typedef struct
+{
+	Oid					dbid;		/* database of the server */
+	Oid					serverid;	/* InvalidOid if slot is free */
+	TimestampTz			stats_reset;
+	pg_atomic_uint64	counters[STAT_REMOTE_NCOUNTERS];
+	pg_atomic_uint64	latency[STAT_REMOTE_NBUCKETS];
+} StatRemoteEntry;
+
+
+/*
+ * Definitions for the "gogudb_stat_remote" view.
+ */
+#define Natts_stat_remote				17
+#define Anum_stat_remote_dbid			1
+#define Anum_stat_remote_serverid		2
+#define Anum_stat_remote_queries		3
+#define Anum_stat_remote_rows			4
+#define Anum_stat_remote_bytes_in		5
+#define Anum_stat_remote_bytes_out		6
+#define Anum_stat_remote_total_time		7
+#define Anum_stat_remote_latency		8
+#define Anum_stat_remote_latency_bounds	9
+#define Anum_stat_remote_errors			10
+#define Anum_stat_remote_connects		11
+#define Anum_stat_remote_reconnects		12
+#define Anum_stat_remote_cursor_scans	13
+#define Anum_stat_remote_single_row_scans 14
+#define Anum_stat_remote_commits		15
+#define Anum_stat_remote_aborts			16
+#define Anum_stat_remote_stats_reset	17
+
+
+Size estimate_stat_remote_size(void);
+void init_stat_remote(void);
+
+StatRemoteEntry *stat_remote_entry(Oid serverid);
+void stat_remote_latency(StatRemoteEntry *entry, double ms);
+
+
+static inline void
+stat_remote_count(StatRemoteEntry *entry, StatRemoteCounter counter,
+				  uint64 value)
+{
+	if (entry != NULL && value > 0)
+		pg_atomic_fetch_add_u64(&entry->counters[counter], value);
+}
+
+
+#endif /* STAT_REMOTE_H */
@@ -26,6 +26,7 @@ LockAcquireResult xact_lock_rel(Oid relid, LOCKMODE lockmode, bool nowait);
  * Utility checks.
  */
 bool xact_bgw_conflicting_lock_exists(Oid relid);
+bool xact_spawner_conflicting_lock_exists(Oid relid);
 bool xact_is_level_read_committed(void);
 bool xact_is_transaction_stmt(Node *stmt);
 bool xact_is_set_stmt(Node *stmt, const char *name);
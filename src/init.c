@@ -17,6 +17,14 @@
 #include "init.h"
 #include "pathman.h"
 #include "pathman_workers.h"
+#include "partition_move.h"
+#include "partition_precreate.h"
+#include "partition_retention.h"
+#include "remote_stats.h"
+#include "remote_estimate.h"
+#include "replica_routing.h"
+#include "stat_remote.h"
+#include "connection_pool.h"
 #include "relation_info.h"
 #include "utils.h"
 
@@ -269,7 +277,16 @@ unload_config(void)
 Size
 estimate_pathman_shmem_size(void)
 {
-	return estimate_concurrent_part_task_slots_size();
+	return estimate_concurrent_part_task_slots_size() +
+		   estimate_partition_move_slots_size() +
+		   estimate_partition_precreate_slots_size() +
+		   estimate_partition_retention_slots_size() +
+		   estimate_remote_estimate_cache_size() +
+		   estimate_remote_stats_slots_size() +
+		   estimate_replica_routing_size() +
+		   estimate_server_health_size() +
+		   estimate_stat_remote_size() +
+		   estimate_spawner_state_size();
 }
 
 /*
@@ -11,6 +11,7 @@
 
 #include "init.h"
 #include "nodes_common.h"
+#include "remote_instr.h"
 #include "runtimeappend.h"
 #include "utils.h"
 
@@ -828,6 +829,10 @@ explain_append_common(CustomScanState *node,
 	/* And add to es->str */
 	ExplainPropertyText("Prune by", exprstr, es);
 
+	/* Show how much time each server took to scan our partitions */
+	if (es->analyze)
+		remote_instr_explain_servers(node->custom_ps, es);
+
 	/* Construct excess PlanStates */
 	if (!es->analyze)
 	{
@@ -138,6 +138,36 @@ gogudb_fdw_validator(PG_FUNCTION_ARGS)
 			/* check list syntax, warn about uninstalled extensions */
 			(void) GoguExtractExtensionList(defGetString(def), true);
 		}
+		else if (strcmp(def->defname, "analyze_sampling") == 0)
+		{
+			char	   *value = defGetString(def);
+
+			if (strcmp(value, "off") != 0 &&
+				strcmp(value, "auto") != 0 &&
+				strcmp(value, "random") != 0 &&
+				strcmp(value, "system") != 0 &&
+				strcmp(value, "bernoulli") != 0)
+				ereport(ERROR,
+						(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+						 errmsg("invalid value for string option \"%s\": %s",
+								def->defname, value)));
+		}
+		else if (strcmp(def->defname, "keepalives_idle") == 0 ||
+				 strcmp(def->defname, "keepalives_interval") == 0 ||
+				 strcmp(def->defname, "keepalives_count") == 0 ||
+				 strcmp(def->defname, "connect_timeout") == 0)
+		{
+			/* libpq silently ignores garbage here, so check it ourselves */
+			char	   *endp;
+			long		val;
+
+			val = strtol(defGetString(def), &endp, 10);
+			if (*endp || val < 0 || val > INT_MAX)
+				ereport(ERROR,
+						(errcode(ERRCODE_SYNTAX_ERROR),
+						 errmsg("%s requires a non-negative integer value",
+								def->defname)));
+		}
 		else if (strcmp(def->defname, "fetch_size") == 0)
 		{
 			int			fetch_size;
@@ -183,6 +213,9 @@ InitPgFdwOptions(void)
 		/* fetch_size is available on both server and table */
 		{"fetch_size", ForeignServerRelationId, false},
 		{"fetch_size", ForeignTableRelationId, false},
+		/* analyze_sampling is available on both server and table */
+		{"analyze_sampling", ForeignServerRelationId, false},
+		{"analyze_sampling", ForeignTableRelationId, false},
 		{NULL, InvalidOid, false}
 	};
 
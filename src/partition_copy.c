@@ -0,0 +1,643 @@
+/*-------------------------------------------------------------------------
+ *
+ * partition_copy.c
+ *		Relocation of rows to remote partitions via COPY
+ *
+ *		ConcurrentPartWorker hands over a batch of the parent's ctids.
+ *		The rows are locked and deleted from the parent; the ones which
+ *		belong to foreign partitions are grouped by partition and sent
+ *		to their servers with a single "COPY ... FROM STDIN" per
+ *		partition, instead of an INSERT per row.  Rows of local
+ *		partitions (or rows without a partition yet) are inserted into
+ *		the parent again, which routes them as usual.
+ *
+ *		Remote COPY runs in the remote transaction of the connection,
+ *		so it is committed or rolled back together with the batch.
+ *
+ *		Split and merge of RANGE partitions move rows between remote
+ *		partitions on the shards themselves, the coordinator only
+ *		changes the constraints.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "compat/pg_compat.h"
+#include "connection_pool.h"
+#include "partition_copy.h"
+#include "partition_filter.h"
+#include "relation_info.h"
+#include "utils.h"
+
+#include "access/htup_details.h"
+#include "catalog/pg_class.h"
+#include "catalog/pg_type.h"
+#include "commands/defrem.h"
+#include "executor/executor.h"
+#include "executor/spi.h"
+#include "foreign/foreign.h"
+#include "miscadmin.h"
+#include "pgstat.h"
+#include "storage/latch.h"
+#include "utils/array.h"
+#include "utils/builtins.h"
+#include "utils/lsyscache.h"
+#include "utils/rel.h"
+
+
+/*
+ * Rows of a batch which go to a single foreign partition.
+ */
+typedef struct
+{
+	Oid				partid;		/* foreign partition */
+	StringInfoData	data;		/* rows in COPY text format */
+	int64			nrows;
+} CopyTarget;
+
+
+static HeapTuple form_parent_tuple(HeapTuple tuple, TupleDesc spi_tupdesc,
+								   TupleDesc tupdesc);
+static CopyTarget *get_copy_target(List **targets, Oid partid);
+static void append_copy_row(StringInfo buf, HeapTuple tuple,
+							TupleDesc tupdesc, FmgrInfo *out_funcs);
+static void append_copy_text(StringInfo buf, const char *str);
+static void send_copy_target(CopyTarget *target, TupleDesc tupdesc);
+static char *remote_table_name(Oid relid);
+static char *remote_column_list(Oid relid, TupleDesc tupdesc, bool *renamed);
+static void stream_remote_rows(PGconn *src, const char *copy_out,
+							   PGconn *dst, const char *copy_in);
+
+
+/*
+ * Move the given rows of the parent to their partitions, return the
+ * number of rows actually moved.
+ *
+ * Rows are locked with NOWAIT, so a conflict with user queries raises
+ * an ERROR and the caller should retry the batch later.
+ */
+int64
+partition_copy_batch(Oid relid, ItemPointer tids, int ntids)
+{
+	const PartRelationInfo *prel;
+	Relation				parent_rel;
+	TupleDesc				tupdesc,
+							spi_tupdesc;
+	FmgrInfo			   *out_funcs;
+	ExprState			   *expr_state;
+	ExprContext			   *econtext;
+	TupleTableSlot		   *slot;
+	Datum				   *tid_datums,
+						   *local_rows;
+	Datum					arg;
+	Oid						argtype;
+	char				   *rel_name,
+						   *sql;
+	List				   *targets = NIL;
+	ListCell			   *lc;
+	int64					nrows;
+	int						nlocal = 0,
+							ret,
+							i;
+
+	if (ntids == 0)
+		return 0;
+
+	prel = get_pathman_relation_info(relid);
+	if (!prel)
+		elog(ERROR, "relation \"%s\" is not partitioned",
+			 get_rel_name_or_relid(relid));
+
+	/* Caller holds RowExclusiveLock */
+	parent_rel = heap_open(relid, NoLock);
+	tupdesc = RelationGetDescr(parent_rel);
+	rel_name = quote_qualified_identifier(get_namespace_name(get_rel_namespace(relid)),
+										  get_rel_name(relid));
+
+	/* Pass ctids as tid[] */
+	tid_datums = (Datum *) palloc(sizeof(Datum) * ntids);
+	for (i = 0; i < ntids; i++)
+		tid_datums[i] = PointerGetDatum(&tids[i]);
+
+	arg = PointerGetDatum(construct_array(tid_datums, ntids, TIDOID,
+										  sizeof(ItemPointerData), false, 's'));
+	argtype = get_array_type(TIDOID);
+
+	/* Lock rows, don't wait for user queries */
+	sql = psprintf("SELECT 1 FROM ONLY %s WHERE ctid = ANY($1) FOR UPDATE NOWAIT",
+				   rel_name);
+	ret = SPI_execute_with_args(sql, 1, &argtype, &arg, NULL, false, 0);
+	if (ret != SPI_OK_SELECT)
+		elog(ERROR, "could not lock rows of relation \"%s\": %d",
+			 get_rel_name(relid), ret);
+
+	sql = psprintf("DELETE FROM ONLY %s WHERE ctid = ANY($1) RETURNING *",
+				   rel_name);
+	ret = SPI_execute_with_args(sql, 1, &argtype, &arg, NULL, false, 0);
+	if (ret != SPI_OK_DELETE_RETURNING)
+		elog(ERROR, "could not delete rows of relation \"%s\": %d",
+			 get_rel_name(relid), ret);
+
+	nrows = (int64) SPI_processed;
+	spi_tupdesc = SPI_tuptable->tupdesc;
+
+	/* Prepare to evaluate the partitioning expression */
+	expr_state = ExecInitExpr((Expr *) copyObject(prel->expr), NULL);
+	econtext = CreateStandaloneExprContext();
+	slot = MakeSingleTupleTableSlot(tupdesc);
+
+	out_funcs = (FmgrInfo *) palloc0(sizeof(FmgrInfo) * tupdesc->natts);
+	for (i = 0; i < tupdesc->natts; i++)
+	{
+		Form_pg_attribute	attr = TupleDescAttr(tupdesc, i);
+		Oid					out_func;
+		bool				is_varlena;
+
+		if (attr->attisdropped)
+			continue;
+
+		getTypeOutputInfo(attr->atttypid, &out_func, &is_varlena);
+		fmgr_info(out_func, &out_funcs[i]);
+	}
+
+	local_rows = (Datum *) palloc(sizeof(Datum) * Max(nrows, 1));
+
+	/* Sort rows out by partitions */
+	for (i = 0; i < nrows; i++)
+	{
+		HeapTuple	tuple;
+		Datum		value;
+		bool		isnull;
+		Oid		   *parts;
+		int			nparts;
+
+		tuple = form_parent_tuple(SPI_tuptable->vals[i], spi_tupdesc, tupdesc);
+
+		ExecStoreTuple(tuple, slot, InvalidBuffer, false);
+		econtext->ecxt_scantuple = slot;
+		value = ExecEvalExprCompat(expr_state, econtext, &isnull,
+								   mult_result_handler);
+
+		if (isnull)
+			elog(ERROR, ERR_PART_ATTR_NULL);
+
+		parts = find_partitions_for_value(value, prel->ev_type, prel, &nparts);
+
+		if (nparts > 1)
+			elog(ERROR, ERR_PART_ATTR_MULTIPLE);
+
+		if (nparts == 1 && get_rel_relkind(parts[0]) == RELKIND_FOREIGN_TABLE)
+		{
+			CopyTarget *target = get_copy_target(&targets, parts[0]);
+
+			append_copy_row(&target->data, tuple, tupdesc, out_funcs);
+			target->nrows++;
+		}
+		/* Let the parent route it */
+		else local_rows[nlocal++] = heap_copy_tuple_as_datum(tuple, tupdesc);
+
+		ResetExprContext(econtext);
+	}
+
+	/* One COPY per foreign partition */
+	foreach (lc, targets)
+		send_copy_target((CopyTarget *) lfirst(lc), tupdesc);
+
+	if (nlocal > 0)
+	{
+		Oid		rowtype = RelationGetForm(parent_rel)->reltype;
+
+		arg = PointerGetDatum(construct_array(local_rows, nlocal, rowtype,
+											  -1, false, 'd'));
+		argtype = get_array_type(rowtype);
+
+		sql = psprintf("INSERT INTO %s SELECT * FROM unnest($1)", rel_name);
+		ret = SPI_execute_with_args(sql, 1, &argtype, &arg, NULL, false, 0);
+		if (ret != SPI_OK_INSERT)
+			elog(ERROR, "could not insert rows into relation \"%s\": %d",
+				 get_rel_name(relid), ret);
+	}
+
+	ExecDropSingleTupleTableSlot(slot);
+	FreeExprContext(econtext, true);
+	heap_close(parent_rel, NoLock);
+
+	return nrows;
+}
+
+/*
+ * "RETURNING *" skips dropped columns, put them back.
+ */
+static HeapTuple
+form_parent_tuple(HeapTuple tuple, TupleDesc spi_tupdesc, TupleDesc tupdesc)
+{
+	Datum	   *values = (Datum *) palloc0(sizeof(Datum) * tupdesc->natts);
+	bool	   *isnull = (bool *) palloc(sizeof(bool) * tupdesc->natts);
+	int			spi_attno = 0,
+				i;
+
+	for (i = 0; i < tupdesc->natts; i++)
+	{
+		if (TupleDescAttr(tupdesc, i)->attisdropped)
+		{
+			isnull[i] = true;
+			continue;
+		}
+
+		values[i] = heap_getattr(tuple, ++spi_attno, spi_tupdesc, &isnull[i]);
+	}
+
+	return heap_form_tuple(tupdesc, values, isnull);
+}
+
+static CopyTarget *
+get_copy_target(List **targets, Oid partid)
+{
+	CopyTarget *target;
+	ListCell   *lc;
+
+	foreach (lc, *targets)
+	{
+		target = (CopyTarget *) lfirst(lc);
+
+		if (target->partid == partid)
+			return target;
+	}
+
+	target = (CopyTarget *) palloc0(sizeof(CopyTarget));
+	target->partid = partid;
+	initStringInfo(&target->data);
+	*targets = lappend(*targets, target);
+
+	return target;
+}
+
+/*
+ * Append a row in COPY text format.
+ */
+static void
+append_copy_row(StringInfo buf, HeapTuple tuple,
+				TupleDesc tupdesc, FmgrInfo *out_funcs)
+{
+	bool	first = true;
+	int		i;
+
+	for (i = 0; i < tupdesc->natts; i++)
+	{
+		Datum	value;
+		bool	isnull;
+
+		if (TupleDescAttr(tupdesc, i)->attisdropped)
+			continue;
+
+		if (!first)
+			appendStringInfoChar(buf, '\t');
+		first = false;
+
+		value = heap_getattr(tuple, i + 1, tupdesc, &isnull);
+		if (isnull)
+			appendStringInfoString(buf, "\\N");
+		else
+			append_copy_text(buf, OutputFunctionCall(&out_funcs[i], value));
+	}
+
+	appendStringInfoChar(buf, '\n');
+}
+
+static void
+append_copy_text(StringInfo buf, const char *str)
+{
+	const char *ptr;
+
+	for (ptr = str; *ptr; ptr++)
+	{
+		switch (*ptr)
+		{
+			case '\\':
+				appendStringInfoString(buf, "\\\\");
+				break;
+
+			case '\t':
+				appendStringInfoString(buf, "\\t");
+				break;
+
+			case '\n':
+				appendStringInfoString(buf, "\\n");
+				break;
+
+			case '\r':
+				appendStringInfoString(buf, "\\r");
+				break;
+
+			default:
+				appendStringInfoChar(buf, *ptr);
+		}
+	}
+}
+
+/*
+ * Send the rows of a partition to its server.
+ */
+static void
+send_copy_target(CopyTarget *target, TupleDesc tupdesc)
+{
+	Relation		child_rel;
+	ForeignTable   *ftable;
+	UserMapping	   *user;
+	PGconn		   *conn;
+	PGresult	   *res;
+	char		   *sql;
+
+	/* Same lock as INSERT would take */
+	child_rel = heap_open(target->partid, RowExclusiveLock);
+	ftable = GetForeignTable(target->partid);
+
+	sql = psprintf("COPY %s (%s) FROM STDIN",
+				   remote_table_name(target->partid),
+				   remote_column_list(target->partid, tupdesc, NULL));
+
+	/* Join the remote transaction of this backend */
+	user = GetUserMapping(child_rel->rd_rel->relowner, ftable->serverid);
+	conn = GoguGetConnection(user, false, true);
+
+	res = PQexec(conn, sql);
+	if (PQresultStatus(res) != PGRES_COPY_IN)
+		Gogu_pgfdw_report_error(ERROR, res, conn, true, sql);
+	PQclear(res);
+
+	if (PQputCopyData(conn, target->data.data, target->data.len) != 1 ||
+		PQputCopyEnd(conn, NULL) != 1)
+		Gogu_pgfdw_report_error(ERROR, NULL, conn, false, sql);
+
+	res = Gogu_pgfdw_get_result(conn, sql);
+	if (PQresultStatus(res) != PGRES_COMMAND_OK)
+		Gogu_pgfdw_report_error(ERROR, res, conn, true, sql);
+	PQclear(res);
+
+	GoguReleaseConnection(conn);
+	heap_close(child_rel, NoLock);
+}
+
+/*
+ * Qualified name of the remote table of a foreign partition.
+ */
+static char *
+remote_table_name(Oid relid)
+{
+	ForeignTable   *ftable = GetForeignTable(relid);
+	const char	   *remote_schema = NULL,
+				   *remote_table = NULL;
+	ListCell	   *lc;
+
+	foreach (lc, ftable->options)
+	{
+		DefElem *def = (DefElem *) lfirst(lc);
+
+		if (strcmp(def->defname, "schema_name") == 0)
+			remote_schema = defGetString(def);
+		else if (strcmp(def->defname, "table_name") == 0)
+			remote_table = defGetString(def);
+	}
+
+	if (!remote_schema)
+		remote_schema = get_namespace_name(get_rel_namespace(relid));
+	if (!remote_table)
+		remote_table = get_rel_name(relid);
+
+	return quote_qualified_identifier(remote_schema, remote_table);
+}
+
+/*
+ * Remote names of the columns of 'tupdesc' in a foreign partition.
+ * Columns are matched by name, as INSERT does; 'renamed' is set if
+ * any remote name differs from ours.
+ */
+static char *
+remote_column_list(Oid relid, TupleDesc tupdesc, bool *renamed)
+{
+	StringInfoData	buf;
+	bool			first = true;
+	int				i;
+
+	initStringInfo(&buf);
+
+	for (i = 0; i < tupdesc->natts; i++)
+	{
+		Form_pg_attribute	attr = TupleDescAttr(tupdesc, i);
+		const char		   *colname = NameStr(attr->attname);
+		AttrNumber			attno;
+		ListCell		   *lc;
+
+		if (attr->attisdropped)
+			continue;
+
+		attno = get_attnum(relid, colname);
+		if (attno == InvalidAttrNumber)
+			elog(ERROR, "column \"%s\" of relation \"%s\" does not exist",
+				 colname, get_rel_name_or_relid(relid));
+
+		foreach (lc, GetForeignColumnOptions(relid, attno))
+		{
+			DefElem *def = (DefElem *) lfirst(lc);
+
+			if (strcmp(def->defname, "column_name") == 0)
+				colname = defGetString(def);
+		}
+
+		if (renamed && strcmp(colname, NameStr(attr->attname)) != 0)
+			*renamed = true;
+
+		if (!first)
+			appendStringInfoString(&buf, ", ");
+		first = false;
+
+		appendStringInfoString(&buf, quote_identifier(colname));
+	}
+
+	return buf.data;
+}
+
+
+/*
+ * Move rows of foreign partition 'source' which match 'condition' (all
+ * rows if it's NULL) to foreign partition 'target' without fetching
+ * them to the coordinator.
+ *
+ * If both tables are on the same server (and user mapping), a single
+ * statement does the job there; otherwise rows are deleted and streamed
+ * to the other server by a single "COPY (DELETE ... RETURNING) TO".
+ * Both run in the remote transactions of this backend.
+ *
+ * Returns false if that's not possible, and the caller should move the
+ * rows itself.
+ */
+bool
+partition_copy_remote_rows(Oid source, Oid target, const char *condition)
+{
+	Relation		source_rel,
+					target_rel;
+	ForeignTable   *source_ftable,
+				   *target_ftable;
+	UserMapping	   *source_user,
+				   *target_user;
+	TupleDesc		tupdesc;
+	char		   *source_table,
+				   *target_table,
+				   *source_cols,
+				   *target_cols,
+				   *where = "";
+	bool			renamed = false;
+
+	if (get_rel_relkind(source) != RELKIND_FOREIGN_TABLE ||
+		get_rel_relkind(target) != RELKIND_FOREIGN_TABLE)
+		return false;
+
+	/* Callers have locked both partitions */
+	source_rel = heap_open(source, NoLock);
+	target_rel = heap_open(target, NoLock);
+	tupdesc = RelationGetDescr(source_rel);
+
+	source_cols = remote_column_list(source, tupdesc, &renamed);
+	target_cols = remote_column_list(target, tupdesc, NULL);
+
+	/* 'condition' refers to our column names */
+	if (condition && renamed)
+	{
+		heap_close(source_rel, NoLock);
+		heap_close(target_rel, NoLock);
+		return false;
+	}
+
+	if (condition)
+		where = psprintf(" WHERE %s", condition);
+
+	source_table = remote_table_name(source);
+	target_table = remote_table_name(target);
+
+	source_ftable = GetForeignTable(source);
+	target_ftable = GetForeignTable(target);
+	source_user = GetUserMapping(source_rel->rd_rel->relowner,
+								 source_ftable->serverid);
+	target_user = GetUserMapping(target_rel->rd_rel->relowner,
+								 target_ftable->serverid);
+
+	if (source_user->umid == target_user->umid)
+	{
+		PGconn	   *conn = GoguGetConnection(source_user, false, true);
+		PGresult   *res;
+		char	   *sql;
+
+		/* Same as the coordinator would do, but on the shard */
+		sql = psprintf("WITH part_data AS (DELETE FROM %s%s RETURNING %s) "
+					   "INSERT INTO %s (%s) SELECT * FROM part_data",
+					   source_table, where, source_cols,
+					   target_table, target_cols);
+
+		res = Gogu_pgfdw_exec_query(conn, sql);
+		if (PQresultStatus(res) != PGRES_COMMAND_OK)
+			Gogu_pgfdw_report_error(ERROR, res, conn, true, sql);
+		PQclear(res);
+
+		GoguReleaseConnection(conn);
+	}
+	else
+	{
+		PGconn	   *src = GoguGetConnection(source_user, false, true),
+				   *dst = GoguGetConnection(target_user, false, true);
+
+		/*
+		 * Rows are deleted by the statement which sends them, so rows
+		 * written to the shard meanwhile are either moved or left alone
+		 */
+		stream_remote_rows(src,
+						   psprintf("COPY (DELETE FROM %s%s RETURNING %s) TO STDOUT",
+									source_table, where, source_cols),
+						   dst,
+						   psprintf("COPY %s (%s) FROM STDIN",
+									target_table, target_cols));
+
+		GoguReleaseConnection(src);
+		GoguReleaseConnection(dst);
+	}
+
+	heap_close(source_rel, NoLock);
+	heap_close(target_rel, NoLock);
+
+	return true;
+}
+
+/*
+ * Pipe "COPY TO STDOUT" of one server into "COPY FROM STDIN" of another.
+ */
+static void
+stream_remote_rows(PGconn *src, const char *copy_out,
+				   PGconn *dst, const char *copy_in)
+{
+	PGresult   *res;
+
+	res = PQexec(dst, copy_in);
+	if (PQresultStatus(res) != PGRES_COPY_IN)
+		Gogu_pgfdw_report_error(ERROR, res, dst, true, copy_in);
+	PQclear(res);
+
+	res = PQexec(src, copy_out);
+	if (PQresultStatus(res) != PGRES_COPY_OUT)
+		Gogu_pgfdw_report_error(ERROR, res, src, true, copy_out);
+	PQclear(res);
+
+	for (;;)
+	{
+		char   *buf;
+		int		len;
+
+		CHECK_FOR_INTERRUPTS();
+
+		len = PQgetCopyData(src, &buf, true);
+
+		/* Nothing to read yet, wait for the socket */
+		if (len == 0)
+		{
+			int wc;
+
+			wc = WaitLatchOrSocket(MyLatch,
+								   WL_LATCH_SET | WL_SOCKET_READABLE,
+								   PQsocket(src),
+								   -1L
+#if PG_VERSION_NUM >= 100000
+								   , PG_WAIT_EXTENSION
+#endif
+								   );
+			ResetLatch(MyLatch);
+
+			if ((wc & WL_SOCKET_READABLE) && !PQconsumeInput(src))
+				Gogu_pgfdw_report_error(ERROR, NULL, src, false, copy_out);
+			continue;
+		}
+
+		/* COPY is done */
+		if (len == -1)
+			break;
+
+		if (len < 0)
+			Gogu_pgfdw_report_error(ERROR, NULL, src, false, copy_out);
+
+		if (PQputCopyData(dst, buf, len) != 1)
+		{
+			PQfreemem(buf);
+			Gogu_pgfdw_report_error(ERROR, NULL, dst, false, copy_in);
+		}
+		PQfreemem(buf);
+	}
+
+	if (PQputCopyEnd(dst, NULL) != 1)
+		Gogu_pgfdw_report_error(ERROR, NULL, dst, false, copy_in);
+
+	res = Gogu_pgfdw_get_result(dst, copy_in);
+	if (PQresultStatus(res) != PGRES_COMMAND_OK)
+		Gogu_pgfdw_report_error(ERROR, res, dst, true, copy_in);
+	PQclear(res);
+
+	res = Gogu_pgfdw_get_result(src, copy_out);
+	if (PQresultStatus(res) != PGRES_COMMAND_OK)
+		Gogu_pgfdw_report_error(ERROR, res, src, true, copy_out);
+	PQclear(res);
+}
@@ -83,6 +83,16 @@ static Oid create_single_fdw_partition_internal(Oid parent_relid,
 												char *servername,
 												char *remote_schema);
 
+static Oid create_fdw_hash_partition(Oid parent_relid,
+									 uint32 part_idx,
+									 uint32 part_count,
+									 RangeVar *partition_rv,
+									 char *tablespace,
+									 char *remote_schema,
+									 Node *expr,
+									 Oid expr_type,
+									 List *trigger_columns);
+
 static char *choose_range_partition_name(Oid parent_relid, Oid parent_nsp);
 static char *choose_hash_partition_name(Oid parent_relid, Oid parent_nsp, uint32 part_idx);
 
@@ -310,11 +320,64 @@ create_single_fdw_hash_partition_internal(Oid parent_relid,
 									  char *tablespace,
 									  char *remote_schema)
 {
-	Oid			partition_relid, expr_type;
+	List	   *trigger_columns = NIL;
+	Node	   *expr;
+	Oid			expr_type;
+
+	/* check pathman config and fill variables */
+	expr = build_partitioning_expression(parent_relid, &expr_type, &trigger_columns);
+
+	return create_fdw_hash_partition(parent_relid, part_idx, part_count,
+									 partition_rv, tablespace, remote_schema,
+									 expr, expr_type, trigger_columns);
+}
+
+/*
+ * Create all fdw HASH partitions of a table, building the partitioning
+ * expression only once.
+ */
+void
+create_fdw_hash_partitions_internal(Oid parent_relid,
+									uint32 part_count,
+									RangeVar **rangevars,
+									char **tablespaces,
+									char *remote_schema)
+{
+	List	   *trigger_columns = NIL;
+	Node	   *expr;
+	Oid			expr_type;
+	uint32		i;
+
+	/* check pathman config and fill variables */
+	expr = build_partitioning_expression(parent_relid, &expr_type, &trigger_columns);
+
+	for (i = 0; i < part_count; i++)
+	{
+		RangeVar   *partition_rv	= rangevars ? rangevars[i] : NULL;
+		char	   *tablespace		= tablespaces ? tablespaces[i] : NULL;
+
+		/* Create a partition (copy FKs, invoke callbacks etc) */
+		create_fdw_hash_partition(parent_relid, i, part_count,
+								  partition_rv, tablespace, remote_schema,
+								  copyObject(expr), expr_type, trigger_columns);
+	}
+}
+
+/* Create one fdw HASH partition using a prepared partitioning expression */
+static Oid
+create_fdw_hash_partition(Oid parent_relid,
+						  uint32 part_idx,
+						  uint32 part_count,
+						  RangeVar *partition_rv,
+						  char *tablespace,
+						  char *remote_schema,
+						  Node *expr,
+						  Oid expr_type,
+						  List *trigger_columns)
+{
+	Oid			partition_relid;
 	Constraint		*check_constr;
 	init_callback_params	callback_params;
-	List			*trigger_columns = NIL;
-	Node			*expr;
 	char 			*server;
 	int			part_per_server = part_count/rangeServerSet->server_count;
 
@@ -344,9 +407,6 @@ create_single_fdw_hash_partition_internal(Oid parent_relid,
 													   		server,
 															remote_schema);
 
-	/* check pathman config and fill variables */
-	expr = build_partitioning_expression(parent_relid, &expr_type, &trigger_columns);
-
 	/* Build check constraint for HASH partition */
 	check_constr = build_remote_hash_check_constraint(partition_relid,
 											   expr,
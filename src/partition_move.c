@@ -0,0 +1,1436 @@
+/*-------------------------------------------------------------------------
+ *
+ * partition_move.c
+ *		Online relocation of a remote partition to another foreign server
+ *
+ *		The move is done by PartitionMoveWorker in several steps:
+ *
+ *			* create the remote table on the target server;
+ *			* create a publication and a logical replication slot on the
+ *			  source server, then stream the table contents to the target
+ *			  via COPY using the snapshot exported by the slot;
+ *			* create a subscription on the target server which replays
+ *			  everything committed after that snapshot;
+ *			* lock the coordinator partition, wait until the target has
+ *			  confirmed the source's current WAL position, then switch
+ *			  the foreign table's server.
+ *
+ *		The foreign table's server is the partition's placement, so
+ *		server_map (which is shared by all HASH tables) is left alone.
+ *
+ *		Both remote servers must run PostgreSQL 10+ with wal_level=logical
+ *		on the source side.  The old remote table is left in place.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "init.h"
+#include "partition_move.h"
+#include "pathman_workers.h"
+#include "relation_info.h"
+#include "utils.h"
+#include "connection_pool.h"
+
+#include <math.h>
+
+#include "access/heapam.h"
+#include "access/htup_details.h"
+#include "access/xact.h"
+#include "catalog/pg_class.h"
+#include "catalog/pg_type.h"
+#include "executor/spi.h"
+#include "foreign/foreign.h"
+#include "funcapi.h"
+#include "miscadmin.h"
+#include "pgstat.h"
+#include "postmaster/bgworker.h"
+#include "storage/ipc.h"
+#include "storage/latch.h"
+#include "storage/lmgr.h"
+#include "storage/proc.h"
+#include "storage/shmem.h"
+#include "utils/builtins.h"
+#include "utils/inval.h"
+#include "utils/lsyscache.h"
+#include "utils/memutils.h"
+#include "utils/rel.h"
+#include "utils/resowner.h"
+#include "utils/snapmgr.h"
+#include "utils/timestamp.h"
+
+
+/* Declarations for PartitionMoveWorker */
+PG_FUNCTION_INFO_V1( move_partition );
+PG_FUNCTION_INFO_V1( show_partition_moves_internal );
+PG_FUNCTION_INFO_V1( rebalance );
+
+
+/*
+ * Dynamically resolve functions (for BGW API).
+ */
+extern PGDLLEXPORT void bgw_main_move_partition(Datum main_arg);
+
+
+/*
+ * Everything PartitionMoveWorker knows about the partition being moved.
+ */
+typedef struct
+{
+	Oid			relid;				/* coordinator partition */
+	Oid			source_server;
+	Oid			target_server;
+	char	   *target_name;		/* name of target server */
+
+	char	   *remote_table;		/* qualified remote table name */
+	char	   *table_def;			/* CREATE TABLE for target server */
+	char	   *index_def;			/* CREATE INDEX for target server */
+	char	   *source_conninfo;	/* used by subscription */
+	char	   *repl_name;			/* publication, slot, subscription */
+
+	PGconn	   *source_conn;
+	PGconn	   *target_conn;
+	PGconn	   *repl_conn;			/* walsender connection to source */
+
+	/* Remote objects we have to drop on failure */
+	bool		target_created;
+	bool		pub_created;
+	bool		slot_created;
+	bool		sub_created;
+	bool		switched;
+} PartitionMoveState;
+
+
+/*
+ * Function context for show_partition_moves_internal() SRF.
+ */
+typedef struct
+{
+	int cur_idx; /* current slot to be processed */
+} active_moves_cxt;
+
+
+/*
+ * Slots for partition moves.
+ */
+static PartitionMoveSlot   *partition_move_slots;
+
+static const char		   *partition_move_bgw = "PartitionMoveWorker";
+
+
+static void prepare_move_state(PartitionMoveState *state,
+							   PartitionMoveSlot *move_slot);
+static void copy_initial_data(PartitionMoveState *state,
+							  PartitionMoveSlot *move_slot);
+static void wait_for_catchup(PartitionMoveState *state);
+static bool switch_partition_server(PartitionMoveState *state);
+static void cleanup_partition_move(int code, Datum arg);
+
+
+/*
+ * Estimate amount of shmem needed for partition moves.
+ */
+Size
+estimate_partition_move_slots_size(void)
+{
+	/* NOTE: we suggest that max_worker_processes is in PGC_POSTMASTER */
+	return sizeof(PartitionMoveSlot) * PARTITION_MOVE_SLOTS;
+}
+
+/*
+ * Initialize shared memory needed for partition moves.
+ */
+void
+init_partition_move_slots(void)
+{
+	bool	found;
+	Size	size = estimate_partition_move_slots_size();
+
+	partition_move_slots = (PartitionMoveSlot *)
+			ShmemInitStruct("array of PartitionMoveSlots", size, &found);
+
+	/* Initialize 'partition_move_slots' if needed */
+	if (!found)
+		init_worker_slots(&partition_move_slots->head, sizeof(PartitionMoveSlot),
+						  PARTITION_MOVE_SLOTS);
+}
+
+
+/*
+ * ------------------------------------
+ *  PartitionMoveWorker implementation
+ * ------------------------------------
+ */
+
+/* Sleep for 'timeout' ms or until our latch is set */
+static void
+move_worker_sleep(long timeout)
+{
+	int rc;
+
+	rc = WaitLatch(MyLatch,
+				   WL_LATCH_SET | WL_TIMEOUT | WL_POSTMASTER_DEATH,
+				   timeout
+#if PG_VERSION_NUM >= 100000
+				   , PG_WAIT_EXTENSION
+#endif
+				   );
+	ResetLatch(MyLatch);
+
+	if (rc & WL_POSTMASTER_DEATH)
+		proc_exit(1);
+
+	CHECK_FOR_INTERRUPTS();
+}
+
+/* Run a query which must return exactly one row, return its first value */
+static char *
+remote_query_value(PGconn *conn, const char *sql)
+{
+	PGresult   *res;
+	char	   *value = NULL;
+
+	res = Gogu_pgfdw_exec_query(conn, sql);
+	if (PQresultStatus(res) != PGRES_TUPLES_OK)
+		Gogu_pgfdw_report_error(ERROR, res, conn, true, sql);
+
+	if (PQntuples(res) == 1 && !PQgetisnull(res, 0, 0))
+		value = pstrdup(PQgetvalue(res, 0, 0));
+	PQclear(res);
+
+	return value;
+}
+
+/* Make sure that remote server supports logical replication */
+static void
+check_remote_version(PGconn *conn, Oid serverid)
+{
+	if (PQserverVersion(conn) < 100000)
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("server \"%s\" does not support logical replication",
+						GetForeignServer(serverid)->servername),
+				 errhint("PostgreSQL 10 or later is required to move partitions.")));
+}
+
+/*
+ * Entry point for PartitionMoveWorker's process.
+ */
+void
+bgw_main_move_partition(Datum main_arg)
+{
+	PartitionMoveSlot	   *move_slot;
+	PartitionMoveState		state;
+	int						attempts = 0;
+
+	/* Update partition move slot */
+	move_slot = &partition_move_slots[DatumGetInt32(main_arg)];
+	attach_worker_slot(&move_slot->head, partition_move_bgw);
+
+	memset(&state, 0, sizeof(state));
+
+	/* Drop replication objects whatever happens (ERROR or FATAL) */
+	PG_ENSURE_ERROR_CLEANUP(cleanup_partition_move, PointerGetDatum(&state));
+	{
+		/* Initialize gogudb's local config and resolve the partition */
+		StartTransactionCommand();
+		bg_worker_load_config(partition_move_bgw);
+		prepare_move_state(&state, move_slot);
+		CommitTransactionCommand();
+
+		pms_set_status(move_slot, PMS_COPYING);
+		copy_initial_data(&state, move_slot);
+
+		/* Try to switch till the target keeps up */
+		for (;;)
+		{
+			pms_set_status(move_slot, PMS_CATCHING_UP);
+			wait_for_catchup(&state);
+
+			pms_set_status(move_slot, PMS_SWITCHING);
+			if (switch_partition_server(&state))
+				break;
+
+			if (++attempts >= PARTITION_MOVE_MAX_ATTEMPTS)
+				elog(ERROR, "%s: could not switch partition \"%s\" after %d attempts",
+					 partition_move_bgw, get_rel_name_or_relid(state.relid),
+					 PARTITION_MOVE_MAX_ATTEMPTS);
+
+			ereport(LOG,
+					(errmsg("%s: target server is lagging behind, retrying",
+							partition_move_bgw),
+					 errdetail("attempt: %d/%d", attempts,
+							   PARTITION_MOVE_MAX_ATTEMPTS)));
+		}
+
+		pms_set_status(move_slot, PMS_CLEANUP);
+	}
+	PG_END_ENSURE_ERROR_CLEANUP(cleanup_partition_move, PointerGetDatum(&state));
+
+	/* Drop subscription & publication, keep the old remote table */
+	cleanup_partition_move(0, PointerGetDatum(&state));
+
+	elog(LOG, "%s: partition %u has been moved to server \"%s\", "
+			  "remote table %s may now be dropped on the old server",
+		 partition_move_bgw, state.relid, state.target_name, state.remote_table);
+}
+
+/*
+ * Collect everything we need to know about the partition and open
+ * connections to both servers.  Must be called in a transaction.
+ */
+static void
+prepare_move_state(PartitionMoveState *state, PartitionMoveSlot *move_slot)
+{
+	MemoryContext			old_mcxt;
+	ForeignTable		   *ftable;
+	Relation				child_rel;
+	Oid						parent_relid,
+							owner;
+	UserMapping			   *source_user,
+						   *target_user;
+	const char			   *remote_schema = NULL,
+						   *remote_table = NULL;
+	StringInfoData			buf;
+
+	/* State must survive transaction end */
+	old_mcxt = MemoryContextSwitchTo(TopMemoryContext);
+
+	state->relid = move_slot->head.relid;
+	state->target_server = move_slot->target_server;
+	state->repl_name = psprintf("gogudb_move_%u_%u",
+								move_slot->head.dbid, move_slot->head.relid);
+
+	if (get_rel_relkind(state->relid) != RELKIND_FOREIGN_TABLE)
+		elog(ERROR, "relation %u is not a foreign table", state->relid);
+
+	ftable = GetForeignTable(state->relid);
+	state->source_server = ftable->serverid;
+	state->target_name = pstrdup(GetForeignServer(state->target_server)->servername);
+
+	GoguGetRemoteTableName(state->relid, &remote_schema, &remote_table);
+	state->remote_table = quote_qualified_identifier(remote_schema,
+													 remote_table);
+
+	/* Remote table is built after the parent, as in spawn_partitions_val() */
+	parent_relid = get_parent_of_partition(state->relid, NULL);
+	if (!OidIsValid(parent_relid))
+		elog(ERROR, "relation \"%s\" is not a partition",
+			 get_rel_name_or_relid(state->relid));
+
+	initStringInfo(&buf);
+	appendStringInfo(&buf, "CREATE TABLE %s ", state->remote_table);
+	buildCTS4RemoteServer(&buf, parent_relid);
+	state->table_def = buf.data;
+
+	initStringInfo(&buf);
+	buildCIS4RemoteServer(&buf, parent_relid, remote_schema, remote_table);
+	state->index_def = buf.len > 0 ? buf.data : NULL;
+
+	/* Use the same user mappings as the rest of gogudb */
+	child_rel = heap_open(state->relid, AccessShareLock);
+	owner = child_rel->rd_rel->relowner;
+	heap_close(child_rel, AccessShareLock);
+
+	source_user = GetUserMapping(owner, state->source_server);
+	target_user = GetUserMapping(owner, state->target_server);
+	state->source_conninfo = GoguBuildConnInfo(source_user);
+
+	MemoryContextSwitchTo(old_mcxt);
+
+	state->source_conn = GoguOpenConnection(source_user, false);
+	state->target_conn = GoguOpenConnection(target_user, false);
+	state->repl_conn = GoguOpenConnection(source_user, true);
+
+	check_remote_version(state->source_conn, state->source_server);
+	check_remote_version(state->target_conn, state->target_server);
+}
+
+/* Sleep if we're streaming faster than 'max_rate' kB/s */
+static void
+throttle_copy(int32 max_rate, int64 copied, TimestampTz started)
+{
+	long	secs;
+	int		usecs;
+	int64	elapsed,
+			expected;
+
+	if (max_rate <= 0)
+		return;
+
+	TimestampDifference(started, GetCurrentTimestamp(), &secs, &usecs);
+	elapsed = secs * USECS_PER_SEC + usecs;
+	expected = copied * USECS_PER_SEC / ((int64) max_rate * 1024);
+
+	if (expected > elapsed)
+		move_worker_sleep((long) ((expected - elapsed) / 1000) + 1);
+}
+
+/*
+ * Pipe "COPY TO STDOUT" of the source into "COPY FROM STDIN" of the target.
+ */
+static void
+stream_remote_table(PartitionMoveState *state, PartitionMoveSlot *move_slot)
+{
+	PGconn	   *src = state->source_conn,
+			   *dst = state->target_conn;
+	char	   *copy_out = psprintf("COPY %s TO STDOUT", state->remote_table),
+			   *copy_in = psprintf("COPY %s FROM STDIN", state->remote_table);
+	PGresult   *res;
+	int64		copied = 0,
+				reported = 0;
+	TimestampTz	started = GetCurrentTimestamp();
+
+	res = PQexec(dst, copy_in);
+	if (PQresultStatus(res) != PGRES_COPY_IN)
+		Gogu_pgfdw_report_error(ERROR, res, dst, true, copy_in);
+	PQclear(res);
+
+	res = PQexec(src, copy_out);
+	if (PQresultStatus(res) != PGRES_COPY_OUT)
+		Gogu_pgfdw_report_error(ERROR, res, src, true, copy_out);
+	PQclear(res);
+
+	for (;;)
+	{
+		char   *buf;
+		int		len;
+
+		CHECK_FOR_INTERRUPTS();
+
+		len = PQgetCopyData(src, &buf, true);
+
+		/* Nothing to read yet, wait for the socket */
+		if (len == 0)
+		{
+			int wc;
+
+			wc = WaitLatchOrSocket(MyLatch,
+								   WL_LATCH_SET | WL_SOCKET_READABLE,
+								   PQsocket(src),
+								   -1L
+#if PG_VERSION_NUM >= 100000
+								   , PG_WAIT_EXTENSION
+#endif
+								   );
+			ResetLatch(MyLatch);
+
+			if ((wc & WL_SOCKET_READABLE) && !PQconsumeInput(src))
+				Gogu_pgfdw_report_error(ERROR, NULL, src, false, copy_out);
+			continue;
+		}
+
+		/* COPY is done */
+		if (len == -1)
+			break;
+
+		if (len < 0)
+			Gogu_pgfdw_report_error(ERROR, NULL, src, false, copy_out);
+
+		if (PQputCopyData(dst, buf, len) != 1)
+		{
+			PQfreemem(buf);
+			Gogu_pgfdw_report_error(ERROR, NULL, dst, false, copy_in);
+		}
+		PQfreemem(buf);
+
+		copied += len;
+		if (copied - reported >= PARTITION_MOVE_CHUNK)
+		{
+			SpinLockAcquire(&move_slot->head.mutex);
+			move_slot->bytes_copied = copied;
+			SpinLockRelease(&move_slot->head.mutex);
+
+			reported = copied;
+			throttle_copy(move_slot->max_rate, copied, started);
+		}
+	}
+
+	if (PQputCopyEnd(dst, NULL) != 1)
+		Gogu_pgfdw_report_error(ERROR, NULL, dst, false, copy_in);
+
+	res = Gogu_pgfdw_get_result(dst, copy_in);
+	if (PQresultStatus(res) != PGRES_COMMAND_OK)
+		Gogu_pgfdw_report_error(ERROR, res, dst, true, copy_in);
+	PQclear(res);
+
+	res = Gogu_pgfdw_get_result(src, copy_out);
+	if (PQresultStatus(res) != PGRES_COMMAND_OK)
+		Gogu_pgfdw_report_error(ERROR, res, src, true, copy_out);
+	PQclear(res);
+
+	SpinLockAcquire(&move_slot->head.mutex);
+	move_slot->bytes_copied = copied;
+	SpinLockRelease(&move_slot->head.mutex);
+}
+
+/*
+ * Create the remote table on the target server and fill it with a
+ * consistent copy of the source; start replicating from that point.
+ */
+static void
+copy_initial_data(PartitionMoveState *state, PartitionMoveSlot *move_slot)
+{
+	char	   *sql;
+	char	   *snapshot;
+	PGresult   *res;
+
+	GoguRunCommand(state->target_conn, state->table_def);
+	state->target_created = true;
+
+	/* Publication must exist before the slot starts decoding */
+	sql = psprintf("CREATE PUBLICATION %s FOR TABLE %s",
+				   state->repl_name, state->remote_table);
+	GoguRunCommand(state->source_conn, sql);
+	state->pub_created = true;
+
+	/* The slot exports the snapshot the COPY has to see */
+	sql = psprintf("CREATE_REPLICATION_SLOT %s LOGICAL pgoutput EXPORT_SNAPSHOT",
+				   state->repl_name);
+	res = PQexec(state->repl_conn, sql);
+	if (PQresultStatus(res) != PGRES_TUPLES_OK)
+		Gogu_pgfdw_report_error(ERROR, res, state->repl_conn, true, sql);
+	state->slot_created = true;
+	snapshot = pstrdup(PQgetvalue(res, 0, 2));
+	PQclear(res);
+
+	GoguRunCommand(state->source_conn, "BEGIN ISOLATION LEVEL REPEATABLE READ");
+	GoguRunCommand(state->source_conn,
+				   psprintf("SET TRANSACTION SNAPSHOT %s",
+							quote_literal_cstr(snapshot)));
+
+	/* Snapshot is imported, walsender is not needed anymore */
+	GoguCloseConnection(state->repl_conn);
+	state->repl_conn = NULL;
+
+	stream_remote_table(state, move_slot);
+	GoguRunCommand(state->source_conn, "COMMIT");
+
+	/* Indexes are cheaper to build after the data is loaded */
+	if (state->index_def)
+		GoguRunCommand(state->target_conn, state->index_def);
+
+	/* Replay everything committed after the snapshot */
+	sql = psprintf("CREATE SUBSCRIPTION %s CONNECTION %s PUBLICATION %s "
+				   "WITH (create_slot = false, slot_name = %s, copy_data = false)",
+				   state->repl_name,
+				   quote_literal_cstr(state->source_conninfo),
+				   state->repl_name,
+				   state->repl_name);
+	GoguRunCommand(state->target_conn, sql);
+	state->sub_created = true;
+}
+
+/*
+ * Wait until the subscription is less than PARTITION_MOVE_MAX_LAG behind.
+ */
+static void
+wait_for_catchup(PartitionMoveState *state)
+{
+	char   *sql;
+
+	sql = psprintf("SELECT pg_catalog.pg_wal_lsn_diff(pg_catalog.pg_current_wal_lsn(), "
+				   "confirmed_flush_lsn) FROM pg_catalog.pg_replication_slots "
+				   "WHERE slot_name = '%s'",
+				   state->repl_name);
+
+	for (;;)
+	{
+		char *lag = remote_query_value(state->source_conn, sql);
+
+		if (lag == NULL)
+			elog(ERROR, "replication slot \"%s\" does not exist", state->repl_name);
+
+		if (strtoll(lag, NULL, 10) <= PARTITION_MOVE_MAX_LAG)
+			break;
+
+		move_worker_sleep(1000L);
+	}
+}
+
+/*
+ * Lock the coordinator partition, wait till the target has applied all
+ * changes and flip the server.  Return false if we ran out of time.
+ */
+static bool
+switch_partition_server(PartitionMoveState *state)
+{
+	TimestampTz	deadline;
+	char	   *source_lsn;
+	char	   *sql;
+	bool		locked = false;
+	bool		synced = false;
+
+	deadline = TimestampTzPlusMilliseconds(GetCurrentTimestamp(),
+										   PARTITION_MOVE_LOCK_TIMEOUT);
+
+	StartTransactionCommand();
+
+	/* Don't queue behind long transactions, this would block everyone */
+	while (!(locked = ConditionalLockRelationOid(state->relid, AccessExclusiveLock)))
+	{
+		if (GetCurrentTimestamp() >= deadline)
+			break;
+		move_worker_sleep(10L);
+	}
+
+	if (!locked)
+	{
+		AbortCurrentTransaction();
+		return false;
+	}
+
+	/* Nobody writes through the coordinator now, wait for the rest */
+	source_lsn = remote_query_value(state->source_conn,
+									"SELECT pg_catalog.pg_current_wal_lsn()");
+	sql = psprintf("SELECT confirmed_flush_lsn >= '%s'::pg_lsn "
+				   "FROM pg_catalog.pg_replication_slots WHERE slot_name = '%s'",
+				   source_lsn, state->repl_name);
+
+	while (GetCurrentTimestamp() < deadline)
+	{
+		char *value = remote_query_value(state->source_conn, sql);
+
+		if (value && strcmp(value, "t") == 0)
+		{
+			synced = true;
+			break;
+		}
+		move_worker_sleep(50L);
+	}
+
+	if (!synced)
+	{
+		AbortCurrentTransaction();
+		return false;
+	}
+
+	if (SPI_connect() != SPI_OK_CONNECT)
+		elog(ERROR, "could not connect using SPI");
+
+	PushActiveSnapshot(GetTransactionSnapshot());
+
+	/* ALTER FOREIGN TABLE cannot change the server, see Expansion.md */
+	sql = psprintf("UPDATE pg_catalog.pg_foreign_table SET ftserver = %u "
+				   "WHERE ftrelid = %u",
+				   state->target_server, state->relid);
+	if (SPI_execute(sql, false, 0) != SPI_OK_UPDATE || SPI_processed != 1)
+		elog(ERROR, "could not change server of partition %u", state->relid);
+
+	sql = psprintf("UPDATE pg_catalog.pg_depend SET refobjid = %u "
+				   "WHERE classid = 'pg_catalog.pg_class'::regclass "
+				   "AND objid = %u "
+				   "AND refclassid = 'pg_catalog.pg_foreign_server'::regclass "
+				   "AND refobjid = %u",
+				   state->target_server, state->relid, state->source_server);
+	if (SPI_execute(sql, false, 0) != SPI_OK_UPDATE)
+		elog(ERROR, "could not update dependencies of partition %u", state->relid);
+
+	SPI_finish();
+	PopActiveSnapshot();
+
+	/* Make backends rebuild plans which reference the partition */
+	CacheInvalidateRelcacheByRelid(state->relid);
+
+	CommitTransactionCommand();
+	state->switched = true;
+
+	return true;
+}
+
+/* Run a cleanup command, don't throw on failure */
+static void
+run_cleanup_command(PGconn *conn, const char *sql)
+{
+	PGresult *res;
+
+	/* Connection might be broken or stuck in the middle of COPY */
+	if (PQstatus(conn) != CONNECTION_OK ||
+		PQtransactionStatus(conn) != PQTRANS_IDLE)
+		PQreset(conn);
+
+	res = PQexec(conn, sql);
+	if (PQresultStatus(res) != PGRES_COMMAND_OK &&
+		PQresultStatus(res) != PGRES_TUPLES_OK)
+		elog(LOG, "%s: could not execute \"%s\": %s",
+			 partition_move_bgw, sql, PQerrorMessage(conn));
+	PQclear(res);
+}
+
+/*
+ * Drop replication objects, and the target table unless the move has
+ * completed.  Also used as the ERROR/FATAL cleanup callback.
+ */
+static void
+cleanup_partition_move(int code, Datum arg)
+{
+	PartitionMoveState *state = (PartitionMoveState *) DatumGetPointer(arg);
+	char			   *name = state->repl_name;
+
+	if (state->repl_conn)
+	{
+		GoguCloseConnection(state->repl_conn);
+		state->repl_conn = NULL;
+	}
+
+	if (state->sub_created)
+	{
+		/* Detach the slot if we're giving up, so DROP won't wait for it */
+		if (!state->switched)
+		{
+			run_cleanup_command(state->target_conn,
+								psprintf("ALTER SUBSCRIPTION %s DISABLE", name));
+			run_cleanup_command(state->target_conn,
+								psprintf("ALTER SUBSCRIPTION %s SET (slot_name = NONE)",
+										 name));
+		}
+		else
+			state->slot_created = false; /* dropped along with subscription */
+
+		run_cleanup_command(state->target_conn,
+							psprintf("DROP SUBSCRIPTION %s", name));
+		state->sub_created = false;
+	}
+
+	if (state->slot_created)
+	{
+		run_cleanup_command(state->source_conn,
+							psprintf("SELECT pg_catalog.pg_drop_replication_slot(slot_name) "
+									 "FROM pg_catalog.pg_replication_slots "
+									 "WHERE slot_name = '%s'", name));
+		state->slot_created = false;
+	}
+
+	if (state->pub_created)
+	{
+		run_cleanup_command(state->source_conn,
+							psprintf("DROP PUBLICATION IF EXISTS %s", name));
+		state->pub_created = false;
+	}
+
+	if (state->target_created && !state->switched)
+	{
+		run_cleanup_command(state->target_conn,
+							psprintf("DROP TABLE IF EXISTS %s", state->remote_table));
+		state->target_created = false;
+	}
+
+	GoguCloseConnection(state->source_conn);
+	GoguCloseConnection(state->target_conn);
+	state->source_conn = state->target_conn = NULL;
+}
+
+
+/*
+ * ------------------------------------------------
+ *  Public interface for the PartitionMoveWorker
+ * ------------------------------------------------
+ */
+
+/*
+ * Check arguments, take a free slot and start PartitionMoveWorker.
+ * NOTE: this function returns immediately.
+ */
+int
+start_partition_move(Oid relid, Oid target_server, int32 max_rate)
+{
+	ForeignTable   *ftable;
+	ForeignServer  *source,
+				   *target;
+	int				empty_slot_idx;
+
+	if (!superuser())
+		ereport(ERROR, (errcode(ERRCODE_INSUFFICIENT_PRIVILEGE),
+						errmsg("must be superuser to move partitions")));
+
+	if (max_rate < 0)
+		ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+						errmsg("'max_rate' should not be less than 0")));
+
+	if (get_rel_relkind(relid) != RELKIND_FOREIGN_TABLE ||
+		!OidIsValid(get_parent_of_partition(relid, NULL)))
+		ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+						errmsg("\"%s\" is not a remote partition",
+							   get_rel_name_or_relid(relid))));
+
+	ftable = GetForeignTable(relid);
+	source = GetForeignServer(ftable->serverid);
+	target = GetForeignServer(target_server);
+
+	if (source->serverid == target->serverid)
+		ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+						errmsg("partition \"%s\" already belongs to server \"%s\"",
+							   get_rel_name(relid), target->servername)));
+
+	if (source->fdwid != target->fdwid)
+		ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+						errmsg("server \"%s\" uses another foreign-data wrapper",
+							   target->servername)));
+
+	empty_slot_idx = claim_worker_slot(&partition_move_slots->head,
+									   sizeof(PartitionMoveSlot),
+									   PARTITION_MOVE_SLOTS,
+									   GetUserId(), relid, PMS_PREPARING);
+	if (empty_slot_idx < 0)
+		ereport(ERROR, (errmsg("partition \"%s\" is already being moved",
+							   get_rel_name(relid))));
+	else
+	{
+		PartitionMoveSlot *slot = &partition_move_slots[empty_slot_idx];
+
+		InitPartitionMoveSlot(slot, target_server, max_rate);
+		namestrcpy(&slot->target_name, target->servername);
+
+		SpinLockRelease(&slot->head.mutex);
+	}
+
+	/* Start worker (we should not wait) */
+	launch_worker(&partition_move_slots[empty_slot_idx].head, empty_slot_idx,
+				  partition_move_bgw, CppAsString(bgw_main_move_partition));
+
+	return empty_slot_idx;
+}
+
+/*
+ * Is the slot still occupied by the move of 'relid'?
+ */
+bool
+partition_move_is_active(int slot_idx, Oid relid)
+{
+	PartitionMoveSlot  *slot = &partition_move_slots[slot_idx];
+	bool				result;
+
+	SpinLockAcquire(&slot->head.mutex);
+	result = (slot->head.worker_status != PMS_FREE &&
+			  slot->head.relid == relid &&
+			  slot->head.dbid == MyDatabaseId);
+	SpinLockRelease(&slot->head.mutex);
+
+	return result;
+}
+
+/*
+ * Move a remote partition to another foreign server without downtime.
+ */
+Datum
+move_partition(PG_FUNCTION_ARGS)
+{
+	Oid		relid = PG_GETARG_OID(0);
+	char   *target = TextDatumGetCString(PG_GETARG_DATUM(1));
+	int32	max_rate = PG_GETARG_INT32(2);
+
+	start_partition_move(relid,
+						 GetForeignServerByName(target, false)->serverid,
+						 max_rate);
+
+	elog(NOTICE,
+		 "worker started, you can watch it in %s.gogudb_partition_moves",
+		 get_namespace_name(get_pathman_schema()));
+
+	PG_RETURN_VOID();
+}
+
+/*
+ * Return list of active partition moves.
+ * NOTE: this is a set-returning-function (SRF).
+ */
+Datum
+show_partition_moves_internal(PG_FUNCTION_ARGS)
+{
+	FuncCallContext	   *funcctx;
+	active_moves_cxt   *userctx;
+	PartitionMoveSlot	slot_copy;
+
+	/*
+	 * Initialize tuple descriptor & function call context.
+	 */
+	if (SRF_IS_FIRSTCALL())
+	{
+		TupleDesc			tupdesc;
+		MemoryContext		old_mcxt;
+
+		funcctx = SRF_FIRSTCALL_INIT();
+
+		old_mcxt = MemoryContextSwitchTo(funcctx->multi_call_memory_ctx);
+
+		userctx = (active_moves_cxt *) palloc(sizeof(active_moves_cxt));
+		userctx->cur_idx = 0;
+
+		/* Create tuple descriptor */
+		tupdesc = CreateTemplateTupleDesc(Natts_partition_moves, false);
+
+		TupleDescInitEntry(tupdesc, Anum_partition_moves_userid,
+						   "userid", REGROLEOID, -1, 0);
+		TupleDescInitEntry(tupdesc, Anum_partition_moves_pid,
+						   "pid", INT4OID, -1, 0);
+		TupleDescInitEntry(tupdesc, Anum_partition_moves_dbid,
+						   "dbid", OIDOID, -1, 0);
+		TupleDescInitEntry(tupdesc, Anum_partition_moves_partition,
+						   "partition", REGCLASSOID, -1, 0);
+		TupleDescInitEntry(tupdesc, Anum_partition_moves_target,
+						   "target_server", TEXTOID, -1, 0);
+		TupleDescInitEntry(tupdesc, Anum_partition_moves_copied,
+						   "copied", INT8OID, -1, 0);
+		TupleDescInitEntry(tupdesc, Anum_partition_moves_status,
+						   "status", TEXTOID, -1, 0);
+
+		funcctx->tuple_desc = BlessTupleDesc(tupdesc);
+		funcctx->user_fctx = (void *) userctx;
+
+		MemoryContextSwitchTo(old_mcxt);
+	}
+
+	funcctx = SRF_PERCALL_SETUP();
+	userctx = (active_moves_cxt *) funcctx->user_fctx;
+
+	/* Iterate through worker slots */
+	if (next_worker_slot(&partition_move_slots->head, sizeof(PartitionMoveSlot),
+						 PARTITION_MOVE_SLOTS, &userctx->cur_idx,
+						 &slot_copy.head))
+	{
+		Datum		values[Natts_partition_moves];
+		bool		isnull[Natts_partition_moves] = { 0 };
+		HeapTuple	htup;
+
+		values[Anum_partition_moves_userid - 1]		= slot_copy.head.userid;
+		values[Anum_partition_moves_pid - 1]		= slot_copy.head.pid;
+		values[Anum_partition_moves_dbid - 1]		= slot_copy.head.dbid;
+		values[Anum_partition_moves_partition - 1]	= slot_copy.head.relid;
+		values[Anum_partition_moves_target - 1]		=
+				CStringGetTextDatum(NameStr(slot_copy.target_name));
+		values[Anum_partition_moves_copied - 1]		=
+				Int64GetDatum(slot_copy.bytes_copied);
+		values[Anum_partition_moves_status - 1]		=
+				CStringGetTextDatum(pms_print_status(slot_copy.head.worker_status));
+
+		/* Form output tuple */
+		htup = heap_form_tuple(funcctx->tuple_desc, values, isnull);
+
+		SRF_RETURN_NEXT(funcctx, HeapTupleGetDatum(htup));
+	}
+
+	SRF_RETURN_DONE(funcctx);
+}
+
+
+/*
+ * -------------------------
+ *  Rebalancer of partitions
+ * -------------------------
+ */
+
+typedef struct
+{
+	Oid				serverid;
+	char		   *name;
+	UserMapping	   *user;			/* NULL if server holds no partitions */
+	double			load;
+} RebalanceServer;
+
+typedef struct
+{
+	Oid				relid;
+	char		   *remote_table;	/* qualified remote table name */
+	int				source;			/* index in servers[] */
+	int				target;			/* -1 if partition stays */
+	double			load;
+	bool			failed;			/* move could not be started */
+} RebalancePart;
+
+/*
+ * Function context for rebalance() SRF.
+ */
+typedef struct
+{
+	RebalanceServer	   *servers;
+	RebalancePart	   *parts;
+	List			   *moves;		/* list of RebalancePart pointers */
+	ListCell		   *cur_move;	/* next row to be returned */
+	bool				dry_run;	/* moves were only planned */
+} rebalance_cxt;
+
+
+/* Find (or add) a server in servers[] */
+static int
+rebalance_server_idx(RebalanceServer *servers, int *nservers, Oid serverid)
+{
+	int i;
+
+	for (i = 0; i < *nservers; i++)
+		if (servers[i].serverid == serverid)
+			return i;
+
+	servers[i].serverid = serverid;
+	servers[i].name = pstrdup(GetForeignServer(serverid)->servername);
+	servers[i].user = NULL;
+	servers[i].load = 0;
+
+	return (*nservers)++;
+}
+
+/*
+ * Ask every server for the load of its partitions.  All servers are
+ * queried at once; 'qps' is derived from two samples of the counters.
+ */
+static void
+fetch_partition_loads(RebalanceServer *servers, int nservers,
+					  RebalancePart *parts, int nparts, bool qps)
+{
+	UserMapping	  **users = palloc(sizeof(UserMapping *) * nservers);
+	const char	  **queries = palloc(sizeof(char *) * nservers);
+	int			  **members = palloc(sizeof(int *) * nservers);
+	PGconn		  **conns = palloc(sizeof(PGconn *) * nservers);
+	int				nqueries = 0,
+					sample,
+					i,
+					j;
+
+	/* Build one query per server which holds partitions */
+	for (i = 0; i < nservers; i++)
+	{
+		StringInfoData	sql;
+		int				nmembers = 0;
+
+		if (servers[i].user == NULL)
+			continue;
+
+		members[nqueries] = palloc(sizeof(int) * nparts);
+
+		initStringInfo(&sql);
+		appendStringInfo(&sql,
+						 "SELECT t.n, pg_catalog.pg_total_relation_size(c.oid), "
+						 "COALESCE(s.seq_scan, 0) + COALESCE(s.idx_scan, 0) + "
+						 "COALESCE(s.n_tup_ins, 0) + COALESCE(s.n_tup_upd, 0) + "
+						 "COALESCE(s.n_tup_del, 0) "
+						 "FROM pg_catalog.unnest(ARRAY[");
+
+		for (j = 0; j < nparts; j++)
+		{
+			if (parts[j].source != i)
+				continue;
+
+			if (nmembers > 0)
+				appendStringInfoChar(&sql, ',');
+			appendStringInfoString(&sql, quote_literal_cstr(parts[j].remote_table));
+			members[nqueries][nmembers++] = j;
+		}
+
+		appendStringInfo(&sql,
+						 "]::text[]) WITH ORDINALITY AS t(name, n) "
+						 "JOIN pg_catalog.pg_class c "
+						 "ON c.oid = pg_catalog.to_regclass(t.name) "
+						 "LEFT JOIN pg_catalog.pg_stat_user_tables s "
+						 "ON s.relid = c.oid");
+
+		users[nqueries] = servers[i].user;
+		queries[nqueries] = sql.data;
+		nqueries++;
+	}
+
+	for (sample = 0; sample < (qps ? 2 : 1); sample++)
+	{
+		PGresult **results;
+
+		/* Wait for the counters to move */
+		if (sample > 0)
+		{
+			int rc;
+
+			rc = WaitLatch(MyLatch,
+						   WL_LATCH_SET | WL_TIMEOUT | WL_POSTMASTER_DEATH,
+						   REBALANCE_SAMPLE_INTERVAL
+#if PG_VERSION_NUM >= 100000
+						   , PG_WAIT_EXTENSION
+#endif
+						   );
+			ResetLatch(MyLatch);
+
+			if (rc & WL_POSTMASTER_DEATH)
+				proc_exit(1);
+
+			CHECK_FOR_INTERRUPTS();
+		}
+
+		results = GoguExecParallel(users, queries, nqueries, conns, false);
+
+		for (i = 0; i < nqueries; i++)
+		{
+			PGresult *res = results[i];
+
+			if (PQresultStatus(res) != PGRES_TUPLES_OK)
+			{
+				/* Don't leak the rest of results */
+				for (j = i + 1; j < nqueries; j++)
+					PQclear(results[j]);
+
+				Gogu_pgfdw_report_error(ERROR, res, conns[i], true, queries[i]);
+			}
+
+			for (j = 0; j < PQntuples(res); j++)
+			{
+				int				n = atoi(PQgetvalue(res, j, 0)) - 1;
+				RebalancePart  *part = &parts[members[i][n]];
+
+				if (!qps)
+					part->load = strtod(PQgetvalue(res, j, 1), NULL);
+				else if (sample == 0)
+					part->load = -strtod(PQgetvalue(res, j, 2), NULL);
+				else
+					part->load = (part->load + strtod(PQgetvalue(res, j, 2), NULL)) /
+								 (REBALANCE_SAMPLE_INTERVAL / 1000.0);
+			}
+
+			PQclear(res);
+		}
+	}
+
+	for (j = 0; j < nparts; j++)
+		servers[parts[j].source].load += parts[j].load;
+}
+
+/*
+ * Greedily move partitions from the most to the least loaded server,
+ * picking the partition which halves their difference best.  Every
+ * partition moves at most once, so the plan is short and always ends.
+ */
+static List *
+plan_rebalance(RebalanceServer *servers, int nservers,
+			   RebalancePart *parts, int nparts)
+{
+	List   *moves = NIL;
+	double	total = 0;
+	int		i;
+
+	for (i = 0; i < nservers; i++)
+		total += servers[i].load;
+
+	for (;;)
+	{
+		RebalancePart  *best = NULL;
+		int				hi = 0,
+						lo = 0;
+		double			gap;
+
+		for (i = 1; i < nservers; i++)
+		{
+			if (servers[i].load > servers[hi].load)
+				hi = i;
+			if (servers[i].load < servers[lo].load)
+				lo = i;
+		}
+
+		gap = servers[hi].load - servers[lo].load;
+		if (gap <= total / nservers * REBALANCE_TOLERANCE)
+			break;
+
+		for (i = 0; i < nparts; i++)
+		{
+			RebalancePart *part = &parts[i];
+
+			/* Moving a partition heavier than 'gap' makes things worse */
+			if (part->source != hi || part->target >= 0 ||
+				part->load <= 0 || part->load >= gap)
+				continue;
+
+			if (!best || fabs(part->load - gap / 2) < fabs(best->load - gap / 2))
+				best = part;
+		}
+
+		if (!best)
+			break;
+
+		best->target = lo;
+		servers[hi].load -= best->load;
+		servers[lo].load += best->load;
+		moves = lappend(moves, best);
+	}
+
+	return moves;
+}
+
+/*
+ * Start the move of 'part'.  A failure is reported as a WARNING and marks
+ * the part, so that the rest of the plan still runs.
+ */
+static bool
+start_rebalance_move(RebalancePart *part, RebalanceServer *servers,
+					 int32 max_rate, int *slot_idx)
+{
+	MemoryContext	old_mcxt = CurrentMemoryContext;
+	ResourceOwner	old_owner = CurrentResourceOwner;
+
+	BeginInternalSubTransaction(NULL);
+	MemoryContextSwitchTo(old_mcxt);
+
+	PG_TRY();
+	{
+		*slot_idx = start_partition_move(part->relid,
+										 servers[part->target].serverid,
+										 max_rate);
+
+		ReleaseCurrentSubTransaction();
+		MemoryContextSwitchTo(old_mcxt);
+		CurrentResourceOwner = old_owner;
+	}
+	PG_CATCH();
+	{
+		ErrorData *edata;
+
+		MemoryContextSwitchTo(old_mcxt);
+		edata = CopyErrorData();
+		FlushErrorState();
+
+		RollbackAndReleaseCurrentSubTransaction();
+		MemoryContextSwitchTo(old_mcxt);
+		CurrentResourceOwner = old_owner;
+
+		ereport(WARNING,
+				(errmsg("could not move partition \"%s\" to server \"%s\": %s",
+						get_rel_name_or_relid(part->relid),
+						servers[part->target].name, edata->message)));
+		FreeErrorData(edata);
+
+		part->failed = true;
+	}
+	PG_END_TRY();
+
+	return !part->failed;
+}
+
+/*
+ * Run planned moves, at most 'max_parallel' at a time.
+ */
+static void
+execute_rebalance(List *moves, RebalanceServer *servers,
+				  int max_parallel, int32 max_rate)
+{
+	int		   *slots = palloc(sizeof(int) * max_parallel);
+	Oid		   *relids = palloc(sizeof(Oid) * max_parallel);
+	int			nrunning = 0;
+	ListCell   *lc = list_head(moves);
+
+	while (lc || nrunning > 0)
+	{
+		int i;
+
+		/* Forget finished moves */
+		for (i = 0; i < nrunning; i++)
+		{
+			if (!partition_move_is_active(slots[i], relids[i]))
+			{
+				nrunning--;
+				slots[i] = slots[nrunning];
+				relids[i] = relids[nrunning];
+				i--;
+			}
+		}
+
+		if (lc && nrunning < max_parallel)
+		{
+			RebalancePart *part = (RebalancePart *) lfirst(lc);
+
+			if (start_rebalance_move(part, servers, max_rate, &slots[nrunning]))
+			{
+				relids[nrunning] = part->relid;
+				nrunning++;
+			}
+
+			lc = lnext(lc);
+			continue;
+		}
+
+		/* Check workers once a second */
+		i = WaitLatch(MyLatch,
+					  WL_LATCH_SET | WL_TIMEOUT | WL_POSTMASTER_DEATH,
+					  1000L
+#if PG_VERSION_NUM >= 100000
+					  , PG_WAIT_EXTENSION
+#endif
+					  );
+		ResetLatch(MyLatch);
+
+		if (i & WL_POSTMASTER_DEATH)
+			proc_exit(1);
+
+		CHECK_FOR_INTERRUPTS();
+	}
+
+	/* Workers have changed pg_foreign_table, see their results */
+	AcceptInvalidationMessages();
+}
+
+/*
+ * Even out size or load of partitions across servers.
+ * NOTE: this is a set-returning-function (SRF).
+ */
+Datum
+rebalance(PG_FUNCTION_ARGS)
+{
+	FuncCallContext	   *funcctx;
+	rebalance_cxt	   *userctx;
+
+	if (SRF_IS_FIRSTCALL())
+	{
+		Oid						relid = PG_GETARG_OID(0);
+		char				   *strategy = TextDatumGetCString(PG_GETARG_DATUM(1));
+		int32					max_parallel = PG_GETARG_INT32(2);
+		int32					max_rate = PG_GETARG_INT32(3);
+		bool					dry_run = PG_GETARG_BOOL(4);
+		bool					qps;
+		const PartRelationInfo *prel;
+		Oid					   *children;
+		int						nservers = 0,
+								nparts = 0,
+								i;
+		TupleDesc				tupdesc;
+		MemoryContext			old_mcxt;
+
+		if (strcmp(strategy, "size") == 0)
+			qps = false;
+		else if (strcmp(strategy, "qps") == 0)
+			qps = true;
+		else
+			ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+							errmsg("unknown rebalance strategy \"%s\"", strategy),
+							errhint("use \"size\" or \"qps\"")));
+
+		if (max_parallel < 1)
+			ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+							errmsg("'max_parallel' should not be less than 1")));
+
+		if (!superuser())
+			ereport(ERROR, (errcode(ERRCODE_INSUFFICIENT_PRIVILEGE),
+							errmsg("must be superuser to move partitions")));
+
+		prel = get_pathman_relation_info(relid);
+		shout_if_prel_is_invalid(relid, prel, PT_ANY);
+
+		funcctx = SRF_FIRSTCALL_INIT();
+		old_mcxt = MemoryContextSwitchTo(funcctx->multi_call_memory_ctx);
+
+		userctx = (rebalance_cxt *) palloc0(sizeof(rebalance_cxt));
+		userctx->dry_run = dry_run;
+		userctx->servers = palloc0(sizeof(RebalanceServer) *
+								   (PrelChildrenCount(prel) + HASH_SLOT_SIZE));
+		userctx->parts = palloc0(sizeof(RebalancePart) * PrelChildrenCount(prel));
+
+		/* Every server from server_map may receive partitions */
+		if (rangeServerSet)
+		{
+			for (i = 0; i < rangeServerSet->server_count; i++)
+			{
+				ForeignServer *server;
+
+				server = GetForeignServerByName(rangeServerSet->server_set[i].server_name,
+												true);
+				if (server)
+					rebalance_server_idx(userctx->servers, &nservers,
+										 server->serverid);
+			}
+		}
+
+		/* Collect remote partitions */
+		children = PrelGetChildrenArray(prel);
+		for (i = 0; i < PrelChildrenCount(prel); i++)
+		{
+			RebalancePart  *part = &userctx->parts[nparts];
+			ForeignTable   *ftable;
+			const char	   *remote_schema,
+						   *remote_table;
+
+			if (get_rel_relkind(children[i]) != RELKIND_FOREIGN_TABLE)
+				continue;
+
+			ftable = GetForeignTable(children[i]);
+
+			GoguGetRemoteTableName(children[i], &remote_schema, &remote_table);
+
+			part->relid = children[i];
+			part->remote_table = quote_qualified_identifier(remote_schema,
+															remote_table);
+			part->source = rebalance_server_idx(userctx->servers, &nservers,
+												ftable->serverid);
+			part->target = -1;
+
+			if (userctx->servers[part->source].user == NULL)
+			{
+				Relation child_rel = heap_open(children[i], AccessShareLock);
+
+				userctx->servers[part->source].user =
+						GetUserMapping(child_rel->rd_rel->relowner, ftable->serverid);
+				heap_close(child_rel, AccessShareLock);
+			}
+
+			nparts++;
+		}
+
+		if (nparts > 0 && nservers > 1)
+		{
+			fetch_partition_loads(userctx->servers, nservers,
+								  userctx->parts, nparts, qps);
+
+			userctx->moves = plan_rebalance(userctx->servers, nservers,
+											userctx->parts, nparts);
+
+			if (!dry_run && userctx->moves != NIL)
+				execute_rebalance(userctx->moves, userctx->servers,
+								  max_parallel, max_rate);
+		}
+
+		userctx->cur_move = list_head(userctx->moves);
+
+		/* Create tuple descriptor */
+		tupdesc = CreateTemplateTupleDesc(Natts_rebalance_plan, false);
+
+		TupleDescInitEntry(tupdesc, Anum_rebalance_plan_partition,
+						   "partition", REGCLASSOID, -1, 0);
+		TupleDescInitEntry(tupdesc, Anum_rebalance_plan_source,
+						   "source_server", TEXTOID, -1, 0);
+		TupleDescInitEntry(tupdesc, Anum_rebalance_plan_target,
+						   "target_server", TEXTOID, -1, 0);
+		TupleDescInitEntry(tupdesc, Anum_rebalance_plan_load,
+						   "load", FLOAT8OID, -1, 0);
+		TupleDescInitEntry(tupdesc, Anum_rebalance_plan_status,
+						   "status", TEXTOID, -1, 0);
+
+		funcctx->tuple_desc = BlessTupleDesc(tupdesc);
+		funcctx->user_fctx = (void *) userctx;
+
+		MemoryContextSwitchTo(old_mcxt);
+	}
+
+	funcctx = SRF_PERCALL_SETUP();
+	userctx = (rebalance_cxt *) funcctx->user_fctx;
+
+	if (userctx->cur_move)
+	{
+		RebalancePart  *part = (RebalancePart *) lfirst(userctx->cur_move);
+		RebalanceServer *target = &userctx->servers[part->target];
+		Datum			values[Natts_rebalance_plan];
+		bool			isnull[Natts_rebalance_plan] = { 0 };
+		const char	   *status;
+		HeapTuple		htup;
+
+		if (userctx->dry_run)
+			status = "planned";
+		else if (part->failed)
+			status = "failed";
+		else if (GetForeignTable(part->relid)->serverid == target->serverid)
+			status = "moved";
+		else
+			status = "failed";
+
+		values[Anum_rebalance_plan_partition - 1]	= ObjectIdGetDatum(part->relid);
+		values[Anum_rebalance_plan_source - 1]		=
+				CStringGetTextDatum(userctx->servers[part->source].name);
+		values[Anum_rebalance_plan_target - 1]		= CStringGetTextDatum(target->name);
+		values[Anum_rebalance_plan_load - 1]		= Float8GetDatum(part->load);
+		values[Anum_rebalance_plan_status - 1]		= CStringGetTextDatum(status);
+
+		userctx->cur_move = lnext(userctx->cur_move);
+
+		htup = heap_form_tuple(funcctx->tuple_desc, values, isnull);
+		SRF_RETURN_NEXT(funcctx, HeapTupleGetDatum(htup));
+	}
+
+	SRF_RETURN_DONE(funcctx);
+}
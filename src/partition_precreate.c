@@ -0,0 +1,696 @@
+/*-------------------------------------------------------------------------
+ *
+ * partition_precreate.c
+ *		Scheduled pre-creation of RANGE partitions of time-series tables
+ *
+ *		An INSERT which misses every partition makes the inserting backend
+ *		(or a BGW it waits for) create the missing foreign partitions and
+ *		their remote tables.  For time-series tables this happens to all
+ *		inserts at the start of every interval.  PartitionPrecreateWorker
+ *		runs periodically and keeps partitions for the given number of
+ *		intervals past the current time, so that inserts find them ready.
+ *
+ *		Partitions are spawned by create_partitions_for_value_internal(),
+ *		so they are placed on the servers of table_partition_rule exactly
+ *		as the insert path would place them.  Only tables partitioned by
+ *		a date or timestamp key are handled; each table is processed in a
+ *		transaction of its own.
+ *
+ *		Periodic schedules are kept in PRECREATE_CONFIG, and their workers
+ *		are started again by WorkerRestarter when the server restarts.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "init.h"
+#include "partition_creation.h"
+#include "partition_filter.h"
+#include "partition_precreate.h"
+#include "pathman_workers.h"
+#include "relation_info.h"
+#include "utils.h"
+
+#include "access/heapam.h"
+#include "access/htup_details.h"
+#include "access/xact.h"
+#include "catalog/namespace.h"
+#include "catalog/pg_type.h"
+#include "executor/spi.h"
+#include "funcapi.h"
+#include "miscadmin.h"
+#include "pgstat.h"
+#include "postmaster/bgworker.h"
+#include "storage/ipc.h"
+#include "storage/latch.h"
+#include "storage/shmem.h"
+#include "utils/builtins.h"
+#include "utils/lsyscache.h"
+#include "utils/memutils.h"
+#include "utils/rel.h"
+#include "utils/resowner.h"
+#include "utils/snapmgr.h"
+
+
+/* Declarations for PartitionPrecreateWorker */
+PG_FUNCTION_INFO_V1( precreate_range_partitions );
+PG_FUNCTION_INFO_V1( stop_partition_precreation );
+PG_FUNCTION_INFO_V1( show_partition_precreations_internal );
+
+
+/*
+ * Dynamically resolve functions (for BGW API).
+ */
+extern PGDLLEXPORT void bgw_main_precreate_partitions(Datum main_arg);
+
+
+/*
+ * Function context for show_partition_precreations_internal() SRF.
+ */
+typedef struct
+{
+	int cur_idx; /* current slot to be processed */
+} active_precreations_cxt;
+
+
+/*
+ * Slots for partition pre-creation.
+ */
+static PrecreateSlot	   *precreate_slots;
+
+static const char		   *precreate_bgw = "PartitionPrecreateWorker";
+
+
+static List *collect_precreate_tables(Oid parent_relid);
+static bool precreate_target_value(Oid relid, int intervals,
+								   Datum *value, Oid *value_type);
+static int64 precreate_table_partitions(Oid relid, int intervals);
+
+
+/*
+ * Estimate amount of shmem needed for partition pre-creation.
+ */
+Size
+estimate_partition_precreate_slots_size(void)
+{
+	/* NOTE: we suggest that max_worker_processes is in PGC_POSTMASTER */
+	return sizeof(PrecreateSlot) * PRECREATE_SLOTS;
+}
+
+/*
+ * Initialize shared memory needed for partition pre-creation.
+ */
+void
+init_partition_precreate_slots(void)
+{
+	bool	found;
+	Size	size = estimate_partition_precreate_slots_size();
+
+	precreate_slots = (PrecreateSlot *)
+			ShmemInitStruct("array of PrecreateSlots", size, &found);
+
+	/* Initialize 'precreate_slots' if needed */
+	if (!found)
+		init_worker_slots(&precreate_slots->head, sizeof(PrecreateSlot),
+						  PRECREATE_SLOTS);
+}
+
+
+/*
+ * --------------------------------------------
+ *  PartitionPrecreateWorker implementation
+ * --------------------------------------------
+ */
+
+/*
+ * Entry point for PartitionPrecreateWorker's process.
+ */
+void
+bgw_main_precreate_partitions(Datum main_arg)
+{
+	PrecreateSlot	   *precreate_slot;
+
+	/* Update pre-creation slot */
+	precreate_slot = &precreate_slots[DatumGetInt32(main_arg)];
+	attach_worker_slot(&precreate_slot->head, precreate_bgw);
+
+	for (;;)
+	{
+		MemoryContext	round_mcxt;
+		List		   *tables;
+		ListCell	   *lc;
+		volatile int64	created = 0;
+
+		ws_set_status(&precreate_slot->head, WS_WORKING);
+
+		/* The list of tables has to outlive the transaction */
+		round_mcxt = AllocSetContextCreate(TopMemoryContext,
+										   "PartitionPrecreateWorker round",
+										   ALLOCSET_DEFAULT_SIZES);
+
+		StartTransactionCommand();
+		bg_worker_load_config(precreate_bgw);
+		PushActiveSnapshot(GetTransactionSnapshot());
+		{
+			MemoryContext old_mcxt = MemoryContextSwitchTo(round_mcxt);
+
+			tables = collect_precreate_tables(precreate_slot->head.relid);
+			MemoryContextSwitchTo(old_mcxt);
+		}
+		PopActiveSnapshot();
+		CommitTransactionCommand();
+
+		/* A failure of one table must not hold up the others */
+		foreach(lc, tables)
+		{
+			Oid relid = lfirst_oid(lc);
+
+			if (ws_check_status(&precreate_slot->head) == WS_STOPPING)
+				break;
+
+			PG_TRY();
+			{
+				StartTransactionCommand();
+				PushActiveSnapshot(GetTransactionSnapshot());
+				created += precreate_table_partitions(relid,
+													  precreate_slot->intervals);
+				PopActiveSnapshot();
+				CommitTransactionCommand();
+			}
+			PG_CATCH();
+			{
+				HOLD_INTERRUPTS();
+				EmitErrorReport();
+				FlushErrorState();
+				AbortCurrentTransaction();
+				RESUME_INTERRUPTS();
+			}
+			PG_END_TRY();
+		}
+
+		MemoryContextDelete(round_mcxt);
+
+		SpinLockAcquire(&precreate_slot->head.mutex);
+		precreate_slot->created = created;
+		precreate_slot->last_round = GetCurrentTimestamp();
+		SpinLockRelease(&precreate_slot->head.mutex);
+
+		if (created > 0)
+			elog(LOG, "%s: created " INT64_FORMAT " partitions",
+				 precreate_bgw, created);
+
+		if (precreate_slot->period == 0 ||
+			!sleep_worker_slot(&precreate_slot->head, precreate_slot->period))
+			break;
+	}
+}
+
+/*
+ * Return 'parent_relid', or every RANGE table of table_partition_rule,
+ * if it is partitioned by time.  Must be called in a transaction.
+ */
+static List *
+collect_precreate_tables(Oid parent_relid)
+{
+	List		   *result = NIL;
+	Relation		rel;
+	HeapScanDesc	scan;
+	HeapTuple		htup;
+
+	if (OidIsValid(parent_relid))
+	{
+		const PartRelationInfo *prel = get_pathman_relation_info(parent_relid);
+
+		if (prel && prel->parttype == PT_RANGE &&
+			is_date_type_internal(getBaseType(prel->ev_type)))
+			result = lappend_oid(result, parent_relid);
+
+		return result;
+	}
+
+	rel = heap_open(get_table_partition_rule_relid(false), AccessShareLock);
+	scan = heap_beginscan(rel, GetActiveSnapshot(), 0, NULL);
+
+	while ((htup = heap_getnext(scan, ForwardScanDirection)) != NULL)
+	{
+		Datum		values[Natts_table_partition_rule];
+		bool		isnull[Natts_table_partition_rule];
+		Oid			nspid,
+					relid;
+		const PartRelationInfo *prel;
+
+		heap_deform_tuple(htup, RelationGetDescr(rel), values, isnull);
+
+		if (DatumGetInt32(values[Anum_table_partition_rule_parttype - 1]) != PT_RANGE)
+			continue;
+
+		nspid = get_namespace_oid(TextDatumGetCString(
+						values[Anum_table_partition_rule_schema - 1]), true);
+		if (!OidIsValid(nspid))
+			continue;
+
+		relid = get_relname_relid(TextDatumGetCString(
+						values[Anum_table_partition_rule_relname - 1]), nspid);
+		if (!OidIsValid(relid))
+			continue;
+
+		prel = get_pathman_relation_info(relid);
+		if (prel && prel->parttype == PT_RANGE &&
+			is_date_type_internal(getBaseType(prel->ev_type)))
+			result = lappend_oid(result, relid);
+	}
+
+	heap_endscan(scan);
+	heap_close(rel, AccessShareLock);
+
+	return result;
+}
+
+/*
+ * Compute the current time plus 'intervals' range intervals of 'relid'.
+ */
+static bool
+precreate_target_value(Oid relid, int intervals, Datum *value, Oid *value_type)
+{
+	const PartRelationInfo *prel;
+	Datum		values[Natts_pathman_config];
+	bool		isnull[Natts_pathman_config];
+	Oid			bound_type,
+				interval_type,
+				op_func,
+				op_ret_type;
+	Datum		interval_binary,
+				cur;
+	int			i;
+
+	prel = get_pathman_relation_info(relid);
+	if (prel == NULL || prel->parttype != PT_RANGE)
+		return false;
+
+	if (!pathman_config_contains_relation(relid, values, isnull, NULL, NULL) ||
+		isnull[Anum_pathman_config_range_interval - 1])
+		return false;
+
+	bound_type = getBaseType(prel->ev_type);
+	interval_binary = extract_binary_interval_from_text(
+							values[Anum_pathman_config_range_interval - 1],
+							bound_type, &interval_type);
+
+	cur = perform_type_cast(TimestampTzGetDatum(GetCurrentTimestamp()),
+							TIMESTAMPTZOID, bound_type, NULL);
+
+	/* Same as spawn_partitions_val(), date + interval = timestamp */
+	extract_op_func_and_ret_type("+", bound_type, interval_type,
+								 &op_func, &op_ret_type);
+	if (op_ret_type != bound_type)
+	{
+		cur = perform_type_cast(cur, bound_type, op_ret_type, NULL);
+		bound_type = op_ret_type;
+
+		extract_op_func_and_ret_type("+", bound_type, interval_type,
+									 &op_func, &op_ret_type);
+		if (op_ret_type != bound_type)
+			return false;
+	}
+
+	for (i = 0; i < intervals; i++)
+		cur = OidFunctionCall2(op_func, cur, interval_binary);
+
+	*value = cur;
+	*value_type = bound_type;
+
+	return true;
+}
+
+/*
+ * Make sure 'relid' has partitions up to the current time plus 'intervals'
+ * range intervals, return the number of partitions created.  Must be called
+ * in a transaction.
+ */
+static int64
+precreate_table_partitions(Oid relid, int intervals)
+{
+	const PartRelationInfo *prel;
+	Datum		value;
+	Oid			value_type;
+	Oid		   *parts;
+	int			nparts,
+				nchildren;
+
+	if (!precreate_target_value(relid, intervals, &value, &value_type))
+		return 0;
+
+	/* Most rounds find the partition in place and take no locks */
+	prel = get_pathman_relation_info(relid);
+	parts = find_partitions_for_value(value, value_type, prel, &nparts);
+	pfree(parts);
+
+	if (nparts > 0)
+		return 0;
+
+	nchildren = PrelChildrenCount(prel);
+
+	if (!OidIsValid(create_partitions_for_value_internal(relid, value,
+														 value_type, false)))
+		elog(ERROR, "could not create new partitions for relation \"%s\"",
+			 get_rel_name_or_relid(relid));
+
+	prel = get_pathman_relation_info(relid);
+
+	return prel ? PrelChildrenCount(prel) - nchildren : 0;
+}
+
+
+/*
+ * -------------------------------------------
+ *  Schedules of PartitionPrecreateWorkers
+ * -------------------------------------------
+ */
+
+/*
+ * Qualified name of PRECREATE_CONFIG, NULL if there's no such table.
+ */
+static char *
+precreate_config_name(void)
+{
+	Oid		schema = get_pathman_schema();
+
+	if (!OidIsValid(schema) ||
+		!OidIsValid(get_relname_relid(PRECREATE_CONFIG, schema)))
+		return NULL;
+
+	return quote_qualified_identifier(get_namespace_name(schema),
+									  PRECREATE_CONFIG);
+}
+
+/*
+ * Remember (period > 0) or forget the schedule of 'relid'.
+ */
+static void
+save_precreate_schedule(Oid relid, int32 intervals, int32 period)
+{
+	char   *config = precreate_config_name();
+	Oid		types[Natts_precreate_config] = { REGCLASSOID, INT4OID,
+											  INT4OID, REGROLEOID };
+	Datum	values[Natts_precreate_config];
+	char	nulls[Natts_precreate_config] = { ' ', ' ', ' ', ' ' };
+	char   *sql;
+
+	if (config == NULL)
+		return;
+
+	values[Anum_precreate_config_partrel - 1]	= ObjectIdGetDatum(relid);
+	values[Anum_precreate_config_intervals - 1]	= Int32GetDatum(intervals);
+	values[Anum_precreate_config_period - 1]	= Int32GetDatum(period);
+	values[Anum_precreate_config_owner - 1]		= ObjectIdGetDatum(GetUserId());
+
+	if (!OidIsValid(relid))
+		nulls[Anum_precreate_config_partrel - 1] = 'n';
+
+	if (SPI_connect() != SPI_OK_CONNECT)
+		elog(ERROR, "could not connect using SPI");
+
+	sql = psprintf("DELETE FROM %s WHERE partrel IS NOT DISTINCT FROM $1",
+				   config);
+	if (SPI_execute_with_args(sql, 1, types, values, nulls, false, 0) != SPI_OK_DELETE)
+		elog(ERROR, "could not update \"%s\"", PRECREATE_CONFIG);
+
+	if (period > 0)
+	{
+		sql = psprintf("INSERT INTO %s VALUES ($1, $2, $3, $4)", config);
+		if (SPI_execute_with_args(sql, Natts_precreate_config,
+								  types, values, nulls,
+								  false, 0) != SPI_OK_INSERT)
+			elog(ERROR, "could not update \"%s\"", PRECREATE_CONFIG);
+	}
+
+	SPI_finish();
+}
+
+/*
+ * Take a free slot and start PartitionPrecreateWorker.
+ * Returns false if this table is being processed already.
+ */
+static bool
+launch_precreate_worker(Oid userid, Oid relid, int32 intervals, int32 period)
+{
+	int		empty_slot_idx;
+
+	empty_slot_idx = claim_worker_slot(&precreate_slots->head,
+									   sizeof(PrecreateSlot),
+									   PRECREATE_SLOTS,
+									   userid, relid, WS_WORKING);
+	if (empty_slot_idx < 0)
+		return false;
+	else
+	{
+		PrecreateSlot *slot = &precreate_slots[empty_slot_idx];
+
+		InitPrecreateSlot(slot, intervals, period);
+
+		SpinLockRelease(&slot->head.mutex);
+	}
+
+	/* Start worker (we should not wait) */
+	launch_worker(&precreate_slots[empty_slot_idx].head, empty_slot_idx,
+				  precreate_bgw, CppAsString(bgw_main_precreate_partitions));
+
+	return true;
+}
+
+/*
+ * Start the workers of PRECREATE_CONFIG in the current database.
+ * Must be called in a transaction.
+ */
+void
+restart_partition_precreations(void)
+{
+	char   *config = precreate_config_name();
+	uint64	i;
+
+	if (config == NULL)
+		return;
+
+	if (SPI_connect() != SPI_OK_CONNECT)
+		elog(ERROR, "could not connect using SPI");
+
+	if (SPI_execute(psprintf("SELECT partrel, intervals, period, owner FROM %s",
+							 config),
+					true, 0) != SPI_OK_SELECT)
+		elog(ERROR, "could not read \"%s\"", PRECREATE_CONFIG);
+
+	for (i = 0; i < SPI_processed; i++)
+	{
+		HeapTuple	htup = SPI_tuptable->vals[i];
+		TupleDesc	tupdesc = SPI_tuptable->tupdesc;
+		bool		isnull;
+		Oid			relid = InvalidOid,
+					owner;
+		int32		intervals,
+					period;
+		Datum		value;
+
+		value = SPI_getbinval(htup, tupdesc, Anum_precreate_config_partrel, &isnull);
+		if (!isnull)
+		{
+			relid = DatumGetObjectId(value);
+
+			/* Table was dropped */
+			if (get_rel_name(relid) == NULL)
+				continue;
+		}
+
+		intervals = DatumGetInt32(SPI_getbinval(htup, tupdesc,
+												Anum_precreate_config_intervals,
+												&isnull));
+		period = DatumGetInt32(SPI_getbinval(htup, tupdesc,
+											 Anum_precreate_config_period,
+											 &isnull));
+		owner = DatumGetObjectId(SPI_getbinval(htup, tupdesc,
+											   Anum_precreate_config_owner,
+											   &isnull));
+
+		if (!launch_precreate_worker(owner, relid, intervals, period))
+			elog(LOG, "%s: partitions of \"%s\" are already being pre-created",
+				 precreate_bgw,
+				 OidIsValid(relid) ? get_rel_name(relid) : "all tables");
+	}
+
+	SPI_finish();
+}
+
+
+/*
+ * -------------------------------------------
+ *  Pre-creation related SQL functions
+ * -------------------------------------------
+ */
+
+/*
+ * Take a free slot and start PartitionPrecreateWorker.
+ * NOTE: this function returns immediately.
+ */
+Datum
+precreate_range_partitions(PG_FUNCTION_ARGS)
+{
+	Oid		relid = PG_ARGISNULL(0) ? InvalidOid : PG_GETARG_OID(0);
+	int32	intervals = PG_ARGISNULL(1) ? 3 : PG_GETARG_INT32(1);
+	int32	period = PG_ARGISNULL(2) ? 3600 : PG_GETARG_INT32(2);
+
+	if (!superuser())
+		ereport(ERROR, (errcode(ERRCODE_INSUFFICIENT_PRIVILEGE),
+						errmsg("must be superuser to pre-create partitions")));
+
+	if (intervals < 1)
+		ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+						errmsg("'intervals' should not be less than 1")));
+
+	if (period < 0)
+		ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+						errmsg("'period' should not be less than 0")));
+
+	if (OidIsValid(relid))
+	{
+		const PartRelationInfo *prel = get_pathman_relation_info(relid);
+
+		shout_if_prel_is_invalid(relid, prel, PT_RANGE);
+
+		if (!is_date_type_internal(getBaseType(prel->ev_type)))
+			ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+							errmsg("table \"%s\" is not partitioned by date or timestamp",
+								   get_rel_name_or_relid(relid))));
+	}
+
+	if (!launch_precreate_worker(GetUserId(), relid, intervals, period))
+		ereport(ERROR, (errmsg("partitions of \"%s\" are already being pre-created",
+							   OidIsValid(relid) ?
+									get_rel_name(relid) : "all tables")));
+
+	/* Periodic pre-creation survives restarts */
+	if (period > 0)
+		save_precreate_schedule(relid, intervals, period);
+
+	elog(NOTICE,
+		 "worker started, you can watch it in %s.gogudb_partition_precreations",
+		 get_namespace_name(get_pathman_schema()));
+
+	PG_RETURN_VOID();
+}
+
+/*
+ * Ask PartitionPrecreateWorker of 'relation' (NULL means all tables)
+ * to stop.
+ */
+Datum
+stop_partition_precreation(PG_FUNCTION_ARGS)
+{
+	Oid		relid = PG_ARGISNULL(0) ? InvalidOid : PG_GETARG_OID(0);
+
+	if (stop_worker_slot(&precreate_slots->head, sizeof(PrecreateSlot),
+						 PRECREATE_SLOTS, relid))
+	{
+		/* Don't start it again after a restart */
+		save_precreate_schedule(relid, 0, 0);
+
+		elog(NOTICE, "worker will stop after it finishes current round");
+		PG_RETURN_BOOL(true);
+	}
+	else
+	{
+		elog(ERROR, "cannot find worker for %s",
+			 OidIsValid(relid) ? get_rel_name_or_relid(relid) : "all tables");
+		PG_RETURN_BOOL(false); /* keep compiler happy */
+	}
+}
+
+/*
+ * Return list of active pre-creation workers.
+ * NOTE: this is a set-returning-function (SRF).
+ */
+Datum
+show_partition_precreations_internal(PG_FUNCTION_ARGS)
+{
+	FuncCallContext			   *funcctx;
+	active_precreations_cxt	   *userctx;
+	PrecreateSlot				slot_copy;
+
+	/*
+	 * Initialize tuple descriptor & function call context.
+	 */
+	if (SRF_IS_FIRSTCALL())
+	{
+		TupleDesc			tupdesc;
+		MemoryContext		old_mcxt;
+
+		funcctx = SRF_FIRSTCALL_INIT();
+
+		old_mcxt = MemoryContextSwitchTo(funcctx->multi_call_memory_ctx);
+
+		userctx = (active_precreations_cxt *) palloc(sizeof(active_precreations_cxt));
+		userctx->cur_idx = 0;
+
+		/* Create tuple descriptor */
+		tupdesc = CreateTemplateTupleDesc(Natts_partition_precreations, false);
+
+		TupleDescInitEntry(tupdesc, Anum_partition_precreations_userid,
+						   "userid", REGROLEOID, -1, 0);
+		TupleDescInitEntry(tupdesc, Anum_partition_precreations_pid,
+						   "pid", INT4OID, -1, 0);
+		TupleDescInitEntry(tupdesc, Anum_partition_precreations_dbid,
+						   "dbid", OIDOID, -1, 0);
+		TupleDescInitEntry(tupdesc, Anum_partition_precreations_relid,
+						   "relid", REGCLASSOID, -1, 0);
+		TupleDescInitEntry(tupdesc, Anum_partition_precreations_intervals,
+						   "intervals", INT4OID, -1, 0);
+		TupleDescInitEntry(tupdesc, Anum_partition_precreations_period,
+						   "period", INT4OID, -1, 0);
+		TupleDescInitEntry(tupdesc, Anum_partition_precreations_created,
+						   "created", INT8OID, -1, 0);
+		TupleDescInitEntry(tupdesc, Anum_partition_precreations_last,
+						   "last_round", TIMESTAMPTZOID, -1, 0);
+		TupleDescInitEntry(tupdesc, Anum_partition_precreations_status,
+						   "status", TEXTOID, -1, 0);
+
+		funcctx->tuple_desc = BlessTupleDesc(tupdesc);
+		funcctx->user_fctx = (void *) userctx;
+
+		MemoryContextSwitchTo(old_mcxt);
+	}
+
+	funcctx = SRF_PERCALL_SETUP();
+	userctx = (active_precreations_cxt *) funcctx->user_fctx;
+
+	/* Iterate through worker slots */
+	if (next_worker_slot(&precreate_slots->head, sizeof(PrecreateSlot),
+						 PRECREATE_SLOTS, &userctx->cur_idx,
+						 &slot_copy.head))
+	{
+		Datum		values[Natts_partition_precreations];
+		bool		isnull[Natts_partition_precreations] = { 0 };
+		HeapTuple	htup;
+
+		values[Anum_partition_precreations_userid - 1]		= slot_copy.head.userid;
+		values[Anum_partition_precreations_pid - 1]			= slot_copy.head.pid;
+		values[Anum_partition_precreations_dbid - 1]		= slot_copy.head.dbid;
+		values[Anum_partition_precreations_relid - 1]		= slot_copy.head.relid;
+		values[Anum_partition_precreations_intervals - 1]	=
+				Int32GetDatum(slot_copy.intervals);
+		values[Anum_partition_precreations_period - 1]		=
+				Int32GetDatum(slot_copy.period);
+		values[Anum_partition_precreations_created - 1]		=
+				Int64GetDatum(slot_copy.created);
+		values[Anum_partition_precreations_last - 1]		=
+				TimestampTzGetDatum(slot_copy.last_round);
+		values[Anum_partition_precreations_status - 1]		=
+				CStringGetTextDatum(ws_print_status(slot_copy.head.worker_status));
+
+		isnull[Anum_partition_precreations_relid - 1] = !OidIsValid(slot_copy.head.relid);
+		isnull[Anum_partition_precreations_last - 1] = (slot_copy.last_round == 0);
+
+		/* Form output tuple */
+		htup = heap_form_tuple(funcctx->tuple_desc, values, isnull);
+
+		SRF_RETURN_NEXT(funcctx, HeapTupleGetDatum(htup));
+	}
+
+	SRF_RETURN_DONE(funcctx);
+}
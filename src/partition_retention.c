@@ -0,0 +1,1098 @@
+/*-------------------------------------------------------------------------
+ *
+ * partition_retention.c
+ *		Scheduled removal of expired RANGE partitions of time-series tables
+ *
+ *		Tables with a 'retention' in gogudb_config_params keep only the
+ *		partitions which may contain rows newer than the current time
+ *		minus the retention.  PartitionRetentionWorker runs periodically,
+ *		drops (or detaches) at most 'batch_size' of the oldest expired
+ *		partitions of every such table and then removes their remote
+ *		tables on the shards.
+ *
+ *		Each partition is removed in a transaction of its own under the
+ *		given lock_timeout, so the worker gives way to ingest instead of
+ *		queueing behind it: a partition which could not be locked is
+ *		retried in the next round.  Only the parent's partitioning lock
+ *		and the partition itself are locked on the coordinator.
+ *
+ *		Remote tables of removed partitions are recorded in
+ *		gogudb_retention_pending by the transaction which removes the
+ *		partition, and are dropped (or renamed) afterwards; a failed
+ *		attempt is retried in later rounds, also after a restart.  The
+ *		last partition of a table is never removed, so that inserts always
+ *		have somewhere to go.
+ *
+ *		Periodic schedules are saved in gogudb_retention_config and are
+ *		started again by WorkerRestarter.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "compat/pg_compat.h"
+#include "connection_pool.h"
+#include "hooks.h"
+#include "init.h"
+#include "partition_retention.h"
+#include "pathman_workers.h"
+#include "relation_info.h"
+#include "utils.h"
+
+#include "access/heapam.h"
+#include "access/htup_details.h"
+#include "access/xact.h"
+#include "catalog/pg_class.h"
+#include "catalog/pg_type.h"
+#include "commands/dbcommands.h"
+#include "commands/defrem.h"
+#include "executor/spi.h"
+#include "foreign/foreign.h"
+#include "funcapi.h"
+#include "miscadmin.h"
+#include "pgstat.h"
+#include "postmaster/bgworker.h"
+#include "storage/ipc.h"
+#include "storage/latch.h"
+#include "storage/shmem.h"
+#include "utils/builtins.h"
+#include "utils/lsyscache.h"
+#include "utils/memutils.h"
+#include "utils/rel.h"
+#include "utils/resowner.h"
+#include "utils/snapmgr.h"
+#include "utils/syscache.h"
+
+
+/* Declarations for PartitionRetentionWorker */
+PG_FUNCTION_INFO_V1( start_partition_retention );
+PG_FUNCTION_INFO_V1( stop_partition_retention );
+PG_FUNCTION_INFO_V1( show_partition_retentions_internal );
+
+
+/*
+ * Dynamically resolve functions (for BGW API).
+ */
+extern PGDLLEXPORT void bgw_main_partition_retention(Datum main_arg);
+
+
+/*
+ * Function context for show_partition_retentions_internal() SRF.
+ */
+typedef struct
+{
+	int cur_idx; /* current slot to be processed */
+} active_retentions_cxt;
+
+/*
+ * Table with a retention policy.
+ */
+typedef struct
+{
+	Oid			relid;
+	Interval	retention;
+} RetentionTable;
+
+/*
+ * Row of RETENTION_PENDING: remote table of a removed partition,
+ * waiting to be dropped or renamed.
+ */
+typedef struct
+{
+	char   *server;			/* foreign server of the removed partition */
+	Oid		userid;			/* owner of the removed foreign table */
+	char   *remote_schema;
+	char   *remote_table;
+	RetentionAction action;	/* RETENTION_DROP or RETENTION_ARCHIVE */
+	int32	attempts;		/* failed attempts so far */
+} RetentionRemote;
+
+
+/*
+ * Slots for partition retention.
+ */
+static RetentionSlot	   *retention_slots;
+
+static const char		   *retention_bgw = "PartitionRetentionWorker";
+
+
+static char *retention_catalog_name(const char *relname);
+static RetentionAction parse_retention_action(const char *action_str);
+static List *collect_retention_tables(void);
+static List *expired_partitions(RetentionTable *table, int batch_size);
+static void remove_expired_partition(Oid partid, RetentionAction action,
+									 int lock_timeout);
+static List *collect_pending_remotes(void);
+static void forget_pending_remote(RetentionRemote *remote);
+static void remove_remote_table(RetentionRemote *remote, int lock_timeout);
+static void count_remote_failure(RetentionRemote *remote);
+
+
+/*
+ * Estimate amount of shmem needed for partition retention.
+ */
+Size
+estimate_partition_retention_slots_size(void)
+{
+	/* NOTE: we suggest that max_worker_processes is in PGC_POSTMASTER */
+	return sizeof(RetentionSlot) * RETENTION_SLOTS;
+}
+
+/*
+ * Initialize shared memory needed for partition retention.
+ */
+void
+init_partition_retention_slots(void)
+{
+	bool	found;
+	Size	size = estimate_partition_retention_slots_size();
+
+	retention_slots = (RetentionSlot *)
+			ShmemInitStruct("array of RetentionSlots", size, &found);
+
+	/* Initialize 'retention_slots' if needed */
+	if (!found)
+		init_worker_slots(&retention_slots->head, sizeof(RetentionSlot),
+						  RETENTION_SLOTS);
+}
+
+
+/*
+ * --------------------------------------------
+ *  PartitionRetentionWorker implementation
+ * --------------------------------------------
+ */
+
+/*
+ * Entry point for PartitionRetentionWorker's process.
+ */
+void
+bgw_main_partition_retention(Datum main_arg)
+{
+	RetentionSlot	   *retention_slot;
+
+	/* Update retention slot */
+	retention_slot = &retention_slots[DatumGetInt32(main_arg)];
+	attach_worker_slot(&retention_slot->head, retention_bgw);
+
+	for (;;)
+	{
+		MemoryContext	round_mcxt;
+		List		   *tables;
+		List		   *volatile remotes = NIL;
+		ListCell	   *lc;
+		int64			removed = 0;
+		int32			pending;
+
+		ws_set_status(&retention_slot->head, WS_WORKING);
+
+		/* The list of tables has to outlive the transaction */
+		round_mcxt = AllocSetContextCreate(TopMemoryContext,
+										   "PartitionRetentionWorker round",
+										   ALLOCSET_DEFAULT_SIZES);
+
+		StartTransactionCommand();
+		bg_worker_load_config(retention_bgw);
+		PushActiveSnapshot(GetTransactionSnapshot());
+		{
+			MemoryContext old_mcxt = MemoryContextSwitchTo(round_mcxt);
+
+			tables = collect_retention_tables();
+			MemoryContextSwitchTo(old_mcxt);
+		}
+		PopActiveSnapshot();
+		CommitTransactionCommand();
+
+		/* A failure of one table must not hold up the others */
+		foreach(lc, tables)
+		{
+			RetentionTable *table = (RetentionTable *) lfirst(lc);
+			List		   *volatile parts = NIL;
+			ListCell	   *lc2;
+
+			if (ws_check_status(&retention_slot->head) == WS_STOPPING)
+				break;
+
+			PG_TRY();
+			{
+				StartTransactionCommand();
+				PushActiveSnapshot(GetTransactionSnapshot());
+				{
+					MemoryContext old_mcxt = MemoryContextSwitchTo(round_mcxt);
+
+					parts = expired_partitions(table, retention_slot->batch_size);
+					MemoryContextSwitchTo(old_mcxt);
+				}
+				PopActiveSnapshot();
+				CommitTransactionCommand();
+			}
+			PG_CATCH();
+			{
+				HOLD_INTERRUPTS();
+				EmitErrorReport();
+				FlushErrorState();
+				AbortCurrentTransaction();
+				RESUME_INTERRUPTS();
+			}
+			PG_END_TRY();
+
+			/* Oldest first, a locked partition stops the table's round */
+			foreach(lc2, parts)
+			{
+				Oid				partid = lfirst_oid(lc2);
+				volatile bool	done = false;
+
+				if (ws_check_status(&retention_slot->head) == WS_STOPPING)
+					break;
+
+				PG_TRY();
+				{
+					StartTransactionCommand();
+					PushActiveSnapshot(GetTransactionSnapshot());
+					remove_expired_partition(partid,
+											 retention_slot->action,
+											 retention_slot->lock_timeout);
+					PopActiveSnapshot();
+					CommitTransactionCommand();
+
+					done = true;
+				}
+				PG_CATCH();
+				{
+					HOLD_INTERRUPTS();
+					EmitErrorReport();
+					FlushErrorState();
+					AbortCurrentTransaction();
+					RESUME_INTERRUPTS();
+				}
+				PG_END_TRY();
+
+				if (!done)
+					break;
+
+				removed++;
+			}
+		}
+
+		/* Coordinator doesn't see them anymore, remove remote tables */
+		PG_TRY();
+		{
+			StartTransactionCommand();
+			PushActiveSnapshot(GetTransactionSnapshot());
+			{
+				MemoryContext old_mcxt = MemoryContextSwitchTo(round_mcxt);
+
+				remotes = collect_pending_remotes();
+				MemoryContextSwitchTo(old_mcxt);
+			}
+			PopActiveSnapshot();
+			CommitTransactionCommand();
+		}
+		PG_CATCH();
+		{
+			HOLD_INTERRUPTS();
+			EmitErrorReport();
+			FlushErrorState();
+			AbortCurrentTransaction();
+			RESUME_INTERRUPTS();
+		}
+		PG_END_TRY();
+
+		pending = list_length(remotes);
+
+		foreach(lc, remotes)
+		{
+			RetentionRemote	   *remote = (RetentionRemote *) lfirst(lc);
+			volatile bool		done = false;
+
+			if (ws_check_status(&retention_slot->head) == WS_STOPPING)
+				break;
+
+			PG_TRY();
+			{
+				StartTransactionCommand();
+				PushActiveSnapshot(GetTransactionSnapshot());
+				remove_remote_table(remote, retention_slot->lock_timeout);
+				PopActiveSnapshot();
+				CommitTransactionCommand();
+
+				done = true;
+			}
+			PG_CATCH();
+			{
+				HOLD_INTERRUPTS();
+				EmitErrorReport();
+				FlushErrorState();
+				AbortCurrentTransaction();
+				RESUME_INTERRUPTS();
+			}
+			PG_END_TRY();
+
+			if (done)
+			{
+				pending--;
+				continue;
+			}
+
+			/* It stays in RETENTION_PENDING for the next round */
+			PG_TRY();
+			{
+				StartTransactionCommand();
+				PushActiveSnapshot(GetTransactionSnapshot());
+				count_remote_failure(remote);
+				PopActiveSnapshot();
+				CommitTransactionCommand();
+			}
+			PG_CATCH();
+			{
+				HOLD_INTERRUPTS();
+				EmitErrorReport();
+				FlushErrorState();
+				AbortCurrentTransaction();
+				RESUME_INTERRUPTS();
+			}
+			PG_END_TRY();
+		}
+
+		MemoryContextDelete(round_mcxt);
+
+		SpinLockAcquire(&retention_slot->head.mutex);
+		retention_slot->removed = removed;
+		retention_slot->pending = pending;
+		retention_slot->last_round = GetCurrentTimestamp();
+		SpinLockRelease(&retention_slot->head.mutex);
+
+		if (removed > 0)
+			elog(LOG, "%s: removed " INT64_FORMAT " partitions",
+				 retention_bgw, removed);
+
+		if (retention_slot->period == 0 ||
+			!sleep_worker_slot(&retention_slot->head, retention_slot->period))
+			break;
+	}
+}
+
+/*
+ * Return quoted name of the catalog table 'relname' of the extension,
+ * NULL if it doesn't exist (i.e. the extension is not installed).
+ */
+static char *
+retention_catalog_name(const char *relname)
+{
+	Oid		schema = get_pathman_schema();
+
+	if (!OidIsValid(schema) ||
+		!OidIsValid(get_relname_relid(relname, schema)))
+		return NULL;
+
+	return quote_qualified_identifier(get_namespace_name(schema), relname);
+}
+
+/*
+ * Convert 'drop', 'detach' or 'archive' to RetentionAction.
+ */
+static RetentionAction
+parse_retention_action(const char *action_str)
+{
+	if (pg_strcasecmp(action_str, "drop") == 0)
+		return RETENTION_DROP;
+	else if (pg_strcasecmp(action_str, "detach") == 0)
+		return RETENTION_DETACH;
+	else if (pg_strcasecmp(action_str, "archive") == 0)
+		return RETENTION_ARCHIVE;
+
+	ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+					errmsg("'action' should be one of 'drop', 'detach' or 'archive'")));
+	return RETENTION_DROP; /* keep compiler happy */
+}
+
+/*
+ * Return every RANGE table partitioned by time which has a retention
+ * in gogudb_config_params.  Must be called in a transaction.
+ */
+static List *
+collect_retention_tables(void)
+{
+	List		   *result = NIL;
+	Relation		rel;
+	HeapScanDesc	scan;
+	HeapTuple		htup;
+
+	rel = heap_open(get_pathman_config_params_relid(false), AccessShareLock);
+	scan = heap_beginscan(rel, GetActiveSnapshot(), 0, NULL);
+
+	while ((htup = heap_getnext(scan, ForwardScanDirection)) != NULL)
+	{
+		Datum			values[Natts_pathman_config_params];
+		bool			isnull[Natts_pathman_config_params];
+		Oid				relid;
+		RetentionTable *table;
+		const PartRelationInfo *prel;
+
+		heap_deform_tuple(htup, RelationGetDescr(rel), values, isnull);
+
+		if (isnull[Anum_pathman_config_params_retention - 1])
+			continue;
+
+		relid = DatumGetObjectId(values[Anum_pathman_config_params_partrel - 1]);
+
+		prel = get_pathman_relation_info(relid);
+		if (!prel || prel->parttype != PT_RANGE ||
+			!is_date_type_internal(getBaseType(prel->ev_type)))
+			continue;
+
+		table = palloc(sizeof(RetentionTable));
+		table->relid = relid;
+		memcpy(&table->retention,
+			   DatumGetIntervalP(values[Anum_pathman_config_params_retention - 1]),
+			   sizeof(Interval));
+
+		result = lappend(result, table);
+	}
+
+	heap_endscan(scan);
+	heap_close(rel, AccessShareLock);
+
+	return result;
+}
+
+/*
+ * Return at most 'batch_size' of the oldest partitions of 'table' which
+ * contain nothing newer than the current time minus its retention.
+ */
+static List *
+expired_partitions(RetentionTable *table, int batch_size)
+{
+	const PartRelationInfo *prel;
+	RangeEntry *ranges;
+	FmgrInfo	cmp_func;
+	TimestampTz	cutoff_ts;
+	Bound		cutoff;
+	List	   *result = NIL;
+	uint32		i;
+
+	prel = get_pathman_relation_info(table->relid);
+	if (prel == NULL || prel->parttype != PT_RANGE)
+		return NIL;
+
+	cutoff_ts = DatumGetTimestampTz(
+					DirectFunctionCall2(timestamptz_mi_interval,
+										TimestampTzGetDatum(GetCurrentTimestamp()),
+										IntervalPGetDatum(&table->retention)));
+
+	/* Date keys are truncated, which only makes us more careful */
+	cutoff = MakeBound(perform_type_cast(TimestampTzGetDatum(cutoff_ts),
+										 TIMESTAMPTZOID,
+										 getBaseType(prel->ev_type),
+										 NULL));
+
+	fmgr_info(prel->cmp_proc, &cmp_func);
+	ranges = PrelGetRangesArray(prel);
+
+	/* Never remove the last partition */
+	for (i = 0;
+		 i + 1 < PrelChildrenCount(prel) && list_length(result) < batch_size;
+		 i++)
+	{
+		if (cmp_bounds(&cmp_func, prel->ev_collid, &ranges[i].max, &cutoff) > 0)
+			break;
+
+		result = lappend_oid(result, ranges[i].child_oid);
+	}
+
+	return result;
+}
+
+/*
+ * Drop or detach partition 'partid' without waiting for locks longer
+ * than 'lock_timeout' ms.  Its remote table is recorded in
+ * RETENTION_PENDING if it has to be removed too.  Must be called in a
+ * transaction.
+ */
+static void
+remove_expired_partition(Oid partid, RetentionAction action, int lock_timeout)
+{
+	char	   *pending_name = retention_catalog_name(RETENTION_PENDING);
+	char	   *sql;
+
+	if (pending_name == NULL)
+		elog(ERROR, "%s: table \"%s\" does not exist",
+			 retention_bgw, RETENTION_PENDING);
+
+	/* Partition might have been removed by someone else */
+	if (!SearchSysCacheExists1(RELOID, ObjectIdGetDatum(partid)))
+		return;
+
+	if (SPI_connect() != SPI_OK_CONNECT)
+		elog(ERROR, "could not connect using SPI");
+
+	/* Remember the remote table before the foreign table is gone */
+	if (action != RETENTION_DETACH &&
+		get_rel_relkind(partid) == RELKIND_FOREIGN_TABLE)
+	{
+		ForeignTable   *ftable = GetForeignTable(partid);
+		char		   *remote_schema = NULL,
+					   *remote_table = NULL;
+		HeapTuple		htup;
+		ListCell	   *lc;
+		Oid				types[Natts_retention_pending - 1] = { TEXTOID, REGROLEOID,
+															   TEXTOID, TEXTOID,
+															   TEXTOID };
+		Datum			values[Natts_retention_pending - 1];
+
+		foreach (lc, ftable->options)
+		{
+			DefElem *def = (DefElem *) lfirst(lc);
+
+			if (strcmp(def->defname, "schema_name") == 0)
+				remote_schema = defGetString(def);
+			else if (strcmp(def->defname, "table_name") == 0)
+				remote_table = defGetString(def);
+		}
+
+		if (!remote_schema)
+			remote_schema = get_namespace_name(get_rel_namespace(partid));
+		if (!remote_table)
+			remote_table = get_rel_name(partid);
+
+		htup = SearchSysCache1(RELOID, ObjectIdGetDatum(partid));
+		if (!HeapTupleIsValid(htup))
+			elog(ERROR, "cache lookup failed for relation %u", partid);
+
+		values[Anum_retention_pending_server - 1] =
+				CStringGetTextDatum(GetForeignServer(ftable->serverid)->servername);
+		values[Anum_retention_pending_owner - 1] =
+				ObjectIdGetDatum(((Form_pg_class) GETSTRUCT(htup))->relowner);
+		values[Anum_retention_pending_schema - 1] = CStringGetTextDatum(remote_schema);
+		values[Anum_retention_pending_table - 1] = CStringGetTextDatum(remote_table);
+		values[Anum_retention_pending_action - 1] =
+				CStringGetTextDatum(prs_print_action(action));
+
+		ReleaseSysCache(htup);
+
+		/* Committed (or not) together with the partition's removal */
+		sql = psprintf("INSERT INTO %s VALUES ($1, $2, $3, $4, $5) "
+					   "ON CONFLICT DO NOTHING",
+					   pending_name);
+		if (SPI_execute_with_args(sql, Natts_retention_pending - 1,
+								  types, values, NULL,
+								  false, 0) != SPI_OK_INSERT)
+			elog(ERROR, "could not update \"%s\"", RETENTION_PENDING);
+	}
+
+	/* Give way to ingest, we'll try again in the next round */
+	sql = psprintf("SET LOCAL lock_timeout = %d", lock_timeout);
+	if (SPI_execute(sql, false, 0) < 0)
+		elog(ERROR, "could not execute \"%s\"", sql);
+
+	if (action == RETENTION_DETACH)
+		sql = psprintf("SELECT %s.detach_range_partition(%u::REGCLASS)",
+					   get_namespace_name(get_pathman_schema()), partid);
+	else
+		sql = psprintf("SELECT %s.drop_range_partition(%u::REGCLASS, true)",
+					   get_namespace_name(get_pathman_schema()), partid);
+
+	elog(LOG, "%s: removing partition \"%s\"",
+		 retention_bgw, get_rel_name_or_relid(partid));
+
+	/* Utility hook won't let anyone else touch partitions of a rule */
+	allow_rule_partition_removal(partid);
+
+	if (SPI_execute(sql, false, 0) != SPI_OK_SELECT)
+		elog(ERROR, "could not execute \"%s\"", sql);
+
+	SPI_finish();
+}
+
+/*
+ * Return every row of RETENTION_PENDING, allocated in the caller's
+ * memory context.  Must be called in a transaction.
+ */
+static List *
+collect_pending_remotes(void)
+{
+	MemoryContext	result_mcxt = CurrentMemoryContext;
+	char		   *pending_name = retention_catalog_name(RETENTION_PENDING);
+	List		   *result = NIL;
+	uint64			i;
+
+	if (pending_name == NULL)
+		return NIL;
+
+	if (SPI_connect() != SPI_OK_CONNECT)
+		elog(ERROR, "could not connect using SPI");
+
+	if (SPI_execute(psprintf("SELECT server, owner, remote_schema, remote_table, "
+							 "action, attempts FROM %s",
+							 pending_name),
+					true, 0) != SPI_OK_SELECT)
+		elog(ERROR, "could not read \"%s\"", RETENTION_PENDING);
+
+	for (i = 0; i < SPI_processed; i++)
+	{
+		HeapTuple			htup = SPI_tuptable->vals[i];
+		TupleDesc			tupdesc = SPI_tuptable->tupdesc;
+		RetentionRemote	   *remote;
+		MemoryContext		old_mcxt;
+		bool				isnull;
+
+		old_mcxt = MemoryContextSwitchTo(result_mcxt);
+
+		remote = palloc(sizeof(RetentionRemote));
+		remote->server = SPI_getvalue(htup, tupdesc,
+									  Anum_retention_pending_server);
+		remote->userid = DatumGetObjectId(SPI_getbinval(htup, tupdesc,
+														Anum_retention_pending_owner,
+														&isnull));
+		remote->remote_schema = SPI_getvalue(htup, tupdesc,
+											 Anum_retention_pending_schema);
+		remote->remote_table = SPI_getvalue(htup, tupdesc,
+											Anum_retention_pending_table);
+		remote->action = parse_retention_action(SPI_getvalue(htup, tupdesc,
+															 Anum_retention_pending_action));
+		remote->attempts = DatumGetInt32(SPI_getbinval(htup, tupdesc,
+													   Anum_retention_pending_attempts,
+													   &isnull));
+
+		result = lappend(result, remote);
+
+		MemoryContextSwitchTo(old_mcxt);
+	}
+
+	SPI_finish();
+
+	return result;
+}
+
+/*
+ * Delete 'remote' from RETENTION_PENDING.
+ * NOTE: SPI must be connected.
+ */
+static void
+forget_pending_remote(RetentionRemote *remote)
+{
+	Oid		types[3] = { TEXTOID, TEXTOID, TEXTOID };
+	Datum	values[3];
+	char   *sql;
+
+	values[0] = CStringGetTextDatum(remote->server);
+	values[1] = CStringGetTextDatum(remote->remote_schema);
+	values[2] = CStringGetTextDatum(remote->remote_table);
+
+	sql = psprintf("DELETE FROM %s WHERE server = $1 "
+				   "AND remote_schema = $2 AND remote_table = $3",
+				   retention_catalog_name(RETENTION_PENDING));
+	if (SPI_execute_with_args(sql, 3, types, values, NULL,
+							  false, 0) != SPI_OK_DELETE)
+		elog(ERROR, "could not update \"%s\"", RETENTION_PENDING);
+}
+
+/*
+ * Drop (or rename for the 'archive' action) the remote table of a
+ * removed partition and forget it.  Must be called in a transaction,
+ * the remote statement is committed together with it.
+ */
+static void
+remove_remote_table(RetentionRemote *remote, int lock_timeout)
+{
+	ForeignServer  *server;
+	UserMapping	   *user;
+	PGconn		   *conn;
+	PGresult	   *res;
+	char		   *sql;
+	const char	   *remote_name;
+
+	remote_name = quote_qualified_identifier(remote->remote_schema,
+											 remote->remote_table);
+
+	if (SPI_connect() != SPI_OK_CONNECT)
+		elog(ERROR, "could not connect using SPI");
+
+	/* Nothing to remove it from */
+	server = GetForeignServerByName(remote->server, true);
+	if (server == NULL)
+	{
+		elog(WARNING, "%s: server \"%s\" of remote table %s does not exist",
+			 retention_bgw, remote->server, remote_name);
+
+		forget_pending_remote(remote);
+		SPI_finish();
+		return;
+	}
+
+	user = GetUserMapping(remote->userid, server->serverid);
+	conn = GoguGetConnection(user, false, true);
+
+	sql = psprintf("SET LOCAL lock_timeout = %d", lock_timeout);
+	res = Gogu_pgfdw_exec_query(conn, sql);
+	if (PQresultStatus(res) != PGRES_COMMAND_OK)
+		Gogu_pgfdw_report_error(ERROR, res, conn, true, sql);
+	PQclear(res);
+
+	if (remote->action == RETENTION_ARCHIVE)
+		sql = psprintf("ALTER TABLE IF EXISTS %s RENAME TO %s",
+					   remote_name,
+					   quote_identifier(psprintf("%s%s", remote->remote_table,
+												 RETENTION_ARCHIVE_SUFFIX)));
+	else
+		sql = psprintf("DROP TABLE IF EXISTS %s", remote_name);
+
+	res = Gogu_pgfdw_exec_query(conn, sql);
+	if (PQresultStatus(res) != PGRES_COMMAND_OK)
+		Gogu_pgfdw_report_error(ERROR, res, conn, true, sql);
+	PQclear(res);
+
+	GoguReleaseConnection(conn);
+
+	forget_pending_remote(remote);
+	SPI_finish();
+}
+
+/*
+ * Remember a failed attempt to remove 'remote'.  Must be called in a
+ * transaction.
+ */
+static void
+count_remote_failure(RetentionRemote *remote)
+{
+	Oid		types[3] = { TEXTOID, TEXTOID, TEXTOID };
+	Datum	values[3];
+	char   *sql;
+
+	if (SPI_connect() != SPI_OK_CONNECT)
+		elog(ERROR, "could not connect using SPI");
+
+	values[0] = CStringGetTextDatum(remote->server);
+	values[1] = CStringGetTextDatum(remote->remote_schema);
+	values[2] = CStringGetTextDatum(remote->remote_table);
+
+	sql = psprintf("UPDATE %s SET attempts = attempts + 1 WHERE server = $1 "
+				   "AND remote_schema = $2 AND remote_table = $3",
+				   retention_catalog_name(RETENTION_PENDING));
+	if (SPI_execute_with_args(sql, 3, types, values, NULL,
+							  false, 0) != SPI_OK_UPDATE)
+		elog(ERROR, "could not update \"%s\"", RETENTION_PENDING);
+
+	SPI_finish();
+
+	/* It's never given up, but someone should take a look */
+	if (remote->attempts + 1 == RETENTION_WARN_ATTEMPTS)
+		elog(WARNING, "%s: could not remove remote table %s in %d attempts, "
+			 "see \"%s\"",
+			 retention_bgw,
+			 quote_qualified_identifier(remote->remote_schema,
+										remote->remote_table),
+			 RETENTION_WARN_ATTEMPTS, RETENTION_PENDING);
+}
+
+/*
+ * Remember (period > 0) or forget the schedule of the current database.
+ */
+static void
+save_retention_schedule(RetentionAction action, int32 batch_size,
+						int32 lock_timeout, int32 period)
+{
+	char   *config = retention_catalog_name(RETENTION_CONFIG);
+	Oid		types[Natts_retention_config] = { TEXTOID, INT4OID, INT4OID,
+											  INT4OID, REGROLEOID };
+	Datum	values[Natts_retention_config];
+	char   *sql;
+
+	if (config == NULL)
+		return;
+
+	values[Anum_retention_config_action - 1]		=
+			CStringGetTextDatum(prs_print_action(action));
+	values[Anum_retention_config_batch_size - 1]	= Int32GetDatum(batch_size);
+	values[Anum_retention_config_lock_timeout - 1]	= Int32GetDatum(lock_timeout);
+	values[Anum_retention_config_period - 1]		= Int32GetDatum(period);
+	values[Anum_retention_config_owner - 1]			= ObjectIdGetDatum(GetUserId());
+
+	if (SPI_connect() != SPI_OK_CONNECT)
+		elog(ERROR, "could not connect using SPI");
+
+	sql = psprintf("DELETE FROM %s", config);
+	if (SPI_execute(sql, false, 0) != SPI_OK_DELETE)
+		elog(ERROR, "could not update \"%s\"", RETENTION_CONFIG);
+
+	if (period > 0)
+	{
+		sql = psprintf("INSERT INTO %s VALUES ($1, $2, $3, $4, $5)", config);
+		if (SPI_execute_with_args(sql, Natts_retention_config,
+								  types, values, NULL,
+								  false, 0) != SPI_OK_INSERT)
+			elog(ERROR, "could not update \"%s\"", RETENTION_CONFIG);
+	}
+
+	SPI_finish();
+}
+
+/*
+ * Take a free slot and start PartitionRetentionWorker.
+ * Returns false if the database is being processed already.
+ */
+static bool
+launch_retention_worker(Oid userid, RetentionAction action, int32 batch_size,
+						int32 lock_timeout, int32 period)
+{
+	int		empty_slot_idx;
+
+	/* There is one worker per database, 'relid' is not used */
+	empty_slot_idx = claim_worker_slot(&retention_slots->head,
+									   sizeof(RetentionSlot),
+									   RETENTION_SLOTS,
+									   userid, InvalidOid, WS_WORKING);
+	if (empty_slot_idx < 0)
+		return false;
+	else
+	{
+		RetentionSlot *slot = &retention_slots[empty_slot_idx];
+
+		InitRetentionSlot(slot, action, batch_size, lock_timeout, period);
+
+		SpinLockRelease(&slot->head.mutex);
+	}
+
+	/* Start worker (we should not wait) */
+	launch_worker(&retention_slots[empty_slot_idx].head, empty_slot_idx,
+				  retention_bgw, CppAsString(bgw_main_partition_retention));
+
+	return true;
+}
+
+/*
+ * Start the worker of RETENTION_CONFIG in the current database.
+ * Must be called in a transaction.
+ */
+void
+restart_partition_retention(void)
+{
+	char   *config = retention_catalog_name(RETENTION_CONFIG);
+	uint64	i;
+
+	if (config == NULL)
+		return;
+
+	if (SPI_connect() != SPI_OK_CONNECT)
+		elog(ERROR, "could not connect using SPI");
+
+	if (SPI_execute(psprintf("SELECT action, batch_size, lock_timeout, "
+							 "period, owner FROM %s",
+							 config),
+					true, 0) != SPI_OK_SELECT)
+		elog(ERROR, "could not read \"%s\"", RETENTION_CONFIG);
+
+	for (i = 0; i < SPI_processed; i++)
+	{
+		HeapTuple	htup = SPI_tuptable->vals[i];
+		TupleDesc	tupdesc = SPI_tuptable->tupdesc;
+		bool		isnull;
+		RetentionAction action;
+		int32		batch_size,
+					lock_timeout,
+					period;
+		Oid			owner;
+
+		action = parse_retention_action(SPI_getvalue(htup, tupdesc,
+													 Anum_retention_config_action));
+		batch_size = DatumGetInt32(SPI_getbinval(htup, tupdesc,
+												 Anum_retention_config_batch_size,
+												 &isnull));
+		lock_timeout = DatumGetInt32(SPI_getbinval(htup, tupdesc,
+												   Anum_retention_config_lock_timeout,
+												   &isnull));
+		period = DatumGetInt32(SPI_getbinval(htup, tupdesc,
+											 Anum_retention_config_period,
+											 &isnull));
+		owner = DatumGetObjectId(SPI_getbinval(htup, tupdesc,
+											   Anum_retention_config_owner,
+											   &isnull));
+
+		if (!launch_retention_worker(owner, action, batch_size,
+									 lock_timeout, period))
+			elog(LOG, "%s: expired partitions of database \"%s\" "
+				 "are already being removed",
+				 retention_bgw, get_database_name(MyDatabaseId));
+	}
+
+	SPI_finish();
+}
+
+
+/*
+ * -------------------------------------------
+ *  Retention related SQL functions
+ * -------------------------------------------
+ */
+
+/*
+ * Take a free slot and start PartitionRetentionWorker.
+ * NOTE: this function returns immediately.
+ */
+Datum
+start_partition_retention(PG_FUNCTION_ARGS)
+{
+	const char	   *action_str = PG_ARGISNULL(0) ?
+									"drop" : text_to_cstring(PG_GETARG_TEXT_P(0));
+	int32			batch_size = PG_ARGISNULL(1) ? 10 : PG_GETARG_INT32(1);
+	int32			lock_timeout = PG_ARGISNULL(2) ? 100 : PG_GETARG_INT32(2);
+	int32			period = PG_ARGISNULL(3) ? 3600 : PG_GETARG_INT32(3);
+	RetentionAction	action;
+
+	if (!superuser())
+		ereport(ERROR, (errcode(ERRCODE_INSUFFICIENT_PRIVILEGE),
+						errmsg("must be superuser to remove expired partitions")));
+
+	action = parse_retention_action(action_str);
+
+	if (batch_size < 1)
+		ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+						errmsg("'batch_size' should not be less than 1")));
+
+	if (lock_timeout < 1)
+		ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+						errmsg("'lock_timeout' should not be less than 1")));
+
+	if (period < 0)
+		ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+						errmsg("'period' should not be less than 0")));
+
+	if (!launch_retention_worker(GetUserId(), action, batch_size,
+								 lock_timeout, period))
+		ereport(ERROR, (errmsg("expired partitions of database \"%s\" "
+							   "are already being removed",
+							   get_database_name(MyDatabaseId))));
+
+	/* Periodic retention survives restarts */
+	if (period > 0)
+		save_retention_schedule(action, batch_size, lock_timeout, period);
+
+	elog(NOTICE,
+		 "worker started, you can watch it in %s.gogudb_partition_retentions",
+		 get_namespace_name(get_pathman_schema()));
+
+	PG_RETURN_VOID();
+}
+
+/*
+ * Ask PartitionRetentionWorker of the current database to stop.
+ */
+Datum
+stop_partition_retention(PG_FUNCTION_ARGS)
+{
+	if (stop_worker_slot(&retention_slots->head, sizeof(RetentionSlot),
+						 RETENTION_SLOTS, InvalidOid))
+	{
+		/* Don't start it again after a restart */
+		save_retention_schedule(RETENTION_DROP, 0, 0, 0);
+
+		elog(NOTICE, "worker will stop after it finishes current partition");
+		PG_RETURN_BOOL(true);
+	}
+	else
+	{
+		elog(ERROR, "cannot find retention worker of database \"%s\"",
+			 get_database_name(MyDatabaseId));
+		PG_RETURN_BOOL(false); /* keep compiler happy */
+	}
+}
+
+/*
+ * Return list of active retention workers.
+ * NOTE: this is a set-returning-function (SRF).
+ */
+Datum
+show_partition_retentions_internal(PG_FUNCTION_ARGS)
+{
+	FuncCallContext			   *funcctx;
+	active_retentions_cxt	   *userctx;
+	RetentionSlot				slot_copy;
+
+	/*
+	 * Initialize tuple descriptor & function call context.
+	 */
+	if (SRF_IS_FIRSTCALL())
+	{
+		TupleDesc			tupdesc;
+		MemoryContext		old_mcxt;
+
+		funcctx = SRF_FIRSTCALL_INIT();
+
+		old_mcxt = MemoryContextSwitchTo(funcctx->multi_call_memory_ctx);
+
+		userctx = (active_retentions_cxt *) palloc(sizeof(active_retentions_cxt));
+		userctx->cur_idx = 0;
+
+		/* Create tuple descriptor */
+		tupdesc = CreateTemplateTupleDesc(Natts_partition_retentions, false);
+
+		TupleDescInitEntry(tupdesc, Anum_partition_retentions_userid,
+						   "userid", REGROLEOID, -1, 0);
+		TupleDescInitEntry(tupdesc, Anum_partition_retentions_pid,
+						   "pid", INT4OID, -1, 0);
+		TupleDescInitEntry(tupdesc, Anum_partition_retentions_dbid,
+						   "dbid", OIDOID, -1, 0);
+		TupleDescInitEntry(tupdesc, Anum_partition_retentions_action,
+						   "action", TEXTOID, -1, 0);
+		TupleDescInitEntry(tupdesc, Anum_partition_retentions_batch_size,
+						   "batch_size", INT4OID, -1, 0);
+		TupleDescInitEntry(tupdesc, Anum_partition_retentions_lock_timeout,
+						   "lock_timeout", INT4OID, -1, 0);
+		TupleDescInitEntry(tupdesc, Anum_partition_retentions_period,
+						   "period", INT4OID, -1, 0);
+		TupleDescInitEntry(tupdesc, Anum_partition_retentions_removed,
+						   "removed", INT8OID, -1, 0);
+		TupleDescInitEntry(tupdesc, Anum_partition_retentions_pending,
+						   "pending", INT4OID, -1, 0);
+		TupleDescInitEntry(tupdesc, Anum_partition_retentions_last,
+						   "last_round", TIMESTAMPTZOID, -1, 0);
+		TupleDescInitEntry(tupdesc, Anum_partition_retentions_status,
+						   "status", TEXTOID, -1, 0);
+
+		funcctx->tuple_desc = BlessTupleDesc(tupdesc);
+		funcctx->user_fctx = (void *) userctx;
+
+		MemoryContextSwitchTo(old_mcxt);
+	}
+
+	funcctx = SRF_PERCALL_SETUP();
+	userctx = (active_retentions_cxt *) funcctx->user_fctx;
+
+	/* Iterate through worker slots */
+	if (next_worker_slot(&retention_slots->head, sizeof(RetentionSlot),
+						 RETENTION_SLOTS, &userctx->cur_idx,
+						 &slot_copy.head))
+	{
+		Datum		values[Natts_partition_retentions];
+		bool		isnull[Natts_partition_retentions] = { 0 };
+		HeapTuple	htup;
+
+		values[Anum_partition_retentions_userid - 1]		= slot_copy.head.userid;
+		values[Anum_partition_retentions_pid - 1]			= slot_copy.head.pid;
+		values[Anum_partition_retentions_dbid - 1]			= slot_copy.head.dbid;
+		values[Anum_partition_retentions_action - 1]		=
+				CStringGetTextDatum(prs_print_action(slot_copy.action));
+		values[Anum_partition_retentions_batch_size - 1]	=
+				Int32GetDatum(slot_copy.batch_size);
+		values[Anum_partition_retentions_lock_timeout - 1]	=
+				Int32GetDatum(slot_copy.lock_timeout);
+		values[Anum_partition_retentions_period - 1]		=
+				Int32GetDatum(slot_copy.period);
+		values[Anum_partition_retentions_removed - 1]		=
+				Int64GetDatum(slot_copy.removed);
+		values[Anum_partition_retentions_pending - 1]		=
+				Int32GetDatum(slot_copy.pending);
+		values[Anum_partition_retentions_last - 1]			=
+				TimestampTzGetDatum(slot_copy.last_round);
+		values[Anum_partition_retentions_status - 1]		=
+				CStringGetTextDatum(ws_print_status(slot_copy.head.worker_status));
+
+		isnull[Anum_partition_retentions_last - 1] = (slot_copy.last_round == 0);
+
+		/* Form output tuple */
+		htup = heap_form_tuple(funcctx->tuple_desc, values, isnull);
+
+		SRF_RETURN_NEXT(funcctx, HeapTupleGetDatum(htup));
+	}
+
+	SRF_RETURN_DONE(funcctx);
+}
@@ -7,7 +7,12 @@
  *			* Create new partitions for INSERT in separate transaction
  *			* Process concurrent partitioning operations
  *
- *		Background worker API is used for both cases.
+ *		Background worker API is used for both cases.  New partitions are
+ *		created by a long-lived SpawnerWorker of the database, which takes
+ *		requests from a queue in shmem; a worker per request is only used
+ *		if the spawner can't serve it.  Concurrent partitioning may run
+ *		several workers per table, each of them moving the rows of its
+ *		range of blocks with COPY (see partition_copy.c).
  *
  * Copyright (c) 2015-2016, Postgres Professional
  *
@@ -15,25 +20,34 @@
  */
 
 #include "init.h"
+#include "partition_copy.h"
 #include "partition_creation.h"
+#include "partition_precreate.h"
+#include "partition_retention.h"
 #include "pathman_workers.h"
 #include "relation_info.h"
 #include "xact_handling.h"
 #include "utils.h"
 
+#include "access/heapam.h"
 #include "access/htup_details.h"
 #include "access/xact.h"
+#include "catalog/pg_database.h"
 #include "catalog/pg_type.h"
 #include "executor/spi.h"
 #include "funcapi.h"
 #include "miscadmin.h"
+#include "pgstat.h"
 #include "postmaster/bgworker.h"
+#include "storage/bufmgr.h"
 #include "storage/dsm.h"
 #include "storage/ipc.h"
 #include "storage/latch.h"
 #include "storage/proc.h"
+#include "storage/shmem.h"
 #include "utils/builtins.h"
 #include "utils/datum.h"
+#include "utils/guc.h"
 #include "utils/lsyscache.h"
 #include "utils/syscache.h"
 #include "utils/typcache.h"
@@ -52,15 +66,12 @@ PG_FUNCTION_INFO_V1( stop_concurrent_part_task );
  * Dynamically resolve functions (for BGW API).
  */
 extern PGDLLEXPORT void bgw_main_spawn_partitions(Datum main_arg);
+extern PGDLLEXPORT void bgw_main_spawner(Datum main_arg);
 extern PGDLLEXPORT void bgw_main_concurrent_part(Datum main_arg);
+extern PGDLLEXPORT void bgw_main_worker_launcher(Datum main_arg);
+extern PGDLLEXPORT void bgw_main_worker_restarter(Datum main_arg);
 
 
-static void handle_sigterm(SIGNAL_ARGS);
-static void bg_worker_load_config(const char *bgw_name);
-static bool start_bgworker(const char bgworker_name[BGW_MAXLEN],
-							const char bgworker_proc[BGW_MAXLEN],
-							Datum bgw_arg, bool wait_for_shutdown);
-
 
 /*
  * Function context for concurrent_part_tasks_internal() SRF.
@@ -76,12 +87,23 @@ typedef struct
  */
 static ConcurrentPartSlot  *concurrent_part_slots;
 
+/*
+ * Spawn request queue and SpawnerWorkers.
+ */
+static SpawnerState		   *spawner_state;
+
+/* Request being served by this SpawnerWorker, or -1 */
+static int					spawner_cur_request = -1;
+
 
 /*
  * Available workers' names.
  */
 static const char		   *spawn_partitions_bgw	= "SpawnPartitionsWorker";
+static const char		   *spawner_bgw				= "SpawnerWorker";
 static const char		   *concurrent_part_bgw		= "ConcurrentPartWorker";
+static const char		   *worker_launcher_bgw		= "WorkerLauncher";
+static const char		   *worker_restarter_bgw	= "WorkerRestarter";
 
 
 /*
@@ -118,6 +140,35 @@ init_concurrent_part_task_slots(void)
 }
 
 
+/*
+ * Estimate amount of shmem needed for the spawn request queue.
+ */
+Size
+estimate_spawner_state_size(void)
+{
+	return MAXALIGN(sizeof(SpawnerState));
+}
+
+/*
+ * Initialize shared memory needed for the spawn request queue.
+ */
+void
+init_spawner_state(void)
+{
+	bool	found;
+
+	spawner_state = (SpawnerState *)
+			ShmemInitStruct("gogudb spawner state",
+							estimate_spawner_state_size(), &found);
+
+	if (!found)
+	{
+		memset(spawner_state, 0, sizeof(SpawnerState));
+		SpinLockInit(&spawner_state->mutex);
+	}
+}
+
+
 /*
  * -------------------------------------------------
  *  Common utility functions for background workers
@@ -128,7 +179,7 @@ init_concurrent_part_task_slots(void)
  * Handle SIGTERM in BGW's process.
  * Use it in favor of bgworker_die().
  */
-static void
+void
 handle_sigterm(SIGNAL_ARGS)
 {
 	int save_errno = errno;
@@ -147,7 +198,7 @@ handle_sigterm(SIGNAL_ARGS)
 /*
  * Initialize pg_pathman's local config in BGW's process.
  */
-static void
+void
 bg_worker_load_config(const char *bgw_name)
 {
 	/* Try to load config */
@@ -162,7 +213,7 @@ bg_worker_load_config(const char *bgw_name)
 /*
  * Common function to start background worker.
  */
-static bool
+bool
 start_bgworker(const char bgworker_name[BGW_MAXLEN],
 				const char bgworker_proc[BGW_MAXLEN],
 				Datum bgw_arg, bool wait_for_shutdown)
@@ -233,109 +284,1008 @@ handle_exec_state:
 			break;
 	}
 
-	return true;
-}
+	return true;
+}
+
+/*
+ * ------------------------------------------------
+ *  Slots of the workers started by SQL functions
+ * ------------------------------------------------
+ */
+
+/*
+ * Initialize an array of slots in shmem.
+ */
+void
+init_worker_slots(WorkerSlot *slots, Size slot_size, int nslots)
+{
+	int		i;
+
+	memset(slots, 0, slot_size * nslots);
+
+	for (i = 0; i < nslots; i++)
+		SpinLockInit(&WorkerSlotAt(slots, slot_size, i)->mutex);
+}
+
+/* Free bgworker's slot */
+static void
+free_worker_slot(int code, Datum arg)
+{
+	WorkerSlot *slot = (WorkerSlot *) DatumGetPointer(arg);
+
+	SpinLockAcquire(&slot->mutex);
+	slot->worker_status = WS_FREE;
+	SpinLockRelease(&slot->mutex);
+}
+
+/*
+ * Take a free slot for the worker of 'relid' (InvalidOid for all tables)
+ * in the current database.  The slot is returned locked, with its head
+ * filled in, caller must fill in the rest and release the mutex.
+ * Returns -1 if such a worker is running already.
+ */
+int
+claim_worker_slot(WorkerSlot *slots, Size slot_size, int nslots,
+				  Oid userid, Oid relid, int status)
+{
+	int		empty_slot_idx = -1,
+			i;
+
+	/*
+	 * Look for an empty slot and also check that this table
+	 * isn't being processed yet
+	 */
+	for (i = 0; i < nslots; i++)
+	{
+		WorkerSlot *cur_slot = WorkerSlotAt(slots, slot_size, i);
+		bool		keep_this_lock = false;
+
+		SpinLockAcquire(&cur_slot->mutex);
+
+		if (empty_slot_idx < 0 && cur_slot->worker_status == WS_FREE)
+		{
+			empty_slot_idx = i;
+			keep_this_lock = true;
+		}
+
+		if (cur_slot->relid == relid &&
+			cur_slot->dbid == MyDatabaseId &&
+			cur_slot->worker_status != WS_FREE)
+		{
+			SpinLockRelease(&cur_slot->mutex);
+
+			if (empty_slot_idx >= 0 && empty_slot_idx != i)
+				SpinLockRelease(&WorkerSlotAt(slots, slot_size,
+											  empty_slot_idx)->mutex);
+
+			return -1;
+		}
+
+		if (!keep_this_lock)
+			SpinLockRelease(&cur_slot->mutex);
+	}
+
+	if (empty_slot_idx < 0)
+		ereport(ERROR, (errcode(ERRCODE_CONFIGURATION_LIMIT_EXCEEDED),
+						errmsg("no empty worker slots found"),
+						errhint("consider increasing max_worker_processes")));
+	else
+	{
+		WorkerSlot *slot = WorkerSlotAt(slots, slot_size, empty_slot_idx);
+
+		slot->worker_status = status;
+		slot->userid = userid;
+		slot->pid = 0;
+		slot->dbid = MyDatabaseId;
+		slot->relid = relid;
+	}
+
+	return empty_slot_idx;
+}
+
+/*
+ * Start the worker of a claimed slot.
+ * NOTE: this function returns immediately.
+ */
+void
+launch_worker(WorkerSlot *slot, int slot_idx,
+			  const char *bgw_name, const char *bgw_proc)
+{
+	if (!start_bgworker(bgw_name, bgw_proc, Int32GetDatum(slot_idx), false))
+	{
+		/* Couldn't start, free the slot */
+		free_worker_slot(0, PointerGetDatum(slot));
+
+		start_bgworker_errmsg(bgw_name);
+	}
+}
+
+/*
+ * Set up the process of a worker: its slot, signals and the connection.
+ */
+void
+attach_worker_slot(WorkerSlot *slot, const char *bgw_name)
+{
+	slot->pid = MyProcPid;
+
+	/* Establish atexit callback that will free the slot */
+	on_proc_exit(free_worker_slot, PointerGetDatum(slot));
+
+	/* Establish signal handlers before unblocking signals */
+	pqsignal(SIGTERM, handle_sigterm);
+
+	/* We're now ready to receive signals */
+	BackgroundWorkerUnblockSignals();
+
+	/* Create resource owner */
+	CurrentResourceOwner = ResourceOwnerCreate(NULL, bgw_name);
+
+	/* Establish connection and start transaction */
+#if PG_VERSION_NUM >= 110000
+	BackgroundWorkerInitializeConnectionByOid(slot->dbid, slot->userid, 0);
+#else
+	BackgroundWorkerInitializeConnectionByOid(slot->dbid, slot->userid);
+#endif
+}
+
+/*
+ * Ask the worker of 'relid' (InvalidOid for all tables) in the current
+ * database to stop.  Returns false if there is none.
+ */
+bool
+stop_worker_slot(WorkerSlot *slots, Size slot_size, int nslots, Oid relid)
+{
+	bool	worker_found = false;
+	int		i;
+
+	for (i = 0; i < nslots && !worker_found; i++)
+	{
+		WorkerSlot *cur_slot = WorkerSlotAt(slots, slot_size, i);
+
+		SpinLockAcquire(&cur_slot->mutex);
+
+		if (cur_slot->worker_status != WS_FREE &&
+			cur_slot->relid == relid &&
+			cur_slot->dbid == MyDatabaseId)
+		{
+			/* Change worker's state & set 'worker_found' */
+			cur_slot->worker_status = WS_STOPPING;
+			worker_found = true;
+		}
+
+		SpinLockRelease(&cur_slot->mutex);
+	}
+
+	return worker_found;
+}
+
+/*
+ * Wait 'period' seconds for the next round, but react to stop requests
+ * in time.  Returns false if the worker has to stop.
+ */
+bool
+sleep_worker_slot(WorkerSlot *slot, int period)
+{
+	int		slept;
+
+	ws_set_status(slot, WS_SLEEPING);
+
+	for (slept = 0;
+		 slept < period && ws_check_status(slot) != WS_STOPPING;
+		 slept++)
+	{
+		int rc;
+
+		rc = WaitLatch(MyLatch,
+					   WL_LATCH_SET | WL_TIMEOUT | WL_POSTMASTER_DEATH,
+					   1000L
+#if PG_VERSION_NUM >= 100000
+					   , PG_WAIT_EXTENSION
+#endif
+					   );
+		ResetLatch(MyLatch);
+
+		if (rc & WL_POSTMASTER_DEATH)
+			proc_exit(1);
+
+		CHECK_FOR_INTERRUPTS();
+	}
+
+	return ws_check_status(slot) != WS_STOPPING;
+}
+
+/*
+ * Copy the next busy slot starting at '*cur_idx' to 'copy', for the SRFs
+ * showing the workers.  Returns false if there are no more of them.
+ */
+bool
+next_worker_slot(WorkerSlot *slots, Size slot_size, int nslots,
+				 int *cur_idx, WorkerSlot *copy)
+{
+	int		i;
+
+	for (i = *cur_idx; i < nslots; i++)
+	{
+		WorkerSlot *cur_slot = WorkerSlotAt(slots, slot_size, i);
+
+		/* Copy slot to process local memory */
+		SpinLockAcquire(&cur_slot->mutex);
+		memcpy(copy, cur_slot, slot_size);
+		SpinLockRelease(&cur_slot->mutex);
+
+		if (copy->worker_status != WS_FREE)
+		{
+			/* Switch to next worker */
+			*cur_idx = i + 1;
+			return true;
+		}
+	}
+
+	*cur_idx = nslots;
+	return false;
+}
+
+
+/*
+ * ---------------------------------------------
+ *  Relaunch of scheduled workers at startup
+ * ---------------------------------------------
+ */
+
+/*
+ * Register WorkerLauncher, which starts WorkerRestarter in every database
+ * once the server is up.
+ */
+void
+register_worker_launcher(void)
+{
+	BackgroundWorker	worker;
+
+	memset(&worker, 0, sizeof(worker));
+
+	snprintf(worker.bgw_name, BGW_MAXLEN, "%s", worker_launcher_bgw);
+	snprintf(worker.bgw_function_name, BGW_MAXLEN,
+			 CppAsString(bgw_main_worker_launcher));
+	snprintf(worker.bgw_library_name, BGW_MAXLEN, "gogudb");
+
+	worker.bgw_flags			= BGWORKER_SHMEM_ACCESS |
+									BGWORKER_BACKEND_DATABASE_CONNECTION;
+	worker.bgw_start_time		= BgWorkerStart_RecoveryFinished;
+	worker.bgw_restart_time		= BGW_NEVER_RESTART;
+	worker.bgw_main_arg			= (Datum) 0;
+	worker.bgw_notify_pid		= 0;
+
+	RegisterBackgroundWorker(&worker);
+}
+
+/*
+ * Entry point for WorkerLauncher's process.
+ */
+void
+bgw_main_worker_launcher(Datum main_arg)
+{
+	List		   *databases = NIL;
+	ListCell	   *lc;
+	Relation		rel;
+	HeapScanDesc	scan;
+	HeapTuple		htup;
+
+	/* Establish signal handlers before unblocking signals */
+	pqsignal(SIGTERM, handle_sigterm);
+
+	/* We're now ready to receive signals */
+	BackgroundWorkerUnblockSignals();
+
+	/* Only shared catalogs are needed */
+#if PG_VERSION_NUM >= 110000
+	BackgroundWorkerInitializeConnection(NULL, NULL, 0);
+#else
+	BackgroundWorkerInitializeConnection(NULL, NULL);
+#endif
+
+	StartTransactionCommand();
+
+	rel = heap_open(DatabaseRelationId, AccessShareLock);
+	scan = heap_beginscan_catalog(rel, 0, NULL);
+
+	while ((htup = heap_getnext(scan, ForwardScanDirection)) != NULL)
+	{
+		Form_pg_database	db = (Form_pg_database) GETSTRUCT(htup);
+		MemoryContext		old_mcxt;
+
+		if (!db->datallowconn || db->datistemplate)
+			continue;
+
+		/* The list has to outlive the transaction */
+		old_mcxt = MemoryContextSwitchTo(TopMemoryContext);
+		databases = lappend_oid(databases, HeapTupleGetOid(htup));
+		MemoryContextSwitchTo(old_mcxt);
+	}
+
+	heap_endscan(scan);
+	heap_close(rel, AccessShareLock);
+
+	CommitTransactionCommand();
+
+	/* One database at a time, so that we don't take all worker slots */
+	foreach(lc, databases)
+	{
+		if (!start_bgworker(worker_restarter_bgw,
+							CppAsString(bgw_main_worker_restarter),
+							ObjectIdGetDatum(lfirst_oid(lc)),
+							true))
+			elog(WARNING, "%s: could not start %s for database %u",
+				 worker_launcher_bgw, worker_restarter_bgw, lfirst_oid(lc));
+	}
+}
+
+/*
+ * Entry point for WorkerRestarter's process: start the workers scheduled
+ * in the database, if it has gogudb.
+ */
+void
+bgw_main_worker_restarter(Datum main_arg)
+{
+	/* Establish signal handlers before unblocking signals */
+	pqsignal(SIGTERM, handle_sigterm);
+
+	/* We're now ready to receive signals */
+	BackgroundWorkerUnblockSignals();
+
+	/* Connect as the bootstrap superuser */
+#if PG_VERSION_NUM >= 110000
+	BackgroundWorkerInitializeConnectionByOid(DatumGetObjectId(main_arg),
+											  InvalidOid, 0);
+#else
+	BackgroundWorkerInitializeConnectionByOid(DatumGetObjectId(main_arg),
+											  InvalidOid);
+#endif
+
+	StartTransactionCommand();
+	PushActiveSnapshot(GetTransactionSnapshot());
+
+	if (OidIsValid(get_pathman_schema()))
+	{
+		restart_partition_precreations();
+		restart_partition_retention();
+	}
+
+	PopActiveSnapshot();
+	CommitTransactionCommand();
+}
+
+
+/*
+ * --------------------------------------
+ *  SpawnPartitionsWorker implementation
+ * --------------------------------------
+ */
+
+/*
+ * Create args segment for partitions bgw.
+ */
+static dsm_segment *
+create_partitions_bg_worker_segment(Oid relid, Datum value, Oid value_type)
+{
+	TypeCacheEntry		   *typcache;
+	Size					datum_size;
+	Size					segment_size;
+	dsm_segment			   *segment;
+	SpawnPartitionArgs	   *args;
+
+	typcache = lookup_type_cache(value_type, 0);
+
+	/* Calculate segment size */
+	datum_size = datumGetSize(value, typcache->typbyval, typcache->typlen);
+	segment_size = offsetof(SpawnPartitionArgs, value) + datum_size;
+
+	segment = dsm_create(segment_size, 0);
+
+	/* Initialize BGW args */
+	args = (SpawnPartitionArgs *) dsm_segment_address(segment);
+
+	args->userid = GetUserId();
+	args->result = InvalidOid;
+	args->dbid = MyDatabaseId;
+	args->partitioned_table = relid;
+
+#if PG_VERSION_NUM >= 90600
+	/* Initialize args for BecomeLockGroupMember() */
+	args->parallel_master_pgproc = MyProc;
+	args->parallel_master_pid = MyProcPid;
+#endif
+
+	/* Write value-related stuff */
+	args->value_type = value_type;
+	args->value_size = datum_size;
+	args->value_byval = typcache->typbyval;
+
+	PackDatumToByteArray((void *) args->value, value,
+						 datum_size, args->value_byval);
+
+	return segment;
+}
+
+/*
+ * Starts background worker that will create new partitions,
+ * waits till it finishes the job and returns the result (new partition oid)
+ */
+static Oid
+create_partitions_for_value_new_bg_worker(Oid relid, Datum value, Oid value_type)
+{
+	dsm_segment			   *segment;
+	dsm_handle				segment_handle;
+	SpawnPartitionArgs	   *bgw_args;
+	Oid						child_oid = InvalidOid;
+
+	/* Create a dsm segment for the worker to pass arguments */
+	segment = create_partitions_bg_worker_segment(relid, value, value_type);
+	segment_handle = dsm_segment_handle(segment);
+	bgw_args = (SpawnPartitionArgs *) dsm_segment_address(segment);
+
+#if PG_VERSION_NUM >= 90600
+	/* Become locking group leader */
+	BecomeLockGroupLeader();
+#endif
+
+	/* Start worker and wait for it to finish */
+	if (!start_bgworker(spawn_partitions_bgw,
+						CppAsString(bgw_main_spawn_partitions),
+						UInt32GetDatum(segment_handle),
+						true))
+	{
+		start_bgworker_errmsg(spawn_partitions_bgw);
+	}
+
+	/* Save the result (partition Oid) */
+	child_oid = bgw_args->result;
+
+	/* Free dsm segment */
+	dsm_detach(segment);
+
+	if (child_oid == InvalidOid)
+		ereport(ERROR,
+				(errmsg("attempt to spawn new partitions of relation \"%s\" failed",
+						get_rel_name_or_relid(relid)),
+				 errhint("See server log for more details.")));
+
+	return child_oid;
+}
+
+/*
+ * Entry point for SpawnPartitionsWorker's process.
+ */
+void
+bgw_main_spawn_partitions(Datum main_arg)
+{
+	dsm_handle				handle = DatumGetUInt32(main_arg);
+	dsm_segment			   *segment;
+	SpawnPartitionArgs	   *args;
+	Datum					value;
+
+	/* Establish signal handlers before unblocking signals. */
+	pqsignal(SIGTERM, handle_sigterm);
+
+	/* We're now ready to receive signals */
+	BackgroundWorkerUnblockSignals();
+
+	/* Create resource owner */
+	CurrentResourceOwner = ResourceOwnerCreate(NULL, spawn_partitions_bgw);
+
+	if (!handle)
+		elog(ERROR, "%s: invalid dsm_handle [%u]",
+			 spawn_partitions_bgw, MyProcPid);
+
+	/* Attach to dynamic shared memory */
+	if ((segment = dsm_attach(handle)) == NULL)
+		elog(ERROR, "%s: cannot attach to segment [%u]",
+			 spawn_partitions_bgw, MyProcPid);
+	args = dsm_segment_address(segment);
+
+#if PG_VERSION_NUM >= 90600
+	/* Join locking group. If we can't join the group, quit */
+	if (!BecomeLockGroupMember(args->parallel_master_pgproc,
+							   args->parallel_master_pid))
+		return;
+#endif
+	/* Establish connection and start transaction */
+#if PG_VERSION_NUM >= 110000
+	BackgroundWorkerInitializeConnectionByOid(args->dbid, args->userid, 0);
+#else
+	BackgroundWorkerInitializeConnectionByOid(args->dbid, args->userid);
+#endif
+	/* Start new transaction (syscache access etc.) */
+	StartTransactionCommand();
+
+	/* Initialize pg_pathman's local config */
+	bg_worker_load_config(spawn_partitions_bgw);
+
+	/* Upack Datum from segment to 'value' */
+	UnpackDatumFromByteArray(&value,
+							 args->value_size,
+							 args->value_byval,
+							 (const void *) args->value);
+
+/* Print 'arg->value' for debug purposes */
+#ifdef USE_ASSERT_CHECKING
+	elog(LOG, "%s: arg->value is '%s' [%u]",
+		 spawn_partitions_bgw,
+		 DebugPrintDatum(value, args->value_type), MyProcPid);
+#endif
+
+	/* Create partitions and save the Oid of the last one */
+	args->result = create_partitions_for_value_internal(args->partitioned_table,
+														value, /* unpacked Datum */
+														args->value_type,
+														true); /* background woker */
+
+	/* Finish transaction in an appropriate way */
+	if (args->result == InvalidOid)
+		AbortCurrentTransaction();
+	else
+		CommitTransactionCommand();
+
+	dsm_detach(segment);
+}
+
+/*
+ * ------------------------------
+ *  SpawnerWorker implementation
+ * ------------------------------
+ */
+
+/*
+ * Mark a request done and wake up its waiters.  Caller must hold the mutex;
+ * latches are copied to 'latches' to be set after it's released.
+ */
+static int
+finish_spawn_request(SpawnRequest *req, Oid result, bool served,
+					 Latch **latches)
+{
+	int		nlatches = req->nlatches;
+
+	memcpy(latches, req->latches, sizeof(Latch *) * nlatches);
+
+	req->result = result;
+	req->served = served;
+	req->status = (req->nwaiters > 0) ? SRS_DONE : SRS_FREE;
+
+	return nlatches;
+}
+
+/*
+ * Fail all requests of 'dbid' waiting for a spawner (there's none any
+ * more), so that their backends fall back to SpawnPartitionsWorker.
+ * Caller must hold the mutex.
+ */
+static void
+fail_spawn_requests(Oid dbid)
+{
+	int		i;
+
+	for (i = 0; i < SPAWN_REQUEST_SLOTS; i++)
+	{
+		SpawnRequest   *req = &spawner_state->requests[i];
+		Latch		   *latches[SPAWN_REQUEST_LATCHES];
+
+		if (req->dbid == dbid &&
+			(req->status == SRS_PENDING || req->status == SRS_WORKING))
+		{
+			/* Waiters poll anyway, don't set latches under spinlock */
+			(void) finish_spawn_request(req, InvalidOid, false, latches);
+		}
+	}
+}
+
+/* Free SpawnerWorker's slot unless it has already given it up */
+static void
+free_spawner_slot(int code, Datum arg)
+{
+	SpawnerSlot *spawner = &spawner_state->spawners[DatumGetInt32(arg)];
+
+	SpinLockAcquire(&spawner_state->mutex);
+	if (spawner->status != SPS_FREE && spawner->pid == MyProcPid)
+	{
+		fail_spawn_requests(spawner->dbid);
+		spawner->status = SPS_FREE;
+		spawner->pid = 0;
+		spawner->latch = NULL;
+	}
+	SpinLockRelease(&spawner_state->mutex);
+}
+
+/*
+ * Create partitions for a request, as the user who has sent it.  Locks
+ * are awaited for at most the request's lock_timeout, so that one table
+ * can't hold up the requests of the others; a request which fails is
+ * handed back to its backends.
+ */
+static void
+serve_spawn_request(SpawnRequest *req)
+{
+	Datum			value;
+	volatile Oid	result = InvalidOid;
+	volatile bool	served = true;
+	Oid				save_userid;
+	int				save_sec_context;
+	Latch		   *latches[SPAWN_REQUEST_LATCHES];
+	int				nlatches,
+					i;
+
+	PG_TRY();
+	{
+		/* Start new transaction (syscache access etc.) */
+		StartTransactionCommand();
+
+		/* Reverted at the end of transaction */
+		(void) set_config_option("lock_timeout",
+								 psprintf("%d", req->lock_timeout),
+								 PGC_SUSET, PGC_S_SESSION,
+								 GUC_ACTION_LOCAL, true, 0, false);
+
+		GetUserIdAndSecContext(&save_userid, &save_sec_context);
+		SetUserIdAndSecContext(req->userid,
+							   save_sec_context | SECURITY_LOCAL_USERID_CHANGE);
+
+		/* Only we access the request while it's SRS_WORKING */
+		UnpackDatumFromByteArray(&value,
+								 req->value_size,
+								 req->value_byval,
+								 (const void *) req->value);
+
+		/* Create partitions and save the Oid of the last one */
+		result = create_partitions_for_value_internal(req->partitioned_table,
+													  value,
+													  req->value_type,
+													  true); /* background woker */
+
+		/* Finish transaction in an appropriate way */
+		if (result == InvalidOid)
+			AbortCurrentTransaction();
+		else
+		{
+			SetUserIdAndSecContext(save_userid, save_sec_context);
+			CommitTransactionCommand();
+		}
+	}
+	PG_CATCH();
+	{
+		/* Keep serving other requests, backends will use a BGW */
+		HOLD_INTERRUPTS();
+		EmitErrorReport();
+		FlushErrorState();
+		AbortCurrentTransaction();
+		RESUME_INTERRUPTS();
+
+		result = InvalidOid;
+		served = false;
+	}
+	PG_END_TRY();
+
+	SpinLockAcquire(&spawner_state->mutex);
+	nlatches = finish_spawn_request(req, result, served, latches);
+	SpinLockRelease(&spawner_state->mutex);
+
+	for (i = 0; i < nlatches; i++)
+		SetLatch(latches[i]);
+}
+
+/*
+ * Entry point for SpawnerWorker's process.
+ */
+void
+bgw_main_spawner(Datum main_arg)
+{
+	int				slot_idx = DatumGetInt32(main_arg);
+	SpawnerSlot	   *spawner = &spawner_state->spawners[slot_idx];
+	Oid				dbid;
+	TimestampTz		last_request = GetCurrentTimestamp();
+
+	/* Take the slot, the backend which has started us waits for it */
+	SpinLockAcquire(&spawner_state->mutex);
+	dbid = spawner->dbid;
+	spawner->pid = MyProcPid;
+	spawner->latch = MyLatch;
+	spawner->status = SPS_RUNNING;
+	SpinLockRelease(&spawner_state->mutex);
+
+	/* Establish atexit callback that will free the slot */
+	on_proc_exit(free_spawner_slot, Int32GetDatum(slot_idx));
+
+	/* Establish signal handlers before unblocking signals */
+	pqsignal(SIGTERM, handle_sigterm);
+
+	/* We're now ready to receive signals */
+	BackgroundWorkerUnblockSignals();
+
+	/* Create resource owner */
+	CurrentResourceOwner = ResourceOwnerCreate(NULL, spawner_bgw);
+
+	/* Connect as superuser, requests are served as their users */
+#if PG_VERSION_NUM >= 110000
+	BackgroundWorkerInitializeConnectionByOid(dbid, InvalidOid, 0);
+#else
+	BackgroundWorkerInitializeConnectionByOid(dbid, InvalidOid);
+#endif
+
+	/* Initialize pg_pathman's local config */
+	StartTransactionCommand();
+	bg_worker_load_config(spawner_bgw);
+	CommitTransactionCommand();
+
+	for (;;)
+	{
+		int		rc,
+				i;
+
+		/* Reset the latch first not to miss new requests */
+		ResetLatch(MyLatch);
+		CHECK_FOR_INTERRUPTS();
+
+		SpinLockAcquire(&spawner_state->mutex);
+		for (i = 0; i < SPAWN_REQUEST_SLOTS; i++)
+		{
+			SpawnRequest *req = &spawner_state->requests[i];
+
+			if (req->status == SRS_PENDING && req->dbid == dbid)
+			{
+				req->status = SRS_WORKING;
+				spawner_cur_request = i;
+				break;
+			}
+		}
+
+		/* Give up the slot if we have been idle for too long */
+		if (spawner_cur_request < 0 &&
+			TimestampDifferenceExceeds(last_request, GetCurrentTimestamp(),
+									   SPAWNER_IDLE_TIMEOUT * 1000))
+		{
+			spawner->status = SPS_FREE;
+			spawner->pid = 0;
+			spawner->latch = NULL;
+			SpinLockRelease(&spawner_state->mutex);
+			break;
+		}
+		SpinLockRelease(&spawner_state->mutex);
+
+		if (spawner_cur_request >= 0)
+		{
+			serve_spawn_request(&spawner_state->requests[spawner_cur_request]);
+			spawner_cur_request = -1;
+			last_request = GetCurrentTimestamp();
+			continue;
+		}
+
+		rc = WaitLatch(MyLatch,
+					   WL_LATCH_SET | WL_TIMEOUT | WL_POSTMASTER_DEATH,
+					   1000L
+#if PG_VERSION_NUM >= 100000
+					   , PG_WAIT_EXTENSION
+#endif
+					   );
+
+		if (rc & WL_POSTMASTER_DEATH)
+			proc_exit(1);
+	}
+}
+
+/*
+ * Send a request to the SpawnerWorker of this database (starting it if
+ * needed) and wait for the result.  Returns false if the request could
+ * not be served in SPAWN_WAIT_TIMEOUT ms, caller should use a worker of
+ * its own then.
+ */
+static bool
+spawner_request(Oid relid, Datum value, Oid value_type, Oid *result)
+{
+	TypeCacheEntry *typcache;
+	Size			datum_size;
+	uint8			packed[SPAWN_VALUE_MAXLEN];
+	SpawnRequest   *req = NULL;
+	SpawnerSlot	   *spawner = NULL;
+	Latch		   *spawner_latch = NULL;
+	int				spawner_idx = -1;
+	bool			start_spawner = false,
+					served = false,
+					done = false;
+	TimestampTz		deadline;
+	int				i;
+
+	/* Spawner is not in our locking group, it must not wait for us */
+	if (xact_spawner_conflicting_lock_exists(relid))
+		return false;
+
+	typcache = lookup_type_cache(value_type, 0);
+	datum_size = datumGetSize(value, typcache->typbyval, typcache->typlen);
+
+	/* Pack value the way UnpackDatumFromByteArray() expects */
+	if (Max(datum_size, sizeof(Datum)) > SPAWN_VALUE_MAXLEN)
+		return false;
+
+	memset(packed, 0, sizeof(packed));
+	PackDatumToByteArray((void *) packed, value, datum_size, typcache->typbyval);
+
+	SpinLockAcquire(&spawner_state->mutex);
+
+	/* Join a request for the same value, or take a free slot */
+	for (i = 0; i < SPAWN_REQUEST_SLOTS; i++)
+	{
+		SpawnRequest *cur = &spawner_state->requests[i];
+
+		if ((cur->status == SRS_PENDING || cur->status == SRS_WORKING) &&
+			cur->dbid == MyDatabaseId &&
+			cur->partitioned_table == relid &&
+			cur->value_type == value_type &&
+			cur->value_size == datum_size &&
+			memcmp(cur->value, packed, SPAWN_VALUE_MAXLEN) == 0)
+		{
+			req = cur;
+			break;
+		}
+
+		if (req == NULL && cur->status == SRS_FREE)
+			req = cur;
+	}
+
+	/* Find the spawner of this database, or take a free slot */
+	for (i = 0; i < SPAWNER_SLOTS; i++)
+	{
+		SpawnerSlot *cur = &spawner_state->spawners[i];
+
+		if (cur->status != SPS_FREE && cur->dbid == MyDatabaseId)
+		{
+			spawner = cur;
+			spawner_idx = i;
+			break;
+		}
+
+		if (spawner == NULL && cur->status == SPS_FREE)
+		{
+			spawner = cur;
+			spawner_idx = i;
+		}
+	}
+
+	if (req == NULL || spawner == NULL)
+	{
+		SpinLockRelease(&spawner_state->mutex);
+		return false;
+	}
 
-/*
- * Show generic error message if we failed to start bgworker.
- */
-static inline void
-start_bgworker_errmsg(const char *bgworker_name)
-{
-	ereport(ERROR, (errmsg("could not start %s", bgworker_name),
-					errhint("consider increasing max_worker_processes")));
-}
+	if (req->status == SRS_FREE)
+	{
+		req->status = SRS_PENDING;
+		req->userid = GetUserId();
+		req->dbid = MyDatabaseId;
+		req->partitioned_table = relid;
+		req->value_type = value_type;
+		req->value_size = datum_size;
+		req->value_byval = typcache->typbyval;
+		memcpy(req->value, packed, SPAWN_VALUE_MAXLEN);
+		req->lock_timeout = (LockTimeout > 0 && LockTimeout < SPAWN_LOCK_TIMEOUT) ?
+								LockTimeout : SPAWN_LOCK_TIMEOUT;
+		req->nwaiters = 0;
+		req->nlatches = 0;
+		req->served = false;
+		req->result = InvalidOid;
+	}
 
+	req->nwaiters++;
+	if (req->nlatches < SPAWN_REQUEST_LATCHES)
+		req->latches[req->nlatches++] = MyLatch;
 
-/*
- * --------------------------------------
- *  SpawnPartitionsWorker implementation
- * --------------------------------------
- */
+	if (spawner->status == SPS_FREE)
+	{
+		spawner->status = SPS_STARTING;
+		spawner->dbid = MyDatabaseId;
+		spawner->pid = 0;
+		spawner->latch = NULL;
+		start_spawner = true;
+	}
+	else
+		spawner_latch = spawner->latch;
 
-/*
- * Create args segment for partitions bgw.
- */
-static dsm_segment *
-create_partitions_bg_worker_segment(Oid relid, Datum value, Oid value_type)
-{
-	TypeCacheEntry		   *typcache;
-	Size					datum_size;
-	Size					segment_size;
-	dsm_segment			   *segment;
-	SpawnPartitionArgs	   *args;
+	SpinLockRelease(&spawner_state->mutex);
 
-	typcache = lookup_type_cache(value_type, 0);
+	if (start_spawner)
+	{
+		/* Paid once, then the spawner stays */
+		if (!start_bgworker(spawner_bgw,
+							CppAsString(bgw_main_spawner),
+							Int32GetDatum(spawner_idx),
+							false))
+		{
+			SpinLockAcquire(&spawner_state->mutex);
+			if (spawner->status == SPS_STARTING && spawner->pid == 0)
+			{
+				fail_spawn_requests(MyDatabaseId);
+				spawner->status = SPS_FREE;
+			}
+			SpinLockRelease(&spawner_state->mutex);
+		}
+	}
+	else if (spawner_latch)
+		SetLatch(spawner_latch);
 
-	/* Calculate segment size */
-	datum_size = datumGetSize(value, typcache->typbyval, typcache->typlen);
-	segment_size = offsetof(SpawnPartitionArgs, value) + datum_size;
+	/* Spawner may be stuck, don't wait for it forever */
+	deadline = TimestampTzPlusMilliseconds(GetCurrentTimestamp(),
+										   SPAWN_WAIT_TIMEOUT);
 
-	segment = dsm_create(segment_size, 0);
+	/* Wait for the result, but let the user cancel the query */
+	PG_TRY();
+	{
+		while (!done)
+		{
+			bool	timed_out = (GetCurrentTimestamp() >= deadline);
+			int		rc;
 
-	/* Initialize BGW args */
-	args = (SpawnPartitionArgs *) dsm_segment_address(segment);
+			SpinLockAcquire(&spawner_state->mutex);
+			if (req->status == SRS_DONE)
+			{
+				*result = req->result;
+				served = req->served;
+				if (--req->nwaiters == 0)
+					req->status = SRS_FREE;
+				done = true;
+			}
+			else if (timed_out)
+			{
+				/* Nobody waits for a pending request, forget it */
+				if (--req->nwaiters == 0 && req->status == SRS_PENDING)
+					req->status = SRS_FREE;
+				done = true;
+			}
+			SpinLockRelease(&spawner_state->mutex);
 
-	args->userid = GetUserId();
-	args->result = InvalidOid;
-	args->dbid = MyDatabaseId;
-	args->partitioned_table = relid;
+			if (done)
+				break;
 
-#if PG_VERSION_NUM >= 90600
-	/* Initialize args for BecomeLockGroupMember() */
-	args->parallel_master_pgproc = MyProc;
-	args->parallel_master_pid = MyProcPid;
+			rc = WaitLatch(MyLatch,
+						   WL_LATCH_SET | WL_TIMEOUT | WL_POSTMASTER_DEATH,
+						   SPAWN_POLL_INTERVAL
+#if PG_VERSION_NUM >= 100000
+						   , PG_WAIT_EXTENSION
 #endif
+						   );
+			ResetLatch(MyLatch);
 
-	/* Write value-related stuff */
-	args->value_type = value_type;
-	args->value_size = datum_size;
-	args->value_byval = typcache->typbyval;
+			if (rc & WL_POSTMASTER_DEATH)
+				ereport(ERROR,
+						(errmsg("Postmaster died during the gogudb background worker process"),
+						 errhint("More details may be available in the server log.")));
 
-	PackDatumToByteArray((void *) args->value, value,
-						 datum_size, args->value_byval);
+			CHECK_FOR_INTERRUPTS();
+		}
+	}
+	PG_CATCH();
+	{
+		SpinLockAcquire(&spawner_state->mutex);
+		if (--req->nwaiters == 0 && req->status == SRS_DONE)
+			req->status = SRS_FREE;
+		SpinLockRelease(&spawner_state->mutex);
 
-	return segment;
+		PG_RE_THROW();
+	}
+	PG_END_TRY();
+
+	return served;
 }
 
 /*
- * Starts background worker that will create new partitions,
- * waits till it finishes the job and returns the result (new partition oid)
+ * Create new partitions using the SpawnerWorker of this database (or a
+ * worker of its own if the spawner can't help), wait till it finishes
+ * the job and return the result (new partition oid).
  *
  * NB: This function should not be called directly, use create_partitions() instead.
  */
 Oid
 create_partitions_for_value_bg_worker(Oid relid, Datum value, Oid value_type)
 {
-	dsm_segment			   *segment;
-	dsm_handle				segment_handle;
-	SpawnPartitionArgs	   *bgw_args;
-	Oid						child_oid = InvalidOid;
-
-	/* Create a dsm segment for the worker to pass arguments */
-	segment = create_partitions_bg_worker_segment(relid, value, value_type);
-	segment_handle = dsm_segment_handle(segment);
-	bgw_args = (SpawnPartitionArgs *) dsm_segment_address(segment);
-
-#if PG_VERSION_NUM >= 90600
-	/* Become locking group leader */
-	BecomeLockGroupLeader();
-#endif
-
-	/* Start worker and wait for it to finish */
-	if (!start_bgworker(spawn_partitions_bgw,
-						CppAsString(bgw_main_spawn_partitions),
-						UInt32GetDatum(segment_handle),
-						true))
-	{
-		start_bgworker_errmsg(spawn_partitions_bgw);
-	}
+	Oid		child_oid = InvalidOid;
 
-	/* Save the result (partition Oid) */
-	child_oid = bgw_args->result;
-
-	/* Free dsm segment */
-	dsm_detach(segment);
+	if (!spawner_request(relid, value, value_type, &child_oid))
+		return create_partitions_for_value_new_bg_worker(relid, value,
+														 value_type);
 
 	if (child_oid == InvalidOid)
 		ereport(ERROR,
@@ -346,108 +1296,157 @@ create_partitions_for_value_bg_worker(Oid relid, Datum value, Oid value_type)
 	return child_oid;
 }
 
+
 /*
- * Entry point for SpawnPartitionsWorker's process.
+ * -------------------------------------
+ *  ConcurrentPartWorker implementation
+ * -------------------------------------
  */
-void
-bgw_main_spawn_partitions(Datum main_arg)
+
+/* Free bgworker's CPS slot */
+static void
+free_cps_slot(int code, Datum arg)
 {
-	dsm_handle				handle = DatumGetUInt32(main_arg);
-	dsm_segment			   *segment;
-	SpawnPartitionArgs	   *args;
-	Datum					value;
+	ConcurrentPartSlot *part_slot = (ConcurrentPartSlot *) DatumGetPointer(arg);
 
-	/* Establish signal handlers before unblocking signals. */
-	pqsignal(SIGTERM, handle_sigterm);
+	cps_set_status(part_slot, CPS_FREE);
+}
 
-	/* We're now ready to receive signals */
-	BackgroundWorkerUnblockSignals();
+/*
+ * Find up to 'batch_size' rows of the worker's range, starting with its
+ * current position.  'next' is set to the position after the last one.
+ */
+static int
+collect_batch_tids(ConcurrentPartSlot *part_slot, ItemPointer tids,
+				   ItemPointer next)
+{
+	Relation		rel;
+	HeapScanDesc	scan;
+	HeapTuple		tuple;
+	BlockNumber		start_block,
+					end_block;
+	OffsetNumber	start_offset;
+	int				ntids = 0;
+
+	start_block = ItemPointerGetBlockNumber(&part_slot->position);
+	start_offset = ItemPointerGetOffsetNumber(&part_slot->position);
+
+	/* Caller holds RowExclusiveLock */
+	rel = heap_open(part_slot->relid, NoLock);
+
+	end_block = RelationGetNumberOfBlocks(rel);
+	if (part_slot->end_block != InvalidBlockNumber)
+		end_block = Min(end_block, part_slot->end_block);
+
+	SpinLockAcquire(&part_slot->mutex);
+	part_slot->scan_end = end_block;
+	SpinLockRelease(&part_slot->mutex);
+
+	/* Nothing left in our range */
+	if (start_block >= end_block)
+	{
+		heap_close(rel, NoLock);
+		ItemPointerSet(next, end_block, FirstOffsetNumber);
+		return 0;
+	}
 
-	/* Create resource owner */
-	CurrentResourceOwner = ResourceOwnerCreate(NULL, spawn_partitions_bgw);
+	/* Don't use syncscan, we need our blocks only */
+	scan = heap_beginscan_strat(rel, GetActiveSnapshot(), 0, NULL, true, false);
+	heap_setscanlimits(scan, start_block, end_block - start_block);
 
-	if (!handle)
-		elog(ERROR, "%s: invalid dsm_handle [%u]",
-			 spawn_partitions_bgw, MyProcPid);
+	while (ntids < part_slot->batch_size &&
+		   (tuple = heap_getnext(scan, ForwardScanDirection)) != NULL)
+	{
+		/* Skip rows we have already seen */
+		if (ItemPointerGetBlockNumber(&tuple->t_self) == start_block &&
+			ItemPointerGetOffsetNumber(&tuple->t_self) < start_offset)
+			continue;
 
-	/* Attach to dynamic shared memory */
-	if ((segment = dsm_attach(handle)) == NULL)
-		elog(ERROR, "%s: cannot attach to segment [%u]",
-			 spawn_partitions_bgw, MyProcPid);
-	args = dsm_segment_address(segment);
+		tids[ntids++] = tuple->t_self;
+	}
 
-#if PG_VERSION_NUM >= 90600
-	/* Join locking group. If we can't join the group, quit */
-	if (!BecomeLockGroupMember(args->parallel_master_pgproc,
-							   args->parallel_master_pid))
-		return;
-#endif
-	/* Establish connection and start transaction */
-#if PG_VERSION_NUM >= 110000
-	BackgroundWorkerInitializeConnectionByOid(args->dbid, args->userid, 0);
-#else
-	BackgroundWorkerInitializeConnectionByOid(args->dbid, args->userid);
-#endif
-	/* Start new transaction (syscache access etc.) */
-	StartTransactionCommand();
+	if (ntids > 0)
+		ItemPointerSet(next,
+					   ItemPointerGetBlockNumber(&tids[ntids - 1]),
+					   ItemPointerGetOffsetNumber(&tids[ntids - 1]) + 1);
+	else
+		ItemPointerSet(next, end_block, FirstOffsetNumber);
 
-	/* Initialize pg_pathman's local config */
-	bg_worker_load_config(spawn_partitions_bgw);
+	heap_endscan(scan);
+	heap_close(rel, NoLock);
 
-	/* Upack Datum from segment to 'value' */
-	UnpackDatumFromByteArray(&value,
-							 args->value_size,
-							 args->value_byval,
-							 (const void *) args->value);
+	return ntids;
+}
 
-/* Print 'arg->value' for debug purposes */
-#ifdef USE_ASSERT_CHECKING
-	elog(LOG, "%s: arg->value is '%s' [%u]",
-		 spawn_partitions_bgw,
-		 DebugPrintDatum(value, args->value_type), MyProcPid);
-#endif
+/*
+ * Called when a pass over the worker's range has moved nothing.  Rows
+ * may have got into the ranges of the workers which are done already
+ * (e.g. by UPDATE), so the last worker of the task extends its range to
+ * the whole relation.  Returns true if the worker has to go on.
+ */
+static bool
+cps_start_final_pass(ConcurrentPartSlot *part_slot)
+{
+	bool	last = true;
+	int		i;
 
-	/* Create partitions and save the Oid of the last one */
-	args->result = create_partitions_for_value_internal(args->partitioned_table,
-														value, /* unpacked Datum */
-														args->value_type,
-														true); /* background woker */
+	/* The whole relation is clean */
+	if (part_slot->start_block == 0 &&
+		part_slot->end_block == InvalidBlockNumber)
+		return false;
 
-	/* Finish transaction in an appropriate way */
-	if (args->result == InvalidOid)
-		AbortCurrentTransaction();
-	else
-		CommitTransactionCommand();
+	SpinLockAcquire(&part_slot->mutex);
+	part_slot->range_done = true;
+	SpinLockRelease(&part_slot->mutex);
 
-	dsm_detach(segment);
-}
+	/* Workers which have gone don't count, their ranges are rescanned */
+	for (i = 0; i < PART_WORKER_SLOTS && last; i++)
+	{
+		ConcurrentPartSlot *cur_slot = &concurrent_part_slots[i];
 
+		if (cur_slot == part_slot)
+			continue;
 
-/*
- * -------------------------------------
- *  ConcurrentPartWorker implementation
- * -------------------------------------
- */
+		SpinLockAcquire(&cur_slot->mutex);
+		if (cur_slot->worker_status != CPS_FREE &&
+			cur_slot->relid == part_slot->relid &&
+			cur_slot->dbid == part_slot->dbid &&
+			!cur_slot->range_done)
+			last = false;
+		SpinLockRelease(&cur_slot->mutex);
+	}
 
-/* Free bgworker's CPS slot */
-static void
-free_cps_slot(int code, Datum arg)
-{
-	ConcurrentPartSlot *part_slot = (ConcurrentPartSlot *) DatumGetPointer(arg);
+	if (!last)
+		return false;
 
-	cps_set_status(part_slot, CPS_FREE);
+	SpinLockAcquire(&part_slot->mutex);
+	part_slot->start_block = 0;
+	part_slot->end_block = InvalidBlockNumber;
+	part_slot->scan_end = InvalidBlockNumber;
+	SpinLockRelease(&part_slot->mutex);
+
+	return true;
 }
 
 /*
  * Entry point for ConcurrentPartWorker's process.
+ *
+ * Each worker relocates the rows of its range of the parent's blocks.
+ * Once the range is over, it's scanned once more to pick up the rows
+ * which have been updated meanwhile; the worker exits when a pass over
+ * its range finds nothing to move.  The last worker of a task then does
+ * the same for the whole relation (see cps_start_final_pass()).
  */
 void
 bgw_main_concurrent_part(Datum main_arg)
 {
 	ConcurrentPartSlot *part_slot;
-	char			   *sql = NULL;
-	int64				rows;
-	bool				failed;
+	ItemPointer			tids;
+	int64				rows,
+						pass_rows = 0;
+	int					ntids;
+	bool				failed,
+						finished = false;
 	int					failures_count = 0;
 	LOCKMODE			lockmode = RowExclusiveLock;
 
@@ -482,20 +1481,27 @@ bgw_main_concurrent_part(Datum main_arg)
 	bg_worker_load_config(concurrent_part_bgw);
 	CommitTransactionCommand();
 
+	/* Rows of a batch, must survive transaction end */
+	tids = (ItemPointer) MemoryContextAlloc(TopPathmanContext,
+											sizeof(ItemPointerData) *
+												part_slot->batch_size);
+
+	SpinLockAcquire(&part_slot->mutex);
+	part_slot->started = GetCurrentTimestamp();
+	SpinLockRelease(&part_slot->mutex);
+
 	/* Do the job */
 	do
 	{
-		MemoryContext old_mcxt;
-
-		Oid		types[2]	= { OIDOID,				INT4OID };
-		Datum	vals[2]		= { part_slot->relid,	part_slot->batch_size };
-		char	nulls[2]	= { 0,	0};
+		MemoryContext	old_mcxt;
+		ItemPointerData	next_position;
 
 		bool	rel_locked = false;
 
 		/* Reset loop variables */
 		failed = false;
 		rows = 0;
+		ntids = 0;
 
 		CHECK_FOR_INTERRUPTS();
 
@@ -510,27 +1516,9 @@ bgw_main_concurrent_part(Datum main_arg)
 
 		PushActiveSnapshot(GetTransactionSnapshot());
 
-		/* Prepare the query if needed */
-		if (sql == NULL)
-		{
-			MemoryContext	current_mcxt;
-
-			/*
-			 * Allocate SQL query in TopPathmanContext because current
-			 * context will be destroyed after transaction finishes
-			 */
-			current_mcxt = MemoryContextSwitchTo(TopPathmanContext);
-			sql = psprintf("SELECT %s._partition_data_concurrent($1::oid, p_limit:=$2)",
-						   get_namespace_name(get_pathman_schema()));
-			MemoryContextSwitchTo(current_mcxt);
-		}
-
-		/* Exec ret = _partition_data_concurrent() */
+		/* Move the next batch of our range */
 		PG_TRY();
 		{
-			int		ret;
-			bool	isnull;
-
 			/* Lock relation for DELETE and INSERT */
 			if (!ConditionalLockRelationOid(part_slot->relid, lockmode))
 			{
@@ -562,23 +1550,9 @@ bgw_main_concurrent_part(Datum main_arg)
 					 get_rel_name(part_slot->relid));
 			}
 
-			/* Call concurrent partitioning function */
-			ret = SPI_execute_with_args(sql, 2, types, vals, nulls, false, 0);
-			if (ret == SPI_OK_SELECT)
-			{
-				TupleDesc	tupdesc	= SPI_tuptable->tupdesc;
-				HeapTuple	tuple	= SPI_tuptable->vals[0];
-
-				/* There should be 1 result at most */
-				Assert(SPI_processed == 1);
-
-				/* Extract number of processed rows */
-				rows = DatumGetInt64(SPI_getbinval(tuple, tupdesc, 1, &isnull));
-				Assert(tupdesc->attrs[0]->atttypid == INT8OID); /* check type */
-				Assert(!isnull); /* ... and ofc it must not be NULL */
-			}
-			/* Else raise generic error */
-			else elog(ERROR, "partitioning function returned %u", ret);
+			/* Pick rows and send them to partitions */
+			ntids = collect_batch_tids(part_slot, tids, &next_position);
+			rows = partition_copy_batch(part_slot->relid, tids, ntids);
 
 			/* Finally, unlock our partitioned table */
 			UnlockRelationOid(part_slot->relid, lockmode);
@@ -654,10 +1628,23 @@ bgw_main_concurrent_part(Datum main_arg)
 			/* Commit transaction and reset 'failures_count' */
 			CommitTransactionCommand();
 			failures_count = 0;
+			pass_rows += rows;
+
+			/* End of the range, check it once more unless it was empty */
+			if (ntids == 0)
+			{
+				if (pass_rows == 0)
+					finished = !cps_start_final_pass(part_slot);
+
+				ItemPointerSet(&next_position, part_slot->start_block,
+							   FirstOffsetNumber);
+				pass_rows = 0;
+			}
 
-			/* Add rows to total_rows */
+			/* Add rows to total_rows, move to the next batch */
 			SpinLockAcquire(&part_slot->mutex);
 			part_slot->total_rows += rows;
+			part_slot->position = next_position;
 			SpinLockRelease(&part_slot->mutex);
 
 #ifdef USE_ASSERT_CHECKING
@@ -673,7 +1660,7 @@ bgw_main_concurrent_part(Datum main_arg)
 		if (cps_check_status(part_slot) == CPS_STOPPING)
 			break;
 	}
-	while(rows > 0 || failed); /* do while there's still rows to be relocated */
+	while(!finished); /* do while there's still rows to be relocated */
 }
 
 
@@ -684,7 +1671,7 @@ bgw_main_concurrent_part(Datum main_arg)
  */
 
 /*
- * Start concurrent partitioning worker to redistribute rows.
+ * Start concurrent partitioning workers to redistribute rows.
  * NOTE: this function returns immediately.
  */
 Datum
@@ -693,8 +1680,12 @@ partition_table_concurrently(PG_FUNCTION_ARGS)
 	Oid				relid = PG_GETARG_OID(0);
 	int32			batch_size = PG_GETARG_INT32(1);
 	float8			sleep_time = PG_GETARG_FLOAT8(2);
-	int				empty_slot_idx = -1,		/* do we have a slot for BGWorker? */
+	int32			nworkers = PG_GETARG_INT32(3);
+	int				slot_idxs[PART_WORKER_MAX_WORKERS];
+	int				nslots = 0,					/* slots taken for BGWorkers */
 					i;
+	Relation		rel;
+	BlockNumber		nblocks;
 	TransactionId	rel_xmin;
 
 	/* Check batch_size */
@@ -708,6 +1699,12 @@ partition_table_concurrently(PG_FUNCTION_ARGS)
 		ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
 						errmsg("'sleep_time' should not be less than 0.5")));
 
+	/* Check workers */
+	if (nworkers < 1 || nworkers > PART_WORKER_MAX_WORKERS)
+		ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+						errmsg("'workers' should not be less than 1"
+							   " or greater than %d", PART_WORKER_MAX_WORKERS)));
+
 	/* Check if relation is a partitioned table */
 	shout_if_prel_is_invalid(relid,
 							 /* We also lock the parent relation */
@@ -726,25 +1723,22 @@ partition_table_concurrently(PG_FUNCTION_ARGS)
 						 errmsg("relation \"%s\" is not partitioned",
 								get_rel_name_or_relid(relid))));
 
+	/* Workers split the parent's blocks evenly */
+	rel = heap_open(relid, NoLock);
+	nblocks = RelationGetNumberOfBlocks(rel);
+	heap_close(rel, NoLock);
+
 	/*
-	 * Look for an empty slot and also check that a concurrent
+	 * Take empty slots and also check that a concurrent
 	 * partitioning operation for this table hasn't been started yet
 	 */
 	for (i = 0; i < PART_WORKER_SLOTS; i++)
 	{
 		ConcurrentPartSlot *cur_slot = &concurrent_part_slots[i];
-		bool				keep_this_lock = false;
 
 		/* Lock current slot */
 		SpinLockAcquire(&cur_slot->mutex);
 
-		/* Should we take this slot into account? (it should be FREE) */
-		if (empty_slot_idx < 0 && cur_slot->worker_status == CPS_FREE)
-		{
-			empty_slot_idx = i;		/* yes, remember this slot */
-			keep_this_lock = true;	/* also don't unlock it */
-		}
-
 		/* Oops, looks like we already have BGWorker for this table */
 		if (cur_slot->relid == relid &&
 			cur_slot->dbid == MyDatabaseId &&
@@ -753,51 +1747,75 @@ partition_table_concurrently(PG_FUNCTION_ARGS)
 			/* Unlock current slot */
 			SpinLockRelease(&cur_slot->mutex);
 
-			/* Release borrowed slot for new BGWorker too */
-			if (empty_slot_idx >= 0 && empty_slot_idx != i)
-				SpinLockRelease(&concurrent_part_slots[empty_slot_idx].mutex);
+			/* Release borrowed slots for new BGWorkers too */
+			while (nslots > 0)
+				cps_set_status(&concurrent_part_slots[slot_idxs[--nslots]],
+							   CPS_FREE);
 
 			ereport(ERROR, (errmsg("table \"%s\" is already being partitioned",
 								   get_rel_name(relid))));
 		}
 
-		/* Normally we don't want to keep it */
-		if (!keep_this_lock)
-			SpinLockRelease(&cur_slot->mutex);
+		/* Should we take this slot? (it should be FREE) */
+		if (nslots < nworkers && cur_slot->worker_status == CPS_FREE)
+		{
+			int			worker_num = nslots;
+			BlockNumber	start_block,
+						end_block;
+
+			start_block = (BlockNumber) ((uint64) nblocks * worker_num / nworkers);
+
+			/* The last worker also takes the blocks added later */
+			end_block = (worker_num == nworkers - 1) ?
+							InvalidBlockNumber :
+							(BlockNumber) ((uint64) nblocks * (worker_num + 1) / nworkers);
+
+			/* Initialize concurrent part slot */
+			InitConcurrentPartSlot(cur_slot,
+								   GetUserId(), CPS_WORKING, MyDatabaseId,
+								   relid, batch_size, sleep_time,
+								   worker_num, nworkers, start_block, end_block);
+
+			slot_idxs[nslots++] = i;
+		}
+
+		SpinLockRelease(&cur_slot->mutex);
 	}
 
-	/* Looks like we could not find an empty slot */
-	if (empty_slot_idx < 0)
+	/* Looks like we could not find enough empty slots */
+	if (nslots < nworkers)
+	{
+		while (nslots > 0)
+			cps_set_status(&concurrent_part_slots[slot_idxs[--nslots]],
+						   CPS_FREE);
+
 		ereport(ERROR, (errcode(ERRCODE_CONFIGURATION_LIMIT_EXCEEDED),
 						errmsg("no empty worker slots found"),
 						errhint("consider increasing max_worker_processes")));
-	else
-	{
-		/* Initialize concurrent part slot */
-		InitConcurrentPartSlot(&concurrent_part_slots[empty_slot_idx],
-							   GetUserId(), CPS_WORKING, MyDatabaseId,
-							   relid, batch_size, sleep_time);
-
-		/* Now we can safely unlock slot for new BGWorker */
-		SpinLockRelease(&concurrent_part_slots[empty_slot_idx].mutex);
 	}
 
-	/* Start worker (we should not wait) */
-	if (!start_bgworker(concurrent_part_bgw,
-						CppAsString(bgw_main_concurrent_part),
-						Int32GetDatum(empty_slot_idx),
-						false))
+	/* Start workers (we should not wait) */
+	for (i = 0; i < nslots; i++)
 	{
-		/* Couldn't start, free CPS slot */
-		cps_set_status(&concurrent_part_slots[empty_slot_idx], CPS_FREE);
+		if (!start_bgworker(concurrent_part_bgw,
+							CppAsString(bgw_main_concurrent_part),
+							Int32GetDatum(slot_idxs[i]),
+							false))
+		{
+			/* Couldn't start, free CPS slots of the workers not started */
+			for (; i < nslots; i++)
+				cps_set_status(&concurrent_part_slots[slot_idxs[i]], CPS_FREE);
 
-		start_bgworker_errmsg(concurrent_part_bgw);
+			start_bgworker_errmsg(concurrent_part_bgw);
+		}
 	}
 
 	/* Tell user everything's fine */
 	elog(NOTICE,
-		 "worker started, you can stop it "
+		 "%s started, you can stop %s "
 		 "with the following command: select %s.%s('%s');",
+		 nworkers > 1 ? "workers" : "worker",
+		 nworkers > 1 ? "them" : "it",
 		 get_namespace_name(get_pathman_schema()),
 		 CppAsString(stop_concurrent_part_task),
 		 get_rel_name(relid));
@@ -842,8 +1860,14 @@ show_concurrent_part_tasks_internal(PG_FUNCTION_ARGS)
 						   "dbid", OIDOID, -1, 0);
 		TupleDescInitEntry(tupdesc, Anum_pathman_cp_tasks_relid,
 						   "relid", REGCLASSOID, -1, 0);
+		TupleDescInitEntry(tupdesc, Anum_pathman_cp_tasks_worker,
+						   "worker", INT4OID, -1, 0);
 		TupleDescInitEntry(tupdesc, Anum_pathman_cp_tasks_processed,
 						   "processed", INT4OID, -1, 0);
+		TupleDescInitEntry(tupdesc, Anum_pathman_cp_tasks_progress,
+						   "progress", FLOAT8OID, -1, 0);
+		TupleDescInitEntry(tupdesc, Anum_pathman_cp_tasks_rows_per_sec,
+						   "rows_per_sec", FLOAT8OID, -1, 0);
 		TupleDescInitEntry(tupdesc, Anum_pathman_cp_tasks_status,
 						   "status", TEXTOID, -1, 0);
 
@@ -877,12 +1901,35 @@ show_concurrent_part_tasks_internal(PG_FUNCTION_ARGS)
 			values[Anum_pathman_cp_tasks_pid - 1]		= slot_copy.pid;
 			values[Anum_pathman_cp_tasks_dbid - 1]		= slot_copy.dbid;
 			values[Anum_pathman_cp_tasks_relid - 1]		= slot_copy.relid;
+			values[Anum_pathman_cp_tasks_worker - 1]	=
+					Int32GetDatum(slot_copy.worker_num + 1);
 
 			/* Record processed rows */
 			values[Anum_pathman_cp_tasks_processed - 1]	=
 					/* FIXME: use Int64GetDatum() in release 1.5 */
 					Int32GetDatum((int32) slot_copy.total_rows);
 
+			/* Share of the worker's range passed by now */
+			values[Anum_pathman_cp_tasks_progress - 1] =
+					Float8GetDatum(cps_progress(&slot_copy));
+
+			/* Average speed since the worker has started */
+			if (slot_copy.started != 0)
+			{
+				long	secs;
+				int		usecs;
+				double	elapsed;
+
+				TimestampDifference(slot_copy.started, GetCurrentTimestamp(),
+									&secs, &usecs);
+				elapsed = secs + usecs / 1000000.0;
+
+				values[Anum_pathman_cp_tasks_rows_per_sec - 1] =
+						Float8GetDatum(elapsed > 0 ?
+									   slot_copy.total_rows / elapsed : 0.0);
+			}
+			else isnull[Anum_pathman_cp_tasks_rows_per_sec - 1] = true;
+
 			/* Now build a status string */
 			values[Anum_pathman_cp_tasks_status - 1] =
 					CStringGetTextDatum(cps_print_status(slot_copy.worker_status));
@@ -903,7 +1950,7 @@ show_concurrent_part_tasks_internal(PG_FUNCTION_ARGS)
 }
 
 /*
- * Stop the specified concurrent partitioning worker.
+ * Stop the concurrent partitioning workers of the specified table.
  * NOTE: worker will stop after it finishes a batch.
  */
 Datum
@@ -913,7 +1960,8 @@ stop_concurrent_part_task(PG_FUNCTION_ARGS)
 	bool	worker_found = false;
 	int		i;
 
-	for (i = 0; i < PART_WORKER_SLOTS && !worker_found; i++)
+	/* Stop all workers of the table */
+	for (i = 0; i < PART_WORKER_SLOTS; i++)
 	{
 		ConcurrentPartSlot *cur_slot = &concurrent_part_slots[i];
 
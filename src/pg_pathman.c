@@ -14,9 +14,14 @@
 #include "compat/rowmarks_fix.h"
 
 #include "init.h"
+#include "connection_pool.h"
 #include "hooks.h"
 #include "pathman.h"
 #include "partition_filter.h"
+#include "pathman_workers.h"
+#include "remote_estimate.h"
+#include "remote_log.h"
+#include "replica_routing.h"
 #include "runtimeappend.h"
 #include "runtime_merge_append.h"
 #include "hot_patch.h"
@@ -98,6 +103,7 @@ static void replace_target(void);
 
 /* Expression tree handlers */
 static Node *wrapper_make_expression(WrapperNode *wrap, int index, bool *alwaysTrue);
+static Node *array_make_expression(WrapperNode *wrap, int index);
 
 static void handle_const(const Const *c,
 						 const Oid collid,
@@ -142,6 +148,10 @@ static void set_plain_rel_pathlist(PlannerInfo *root,
 								   RelOptInfo *rel,
 								   RangeTblEntry *rte);
 
+static bool clone_sibling_foreign_rel(PlannerInfo *root,
+									  RelOptInfo *rel,
+									  List *sources);
+
 static List *accumulate_append_subpath(List *subpaths, Path *path);
 
 static void generate_mergeappend_paths(PlannerInfo *root,
@@ -348,6 +358,7 @@ _PG_init(void)
 
 	/* Request additional shared resources */
 	RequestAddinShmemSpace(estimate_pathman_shmem_size());
+	request_remote_estimate_lock();
 
 	/* Assign pg_pathman's initial state */
 	temp_init_state.pg_pathman_enable		= DEFAULT_PATHMAN_ENABLE;
@@ -377,6 +388,13 @@ _PG_init(void)
 	init_runtimeappend_static_data();
 	init_runtime_merge_append_static_data();
 	init_partition_filter_static_data();
+	init_connection_static_data();
+	init_remote_estimate_static_data();
+	init_replica_routing_static_data();
+	init_remote_log_static_data();
+
+	/* Start scheduled workers again once the server is up */
+	register_worker_launcher();
 	/* inject pg_parse_query */
 
 	replace_target();
@@ -1002,10 +1020,82 @@ wrapper_make_expression(WrapperNode *wrap, int index, bool *alwaysTrue)
 		else
 			return (Node *) copyObject(wrap->orig);
 	}
+	else if (IsA(wrap->orig, ScalarArrayOpExpr) && wrap->args != NIL)
+		return array_make_expression(wrap, index);
 	else
 		return (Node *) copyObject(wrap->orig);
 }
 
+/*
+ * Keep only the keys of partition 'index' in 'key = ANY(array)', so that
+ * each partition (and each remote server) gets only its own keys.
+ * Wrappers of the keys are stored in 'wrap->args' by handle_array().
+ */
+static Node *
+array_make_expression(WrapperNode *wrap, int index)
+{
+	const ScalarArrayOpExpr	   *expr = (const ScalarArrayOpExpr *) wrap->orig;
+	const Const				   *array = (const Const *) lsecond(expr->args);
+	ScalarArrayOpExpr		   *result;
+	Const					   *elem = NULL;
+	Datum					   *elem_values;
+	int							elem_count = 0;
+	int16						elem_len;
+	bool						elem_byval;
+	char						elem_align;
+	ListCell				   *lc;
+
+	elem_values = palloc(sizeof(Datum) * list_length(wrap->args));
+
+	foreach (lc, wrap->args)
+	{
+		WrapperNode	   *elem_wrap = (WrapperNode *) lfirst(lc);
+		bool			lossy;
+
+		if (irange_list_find(elem_wrap->rangeset, index, &lossy))
+		{
+			elem = (Const *) elem_wrap->orig;
+			elem_values[elem_count++] = elem->constvalue;
+		}
+	}
+
+	/* Nothing to remove */
+	if (elem_count == 0 || elem_count == list_length(wrap->args))
+	{
+		pfree(elem_values);
+		return (Node *) copyObject(expr);
+	}
+
+	/* Single key, make it 'key = value' */
+	if (elem_count == 1)
+	{
+		pfree(elem_values);
+		return (Node *) make_opclause(expr->opno, BOOLOID, false,
+									  (Expr *) copyObject(linitial(expr->args)),
+									  (Expr *) copyObject(elem),
+									  InvalidOid,
+									  expr->inputcollid);
+	}
+
+	get_typlenbyvalalign(elem->consttype, &elem_len, &elem_byval, &elem_align);
+
+	result = (ScalarArrayOpExpr *) copyObject(expr);
+	lsecond(result->args) = makeConst(array->consttype,
+									  array->consttypmod,
+									  array->constcollid,
+									  -1,
+									  PointerGetDatum(construct_array(elem_values,
+																	  elem_count,
+																	  elem->consttype,
+																	  elem_len,
+																	  elem_byval,
+																	  elem_align)),
+									  false,
+									  false);
+
+	return (Node *) result;
+}
+
 
 /* Const handler */
 static void
@@ -1175,8 +1265,10 @@ handle_array(ArrayType *array,
 	/* Handle non-null Const arrays */
 	if (elem_count > 0)
 	{
-		List   *ranges;
-		int		i;
+		IndexRangeCombiner	combiner;
+		List			   *elem_wraps = NIL;
+		bool				split_keys;
+		int					i;
 
 		/* This is only for paranoia's sake */
 		Assert(BTMaxStrategyNumber == 5 && BTEqualStrategyNumber == 3);
@@ -1241,7 +1333,12 @@ handle_array(ArrayType *array,
 		}
 
 		/* Set default rangeset */
-		ranges = use_or ? NIL : list_make1_irange_full(prel, IR_COMPLETE);
+		irange_combiner_init(&combiner, PrelChildrenCount(prel), use_or);
+
+		/* Can we give each partition its own keys of 'key = ANY(array)'? */
+		split_keys = use_or && strategy == BTEqualStrategyNumber &&
+					 result->orig && IsA(result->orig, ScalarArrayOpExpr) &&
+					 IsA(lsecond(((ScalarArrayOpExpr *) result->orig)->args), Const);
 
 		/* Select partitions using values */
 		for (i = 0; i < elem_count; i++)
@@ -1264,16 +1361,30 @@ handle_array(ArrayType *array,
 			handle_const(&c, collid, strategy, context, &wrap);
 
 			/* Should we use OR | AND? */
-			ranges = use_or ?
-						irange_list_union(ranges, wrap.rangeset) :
-						irange_list_intersection(ranges, wrap.rangeset);
+			irange_combiner_add(&combiner, wrap.rangeset);
+
+			/* Remember partitions of this key (NULL never matches) */
+			if (split_keys && !c.constisnull)
+			{
+				WrapperNode *elem_wrap = palloc(sizeof(WrapperNode));
+
+				*elem_wrap = wrap;
+				elem_wrap->orig = (Node *) makeConst(elem_type, -1,
+													 get_typcollation(elem_type),
+													 elem_len,
+													 elem_values[i],
+													 false,
+													 elem_byval);
+				elem_wraps = lappend(elem_wraps, elem_wrap);
+			}
 		}
 
 		/* Free resources */
 		pfree(elem_values);
 		pfree(elem_isnull);
 
-		result->rangeset = ranges;
+		result->args = elem_wraps;
+		result->rangeset = irange_combiner_result(&combiner);
 		result->paramsel = 1.0;
 
 		return; /* done, exit */
@@ -1291,15 +1402,15 @@ handle_boolexpr(const BoolExpr *expr,
 				WrapperNode *result)	/* ret value #1 */
 {
 	const PartRelationInfo *prel = context->prel;
+	IndexRangeCombiner		combiner;
 	List				   *ranges,
 						   *args = NIL;
 	double					paramsel = 1.0;
 	ListCell			   *lc;
 
 	/* Set default rangeset */
-	ranges = (expr->boolop == AND_EXPR) ?
-					list_make1_irange_full(prel, IR_COMPLETE) :
-					NIL;
+	irange_combiner_init(&combiner, PrelChildrenCount(prel),
+						 expr->boolop != AND_EXPR);
 
 	/* Examine expressions */
 	foreach (lc, expr->args)
@@ -1312,16 +1423,15 @@ handle_boolexpr(const BoolExpr *expr,
 		switch (expr->boolop)
 		{
 			case OR_EXPR:
-				ranges = irange_list_union(ranges, wrap->rangeset);
+				irange_combiner_add(&combiner, wrap->rangeset);
 				break;
 
 			case AND_EXPR:
-				ranges = irange_list_intersection(ranges, wrap->rangeset);
+				irange_combiner_add(&combiner, wrap->rangeset);
 				paramsel *= wrap->paramsel;
 				break;
 
 			default:
-				ranges = list_make1_irange_full(prel, IR_LOSSY);
 				break;
 		}
 	}
@@ -1329,7 +1439,7 @@ handle_boolexpr(const BoolExpr *expr,
 	/* Adjust paramsel for OR */
 	if (expr->boolop == OR_EXPR)
 	{
-		int totallen = irange_list_length(ranges);
+		int totallen = irange_combiner_length(&combiner);
 
 		foreach (lc, args)
 		{
@@ -1342,6 +1452,12 @@ handle_boolexpr(const BoolExpr *expr,
 		paramsel = 1.0 - paramsel;
 	}
 
+	/* NOT can select any partition */
+	if (expr->boolop != OR_EXPR && expr->boolop != AND_EXPR)
+		ranges = list_make1_irange_full(prel, IR_LOSSY);
+	else
+		ranges = irange_combiner_result(&combiner);
+
 	/* Save results */
 	result->rangeset	= ranges;
 	result->paramsel	= paramsel;
@@ -1404,18 +1520,20 @@ handle_arrexpr(const ScalarArrayOpExpr *expr,
 
 		case T_ArrayExpr:
 			{
-				ArrayExpr  *arr_expr = (ArrayExpr *) array;
-				Oid			elem_type = arr_expr->element_typeid;
-				int			array_params = 0;
-				double		paramsel = 1.0;
-				List	   *ranges;
-				ListCell   *lc;
+				ArrayExpr		   *arr_expr = (ArrayExpr *) array;
+				Oid					elem_type = arr_expr->element_typeid;
+				int					array_params = 0;
+				double				paramsel = 1.0;
+				IndexRangeCombiner	combiner;
+				List			   *ranges;
+				ListCell		   *lc;
 
 				if (list_length(arr_expr->elements) == 0)
 					goto handle_arrexpr_all;
 
 				/* Set default ranges for OR | AND */
-				ranges = expr->useOr ? NIL : list_make1_irange_full(prel, IR_COMPLETE);
+				irange_combiner_init(&combiner, PrelChildrenCount(prel),
+									 expr->useOr);
 
 				/* Walk trough elements list */
 				foreach (lc, arr_expr->elements)
@@ -1424,7 +1542,7 @@ handle_arrexpr(const ScalarArrayOpExpr *expr,
 					WrapperNode		wrap = InvalidWrapperNode;
 
 					/* Stop if ALL + quals evaluate to NIL */
-					if (!expr->useOr && ranges == NIL)
+					if (!expr->useOr && irange_combiner_is_empty(&combiner))
 						break;
 
 					/* Is this a const value? */
@@ -1447,13 +1565,13 @@ handle_arrexpr(const ScalarArrayOpExpr *expr,
 						}
 
 						/* Should we use OR | AND? */
-						ranges = expr->useOr ?
-									irange_list_union(ranges, wrap.rangeset) :
-									irange_list_intersection(ranges, wrap.rangeset);
+						irange_combiner_add(&combiner, wrap.rangeset);
 					}
 					else array_params++; /* we've just met non-const nodes */
 				}
 
+				ranges = irange_combiner_result(&combiner);
+
 				/* Check for PARAM-related optimizations */
 				if (array_params > 0)
 				{
@@ -1658,6 +1776,66 @@ set_foreign_size(PlannerInfo *root, RelOptInfo *rel, RangeTblEntry *rte)
 	rel->rows = clamp_row_est(rel->rows);
 }
 
+/*
+ * prefetch_remote_estimates
+ *		Run the remote EXPLAINs of all foreign children at once
+ *
+ * Children are sized once in "collect" mode, which gathers the EXPLAINs the
+ * FDW asks for instead of running them one by one; the whole batch is then
+ * sent to all servers concurrently and its results land in the estimate
+ * cache, where the real sizing pass finds them.  Only children with
+ * use_remote_estimate are sized twice, the others run no EXPLAINs.
+ */
+static void
+prefetch_remote_estimates(PlannerInfo *root, Index parentRTindex)
+{
+	ListCell   *l;
+	List	   *children = NIL;
+
+	if (!remote_estimate_batch_enabled())
+		return;
+
+	foreach(l, root->append_rel_list)
+	{
+		AppendRelInfo  *appinfo = (AppendRelInfo *) lfirst(l);
+		RangeTblEntry  *childRTE;
+
+		if (appinfo->parent_relid != parentRTindex ||
+			root->simple_rel_array[appinfo->child_relid] == NULL)
+			continue;
+
+		childRTE = root->simple_rte_array[appinfo->child_relid];
+		if (childRTE->relkind == RELKIND_FOREIGN_TABLE &&
+			GoguGetTableOptions(childRTE->relid)->use_remote_estimate)
+			children = lappend_int(children, appinfo->child_relid);
+	}
+
+	/* Nothing to run concurrently */
+	if (list_length(children) < 2)
+		return;
+
+	remote_estimate_begin_batch();
+
+	PG_TRY();
+	{
+		foreach(l, children)
+		{
+			Index childRTindex = (Index) lfirst_int(l);
+
+			set_foreign_size(root, root->simple_rel_array[childRTindex],
+							 root->simple_rte_array[childRTindex]);
+		}
+	}
+	PG_CATCH();
+	{
+		remote_estimate_end_batch(false);
+		PG_RE_THROW();
+	}
+	PG_END_TRY();
+
+	remote_estimate_end_batch(true);
+}
+
 /*
  * set_foreign_pathlist
  *		Build access paths for a foreign table RTE
@@ -1669,6 +1847,29 @@ set_foreign_pathlist(PlannerInfo *root, RelOptInfo *rel, RangeTblEntry *rte)
 	rel->fdwroutine->GetForeignPaths(root, rel, rte->relid);
 }
 
+/*
+ * clone_sibling_foreign_rel
+ *		Plan a foreign partition by copying one of 'sources'
+ *
+ * Unpruned queries over many partitions spend most of the planning time
+ * in the FDW, planning structurally identical siblings one by one.
+ */
+static bool
+clone_sibling_foreign_rel(PlannerInfo *root, RelOptInfo *rel, List *sources)
+{
+	ListCell   *lc;
+
+	if (!gogudb_clone_sibling_paths || IS_DUMMY_REL(rel))
+		return false;
+
+	foreach(lc, sources)
+	{
+		if (GoguCloneForeignRel(root, (RelOptInfo *) lfirst(lc), rel))
+			return true;
+	}
+
+	return false;
+}
 
 static List *
 accumulate_append_subpath(List *subpaths, Path *path)
@@ -2019,8 +2220,13 @@ set_append_rel_pathlist(PlannerInfo *root, RelOptInfo *rel, Index rti,
 #endif
 	List	   *all_child_pathkeys = NIL;
 	List	   *all_child_outers = NIL;
+	List	   *clone_sources = NIL;
 	ListCell   *l;
 
+	/* Ask all servers for remote estimates at once */
+	if (!gogudb_clone_sibling_paths)
+		prefetch_remote_estimates(root, parentRTindex);
+
 	/*
 	 * Generate access paths for each member relation, and remember the
 	 * cheapest path for each one.  Also, identify all pathkeys (orderings)
@@ -2062,14 +2268,21 @@ set_append_rel_pathlist(PlannerInfo *root, RelOptInfo *rel, Index rti,
 		/* Compute child's access paths & sizes */
 		if (childRTE->relkind == RELKIND_FOREIGN_TABLE)
 		{
-			/* childrel->rows should be >= 1 */
-			set_foreign_size(root, childrel, childRTE);
+			/* Copy a sibling planned before, if allowed */
+			if (!clone_sibling_foreign_rel(root, childrel, clone_sources))
+			{
+				/* childrel->rows should be >= 1 */
+				set_foreign_size(root, childrel, childRTE);
 
-			/* If child IS dummy, ignore it */
-			if (IS_DUMMY_REL(childrel))
-				continue;
+				/* If child IS dummy, ignore it */
+				if (IS_DUMMY_REL(childrel))
+					continue;
+
+				set_foreign_pathlist(root, childrel, childRTE);
 
-			set_foreign_pathlist(root, childrel, childRTE);
+				if (gogudb_clone_sibling_paths)
+					clone_sources = lappend(clone_sources, childrel);
+			}
 		}
 		else
 		{
@@ -2480,6 +2693,8 @@ __attribute__ ((noinline))
 static void PortalStart_patch(Portal portal, ParamListInfo params, 
 								int eflags, Snapshot snapshot)
 {
+	remote_log_start_query(portal);
+
 	if (!PortalStart_hook(portal, params, eflags, snapshot))
 		trampoline_portalStart(portal, params, eflags, snapshot);
 	return;
@@ -118,8 +118,7 @@ create_remote_hash_partitions_internal(PG_FUNCTION_ARGS)
 	} while (0)
 
 	Oid			parent_relid = PG_GETARG_OID(0);
-	uint32		partitions_count = PG_GETARG_INT32(2),
-				i;
+	uint32		partitions_count = PG_GETARG_INT32(2);
 
 	/* Partition names and tablespaces */
 	char	**partition_names		= NULL,
@@ -204,15 +203,9 @@ create_remote_hash_partitions_internal(PG_FUNCTION_ARGS)
 	rangevars = qualified_relnames_to_rangevars(partition_names, partitions_count);
 
 	/* Finally create HASH partitions */
-	for (i = 0; i < partitions_count; i++)
-	{
-		RangeVar   *partition_rv	= rangevars ? rangevars[i] : NULL;
-		char 	   *tablespace		= tablespaces ? tablespaces[i] : NULL;
-		/* Create a partition (copy FKs, invoke callbacks etc) */
-		create_single_fdw_hash_partition_internal(parent_relid, i, partitions_count,
-							  partition_rv, tablespace,
-							  remote_schema);
-	}
+	create_fdw_hash_partitions_internal(parent_relid, partitions_count,
+										rangevars, tablespaces,
+										remote_schema);
 
 	/* Free arrays */
 	DeepFreeArray(partition_names, partition_names_size);
@@ -10,6 +10,7 @@
 
 #include "init.h"
 #include "pathman.h"
+#include "partition_copy.h"
 #include "partition_creation.h"
 #include "relation_info.h"
 #include "utils.h"
@@ -52,6 +53,7 @@ PG_FUNCTION_INFO_V1( get_part_range_by_idx );
 PG_FUNCTION_INFO_V1( build_range_condition );
 PG_FUNCTION_INFO_V1( build_sequence_name );
 PG_FUNCTION_INFO_V1( merge_range_partitions );
+PG_FUNCTION_INFO_V1( move_remote_partition_data );
 PG_FUNCTION_INFO_V1( drop_range_partition_expand_next );
 PG_FUNCTION_INFO_V1( validate_interval_value );
 
@@ -840,7 +842,7 @@ merge_range_partitions_internal(Oid parent, Oid *parts, uint32 nparts)
 		int j;
 
 		/* Prevent modification of partitions */
-		LockRelationOid(parts[0], AccessExclusiveLock);
+		LockRelationOid(parts[i], AccessExclusiveLock);
 
 		/* Look for the specified partition */
 		for (j = 0; j < PrelChildrenCount(prel); j++)
@@ -884,7 +886,13 @@ merge_range_partitions_internal(Oid parent, Oid *parts, uint32 nparts)
 	/* Migrate the data from all partition to the first one */
 	for (i = 1; i < nparts; i++)
 	{
-		char *query = psprintf("WITH part_data AS ( "
+		char *query;
+
+		/* Remote partitions are merged on the shards */
+		if (partition_copy_remote_rows(parts[i], parts[0], NULL))
+			continue;
+
+		query = psprintf("WITH part_data AS ( "
 									"DELETE FROM %s RETURNING "
 							   "*) "
 							   "INSERT INTO %s SELECT * FROM part_data",
@@ -903,6 +911,95 @@ merge_range_partitions_internal(Oid parent, Oid *parts, uint32 nparts)
 }
 
 
+/*
+ * Move rows of RANGE partition 'source' which fall into the range of
+ * 'target' to it, on the shards (see split_range_partition()).
+ * Returns false if the caller should move them itself.
+ */
+Datum
+move_remote_partition_data(PG_FUNCTION_ARGS)
+{
+	Oid						source,
+							target,
+							parent;
+	PartParentSearch		parent_search;
+	const PartRelationInfo *prel;
+	RangeEntry			   *ranges;
+	Bound					min,
+							max;
+	Constraint			   *con;
+	bool					found = false;
+	uint32					i;
+
+	if (!PG_ARGISNULL(0))
+	{
+		source = PG_GETARG_OID(0);
+	}
+	else ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+						 errmsg("'source' should not be NULL")));
+
+	if (!PG_ARGISNULL(1))
+	{
+		target = PG_GETARG_OID(1);
+	}
+	else ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+						 errmsg("'target' should not be NULL")));
+
+	parent = get_parent_of_partition(source, &parent_search);
+	if (parent_search != PPS_ENTRY_PART_PARENT)
+		ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+						errmsg("relation \"%s\" is not a partition",
+							   get_rel_name_or_relid(source))));
+
+	if (get_parent_of_partition(target, NULL) != parent)
+		ereport(ERROR, (errmsg("cannot move rows between partitions"),
+						errdetail("both relations must share the same parent")));
+
+	/* Check current user's privileges */
+	if (!check_security_policy_internal(parent, GetUserId()))
+	{
+		ereport(ERROR,
+				(errcode(ERRCODE_INSUFFICIENT_PRIVILEGE),
+				 errmsg("only the owner or superuser can change "
+						"partitioning configuration of table \"%s\"",
+						get_rel_name_or_relid(parent))));
+	}
+
+	/* Prevent modification of partitions */
+	LockRelationOid(source, AccessExclusiveLock);
+	LockRelationOid(target, AccessExclusiveLock);
+
+	prel = get_pathman_relation_info(parent);
+	shout_if_prel_is_invalid(parent, prel, PT_RANGE);
+
+	/* Look for the range of 'target' */
+	ranges = PrelGetRangesArray(prel);
+	for (i = 0; i < PrelChildrenCount(prel); i++)
+		if (ranges[i].child_oid == target)
+		{
+			min = CopyBound(&ranges[i].min, prel->ev_byval, prel->ev_len);
+			max = CopyBound(&ranges[i].max, prel->ev_byval, prel->ev_len);
+			found = true;
+			break;
+		}
+
+	if (!found)
+		ereport(ERROR, (errmsg("could not find specified partition")));
+
+	/* Rows are picked by our own bounds, not by a caller's SQL */
+	con = build_range_check_constraint(source,
+									   parse_partitioning_expression(parent,
+																	 prel->expr_cstr,
+																	 NULL, NULL),
+									   &min, &max,
+									   prel->ev_type);
+
+	PG_RETURN_BOOL(partition_copy_remote_rows(source, target,
+											  deparse_constraint(source,
+																 con->raw_expr)));
+}
+
+
 /*
  * Drops partition and expands the next partition
  * so that it could cover the dropped one
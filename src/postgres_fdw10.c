@@ -14,6 +14,9 @@
 #include "postgres.h"
 
 #include "postgres_fdw10.h"
+#include "remote_estimate.h"
+#include "replica_routing.h"
+#include "remote_instr.h"
 
 #include "access/htup_details.h"
 #include "access/sysattr.h"
@@ -35,6 +38,7 @@
 #include "optimizer/var.h"
 #include "optimizer/tlist.h"
 #include "parser/parsetree.h"
+#include "rewrite/rewriteManip.h"
 #include "utils/builtins.h"
 #include "utils/guc.h"
 #include "utils/lsyscache.h"
@@ -43,13 +47,9 @@
 #include "utils/sampling.h"
 #include "utils/selfuncs.h"
 
-//PG_MODULE_MAGIC; remove it since we decleared it in pg_pathma.c already
-
-/* Default CPU cost to start up a foreign query. */
-#define DEFAULT_FDW_STARTUP_COST	100.0
+#include <math.h>
 
-/* Default CPU cost to process 1 row (above and beyond cpu_tuple_cost). */
-#define DEFAULT_FDW_TUPLE_COST		0.01
+//PG_MODULE_MAGIC; remove it since we decleared it in pg_pathma.c already
 
 /* If no remote estimates, assume a sort costs 20% extra */
 #define DEFAULT_FDW_SORT_MULTIPLIER 1.2
@@ -57,6 +57,12 @@
 /* If fetch remote tuples more than it , use cursor to fetch data */
 #define USE_CUROSR_THRESHOLD		5000
 
+/* Ask the remote server for this many more sample rows than needed */
+#define ANALYZE_SAMPLE_MARGIN		1.1
+
+/* In "auto" mode, sample blocks (SYSTEM) when taking less than this fraction */
+#define ANALYZE_SYSTEM_MAX_FRAC		0.01
+
 /*
  *  * 记录扫描每个远程的foreign server的次数，如果次数大于1，则需要走原先的游标，否则就可以不用游标，以提升性能。
  *   */
@@ -84,6 +90,8 @@ enum FdwScanPrivateIndex
 	FdwScanPrivateRetrievedAttrs,
 	/* Integer representing the desired fetch_size */
 	FdwScanPrivateFetchSize,
+	/* Boolean flag showing if the scan may be streamed with COPY */
+	FdwScanPrivateCopyScan,
 
 	/*
 	 * String describing join i.e. names of relations being joined and types
@@ -153,6 +161,11 @@ typedef struct PgFdwScanState
 	PGconn	   *conn;			/* connection for the scan */
 	unsigned int cursor_number; /* quasi-unique ID for my cursor */
 	bool		cursor_exists;	/* have we created the cursor? */
+	bool		copy_scan;		/* are rows streamed with COPY? */
+	bool		copy_begun;		/* has the COPY stream been sent? */
+	GoguCopyStream copy;		/* COPY stream, if copy_scan */
+	double		copy_rows;		/* rows expected from the stream */
+	UserMapping *user;			/* user mapping of the connection */
 	int			numParams;		/* number of parameters passed to query */
 	FmgrInfo   *param_flinfo;	/* output conversion functions for them */
 	List	   *param_exprs;	/* executable expressions for param values */
@@ -173,6 +186,8 @@ typedef struct PgFdwScanState
 
 	int			fetch_size;		/* number of tuples per fetch */
 	RemoteCacheEntry 	*server_count;
+
+	GoguScanInstr	instr;		/* numbers for EXPLAIN ANALYZE */
 } PgFdwScanState;
 
 /*
@@ -256,6 +271,31 @@ typedef struct PgFdwAnalyzeState
 	MemoryContext temp_cxt;		/* context for per-tuple temporary data */
 } PgFdwAnalyzeState;
 
+/*
+ * Foreign table whose size has been asked for by ANALYZE.  ANALYZE of an
+ * inheritance tree asks for the sizes of all children before it samples
+ * any of them, so the first sampled child may fetch the samples of its
+ * siblings too (see prefetch_analyze_samples).
+ */
+typedef struct PgFdwAnalyzeTarget
+{
+	Oid			relid;
+	UserMapping *user;			/* user mapping of the table's owner */
+	BlockNumber relpages;		/* as reported by postgresAnalyzeForeignTable */
+	double		reltuples;		/* remote estimate, -1 if not needed */
+	bool		sampled;		/* postgresAcquireSampleRowsFunc called? */
+
+	/* sample fetched ahead, if any */
+	PGresult   *res;
+	int			res_targrows;	/* max # of sample rows it's good for */
+	PgFdwSamplingMethod res_method;
+	List	   *res_attrs;		/* attr numbers retrieved by the query */
+} PgFdwAnalyzeTarget;
+
+/* Tables of the current ANALYZE, and the memory context they live in */
+static List *analyze_targets = NIL;
+static MemoryContext analyze_targets_cxt = NULL;
+
 /*
  * Identify the attribute where data conversion fails.
  */
@@ -387,6 +427,10 @@ static bool ec_member_matches_foreign(PlannerInfo *root, RelOptInfo *rel,
 static void create_cursor(ForeignScanState *node);
 static void fetch_more_data(ForeignScanState *node);
 static void fetch_more_data_without_cursor(ForeignScanState *node);
+static void fetch_more_data_copy(ForeignScanState *node);
+static void begin_copy_scan(ForeignScanState *node);
+static bool copy_scan_allowed(PlannerInfo *root, RelOptInfo *foreignrel,
+				  Path *path, List *params_list);
 static void close_cursor(PGconn *conn, unsigned int cursor_number);
 static void prepare_foreign_modify(PgFdwModifyState *fmstate);
 static const char **convert_prep_stmt_params(PgFdwModifyState *fmstate,
@@ -410,6 +454,23 @@ static int postgresAcquireSampleRowsFunc(Relation relation, int elevel,
 							  HeapTuple *rows, int targrows,
 							  double *totalrows,
 							  double *totaldeadrows);
+static PgFdwSamplingMethod get_analyze_sampling(ForeignServer *server,
+							  ForeignTable *table);
+static double get_remote_reltuples(PGconn *conn, Relation relation);
+static PgFdwSamplingMethod choose_analyze_sampling(ForeignServer *server,
+						ForeignTable *table,
+						int server_version,
+						double reltuples, int targrows,
+						double *sample_frac);
+static PgFdwSamplingMethod fetch_analyze_sample(Relation relation,
+					 PgFdwAnalyzeState *astate,
+					 double *reltuples, bool known_reltuples);
+static void remember_analyze_target(Relation relation, UserMapping *user,
+						PGconn *conn, BlockNumber relpages);
+static void forget_analyze_targets(void *arg);
+static PgFdwAnalyzeTarget *find_analyze_target(Oid relid);
+static void prefetch_analyze_samples(PgFdwAnalyzeTarget *first, int targrows);
+static char *deparse_analyze_target(PgFdwAnalyzeTarget *target);
 static void analyze_row_processor(PGresult *res, int row,
 					  PgFdwAnalyzeState *astate);
 static HeapTuple make_tuple_from_result_row(PGresult *res,
@@ -419,6 +480,13 @@ static HeapTuple make_tuple_from_result_row(PGresult *res,
 						   List *retrieved_attrs,
 						   ForeignScanState *fsstate,
 						   MemoryContext temp_context);
+static HeapTuple make_tuple_from_strings(char **valstrs,
+						int nfields,
+						Relation rel,
+						AttInMetadata *attinmeta,
+						List *retrieved_attrs,
+						ForeignScanState *fsstate,
+						MemoryContext temp_context);
 static void conversion_error_callback(void *arg);
 static bool foreign_join_ok(PlannerInfo *root, RelOptInfo *joinrel,
 				JoinType jointype, RelOptInfo *outerrel, RelOptInfo *innerrel,
@@ -432,8 +500,6 @@ static void add_paths_with_pathkeys_for_rel(PlannerInfo *root, RelOptInfo *rel,
 static void add_foreign_grouping_paths(PlannerInfo *root,
 						   RelOptInfo *input_rel,
 						   RelOptInfo *grouped_rel);
-static void apply_server_options(PgFdwRelationInfo *fpinfo);
-static void apply_table_options(PgFdwRelationInfo *fpinfo);
 static void merge_fdw_options(PgFdwRelationInfo *fpinfo,
 				  const PgFdwRelationInfo *fpinfo_o,
 				  const PgFdwRelationInfo *fpinfo_i);
@@ -505,6 +571,7 @@ postgresGetForeignRelSize(PlannerInfo *root,
 						  Oid foreigntableid)
 {
 	PgFdwRelationInfo *fpinfo;
+	GoguTableOptions *options;
 	ListCell   *lc;
 	RangeTblEntry *rte = planner_rt_fetch(baserel->relid, root);
 	const char *namespace;
@@ -521,22 +588,15 @@ postgresGetForeignRelSize(PlannerInfo *root,
 	/* Base foreign tables need to be pushed down always. */
 	fpinfo->pushdown_safe = true;
 
-	/* Look up foreign-table catalog info. */
-	fpinfo->table = GetForeignTable(foreigntableid);
-	fpinfo->server = GetForeignServer(fpinfo->table->serverid);
-
-	/*
-	 * Extract user-settable option values.  Note that per-table setting of
-	 * use_remote_estimate overrides per-server setting.
-	 */
-	fpinfo->use_remote_estimate = false;
-	fpinfo->fdw_startup_cost = DEFAULT_FDW_STARTUP_COST;
-	fpinfo->fdw_tuple_cost = DEFAULT_FDW_TUPLE_COST;
-	fpinfo->shippable_extensions = NIL;
-	fpinfo->fetch_size = 100;
-
-	apply_server_options(fpinfo);
-	apply_table_options(fpinfo);
+	/* Look up foreign-table catalog info and user-settable options. */
+	options = GoguGetTableOptions(foreigntableid);
+	fpinfo->table = options->table;
+	fpinfo->server = options->server;
+	fpinfo->use_remote_estimate = options->use_remote_estimate;
+	fpinfo->fdw_startup_cost = options->fdw_startup_cost;
+	fpinfo->fdw_tuple_cost = options->fdw_tuple_cost;
+	fpinfo->shippable_extensions = options->shippable_extensions;
+	fpinfo->fetch_size = options->fetch_size;
 
 	/*
 	 * If the table or the server is configured to use remote estimates,
@@ -548,7 +608,7 @@ postgresGetForeignRelSize(PlannerInfo *root,
 	{
 		Oid			userid = rte->checkAsUser ? rte->checkAsUser : GetUserId();
 
-		fpinfo->user = GetUserMapping(userid, fpinfo->server->serverid);
+		fpinfo->user = GoguGetTableUserMapping(options, userid);
 	}
 	else
 		fpinfo->user = NULL;
@@ -675,6 +735,220 @@ postgresGetForeignRelSize(PlannerInfo *root,
 	fpinfo->relation_index = baserel->relid;
 }
 
+/*
+ * Do two sibling foreign tables have the same options, except for the
+ * name of the remote table?
+ */
+static bool
+table_options_match(List *options1, List *options2)
+{
+	ListCell   *lc1,
+			   *lc2;
+	int			count1 = 0,
+				count2 = 0;
+
+	foreach(lc1, options1)
+	{
+		DefElem    *def1 = (DefElem *) lfirst(lc1);
+		bool		found = false;
+
+		if (strcmp(def1->defname, "schema_name") == 0 ||
+			strcmp(def1->defname, "table_name") == 0)
+			continue;
+
+		count1++;
+		foreach(lc2, options2)
+		{
+			DefElem    *def2 = (DefElem *) lfirst(lc2);
+
+			if (strcmp(def1->defname, def2->defname) == 0 &&
+				strcmp(defGetString(def1), defGetString(def2)) == 0)
+			{
+				found = true;
+				break;
+			}
+		}
+
+		if (!found)
+			return false;
+	}
+
+	foreach(lc2, options2)
+	{
+		DefElem    *def2 = (DefElem *) lfirst(lc2);
+
+		if (strcmp(def2->defname, "schema_name") != 0 &&
+			strcmp(def2->defname, "table_name") != 0)
+			count2++;
+	}
+
+	return count1 == count2;
+}
+
+/*
+ * GoguExprsAreShippable
+ *		Check that 'exprs' over foreign table 'foreigntableid' (range table
+ *		entry 'relid') can be evaluated on the remote server
+ *
+ * Used by the single-partition fast path, which sends the client's
+ * statement as is and thus has no chance to evaluate anything locally.
+ */
+bool
+GoguExprsAreShippable(PlannerInfo *root, Index relid, Oid foreigntableid,
+					  List *exprs)
+{
+	GoguTableOptions   *options = GoguGetTableOptions(foreigntableid);
+	PgFdwRelationInfo  *fpinfo;
+	RelOptInfo		   *baserel;
+	ListCell		   *lc;
+
+	fpinfo = (PgFdwRelationInfo *) palloc0(sizeof(PgFdwRelationInfo));
+	fpinfo->server = options->server;
+	fpinfo->shippable_extensions = options->shippable_extensions;
+
+	baserel = makeNode(RelOptInfo);
+	baserel->reloptkind = RELOPT_BASEREL;
+	baserel->relid = relid;
+	baserel->relids = bms_make_singleton(relid);
+	baserel->fdw_private = fpinfo;
+
+	foreach(lc, exprs)
+	{
+		if (!Gogu_is_foreign_expr(root, baserel, (Expr *) lfirst(lc)))
+			return false;
+	}
+
+	return true;
+}
+
+/*
+ * GoguCloneForeignRel
+ *		Size foreign partition 'baserel' and build its paths by copying
+ *		those of its sibling 'source' on the same server
+ *
+ * Siblings differ only by the remote table, so they get the same split of
+ * the quals, the same estimates and the same paths; the remote query is
+ * still deparsed for each of them by postgresGetForeignPlan.  Returns false
+ * (and leaves 'baserel' alone) unless options and quals of both relations
+ * are the same.  Parameterized paths are never copied, since they depend
+ * on the join clauses of each relation.
+ */
+bool
+GoguCloneForeignRel(PlannerInfo *root, RelOptInfo *source, RelOptInfo *baserel)
+{
+	PgFdwRelationInfo *src_fpinfo = (PgFdwRelationInfo *) source->fdw_private;
+	PgFdwRelationInfo *fpinfo;
+	RangeTblEntry *rte = planner_rt_fetch(baserel->relid, root);
+	ForeignTable *table;
+	ListCell   *lc,
+			   *lc2;
+	const char *namespace;
+	const char *relname;
+	const char *refname;
+
+	/* Both relations must belong to us */
+	if (baserel->fdwroutine == NULL ||
+		baserel->fdwroutine->GetForeignRelSize != postgresGetForeignRelSize)
+		return false;
+
+	if (src_fpinfo == NULL || source->pathlist == NIL || IS_DUMMY_REL(source))
+		return false;
+
+	table = GoguGetTableOptions(rte->relid)->table;
+	if (table->serverid != src_fpinfo->server->serverid ||
+		!table_options_match(table->options, src_fpinfo->table->options))
+		return false;
+
+	/* Quals must be the same, up to the relation index */
+	if (list_length(baserel->baserestrictinfo) !=
+		list_length(source->baserestrictinfo))
+		return false;
+
+	forboth(lc, source->baserestrictinfo, lc2, baserel->baserestrictinfo)
+	{
+		Node	   *clause = copyObject(((RestrictInfo *) lfirst(lc))->clause);
+
+		ChangeVarNodes(clause, source->relid, baserel->relid, 0);
+		if (!equal(clause, ((RestrictInfo *) lfirst(lc2))->clause))
+			return false;
+	}
+
+	foreach(lc, source->pathlist)
+	{
+		Path	   *path = (Path *) lfirst(lc);
+
+		if (!IsA(path, ForeignPath) || path->param_info != NULL ||
+			((ForeignPath *) path)->fdw_outerpath != NULL)
+			return false;
+	}
+
+	fpinfo = (PgFdwRelationInfo *) palloc(sizeof(PgFdwRelationInfo));
+	memcpy(fpinfo, src_fpinfo, sizeof(PgFdwRelationInfo));
+	baserel->fdw_private = (void *) fpinfo;
+
+	fpinfo->table = table;
+
+	/* Use our own RestrictInfos, postgresGetForeignPlan looks for them */
+	fpinfo->remote_conds = NIL;
+	fpinfo->local_conds = NIL;
+	forboth(lc, source->baserestrictinfo, lc2, baserel->baserestrictinfo)
+	{
+		if (list_member_ptr(src_fpinfo->remote_conds, lfirst(lc)))
+			fpinfo->remote_conds = lappend(fpinfo->remote_conds, lfirst(lc2));
+		else
+			fpinfo->local_conds = lappend(fpinfo->local_conds, lfirst(lc2));
+	}
+
+	fpinfo->attrs_used = NULL;
+	pull_varattnos((Node *) baserel->reltarget->exprs, baserel->relid,
+				   &fpinfo->attrs_used);
+	foreach(lc, fpinfo->local_conds)
+	{
+		RestrictInfo *rinfo = (RestrictInfo *) lfirst(lc);
+
+		pull_varattnos((Node *) rinfo->clause, baserel->relid,
+					   &fpinfo->attrs_used);
+	}
+
+	/* Report the sibling's size to planner */
+	baserel->rows = source->rows;
+	baserel->reltarget->width = source->reltarget->width;
+
+	/* See postgresGetForeignRelSize() */
+	fpinfo->relation_name = makeStringInfo();
+	namespace = get_namespace_name(get_rel_namespace(rte->relid));
+	relname = get_rel_name(rte->relid);
+	refname = rte->eref->aliasname;
+	appendStringInfo(fpinfo->relation_name, "%s.%s",
+					 quote_identifier(namespace),
+					 quote_identifier(relname));
+	if (*refname && strcmp(refname, relname) != 0)
+		appendStringInfo(fpinfo->relation_name, " %s",
+						 quote_identifier(rte->eref->aliasname));
+
+	fpinfo->final_remote_exprs = NIL;
+	fpinfo->lower_subquery_rels = NULL;
+	fpinfo->relation_index = baserel->relid;
+	/* Finally, copy the paths */
+	foreach(lc, source->pathlist)
+	{
+		Path	   *path = (Path *) lfirst(lc);
+
+		add_path(baserel, (Path *)
+				 create_foreignscan_path(root, baserel,
+										 NULL,	/* default pathtarget */
+										 path->rows,
+										 path->startup_cost,
+										 path->total_cost,
+										 path->pathkeys,
+										 NULL,	/* no outer rel either */
+										 NULL,	/* no extra plan */
+										 NIL));	/* no fdw_private list */
+	}
+
+	return true;
+}
+
 /*
  * get_useful_ecs_for_relation
  *		Determine which EquivalenceClasses might be involved in useful
@@ -1316,6 +1590,10 @@ postgresGetForeignPlan(PlannerInfo *root,
 	fdw_private = list_make3(makeString(sql.data),
 							 retrieved_attrs,
 							 makeInteger(fpinfo->fetch_size));
+	fdw_private = lappend(fdw_private,
+						  makeInteger(copy_scan_allowed(root, foreignrel,
+														&best_path->path,
+														params_list)));
 	if (IS_JOIN_REL(foreignrel) || IS_UPPER_REL(foreignrel))
 		fdw_private = lappend(fdw_private,
 							  makeString(fpinfo->relation_name->data));
@@ -1349,7 +1627,8 @@ postgresBeginForeignScan(ForeignScanState *node, int eflags)
 	PgFdwScanState *fsstate;
 	RangeTblEntry *rte;
 	Oid			userid;
-	ForeignTable *table;
+	Oid			serverid;
+	GoguTableOptions *options;
 	UserMapping *user;
 	int			rtindex;
 	int			numParams;
@@ -1379,23 +1658,44 @@ postgresBeginForeignScan(ForeignScanState *node, int eflags)
 	rte = rt_fetch(rtindex, estate->es_range_table);
 	userid = rte->checkAsUser ? rte->checkAsUser : GetUserId();
 
-	/* Get info about foreign table. */
-	table = GetForeignTable(rte->relid);
-	user = GetUserMapping(userid, table->serverid);
+	/* Get info about foreign table, cached since planning */
+	options = GoguGetTableOptions(rte->relid);
+
+	/* Read-only transactions may scan a replica instead */
+	serverid = replica_route_server(options->server->serverid, userid);
+	if (serverid == options->server->serverid)
+		user = GoguGetTableUserMapping(options, userid);
+	else
+		user = GetUserMapping(userid, serverid);
+	remote_instr_begin(&fsstate->instr, &node->ss.ps, user->serverid);
 	fsstate->server_count = GetRemoteEntry(user);
 	
 	/*
 	 * Get connection to the foreign server.  Connection manager will
 	 * establish new connection if necessary.
 	 */
-	if (fsstate->server_count->scan_count > 1 ||
-		fsplan->scan.plan.plan_rows > USE_CUROSR_THRESHOLD) {
+	/*
+	 * A COPY stream keeps the connection busy till the end of the scan, so
+	 * it's only used if no other scan needs the connection meanwhile.  That
+	 * is only known once the executor has begun all scans, so the stream is
+	 * begun by the first fetch (see begin_copy_scan).
+	 */
+	fsstate->copy_scan = intVal(list_nth(fsplan->fdw_private,
+										 FdwScanPrivateCopyScan));
+	fsstate->copy_begun = false;
+	fsstate->copy_rows = fsplan->scan.plan.plan_rows;
+	fsstate->user = user;
+
+	if (!fsstate->copy_scan &&
+		(fsstate->server_count->scan_count > 1 ||
+		 fsplan->scan.plan.plan_rows > USE_CUROSR_THRESHOLD)) {
 		/* Assign a unique ID for my cursor */
 		fsstate->cursor_number = GoguGetCursorNumber(fsstate->conn);
 
 		fsstate->conn = GoguGetConnection(user, false, true);
 	} else 
 		fsstate->conn = GoguGetConnection(user, false, false);
+	remote_instr_connected(&fsstate->instr, fsstate->cursor_number != 0);
 
 	fsstate->cursor_exists = false;
 
@@ -1444,7 +1744,7 @@ postgresBeginForeignScan(ForeignScanState *node, int eflags)
 							 &fsstate->param_flinfo,
 							 &fsstate->param_exprs,
 							 &fsstate->param_values);
-	if (fsstate->cursor_number == 0) {
+	if (!fsstate->copy_scan && fsstate->cursor_number == 0) {
 		/* since have no cursor numer, means does not use cursor */
 		if (numParams > 0)             
 		{
@@ -1459,6 +1759,8 @@ postgresBeginForeignScan(ForeignScanState *node, int eflags)
 		if (!PQsendQueryParams(fsstate->conn, fsstate->query, numParams,
 								NULL, fsstate->param_values, NULL, NULL, 0))
 			Gogu_pgfdw_report_error(ERROR, NULL, fsstate->conn, false, fsstate->query);
+		remote_instr_sent(&fsstate->instr, fsstate->query);
+		remote_instr_statement(&fsstate->instr, fsstate->query);
 		
 		PQsetSingleRowMode(fsstate->conn);
 	}
@@ -1476,9 +1778,11 @@ postgresIterateForeignScan(ForeignScanState *node)
 	TupleTableSlot *slot = node->ss.ss_ScanTupleSlot;
 
 	/*
-	 * If this is the first call after Begin or ReScan, we need to create the
-	 * cursor on the remote side.
+	 * If this is the first call after Begin or ReScan, we need to begin the
+	 * COPY stream or to create the cursor on the remote side.
 	 */
+	if (fsstate->copy_scan && !fsstate->copy_begun)
+		begin_copy_scan(node);
 	if (fsstate->cursor_number > 0 && !fsstate->cursor_exists)
 		create_cursor(node);
 
@@ -1489,7 +1793,9 @@ postgresIterateForeignScan(ForeignScanState *node)
 	{
 		/* No point in another fetch if we already detected EOF, though. */
 		if (!fsstate->eof_reached) {
-			if (fsstate->cursor_number > 0)
+			if (fsstate->copy_scan)
+				fetch_more_data_copy(node);
+			else if (fsstate->cursor_number > 0)
 				fetch_more_data(node);
 			else
 				fetch_more_data_without_cursor(node);
@@ -1520,7 +1826,24 @@ postgresReScanForeignScan(ForeignScanState *node)
 	PgFdwScanState *fsstate = (PgFdwScanState *) node->fdw_state;
 	PGresult   *res;
 
-	if (fsstate->cursor_number > 0) {
+	if (fsstate->copy_scan)
+	{
+		/* If we haven't begun the stream yet, nothing to do. */
+		if (!fsstate->copy_begun)
+			return;
+
+		/* Easy: just rescan what we already have in memory, if anything */
+		if (fsstate->fetch_ct_2 <= 1)
+		{
+			fsstate->next_tuple = 0;
+			return;
+		}
+
+		/* Otherwise end the stream; the next fetch begins it again */
+		GoguCopyStreamEnd(&fsstate->copy, fsstate->copy_rows);
+		fsstate->copy_begun = false;
+	}
+	else if (fsstate->cursor_number > 0) {
 		char		sql[64];
 		/* If we haven't created the cursor yet, nothing to do. */
 		if (!fsstate->cursor_exists )
@@ -1554,7 +1877,7 @@ postgresReScanForeignScan(ForeignScanState *node)
 	 	* We don't use a PG_TRY block here, so be careful not to throw error
 	 	* without releasing the PGresult.
 	 	*/
-		res = Gogu_pgfdw_exec_query(fsstate->conn, sql);
+		res = Gogu_pgfdw_exec_cursor_query(fsstate->conn, sql);
 		if (PQresultStatus(res) != PGRES_COMMAND_OK)
 			Gogu_pgfdw_report_error(ERROR, res, fsstate->conn, true, sql);
 		PQclear(res);
@@ -1604,6 +1927,8 @@ postgresReScanForeignScan(ForeignScanState *node)
 			if (!PQsendQueryParams(fsstate->conn, fsstate->query, fsstate->numParams,
 								NULL, fsstate->param_values, NULL, NULL, 0))
 				Gogu_pgfdw_report_error(ERROR, NULL, fsstate->conn, false, fsstate->query);
+			remote_instr_sent(&fsstate->instr, fsstate->query);
+			remote_instr_statement(&fsstate->instr, fsstate->query);
 		
 			PQsetSingleRowMode(fsstate->conn);
 		}
@@ -1630,8 +1955,11 @@ postgresEndForeignScan(ForeignScanState *node)
 	if (fsstate == NULL)
 		return;
 
+	/* Skip or cancel the rest of the COPY stream, if any */
+	if (fsstate->copy_begun)
+		GoguCopyStreamEnd(&fsstate->copy, fsstate->copy_rows);
 	/* Close the cursor if open, to prevent accumulation of cursors */
-	if (fsstate->cursor_exists) {
+	else if (fsstate->cursor_exists) {
 		close_cursor(fsstate->conn, fsstate->cursor_number);
  	} else {
 		if (!fsstate->eof_reached && fsstate->cursor_number==0) {
@@ -1656,6 +1984,8 @@ postgresEndForeignScan(ForeignScanState *node)
 			}
 		}
 	}
+	remote_instr_end(&fsstate->instr);
+
 	/* Release remote connection */
 	GoguReleaseConnection(fsstate->conn);
 	fsstate->conn = NULL;
@@ -2605,6 +2935,26 @@ postgresExplainForeignScan(ForeignScanState *node, ExplainState *es)
 		sql = strVal(list_nth(fdw_private, FdwScanPrivateSelectSql));
 		ExplainPropertyText("Remote SQL", sql, es);
 	}
+
+	/* Add remote timings, when ANALYZE option is specified. */
+	if (node->fdw_state)
+		remote_instr_explain(&((PgFdwScanState *) node->fdw_state)->instr, es);
+}
+
+/*
+ * GoguGetScanInstr
+ *		Return the EXPLAIN ANALYZE numbers of a postgres_fdw scan, or NULL
+ *		if node is not one
+ */
+GoguScanInstr *
+GoguGetScanInstr(ForeignScanState *node)
+{
+	if (node->fdw_state == NULL || node->fdwroutine == NULL ||
+		node->fdwroutine->BeginForeignScan != postgresBeginForeignScan ||
+		((ForeignScan *) node->ss.ps.plan)->operation != CMD_SELECT)
+		return NULL;
+
+	return &((PgFdwScanState *) node->fdw_state)->instr;
 }
 
 /*
@@ -2688,6 +3038,7 @@ estimate_path_cost_size(PlannerInfo *root,
 		List	   *local_param_join_conds;
 		StringInfoData sql;
 		PGconn	   *conn;
+		RemoteEstimate estimate;
 		Selectivity local_sel;
 		QualCost	local_cost;
 		List	   *fdw_scan_tlist = NIL;
@@ -2696,6 +3047,9 @@ estimate_path_cost_size(PlannerInfo *root,
 		/* Required only to be passed to deparseSelectStmtForRel */
 		List	   *retrieved_attrs;
 
+		/* Foreign tables the estimate depends on */
+		List	   *relids;
+
 		/*
 		 * param_join_conds might contain both clauses that are safe to send
 		 * across, and clauses that aren't.
@@ -2728,11 +3082,28 @@ estimate_path_cost_size(PlannerInfo *root,
 								remote_conds, pathkeys, false,
 								&retrieved_attrs, NULL);
 
-		/* Get the remote estimate */
-		conn = GoguGetConnection(fpinfo->user, false, true);
-		get_remote_estimate(sql.data, conn, &rows, &width,
-							&startup_cost, &total_cost);
-		GoguReleaseConnection(conn);
+		/* Get the remote estimate, unless it's cached */
+		relids = remote_estimate_relids(root, foreignrel->relids);
+		if (remote_estimate_lookup(fpinfo->user, sql.data, relids, &estimate))
+		{
+			rows = estimate.rows;
+			width = estimate.width;
+			startup_cost = estimate.startup_cost;
+			total_cost = estimate.total_cost;
+		}
+		else
+		{
+			conn = GoguGetConnection(fpinfo->user, false, true);
+			get_remote_estimate(sql.data, conn, &rows, &width,
+								&startup_cost, &total_cost);
+			GoguReleaseConnection(conn);
+
+			estimate.rows = rows;
+			estimate.width = width;
+			estimate.startup_cost = startup_cost;
+			estimate.total_cost = total_cost;
+			remote_estimate_store(fpinfo->user, sql.data, relids, &estimate);
+		}
 
 		retrieved_rows = rows;
 
@@ -3133,7 +3504,10 @@ create_cursor(ForeignScanState *node)
 	 * We don't use a PG_TRY block here, so be careful not to throw error
 	 * without releasing the PGresult.
 	 */
-	res = Gogu_pgfdw_get_result(conn, buf.data);
+	remote_instr_sent(&fsstate->instr, buf.data);
+	remote_instr_statement(&fsstate->instr, fsstate->query);
+	res = Gogu_pgfdw_get_cursor_result(conn, buf.data);
+	remote_instr_received(&fsstate->instr, res);
 	if (PQresultStatus(res) != PGRES_COMMAND_OK)
 		Gogu_pgfdw_report_error(ERROR, res, conn, true, fsstate->query);
 	PQclear(res);
@@ -3181,7 +3555,9 @@ fetch_more_data_without_cursor(ForeignScanState *node)
 		while (i < fsstate->fetch_size)
 		{
 			Assert(IsA(node->ss.ps.plan, ForeignScan));
+			remote_instr_wait(&fsstate->instr);
 			res = PQgetResult(conn);
+			remote_instr_received(&fsstate->instr, res);
 			if (PQresultStatus(res) == PGRES_TUPLES_OK)
 			{
 				PQclear(res);
@@ -3226,6 +3602,113 @@ fetch_more_data_without_cursor(ForeignScanState *node)
 	MemoryContextSwitchTo(oldcontext);
 }
 
+/*
+ * Can the scan be streamed with COPY (see fetch_more_data_copy)?
+ *
+ * The remote query must not depend on parameters or lock rows, and the
+ * scan must be expected to return enough rows for the stream to pay off.
+ * Rows left unread by LIMIT would have to be received all the same.
+ */
+static bool
+copy_scan_allowed(PlannerInfo *root, RelOptInfo *foreignrel,
+				  Path *path, List *params_list)
+{
+	if (gogudb_copy_scan_threshold < 0 || params_list != NIL)
+		return false;
+
+	/* Rows of result relations and FOR UPDATE/SHARE are locked */
+	if (root->parse->rowMarks != NIL || root->rowMarks != NIL ||
+		bms_is_member(root->parse->resultRelation, foreignrel->relids))
+		return false;
+
+	if (root->parse->limitCount != NULL)
+		return false;
+
+	return path->rows >= gogudb_copy_scan_threshold;
+}
+
+/*
+ * Begin the COPY stream of a scan at its first fetch.  If the connection
+ * is used by another scan or statement, use a cursor instead.
+ */
+static void
+begin_copy_scan(ForeignScanState *node)
+{
+	PgFdwScanState *fsstate = (PgFdwScanState *) node->fdw_state;
+	MemoryContext oldcontext;
+
+	if (!GoguCopyStreamAllowed(fsstate->conn))
+	{
+		/* A cursor needs a remote transaction; we already hold a reference */
+		fsstate->copy_scan = false;
+		fsstate->conn = GoguGetConnection(fsstate->user, false, true);
+		GoguReleaseConnection(fsstate->conn);
+		fsstate->cursor_number = GoguGetCursorNumber(fsstate->conn);
+		fsstate->instr.cursor = true;
+		return;
+	}
+
+	/* We are called in per-tuple memory, but the stream lasts the scan */
+	oldcontext = MemoryContextSwitchTo(node->ss.ps.state->es_query_cxt);
+	GoguCopyStreamBegin(&fsstate->copy, fsstate->conn, fsstate->query);
+	MemoryContextSwitchTo(oldcontext);
+
+	fsstate->copy_begun = true;
+	remote_instr_sent(&fsstate->instr, fsstate->copy.sql);
+	remote_instr_statement(&fsstate->instr, fsstate->copy.sql);
+}
+
+/*
+ * Fetch some more rows from the node's COPY stream.
+ */
+static void
+fetch_more_data_copy(ForeignScanState *node)
+{
+	PgFdwScanState *fsstate = (PgFdwScanState *) node->fdw_state;
+	int64		bytes = fsstate->copy.bytes;
+	MemoryContext oldcontext;
+	int			i = 0;
+
+	/*
+	 * We'll store the tuples in the batch_cxt.  First, flush the previous
+	 * batch.
+	 */
+	fsstate->tuples = NULL;
+	MemoryContextReset(fsstate->batch_cxt);
+	oldcontext = MemoryContextSwitchTo(fsstate->batch_cxt);
+
+	fsstate->tuples = (HeapTuple *) palloc0(fsstate->fetch_size * sizeof(HeapTuple));
+	fsstate->next_tuple = 0;
+
+	remote_instr_wait(&fsstate->instr);
+	while (i < fsstate->fetch_size)
+	{
+		int			nfields = GoguCopyStreamNext(&fsstate->copy);
+
+		if (nfields < 0)
+			break;
+
+		fsstate->tuples[i++] =
+			make_tuple_from_strings(fsstate->copy.fields, nfields,
+									fsstate->rel,
+									fsstate->attinmeta,
+									fsstate->retrieved_attrs,
+									node,
+									fsstate->temp_cxt);
+	}
+	remote_instr_received_rows(&fsstate->instr, i, fsstate->copy.bytes - bytes);
+
+	/* Update fetch_ct_2 */
+	if (fsstate->fetch_ct_2 < 2)
+		fsstate->fetch_ct_2++;
+
+	/* Must be EOF if we didn't get as many tuples as we asked for. */
+	fsstate->eof_reached = (i < fsstate->fetch_size);
+	fsstate->num_tuples = i;
+
+	MemoryContextSwitchTo(oldcontext);
+}
+
 
 /*
  * Fetch some more rows from the node's cursor.
@@ -3256,7 +3739,9 @@ fetch_more_data(ForeignScanState *node)
 		snprintf(sql, sizeof(sql), "FETCH %d FROM c%u",
 				 fsstate->fetch_size, fsstate->cursor_number);
 
-		res = Gogu_pgfdw_exec_query(conn, sql);
+		remote_instr_sent(&fsstate->instr, sql);
+		res = Gogu_pgfdw_exec_cursor_query(conn, sql);
+		remote_instr_received(&fsstate->instr, res);
 		/* On error, report the original query, not the FETCH. */
 		if (PQresultStatus(res) != PGRES_TUPLES_OK)
 			Gogu_pgfdw_report_error(ERROR, res, conn, false, fsstate->query);
@@ -3366,7 +3851,7 @@ close_cursor(PGconn *conn, unsigned int cursor_number)
 	 * We don't use a PG_TRY block here, so be careful not to throw error
 	 * without releasing the PGresult.
 	 */
-	res = Gogu_pgfdw_exec_query(conn, sql);
+	res = Gogu_pgfdw_exec_cursor_query(conn, sql);
 	if (PQresultStatus(res) != PGRES_COMMAND_OK)
 		Gogu_pgfdw_report_error(ERROR, res, conn, true, sql);
 	PQclear(res);
@@ -3773,6 +4258,8 @@ postgresAnalyzeForeignTable(Relation relation,
 	}
 	PG_END_TRY();
 
+	remember_analyze_target(relation, user, conn, *totalpages);
+
 	GoguReleaseConnection(conn);
 
 	return true;
@@ -3781,7 +4268,11 @@ postgresAnalyzeForeignTable(Relation relation,
 /*
  * Acquire a random sample of rows from foreign table managed by postgres_fdw.
  *
- * We fetch the whole table from the remote side and pick out some sample rows.
+ * Unless "analyze_sampling" is off, the remote server samples the table
+ * (TABLESAMPLE, or a random() filter for servers older than 9.5) so that
+ * only about targrows rows are transferred; otherwise we fetch the whole
+ * table from the remote side.  Either way we pick out the final sample rows
+ * locally.
  *
  * Selected rows are returned in the caller-allocated array rows[],
  * which must have at least targrows entries.
@@ -3801,13 +4292,9 @@ postgresAcquireSampleRowsFunc(Relation relation, int elevel,
 							  double *totaldeadrows)
 {
 	PgFdwAnalyzeState astate;
-	ForeignTable *table;
-	ForeignServer *server;
-	UserMapping *user;
-	PGconn	   *conn;
-	unsigned int cursor_number;
-	StringInfoData sql;
-	PGresult   *volatile res = NULL;
+	PgFdwAnalyzeTarget *target;
+	PgFdwSamplingMethod sample_method;
+	double		reltuples = -1;
 
 	/* Initialize workspace state */
 	astate.rel = relation;
@@ -3826,6 +4313,157 @@ postgresAcquireSampleRowsFunc(Relation relation, int elevel,
 											"postgres_fdw temporary data",
 											ALLOCSET_SMALL_SIZES);
 
+	/*
+	 * ANALYZE of a partitioned table samples the partitions one by one, so
+	 * let the first one fetch the samples of all servers at once.
+	 */
+	target = find_analyze_target(RelationGetRelid(relation));
+	if (target)
+	{
+		prefetch_analyze_samples(target, targrows);
+		target->sampled = true;
+		reltuples = target->reltuples;
+	}
+
+	if (target && target->res && target->res_targrows >= targrows)
+	{
+		int			numrows = PQntuples(target->res);
+		int			i;
+
+		/* The sample may be bigger than needed, the reservoir cuts it down */
+		astate.retrieved_attrs = target->res_attrs;
+		for (i = 0; i < numrows; i++)
+			analyze_row_processor(target->res, i, &astate);
+
+		PQclear(target->res);
+		target->res = NULL;
+
+		sample_method = target->res_method;
+	}
+	else
+		sample_method = fetch_analyze_sample(relation, &astate, &reltuples,
+											 target != NULL);
+
+	/* We assume that we have no dead tuple. */
+	*totaldeadrows = 0.0;
+
+	/*
+	 * Without sampling we've retrieved all living tuples from foreign
+	 * server, otherwise trust the remote estimate.
+	 */
+	if (sample_method == ANALYZE_SAMPLE_OFF)
+		*totalrows = astate.samplerows;
+	else
+		*totalrows = reltuples;
+
+	/*
+	 * Emit some interesting relation info
+	 */
+	ereport(elevel,
+			(errmsg("\"%s\": table contains %.0f rows, %d rows in sample",
+					RelationGetRelationName(relation),
+					astate.samplerows, astate.numrows)));
+
+	return astate.numrows;
+}
+
+/*
+ * Get the "analyze_sampling" option of a foreign table (or its server).
+ */
+static PgFdwSamplingMethod
+get_analyze_sampling(ForeignServer *server, ForeignTable *table)
+{
+	PgFdwSamplingMethod method = ANALYZE_SAMPLE_AUTO;
+	const char *value = NULL;
+	ListCell   *lc;
+
+	foreach(lc, server->options)
+	{
+		DefElem    *def = (DefElem *) lfirst(lc);
+
+		if (strcmp(def->defname, "analyze_sampling") == 0)
+			value = defGetString(def);
+	}
+	foreach(lc, table->options)
+	{
+		DefElem    *def = (DefElem *) lfirst(lc);
+
+		if (strcmp(def->defname, "analyze_sampling") == 0)
+			value = defGetString(def);
+	}
+
+	if (value == NULL)
+		return method;
+
+	if (strcmp(value, "off") == 0)
+		method = ANALYZE_SAMPLE_OFF;
+	else if (strcmp(value, "random") == 0)
+		method = ANALYZE_SAMPLE_RANDOM;
+	else if (strcmp(value, "system") == 0)
+		method = ANALYZE_SAMPLE_SYSTEM;
+	else if (strcmp(value, "bernoulli") == 0)
+		method = ANALYZE_SAMPLE_BERNOULLI;
+
+	return method;
+}
+
+/*
+ * Fetch the remote planner's estimate of the number of rows.
+ */
+static double
+get_remote_reltuples(PGconn *conn, Relation relation)
+{
+	StringInfoData sql;
+	PGresult   *volatile res = NULL;
+	double		reltuples = -1;
+
+	initStringInfo(&sql);
+	GogudeparseAnalyzeTuplesSql(&sql, relation);
+
+	/* In what follows, do not risk leaking any PGresults. */
+	PG_TRY();
+	{
+		res = Gogu_pgfdw_exec_query(conn, sql.data);
+		if (PQresultStatus(res) != PGRES_TUPLES_OK)
+			Gogu_pgfdw_report_error(ERROR, res, conn, false, sql.data);
+
+		if (PQntuples(res) != 1 || PQnfields(res) != 1)
+			elog(ERROR, "unexpected result from GogudeparseAnalyzeTuplesSql query");
+		reltuples = strtod(PQgetvalue(res, 0, 0), NULL);
+
+		PQclear(res);
+		res = NULL;
+	}
+	PG_CATCH();
+	{
+		if (res)
+			PQclear(res);
+		PG_RE_THROW();
+	}
+	PG_END_TRY();
+
+	return reltuples;
+}
+
+/*
+ * Fetch the sample of a foreign table with a cursor into 'astate', return
+ * the sampling method used.  The remote estimate of the number of rows is
+ * returned into *reltuples, it's only fetched unless known_reltuples.
+ */
+static PgFdwSamplingMethod
+fetch_analyze_sample(Relation relation, PgFdwAnalyzeState *astate,
+					 double *reltuples, bool known_reltuples)
+{
+	ForeignTable *table;
+	ForeignServer *server;
+	UserMapping *user;
+	PGconn	   *conn;
+	unsigned int cursor_number;
+	StringInfoData sql;
+	PGresult   *volatile res = NULL;
+	PgFdwSamplingMethod sample_method;
+	double		sample_frac;
+
 	/*
 	 * Get the connection to use.  We do the remote access as the table's
 	 * owner, even if the ANALYZE was started by some other user.
@@ -3835,13 +4473,22 @@ postgresAcquireSampleRowsFunc(Relation relation, int elevel,
 	user = GetUserMapping(relation->rd_rel->relowner, table->serverid);
 	conn = GoguGetConnection(user, false, true);
 
+	if (!known_reltuples &&
+		get_analyze_sampling(server, table) != ANALYZE_SAMPLE_OFF)
+		*reltuples = get_remote_reltuples(conn, relation);
+
+	sample_method = choose_analyze_sampling(server, table, PQserverVersion(conn),
+											*reltuples, astate->targrows,
+											&sample_frac);
+
 	/*
-	 * Construct cursor that retrieves whole rows from remote.
+	 * Construct cursor that retrieves (sampled) rows from remote.
 	 */
 	cursor_number = GoguGetCursorNumber(conn);
 	initStringInfo(&sql);
 	appendStringInfo(&sql, "DECLARE c%u CURSOR FOR ", cursor_number);
-	GogudeparseAnalyzeSql(&sql, relation, &astate.retrieved_attrs);
+	GogudeparseAnalyzeSql(&sql, relation, sample_method, sample_frac,
+						  &astate->retrieved_attrs);
 
 	/* In what follows, do not risk leaking any PGresults. */
 	PG_TRY();
@@ -3905,7 +4552,7 @@ postgresAcquireSampleRowsFunc(Relation relation, int elevel,
 			/* Process whatever we got. */
 			numrows = PQntuples(res);
 			for (i = 0; i < numrows; i++)
-				analyze_row_processor(res, i, &astate);
+				analyze_row_processor(res, i, astate);
 
 			PQclear(res);
 			res = NULL;
@@ -3928,21 +4575,269 @@ postgresAcquireSampleRowsFunc(Relation relation, int elevel,
 
 	GoguReleaseConnection(conn);
 
-	/* We assume that we have no dead tuple. */
-	*totaldeadrows = 0.0;
+	return sample_method;
+}
+
+/*
+ * Choose how the remote server should sample a table of 'reltuples' rows
+ * to return about 'targrows' rows, and the fraction of the table to ask
+ * for.
+ */
+static PgFdwSamplingMethod
+choose_analyze_sampling(ForeignServer *server, ForeignTable *table,
+						int server_version, double reltuples, int targrows,
+						double *sample_frac)
+{
+	PgFdwSamplingMethod sample_method = get_analyze_sampling(server, table);
 
-	/* We've retrieved all living tuples from foreign server. */
-	*totalrows = astate.samplerows;
+	*sample_frac = 1.0;
+
+	/* Sampling is pointless if the table isn't bigger than the sample */
+	if (sample_method != ANALYZE_SAMPLE_OFF)
+	{
+		if (reltuples <= 0 || targrows * ANALYZE_SAMPLE_MARGIN >= reltuples)
+			return ANALYZE_SAMPLE_OFF;
+
+		*sample_frac = targrows * ANALYZE_SAMPLE_MARGIN / reltuples;
+	}
+
+	/* TABLESAMPLE is available since 9.5 */
+	if (sample_method != ANALYZE_SAMPLE_OFF &&
+		sample_method != ANALYZE_SAMPLE_RANDOM &&
+		server_version < 90500)
+		sample_method = ANALYZE_SAMPLE_RANDOM;
 
 	/*
-	 * Emit some interesting relation info
+	 * Block sampling is much cheaper for big tables, but returns clustered
+	 * rows, so prefer row sampling unless we only need a small fraction.
 	 */
-	ereport(elevel,
-			(errmsg("\"%s\": table contains %.0f rows, %d rows in sample",
-					RelationGetRelationName(relation),
-					astate.samplerows, astate.numrows)));
+	if (sample_method == ANALYZE_SAMPLE_AUTO)
+		sample_method = (*sample_frac < ANALYZE_SYSTEM_MAX_FRAC) ?
+							ANALYZE_SAMPLE_SYSTEM :
+							ANALYZE_SAMPLE_BERNOULLI;
 
-	return astate.numrows;
+	return sample_method;
+}
+
+/*
+ * Remember a table whose size ANALYZE has asked for, along with the remote
+ * estimate of its rows, which is needed to sample it.  Tables are kept
+ * until the memory context of the ANALYZE goes away.
+ */
+static void
+remember_analyze_target(Relation relation, UserMapping *user, PGconn *conn,
+						BlockNumber relpages)
+{
+	ForeignTable *table = GetForeignTable(RelationGetRelid(relation));
+	ForeignServer *server = GetForeignServer(table->serverid);
+	PgFdwAnalyzeTarget *target;
+
+	/* Tables of another ANALYZE are of no use */
+	if (analyze_targets_cxt != CurrentMemoryContext)
+	{
+		MemoryContextCallback *callback;
+
+		forget_analyze_targets(analyze_targets_cxt);
+
+		callback = (MemoryContextCallback *) palloc(sizeof(MemoryContextCallback));
+		callback->func = forget_analyze_targets;
+		callback->arg = CurrentMemoryContext;
+		MemoryContextRegisterResetCallback(CurrentMemoryContext, callback);
+
+		analyze_targets_cxt = CurrentMemoryContext;
+	}
+
+	target = (PgFdwAnalyzeTarget *) palloc0(sizeof(PgFdwAnalyzeTarget));
+	target->relid = RelationGetRelid(relation);
+	target->user = user;
+	target->relpages = relpages;
+	target->reltuples = -1;
+
+	if (get_analyze_sampling(server, table) != ANALYZE_SAMPLE_OFF)
+		target->reltuples = get_remote_reltuples(conn, relation);
+
+	analyze_targets = lappend(analyze_targets, target);
+}
+
+/*
+ * Forget the tables of an ANALYZE whose memory context 'arg' is going away
+ * (unless another ANALYZE has replaced them already), together with the
+ * samples nobody has asked for.
+ */
+static void
+forget_analyze_targets(void *arg)
+{
+	ListCell   *lc;
+
+	if (arg != (void *) analyze_targets_cxt)
+		return;
+
+	foreach(lc, analyze_targets)
+	{
+		PgFdwAnalyzeTarget *target = (PgFdwAnalyzeTarget *) lfirst(lc);
+
+		if (target->res)
+			PQclear(target->res);
+	}
+
+	analyze_targets = NIL;
+	analyze_targets_cxt = NULL;
+}
+
+/*
+ * Find the table of the current ANALYZE which hasn't been sampled yet.
+ */
+static PgFdwAnalyzeTarget *
+find_analyze_target(Oid relid)
+{
+	ListCell   *lc;
+
+	foreach(lc, analyze_targets)
+	{
+		PgFdwAnalyzeTarget *target = (PgFdwAnalyzeTarget *) lfirst(lc);
+
+		if (target->relid == relid && !target->sampled)
+			return target;
+	}
+
+	return NULL;
+}
+
+/*
+ * Fetch the samples of all tables of the current ANALYZE when the first
+ * of them is sampled, running the queries of different servers (user
+ * mappings, really) concurrently.
+ *
+ * ANALYZE of an inheritance tree splits its sample between the children
+ * in proportion to their sizes, rounding the number of rows of each one.
+ * Knowing that 'first' needs 'targrows' rows, we ask for the most rows a
+ * sibling may need; analyze_row_processor() cuts the sample down to the
+ * actual number.  Tables of unknown size, or which are read in full, are
+ * left to fetch_analyze_sample().
+ */
+static void
+prefetch_analyze_samples(PgFdwAnalyzeTarget *first, int targrows)
+{
+	List	   *pending = NIL;
+	ListCell   *lc;
+
+	if (first->relpages == 0)
+		return;
+
+	foreach(lc, analyze_targets)
+	{
+		PgFdwAnalyzeTarget *target = (PgFdwAnalyzeTarget *) lfirst(lc);
+
+		/* Only the first sampled table fetches ahead */
+		if (target->sampled)
+			return;
+
+		/* ANALYZE doesn't sample empty children */
+		if (target->relpages == 0 || target->reltuples <= 0)
+			continue;
+
+		if (target == first)
+			target->res_targrows = targrows;
+		else
+			target->res_targrows = (int)
+				Min(ceil((targrows + 0.5) * target->relpages / first->relpages),
+					MaxAllocSize / sizeof(HeapTuple));
+
+		pending = lappend(pending, target);
+	}
+
+	/* Nothing to run concurrently */
+	if (list_length(pending) < 2)
+		return;
+
+	/* Each round runs one query per user mapping */
+	while (pending != NIL)
+	{
+		int			nqueries = list_length(pending);
+		UserMapping **users = palloc(sizeof(UserMapping *) * nqueries);
+		const char **queries = palloc(sizeof(char *) * nqueries);
+		PgFdwAnalyzeTarget **round = palloc(sizeof(PgFdwAnalyzeTarget *) * nqueries);
+		PGconn	  **conns = palloc0(sizeof(PGconn *) * nqueries);
+		PGresult  **results;
+		List	   *rest = NIL;
+		int			n = 0,
+					i;
+
+		foreach(lc, pending)
+		{
+			PgFdwAnalyzeTarget *target = (PgFdwAnalyzeTarget *) lfirst(lc);
+
+			for (i = 0; i < n; i++)
+			{
+				if (users[i]->umid == target->user->umid)
+					break;
+			}
+
+			if (i < n)
+			{
+				rest = lappend(rest, target);
+				continue;
+			}
+
+			users[n] = target->user;
+			queries[n] = deparse_analyze_target(target);
+			round[n++] = target;
+		}
+
+		results = GoguExecParallel(users, queries, n, conns, true);
+
+		/* Report the first failure, as fetch_analyze_sample() would */
+		for (i = 0; i < n; i++)
+		{
+			int			j;
+
+			if (PQresultStatus(results[i]) == PGRES_TUPLES_OK)
+				continue;
+
+			for (j = 0; j < n; j++)
+			{
+				if (j != i)
+					PQclear(results[j]);
+			}
+			Gogu_pgfdw_report_error(ERROR, results[i], conns[i], true, queries[i]);
+		}
+
+		for (i = 0; i < n; i++)
+			round[i]->res = results[i];
+
+		pending = rest;
+	}
+}
+
+/*
+ * Build the query which fetches the sample of 'target' in one go.
+ */
+static char *
+deparse_analyze_target(PgFdwAnalyzeTarget *target)
+{
+	Relation	relation = heap_open(target->relid, NoLock);
+	ForeignTable *table = GetForeignTable(target->relid);
+	ForeignServer *server = GetForeignServer(table->serverid);
+	PGconn	   *conn;
+	StringInfoData sql;
+	double		sample_frac;
+
+	/* Only to learn the version of the server */
+	conn = GoguGetConnection(target->user, false, true);
+	target->res_method = choose_analyze_sampling(server, table,
+												 PQserverVersion(conn),
+												 target->reltuples,
+												 target->res_targrows,
+												 &sample_frac);
+	GoguReleaseConnection(conn);
+
+	initStringInfo(&sql);
+	GogudeparseAnalyzeSql(&sql, relation, target->res_method, sample_frac,
+						  &target->res_attrs);
+
+	heap_close(relation, NoLock);
+
+	return sql.data;
 }
 
 /*
@@ -4605,55 +5500,6 @@ add_paths_with_pathkeys_for_rel(PlannerInfo *root, RelOptInfo *rel,
 	}
 }
 
-/*
- * Parse options from foreign server and apply them to fpinfo.
- *
- * New options might also require tweaking merge_fdw_options().
- */
-static void
-apply_server_options(PgFdwRelationInfo *fpinfo)
-{
-	ListCell   *lc;
-
-	foreach(lc, fpinfo->server->options)
-	{
-		DefElem    *def = (DefElem *) lfirst(lc);
-
-		if (strcmp(def->defname, "use_remote_estimate") == 0)
-			fpinfo->use_remote_estimate = defGetBoolean(def);
-		else if (strcmp(def->defname, "fdw_startup_cost") == 0)
-			fpinfo->fdw_startup_cost = strtod(defGetString(def), NULL);
-		else if (strcmp(def->defname, "fdw_tuple_cost") == 0)
-			fpinfo->fdw_tuple_cost = strtod(defGetString(def), NULL);
-		else if (strcmp(def->defname, "extensions") == 0)
-			fpinfo->shippable_extensions =
-				GoguExtractExtensionList(defGetString(def), false);
-		else if (strcmp(def->defname, "fetch_size") == 0)
-			fpinfo->fetch_size = strtol(defGetString(def), NULL, 10);
-	}
-}
-
-/*
- * Parse options from foreign table and apply them to fpinfo.
- *
- * New options might also require tweaking merge_fdw_options().
- */
-static void
-apply_table_options(PgFdwRelationInfo *fpinfo)
-{
-	ListCell   *lc;
-
-	foreach(lc, fpinfo->table->options)
-	{
-		DefElem    *def = (DefElem *) lfirst(lc);
-
-		if (strcmp(def->defname, "use_remote_estimate") == 0)
-			fpinfo->use_remote_estimate = defGetBoolean(def);
-		else if (strcmp(def->defname, "fetch_size") == 0)
-			fpinfo->fetch_size = strtol(defGetString(def), NULL, 10);
-	}
-}
-
 /*
  * Merge FDW options from input relations into a new set of options for a join
  * or an upper rel.
@@ -5170,6 +6016,40 @@ make_tuple_from_result_row(PGresult *res,
 						   List *retrieved_attrs,
 						   ForeignScanState *fsstate,
 						   MemoryContext temp_context)
+{
+	int			nfields = PQnfields(res);
+	char	  **valstrs;
+	int			j;
+
+	Assert(row < PQntuples(res));
+
+	/* make_tuple_from_strings() resets temp_context when it's done */
+	valstrs = (char **) MemoryContextAlloc(temp_context,
+										   Max(nfields, 1) * sizeof(char *));
+	for (j = 0; j < nfields; j++)
+	{
+		if (PQgetisnull(res, row, j))
+			valstrs[j] = NULL;
+		else
+			valstrs[j] = PQgetvalue(res, row, j);
+	}
+
+	return make_tuple_from_strings(valstrs, nfields, rel, attinmeta,
+								   retrieved_attrs, fsstate, temp_context);
+}
+
+/*
+ * Create a tuple from the textual values of a remote row, NULL standing
+ * for a null value.  Arguments are the same as of make_tuple_from_result_row.
+ */
+static HeapTuple
+make_tuple_from_strings(char **valstrs,
+						int nfields,
+						Relation rel,
+						AttInMetadata *attinmeta,
+						List *retrieved_attrs,
+						ForeignScanState *fsstate,
+						MemoryContext temp_context)
 {
 	HeapTuple	tuple;
 	TupleDesc	tupdesc;
@@ -5183,8 +6063,6 @@ make_tuple_from_result_row(PGresult *res,
 	ListCell   *lc;
 	int			j;
 
-	Assert(row < PQntuples(res));
-
 	/*
 	 * Do the following work in a temp context that we reset after each tuple.
 	 * This cleans up not only the data we have direct access to, but any
@@ -5220,7 +6098,7 @@ make_tuple_from_result_row(PGresult *res,
 	error_context_stack = &errcallback;
 
 	/*
-	 * i indexes columns in the relation, j indexes columns in the PGresult.
+	 * i indexes columns in the relation, j indexes columns in the row.
 	 */
 	j = 0;
 	foreach(lc, retrieved_attrs)
@@ -5229,10 +6107,7 @@ make_tuple_from_result_row(PGresult *res,
 		char	   *valstr;
 
 		/* fetch next column's textual value */
-		if (PQgetisnull(res, row, j))
-			valstr = NULL;
-		else
-			valstr = PQgetvalue(res, row, j);
+		valstr = (j < nfields) ? valstrs[j] : NULL;
 
 		/*
 		 * convert value to internal representation
@@ -5283,9 +6158,9 @@ make_tuple_from_result_row(PGresult *res,
 
 	/*
 	 * Check we got the expected number of columns.  Note: j == 0 and
-	 * PQnfields == 1 is expected, since deparse emits a NULL if no columns.
+	 * nfields == 1 is expected, since deparse emits a NULL if no columns.
 	 */
-	if (j > 0 && j != PQnfields(res))
+	if (j > 0 && j != nfields)
 		elog(ERROR, "remote query result does not match the foreign table");
 
 	/*
@@ -410,3 +410,302 @@ irange_list_find(List *rangeset, int index, bool *lossy)
 
 	return false;
 }
+
+
+/*
+ * -------------------
+ *  IndexRangeBitmaps
+ * -------------------
+ */
+
+#define IRANGE_BITMAP_WORD_BITS		64
+
+#define irange_bitmap_word(bit)		( (bit) / IRANGE_BITMAP_WORD_BITS )
+#define irange_bitmap_mask(bit)		( UINT64CONST(1) << ((bit) % IRANGE_BITMAP_WORD_BITS) )
+
+/* Number of set bits in a word */
+static inline int
+irange_bitmap_popcount(uint64 word)
+{
+#if defined(__GNUC__) || defined(__clang__)
+	return __builtin_popcountll(word);
+#else
+	int result = 0;
+
+	while (word)
+	{
+		word &= word - 1;
+		result++;
+	}
+
+	return result;
+#endif
+}
+
+/* Set or clear bits [lower, upper] word by word */
+static void
+irange_bitmap_fill(uint64 *words, uint32 lower, uint32 upper, bool value)
+{
+	uint32	lower_word = irange_bitmap_word(lower),
+			upper_word = irange_bitmap_word(upper),
+			w;
+	uint64	lower_mask = ~UINT64CONST(0) << (lower % IRANGE_BITMAP_WORD_BITS),
+			upper_mask = ~UINT64CONST(0) >> (IRANGE_BITMAP_WORD_BITS - 1 -
+											 upper % IRANGE_BITMAP_WORD_BITS);
+
+	Assert(lower <= upper);
+
+	if (lower_word == upper_word)
+		lower_mask &= upper_mask;
+
+	if (value)
+		words[lower_word] |= lower_mask;
+	else
+		words[lower_word] &= ~lower_mask;
+
+	if (lower_word == upper_word)
+		return;
+
+	for (w = lower_word + 1; w < upper_word; w++)
+		words[w] = value ? ~UINT64CONST(0) : 0;
+
+	if (value)
+		words[upper_word] |= upper_mask;
+	else
+		words[upper_word] &= ~upper_mask;
+}
+
+/* Make an empty bitmap (or a complete one if 'full') of 'nbits' partitions */
+IndexRangeBitmap *
+irange_bitmap_create(uint32 nbits, bool full)
+{
+	IndexRangeBitmap   *result;
+	uint32				nwords = (nbits + IRANGE_BITMAP_WORD_BITS - 1) /
+									IRANGE_BITMAP_WORD_BITS;
+
+	Assert(nbits > 0 && nbits <= IRANGE_BITMAP_MAX_CHILDREN);
+
+	/* A single allocation for both bitmaps */
+	result = (IndexRangeBitmap *) palloc(sizeof(IndexRangeBitmap) +
+										 2 * nwords * sizeof(uint64));
+	result->nbits = nbits;
+	result->nwords = nwords;
+	result->present = (uint64 *) (result + 1);
+	result->complete = result->present + nwords;
+
+	memset(result->present, 0, 2 * nwords * sizeof(uint64));
+
+	if (full)
+	{
+		irange_bitmap_fill(result->present, 0, nbits - 1, true);
+		irange_bitmap_fill(result->complete, 0, nbits - 1, true);
+	}
+
+	return result;
+}
+
+/* Add partitions of 'rangeset', same as irange_list_union() */
+void
+irange_bitmap_union_list(IndexRangeBitmap *bitmap, List *rangeset)
+{
+	ListCell *lc;
+
+	foreach (lc, rangeset)
+	{
+		IndexRange	irange = lfirst_irange(lc);
+		uint32		lower = irange_lower(irange),
+					upper = Min(irange_upper(irange), bitmap->nbits - 1);
+
+		if (lower > upper)
+			continue;
+
+		irange_bitmap_fill(bitmap->present, lower, upper, true);
+
+		/* Complete partition stays complete */
+		if (!is_irange_lossy(irange))
+			irange_bitmap_fill(bitmap->complete, lower, upper, true);
+	}
+}
+
+/* Keep only partitions of 'rangeset', same as irange_list_intersection() */
+void
+irange_bitmap_intersect_list(IndexRangeBitmap *bitmap, List *rangeset)
+{
+	ListCell   *lc;
+	uint32		next = 0;	/* first partition after the previous IndexRange */
+
+	foreach (lc, rangeset)
+	{
+		IndexRange	irange = lfirst_irange(lc);
+		uint32		lower = irange_lower(irange),
+					upper = Min(irange_upper(irange), bitmap->nbits - 1);
+
+		/* IndexRanges of a rangeset are sorted and don't overlap */
+		Assert(lower >= next);
+
+		if (lower >= bitmap->nbits)
+			break;
+
+		/* Drop the gap before this IndexRange */
+		if (lower > next)
+		{
+			irange_bitmap_fill(bitmap->present, next, lower - 1, false);
+			irange_bitmap_fill(bitmap->complete, next, lower - 1, false);
+		}
+
+		/* Lossy partition stays lossy */
+		if (is_irange_lossy(irange))
+			irange_bitmap_fill(bitmap->complete, lower, upper, false);
+
+		next = upper + 1;
+	}
+
+	/* Drop the tail */
+	if (next < bitmap->nbits)
+	{
+		irange_bitmap_fill(bitmap->present, next, bitmap->nbits - 1, false);
+		irange_bitmap_fill(bitmap->complete, next, bitmap->nbits - 1, false);
+	}
+}
+
+/* Is there no partition selected? */
+bool
+irange_bitmap_is_empty(const IndexRangeBitmap *bitmap)
+{
+	uint32 w;
+
+	for (w = 0; w < bitmap->nwords; w++)
+		if (bitmap->present[w] != 0)
+			return false;
+
+	return true;
+}
+
+/* Get total number of selected partitions */
+int
+irange_bitmap_length(const IndexRangeBitmap *bitmap)
+{
+	uint32	w;
+	int		result = 0;
+
+	for (w = 0; w < bitmap->nwords; w++)
+		result += irange_bitmap_popcount(bitmap->present[w]);
+
+	return result;
+}
+
+/* Convert bitmap into a list of maximal IndexRanges */
+List *
+irange_bitmap_to_list(const IndexRangeBitmap *bitmap)
+{
+	List   *result = NIL;
+	uint32	i = 0;
+
+	while (i < bitmap->nbits)
+	{
+		uint32	start;
+		bool	lossy;
+
+		/* Skip empty words */
+		if (i % IRANGE_BITMAP_WORD_BITS == 0 &&
+			bitmap->present[irange_bitmap_word(i)] == 0)
+		{
+			i += IRANGE_BITMAP_WORD_BITS;
+			continue;
+		}
+
+		if (!(bitmap->present[irange_bitmap_word(i)] & irange_bitmap_mask(i)))
+		{
+			i++;
+			continue;
+		}
+
+		/* Extend the IndexRange while lossiness is the same */
+		start = i;
+		lossy = !(bitmap->complete[irange_bitmap_word(i)] & irange_bitmap_mask(i));
+
+		while (i + 1 < bitmap->nbits &&
+			   (bitmap->present[irange_bitmap_word(i + 1)] & irange_bitmap_mask(i + 1)) &&
+			   !(bitmap->complete[irange_bitmap_word(i + 1)] & irange_bitmap_mask(i + 1)) == lossy)
+			i++;
+
+		result = lappend_irange(result, make_irange(start, i, lossy));
+		i++;
+	}
+
+	return result;
+}
+
+
+/*
+ * ---------------------
+ *  IndexRangeCombiners
+ * ---------------------
+ */
+
+/* Start with no partitions for OR, with all of them for AND */
+void
+irange_combiner_init(IndexRangeCombiner *combiner,
+					 uint32 nchildren, bool use_or)
+{
+	combiner->use_or = use_or;
+	combiner->ranges = NIL;
+	combiner->bitmap = NULL;
+
+	if (nchildren > 0 && nchildren <= IRANGE_BITMAP_MAX_CHILDREN)
+		combiner->bitmap = irange_bitmap_create(nchildren, !use_or);
+	else if (!use_or && nchildren > 0)
+		combiner->ranges = list_make1_irange(make_irange(0, nchildren - 1,
+														 IR_COMPLETE));
+}
+
+/* Unite or intersect current result with 'rangeset' */
+void
+irange_combiner_add(IndexRangeCombiner *combiner, List *rangeset)
+{
+	if (combiner->bitmap)
+	{
+		if (combiner->use_or)
+			irange_bitmap_union_list(combiner->bitmap, rangeset);
+		else
+			irange_bitmap_intersect_list(combiner->bitmap, rangeset);
+	}
+	else
+		combiner->ranges = combiner->use_or ?
+								irange_list_union(combiner->ranges, rangeset) :
+								irange_list_intersection(combiner->ranges, rangeset);
+}
+
+bool
+irange_combiner_is_empty(const IndexRangeCombiner *combiner)
+{
+	if (combiner->bitmap)
+		return irange_bitmap_is_empty(combiner->bitmap);
+
+	return combiner->ranges == NIL;
+}
+
+int
+irange_combiner_length(const IndexRangeCombiner *combiner)
+{
+	if (combiner->bitmap)
+		return irange_bitmap_length(combiner->bitmap);
+
+	return irange_list_length(combiner->ranges);
+}
+
+/* Return the rangeset, combiner should not be used anymore */
+List *
+irange_combiner_result(IndexRangeCombiner *combiner)
+{
+	if (combiner->bitmap)
+	{
+		List *result = irange_bitmap_to_list(combiner->bitmap);
+
+		pfree(combiner->bitmap);
+		combiner->bitmap = NULL;
+		combiner->ranges = result;
+	}
+
+	return combiner->ranges;
+}
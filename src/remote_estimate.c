@@ -0,0 +1,493 @@
+/*-------------------------------------------------------------------------
+ *
+ * remote_estimate.c
+ *		Shared cache of remote EXPLAIN estimates
+ *
+ *		With use_remote_estimate, the planner runs a remote EXPLAIN for
+ *		every path of every foreign partition.  Estimates are cached in
+ *		shmem for gogudb.remote_estimate_ttl seconds and dropped by ANALYZE
+ *		of the tables they scan.
+ *
+ *		Before sizing the children of a partitioned table, the planner may
+ *		collect the EXPLAINs it is going to need (see begin/end_batch) and
+ *		send them to all servers at once, one round trip per server.
+ *
+ *		With gogudb.clone_sibling_paths, only the first foreign partition
+ *		on each server is planned, the others copy its estimates and paths.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "remote_estimate.h"
+#include "connection_pool.h"
+
+#include "access/hash.h"
+#include "lib/stringinfo.h"
+#include "miscadmin.h"
+#include "parser/parsetree.h"
+#include "storage/lwlock.h"
+#include "storage/shmem.h"
+#include "utils/guc.h"
+#include "utils/hsearch.h"
+
+
+#define REMOTE_ESTIMATE_TRANCHE		"gogudb remote estimates"
+
+
+/* How long (seconds) an estimate stays valid, 0 disables the cache */
+int				gogudb_remote_estimate_ttl = 60;
+
+/* Plan foreign partitions by copying a sibling on the same server */
+bool			gogudb_clone_sibling_paths = false;
+
+static HTAB	   *remote_estimates = NULL;
+static LWLock  *remote_estimates_lock = NULL;
+
+/* Are we collecting EXPLAINs instead of running them? */
+static bool		batch_collecting = false;
+
+/* EXPLAINs to be sent by remote_estimate_end_batch() */
+typedef struct
+{
+	UserMapping	   *user;
+	char		   *sql;
+	List		   *relids;
+} PendingEstimate;
+
+static List	   *batch_pending = NIL;
+
+/* Savepoint guarding the remote transaction from failed EXPLAINs */
+#define ESTIMATE_SAVEPOINT "gogudb_estimate"
+
+
+static void make_estimate_key(RemoteEstimateKey *key, UserMapping *user,
+							  const char *sql);
+static bool parse_remote_estimate(PGresult *res, RemoteEstimate *estimate);
+
+
+Size
+estimate_remote_estimate_cache_size(void)
+{
+	return hash_estimate_size(REMOTE_ESTIMATE_CACHE_SIZE,
+							  sizeof(RemoteEstimateEntry));
+}
+
+/*
+ * Ask for the LWLock protecting the cache (called by _PG_init).
+ */
+void
+request_remote_estimate_lock(void)
+{
+	RequestNamedLWLockTranche(REMOTE_ESTIMATE_TRANCHE, 1);
+}
+
+/*
+ * Initialize shared memory needed for the estimate cache.
+ */
+void
+init_remote_estimate_cache(void)
+{
+	HASHCTL		ctl;
+
+	memset(&ctl, 0, sizeof(ctl));
+	ctl.keysize = sizeof(RemoteEstimateKey);
+	ctl.entrysize = sizeof(RemoteEstimateEntry);
+
+	remote_estimates = ShmemInitHash("gogudb remote estimates",
+									 REMOTE_ESTIMATE_CACHE_SIZE,
+									 REMOTE_ESTIMATE_CACHE_SIZE,
+									 &ctl,
+									 HASH_ELEM | HASH_BLOBS);
+
+	remote_estimates_lock = &(GetNamedLWLockTranche(REMOTE_ESTIMATE_TRANCHE))->lock;
+}
+
+/*
+ * Define GUC variables of the estimate cache.
+ */
+void
+init_remote_estimate_static_data(void)
+{
+	DefineCustomIntVariable("gogudb.remote_estimate_ttl",
+							"Sets how long remote EXPLAIN estimates are cached.",
+							"Zero disables the cache.",
+							&gogudb_remote_estimate_ttl,
+							60,
+							0, INT_MAX / 1000,
+							PGC_USERSET,
+							GUC_UNIT_S,
+							NULL,
+							NULL,
+							NULL);
+
+	DefineCustomBoolVariable("gogudb.clone_sibling_paths",
+							 "Plans foreign partitions by copying the paths of "
+							 "a sibling on the same server.",
+							 NULL,
+							 &gogudb_clone_sibling_paths,
+							 false,
+							 PGC_USERSET,
+							 0,
+							 NULL,
+							 NULL,
+							 NULL);
+}
+
+
+static void
+make_estimate_key(RemoteEstimateKey *key, UserMapping *user, const char *sql)
+{
+	memset(key, 0, sizeof(RemoteEstimateKey));
+
+	key->dbid = MyDatabaseId;
+	key->userid = user->userid;
+	key->serverid = user->serverid;
+	key->sql_len = strlen(sql);
+	key->sql_hash = DatumGetUInt32(hash_any((const unsigned char *) sql,
+											key->sql_len));
+}
+
+/*
+ * Foreign tables scanned by a foreign rel, to be passed to the functions
+ * below.  An empty list (e.g. for an upper rel) means they are unknown.
+ */
+List *
+remote_estimate_relids(PlannerInfo *root, Relids relids)
+{
+	List   *result = NIL;
+	int		rti = -1;
+
+	while ((rti = bms_next_member(relids, rti)) >= 0)
+	{
+		RangeTblEntry *rte = planner_rt_fetch(rti, root);
+
+		if (rte->rtekind == RTE_RELATION)
+			result = lappend_oid(result, rte->relid);
+	}
+
+	return result;
+}
+
+/*
+ * Find a valid estimate of 'sql' on the server of 'user'.
+ *
+ * While a batch is being collected, a miss is queued for the batch and
+ * answered with dummy numbers, so the caller never goes remote.
+ */
+bool
+remote_estimate_lookup(UserMapping *user, const char *sql, List *relids,
+					   RemoteEstimate *estimate)
+{
+	RemoteEstimateKey		key;
+	RemoteEstimateEntry	   *entry;
+	bool					found = false;
+
+	if (gogudb_remote_estimate_ttl > 0 && remote_estimates)
+	{
+		make_estimate_key(&key, user, sql);
+
+		LWLockAcquire(remote_estimates_lock, LW_SHARED);
+
+		entry = (RemoteEstimateEntry *) hash_search(remote_estimates, &key,
+													HASH_FIND, NULL);
+		if (entry &&
+			!TimestampDifferenceExceeds(entry->stored_at, GetCurrentTimestamp(),
+										gogudb_remote_estimate_ttl * 1000))
+		{
+			*estimate = entry->estimate;
+			found = true;
+		}
+
+		LWLockRelease(remote_estimates_lock);
+	}
+
+	if (!found && batch_collecting)
+	{
+		PendingEstimate	   *pending = palloc(sizeof(PendingEstimate));
+
+		pending->user = user;
+		pending->sql = pstrdup(sql);
+		pending->relids = list_copy(relids);
+		batch_pending = lappend(batch_pending, pending);
+
+		/* Caller is going to throw this away */
+		estimate->rows = 1;
+		estimate->width = 0;
+		estimate->startup_cost = 0;
+		estimate->total_cost = 0;
+		found = true;
+	}
+
+	return found;
+}
+
+/*
+ * Remember the estimate of 'sql' on the server of 'user', which scans the
+ * foreign tables 'relids'.
+ */
+void
+remote_estimate_store(UserMapping *user, const char *sql, List *relids,
+					  const RemoteEstimate *estimate)
+{
+	RemoteEstimateKey		key;
+	RemoteEstimateEntry	   *entry;
+	TimestampTz				now = GetCurrentTimestamp();
+
+	if (gogudb_remote_estimate_ttl <= 0 || remote_estimates == NULL)
+		return;
+
+	make_estimate_key(&key, user, sql);
+
+	LWLockAcquire(remote_estimates_lock, LW_EXCLUSIVE);
+
+	entry = (RemoteEstimateEntry *) hash_search(remote_estimates, &key,
+												HASH_ENTER_NULL, NULL);
+
+	/* Cache is full, make some room by removing stale entries */
+	if (entry == NULL)
+	{
+		HASH_SEQ_STATUS			status;
+		RemoteEstimateEntry	   *cur;
+
+		hash_seq_init(&status, remote_estimates);
+		while ((cur = (RemoteEstimateEntry *) hash_seq_search(&status)) != NULL)
+		{
+			if (TimestampDifferenceExceeds(cur->stored_at, now,
+										   gogudb_remote_estimate_ttl * 1000))
+				hash_search(remote_estimates, &cur->key, HASH_REMOVE, NULL);
+		}
+
+		entry = (RemoteEstimateEntry *) hash_search(remote_estimates, &key,
+													HASH_ENTER_NULL, NULL);
+	}
+
+	if (entry)
+	{
+		entry->stored_at = now;
+		entry->estimate = *estimate;
+
+		if (relids == NIL || list_length(relids) > REMOTE_ESTIMATE_MAX_RELS)
+			entry->nrels = -1;
+		else
+		{
+			ListCell   *lc;
+
+			entry->nrels = 0;
+			foreach(lc, relids)
+				entry->relids[entry->nrels++] = lfirst_oid(lc);
+		}
+	}
+
+	LWLockRelease(remote_estimates_lock);
+}
+
+/*
+ * Drop cached estimates scanning any of the foreign tables 'relids', whose
+ * remote statistics have changed, or all of them if 'relids' is NIL.
+ */
+void
+remote_estimate_invalidate(List *relids)
+{
+	HASH_SEQ_STATUS			status;
+	RemoteEstimateEntry	   *entry;
+
+	if (remote_estimates == NULL)
+		return;
+
+	LWLockAcquire(remote_estimates_lock, LW_EXCLUSIVE);
+
+	hash_seq_init(&status, remote_estimates);
+	while ((entry = (RemoteEstimateEntry *) hash_seq_search(&status)) != NULL)
+	{
+		bool	matches = (relids == NIL || entry->nrels < 0);
+		int		i;
+
+		for (i = 0; !matches && i < entry->nrels; i++)
+			matches = list_member_oid(relids, entry->relids[i]);
+
+		if (matches)
+			hash_search(remote_estimates, &entry->key, HASH_REMOVE, NULL);
+	}
+
+	LWLockRelease(remote_estimates_lock);
+}
+
+
+/*
+ * Batches are useless without the cache, since the planner reads the
+ * results of a batch from it.
+ */
+bool
+remote_estimate_batch_enabled(void)
+{
+	return gogudb_remote_estimate_ttl > 0 && remote_estimates != NULL;
+}
+
+/*
+ * Start collecting the EXPLAINs requested by remote_estimate_lookup().
+ */
+void
+remote_estimate_begin_batch(void)
+{
+	Assert(!batch_collecting);
+
+	batch_collecting = true;
+	batch_pending = NIL;
+}
+
+/*
+ * Stop collecting and, if 'run' is true, run all collected EXPLAINs: the
+ * ones sharing a user mapping are sent as a single multi-statement query,
+ * and all servers are queried concurrently.  Each query runs under a
+ * savepoint, which is rolled back if an EXPLAIN fails, so that the remote
+ * transaction remains usable.  Failed EXPLAINs (and the ones following
+ * them) are simply not cached, the planner will run (and report) them
+ * again.
+ */
+void
+remote_estimate_end_batch(bool run)
+{
+	List	   *users = NIL,		/* one UserMapping per group */
+			   *groups = NIL;		/* list of PendingEstimates per group */
+	PGconn	  **conns;
+	char	  **queries;
+	ListCell   *lc,
+			   *lc2;
+	int			ngroups,
+				i;
+
+	batch_collecting = false;
+
+	if (!run || batch_pending == NIL)
+	{
+		batch_pending = NIL;
+		return;
+	}
+
+	/* Group EXPLAINs by user mapping */
+	foreach(lc, batch_pending)
+	{
+		PendingEstimate	   *pending = (PendingEstimate *) lfirst(lc);
+		ListCell		   *group = NULL;
+
+		forboth(lc2, users, group, groups)
+		{
+			if (((UserMapping *) lfirst(lc2))->umid == pending->user->umid)
+				break;
+		}
+
+		if (lc2)
+			lfirst(group) = lappend((List *) lfirst(group), pending);
+		else
+		{
+			users = lappend(users, pending->user);
+			groups = lappend(groups, list_make1(pending));
+		}
+	}
+	batch_pending = NIL;
+
+	ngroups = list_length(users);
+	conns = (PGconn **) palloc0(sizeof(PGconn *) * ngroups);
+	queries = (char **) palloc0(sizeof(char *) * ngroups);
+
+	/* Send everything */
+	i = 0;
+	forboth(lc, users, lc2, groups)
+	{
+		UserMapping	   *user = (UserMapping *) lfirst(lc);
+		StringInfoData	sql;
+		ListCell	   *cell;
+
+		initStringInfo(&sql);
+		appendStringInfoString(&sql, "SAVEPOINT " ESTIMATE_SAVEPOINT ";\n");
+		foreach(cell, (List *) lfirst(lc2))
+		{
+			appendStringInfoString(&sql, ((PendingEstimate *) lfirst(cell))->sql);
+			appendStringInfoString(&sql, ";\n");
+		}
+		appendStringInfoString(&sql, "RELEASE SAVEPOINT " ESTIMATE_SAVEPOINT);
+
+		queries[i] = sql.data;
+		/* In the remote transaction, which may have created the tables */
+		conns[i] = GoguGetConnection(user, false, true);
+		if (!PQsendQuery(conns[i], queries[i]))
+			Gogu_pgfdw_report_error(ERROR, NULL, conns[i], false, queries[i]);
+		i++;
+	}
+
+	/* Collect and cache the results */
+	i = 0;
+	forboth(lc, users, lc2, groups)
+	{
+		List		   *group = (List *) lfirst(lc2);
+		int				nresults = list_length(group) + 2,
+						j = 1;
+		PGresult	  **results = palloc(sizeof(PGresult *) * nresults);
+		ListCell	   *cell;
+
+		Gogu_pgfdw_get_results(conns[i], queries[i], results, nresults);
+
+		/* Statements after a failed one are skipped, RELEASE included */
+		if (results[nresults - 1] == NULL ||
+			PQresultStatus(results[nresults - 1]) != PGRES_COMMAND_OK)
+		{
+			PG_TRY();
+			{
+				GoguRunCommand(conns[i], "ROLLBACK TO SAVEPOINT " ESTIMATE_SAVEPOINT "; "
+										 "RELEASE SAVEPOINT " ESTIMATE_SAVEPOINT);
+			}
+			PG_CATCH();
+			{
+				for (j = 0; j < nresults; j++)
+					PQclear(results[j]);
+				PG_RE_THROW();
+			}
+			PG_END_TRY();
+		}
+		GoguReleaseConnection(conns[i]);
+
+		PQclear(results[0]);
+		PQclear(results[nresults - 1]);
+
+		foreach(cell, group)
+		{
+			PendingEstimate	   *pending = (PendingEstimate *) lfirst(cell);
+			RemoteEstimate		estimate;
+
+			if (results[j] && parse_remote_estimate(results[j], &estimate))
+				remote_estimate_store(pending->user, pending->sql,
+									  pending->relids, &estimate);
+
+			PQclear(results[j]);
+			j++;
+		}
+
+		pfree(results);
+		i++;
+	}
+
+	pfree(conns);
+	pfree(queries);
+}
+
+/*
+ * Extract cost numbers for topmost plan node, see get_remote_estimate().
+ */
+static bool
+parse_remote_estimate(PGresult *res, RemoteEstimate *estimate)
+{
+	char	   *line;
+	char	   *p;
+
+	if (PQresultStatus(res) != PGRES_TUPLES_OK || PQntuples(res) < 1)
+		return false;
+
+	line = PQgetvalue(res, 0, 0);
+	p = strrchr(line, '(');
+	if (p == NULL)
+		return false;
+
+	return sscanf(p, "(cost=%lf..%lf rows=%lf width=%d)",
+				  &estimate->startup_cost, &estimate->total_cost,
+				  &estimate->rows, &estimate->width) == 4;
+}
@@ -0,0 +1,382 @@
+/*-------------------------------------------------------------------------
+ *
+ * remote_instr.c
+ *		EXPLAIN ANALYZE instrumentation of remote scans
+ *
+ *		Under EXPLAIN ANALYZE, every postgres_fdw scan records the time it
+ *		took to get its connection, the time till the first row and the
+ *		total time spent waiting for the server, together with the number
+ *		of round trips, rows and bytes received.  Each scan shows its own
+ *		numbers, and Append nodes of pg_pathman sum them up per server.
+ *
+ *		Rows, bytes and round trips are counted by every scan, to be added
+ *		to gogudb_stat_remote when the scan ends.  Statements of cursor
+ *		scans go through the connection layer, which counts them itself.
+ *
+ *		The query of a scan is logged by gogudb.log_remote_min_duration
+ *		when the scan ends, with the total time it has waited for its
+ *		server, rather than each FETCH of its cursor.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "remote_instr.h"
+#include "remote_log.h"
+#include "stat_remote.h"
+#include "compat/pg_compat.h"
+
+#include "foreign/foreign.h"
+#include "nodes/nodeFuncs.h"
+
+
+/* Rows of a result whose size is measured, the rest is extrapolated */
+#define RESULT_BYTES_SAMPLE_ROWS	32
+
+
+/*
+ * Numbers of all scans on one server.
+ */
+typedef struct
+{
+	Oid				serverid;
+	int				nscans;
+	GoguScanInstr	sum;
+} ServerInstr;
+
+
+static bool collect_server_instr(PlanState *planstate, List **servers);
+static void explain_instr_numbers(GoguScanInstr *instr, ExplainState *es);
+
+
+/*
+ * Start the instrumentation of a scan (called by BeginForeignScan).
+ */
+void
+remote_instr_begin(GoguScanInstr *instr, PlanState *ps, Oid serverid)
+{
+	memset(instr, 0, sizeof(GoguScanInstr));
+
+	/* ps->instrument is not set up yet, so ask the executor */
+	instr->enabled = (ps->state->es_instrument != 0);
+	instr->timed = instr->enabled || gogudb_log_remote_min_duration >= 0;
+	instr->serverid = serverid;
+	instr->first_row_time = -1;
+
+	if (instr->enabled)
+		INSTR_TIME_SET_CURRENT(instr->started);
+}
+
+/*
+ * We have got the connection.
+ */
+void
+remote_instr_connected(GoguScanInstr *instr, bool cursor)
+{
+	instr_time	now;
+
+	instr->cursor = cursor;
+
+	if (!instr->enabled)
+		return;
+
+	INSTR_TIME_SET_CURRENT(now);
+	INSTR_TIME_SUBTRACT(now, instr->started);
+	instr->connect_time += INSTR_TIME_GET_MILLISEC(now);
+}
+
+/*
+ * The query of the scan has been sent to the server, in whatever form
+ * (cursor, COPY).  It must live until the scan ends.
+ */
+void
+remote_instr_statement(GoguScanInstr *instr, const char *query)
+{
+	instr->query = query;
+}
+
+/*
+ * A statement has been sent to the server.
+ */
+void
+remote_instr_sent(GoguScanInstr *instr, const char *sql)
+{
+	instr->round_trips++;
+	instr->bytes_out += strlen(sql);
+
+	/* Latency of single-row scans is measured here */
+	if (instr->timed || !instr->cursor)
+	{
+		INSTR_TIME_SET_CURRENT(instr->wait_start);
+		instr->awaiting = true;
+	}
+}
+
+/*
+ * A result has come from the server (since remote_instr_sent() or
+ * remote_instr_wait()).
+ */
+void
+remote_instr_received(GoguScanInstr *instr, PGresult *res)
+{
+	int64		nrows = 0,
+				nbytes = 0;
+
+	if (res)
+	{
+		nrows = PQntuples(res);
+		nbytes = remote_result_bytes(res);
+	}
+
+	remote_instr_received_rows(instr, nrows, nbytes);
+}
+
+/*
+ * Size of the data of 'res'.  Large results are measured on evenly spaced
+ * rows only, so that a FETCH of many wide rows is not walked once more.
+ */
+int64
+remote_result_bytes(PGresult *res)
+{
+	int		nrows = PQntuples(res),
+			nfields = PQnfields(res),
+			step = 1,
+			nsampled = 0,
+			i,
+			j;
+	int64	nbytes = 0;
+
+	if (nrows > RESULT_BYTES_SAMPLE_ROWS)
+		step = nrows / RESULT_BYTES_SAMPLE_ROWS;
+
+	for (i = 0; i < nrows; i += step)
+	{
+		for (j = 0; j < nfields; j++)
+			nbytes += PQgetlength(res, i, j);
+		nsampled++;
+	}
+
+	if (nsampled < nrows)
+		nbytes = (int64) ((double) nbytes * nrows / nsampled);
+
+	return nbytes;
+}
+
+/*
+ * Same as remote_instr_received(), for rows which haven't come in a
+ * PGresult (COPY scans).
+ */
+void
+remote_instr_received_rows(GoguScanInstr *instr, int64 nrows, int64 nbytes)
+{
+	instr_time	now,
+				elapsed;
+
+	instr->rows += nrows;
+	instr->bytes += nbytes;
+
+	if (!instr->timed && !instr->awaiting)
+		return;
+
+	INSTR_TIME_SET_CURRENT(now);
+	elapsed = now;
+	INSTR_TIME_SUBTRACT(elapsed, instr->wait_start);
+
+	if (instr->awaiting && !instr->cursor)
+		stat_remote_latency(stat_remote_entry(instr->serverid),
+							INSTR_TIME_GET_MILLISEC(elapsed));
+	instr->awaiting = false;
+
+	if (!instr->timed)
+		return;
+
+	instr->remote_time += INSTR_TIME_GET_MILLISEC(elapsed);
+
+	if (instr->enabled && nrows > 0 && instr->first_row_time < 0)
+	{
+		INSTR_TIME_SUBTRACT(now, instr->started);
+		instr->first_row_time = INSTR_TIME_GET_MILLISEC(now);
+	}
+}
+
+/*
+ * The scan is over, add its numbers to gogudb_stat_remote and log its
+ * query if it has waited long enough.
+ */
+void
+remote_instr_end(GoguScanInstr *instr)
+{
+	StatRemoteEntry *entry = stat_remote_entry(instr->serverid);
+
+	if (instr->query)
+		remote_log_statement(instr->serverid, instr->query, instr->rows,
+							 instr->remote_time);
+
+	if (instr->cursor)
+	{
+		stat_remote_count(entry, STAT_REMOTE_CURSOR_SCANS, 1);
+		return;
+	}
+
+	stat_remote_count(entry, STAT_REMOTE_SINGLE_ROW_SCANS, 1);
+	stat_remote_count(entry, STAT_REMOTE_QUERIES, instr->round_trips);
+	stat_remote_count(entry, STAT_REMOTE_ROWS, instr->rows);
+	stat_remote_count(entry, STAT_REMOTE_BYTES_IN, instr->bytes);
+	stat_remote_count(entry, STAT_REMOTE_BYTES_OUT, instr->bytes_out);
+}
+
+
+/*
+ * Show the numbers of a single scan.
+ */
+void
+remote_instr_explain(GoguScanInstr *instr, ExplainState *es)
+{
+	if (!es->analyze || !instr->enabled)
+		return;
+
+	if (es->format == EXPLAIN_FORMAT_TEXT)
+	{
+		appendStringInfoSpaces(es->str, es->indent * 2);
+		appendStringInfoString(es->str, "Remote:");
+		explain_instr_numbers(instr, es);
+		appendStringInfoChar(es->str, '\n');
+	}
+	else
+	{
+		ExplainPropertyText("Remote Server",
+							GetForeignServer(instr->serverid)->servername, es);
+		explain_instr_numbers(instr, es);
+	}
+}
+
+/*
+ * Sum up the numbers of all postgres_fdw scans below 'planstates' per
+ * server, and show them.
+ */
+void
+remote_instr_explain_servers(List *planstates, ExplainState *es)
+{
+	List	   *servers = NIL;
+	ListCell   *lc;
+
+	if (!es->analyze)
+		return;
+
+	foreach(lc, planstates)
+		collect_server_instr((PlanState *) lfirst(lc), &servers);
+
+	if (servers == NIL)
+		return;
+
+	ExplainOpenGroup("Remote Servers", "Remote Servers", false, es);
+
+	foreach(lc, servers)
+	{
+		ServerInstr	   *server = (ServerInstr *) lfirst(lc);
+		char		   *servername = GetForeignServer(server->serverid)->servername;
+
+		if (es->format == EXPLAIN_FORMAT_TEXT)
+		{
+			appendStringInfoSpaces(es->str, es->indent * 2);
+			appendStringInfo(es->str, "Remote Server %s: scans=%d",
+							 servername, server->nscans);
+			explain_instr_numbers(&server->sum, es);
+			appendStringInfoChar(es->str, '\n');
+		}
+		else
+		{
+			ExplainOpenGroup("Remote Server", NULL, true, es);
+			ExplainPropertyText("Server Name", servername, es);
+			ExplainPropertyInt64Compat("Scans", NULL, server->nscans, es);
+			explain_instr_numbers(&server->sum, es);
+			ExplainCloseGroup("Remote Server", NULL, true, es);
+		}
+	}
+
+	ExplainCloseGroup("Remote Servers", "Remote Servers", false, es);
+}
+
+static bool
+collect_server_instr(PlanState *planstate, List **servers)
+{
+	if (planstate == NULL)
+		return false;
+
+	if (IsA(planstate, ForeignScanState))
+	{
+		GoguScanInstr  *instr = GoguGetScanInstr((ForeignScanState *) planstate);
+		ServerInstr	   *server = NULL;
+		ListCell	   *lc;
+
+		if (instr == NULL || !instr->enabled)
+			return false;
+
+		foreach(lc, *servers)
+		{
+			if (((ServerInstr *) lfirst(lc))->serverid == instr->serverid)
+			{
+				server = (ServerInstr *) lfirst(lc);
+				break;
+			}
+		}
+
+		if (server == NULL)
+		{
+			server = (ServerInstr *) palloc0(sizeof(ServerInstr));
+			server->serverid = instr->serverid;
+			server->sum.first_row_time = -1;
+			*servers = lappend(*servers, server);
+		}
+
+		server->nscans++;
+		server->sum.connect_time += instr->connect_time;
+		server->sum.remote_time += instr->remote_time;
+		server->sum.round_trips += instr->round_trips;
+		server->sum.bytes += instr->bytes;
+		server->sum.rows += instr->rows;
+
+		/* The earliest first row of the server */
+		if (instr->first_row_time >= 0 &&
+			(server->sum.first_row_time < 0 ||
+			 instr->first_row_time < server->sum.first_row_time))
+			server->sum.first_row_time = instr->first_row_time;
+
+		return false;
+	}
+
+	return planstate_tree_walker(planstate, collect_server_instr,
+								 (void *) servers);
+}
+
+/*
+ * Append the numbers to the current line (text format), or add them as
+ * properties.
+ */
+static void
+explain_instr_numbers(GoguScanInstr *instr, ExplainState *es)
+{
+	if (es->format == EXPLAIN_FORMAT_TEXT)
+	{
+		appendStringInfo(es->str, " connect=%.3f", instr->connect_time);
+		if (instr->first_row_time >= 0)
+			appendStringInfo(es->str, " first row=%.3f", instr->first_row_time);
+		appendStringInfo(es->str,
+						 " total=%.3f round trips=" INT64_FORMAT
+						 " rows=" INT64_FORMAT " bytes=" INT64_FORMAT,
+						 instr->remote_time, instr->round_trips,
+						 instr->rows, instr->bytes);
+	}
+	else
+	{
+		ExplainPropertyFloatCompat("Connect Time", "ms",
+								   instr->connect_time, 3, es);
+		if (instr->first_row_time >= 0)
+			ExplainPropertyFloatCompat("First Row Time", "ms",
+									   instr->first_row_time, 3, es);
+		ExplainPropertyFloatCompat("Remote Time", "ms",
+								   instr->remote_time, 3, es);
+		ExplainPropertyInt64Compat("Round Trips", NULL, instr->round_trips, es);
+		ExplainPropertyInt64Compat("Rows Received", NULL, instr->rows, es);
+		ExplainPropertyInt64Compat("Bytes Received", NULL, instr->bytes, es);
+	}
+}
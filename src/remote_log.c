@@ -0,0 +1,117 @@
+/*-------------------------------------------------------------------------
+ *
+ * remote_log.c
+ *		Logging of slow remote statements
+ *
+ *		Remote statements which have waited for their server longer than
+ *		gogudb.log_remote_min_duration are logged by the coordinator,
+ *		together with the server, the number of rows and an id of the
+ *		coordinator query which has issued them.  The id consists of the
+ *		backend pid and the number of the portal started by the backend,
+ *		so all statements of one query share it; the query id computed by
+ *		pg_stat_statements is added if there is one.
+ *
+ *		With gogudb.log_remote_sample_rate below 1, only that fraction of
+ *		slow statements is logged.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "remote_log.h"
+
+#include "foreign/foreign.h"
+#include "miscadmin.h"
+#include "nodes/plannodes.h"
+#include "utils/guc.h"
+
+
+/* Min wait (ms) of a logged remote statement, -1 disables logging */
+int		gogudb_log_remote_min_duration = -1;
+
+/* Fraction of slow remote statements to be logged */
+double	gogudb_log_remote_sample_rate = 1.0;
+
+/* Coordinator query being run by this backend */
+static uint64	coordinator_query_number = 0;
+static uint64	coordinator_query_id = 0;
+
+
+/*
+ * Define GUC variables of slow statement logging.
+ */
+void
+init_remote_log_static_data(void)
+{
+	DefineCustomIntVariable("gogudb.log_remote_min_duration",
+							"Sets the minimum wait of a remote statement above "
+							"which the statement will be logged.",
+							"Zero logs all remote statements. -1 turns this feature off.",
+							&gogudb_log_remote_min_duration,
+							-1,
+							-1, INT_MAX,
+							PGC_SUSET,
+							GUC_UNIT_MS,
+							NULL,
+							NULL,
+							NULL);
+
+	DefineCustomRealVariable("gogudb.log_remote_sample_rate",
+							 "Fraction of slow remote statements to log.",
+							 "Use a value between 0.0 (never log) and 1.0 (always log).",
+							 &gogudb_log_remote_sample_rate,
+							 1.0,
+							 0.0, 1.0,
+							 PGC_SUSET,
+							 0,
+							 NULL,
+							 NULL,
+							 NULL);
+}
+
+/*
+ * A new coordinator query is about to run (called by PortalStart).
+ */
+void
+remote_log_start_query(Portal portal)
+{
+	Node   *stmt;
+
+	coordinator_query_number++;
+	coordinator_query_id = 0;
+
+	if (portal->stmts == NIL)
+		return;
+
+	stmt = (Node *) linitial(portal->stmts);
+	if (IsA(stmt, PlannedStmt))
+		coordinator_query_id = ((PlannedStmt *) stmt)->queryId;
+}
+
+/*
+ * Log a remote statement if it has waited long enough for 'serverid'.
+ */
+void
+remote_log_statement(Oid serverid, const char *sql,
+					 uint64 rows, double wait_ms)
+{
+	if (gogudb_log_remote_min_duration < 0 ||
+		wait_ms < gogudb_log_remote_min_duration)
+		return;
+
+	if (gogudb_log_remote_sample_rate < 1.0 &&
+		random() > gogudb_log_remote_sample_rate * MAX_RANDOM_VALUE)
+		return;
+
+	ereport(LOG,
+			(errmsg("remote duration: %.3f ms  server: %s  rows: " UINT64_FORMAT
+					"  statement: %s",
+					wait_ms, GetForeignServer(serverid)->servername, rows,
+					sql ? sql : "<unknown>"),
+			 coordinator_query_id != 0 ?
+				errdetail_internal("Coordinator query %d/" UINT64_FORMAT
+								   ", query id " UINT64_FORMAT ".",
+								   MyProcPid, coordinator_query_number,
+								   coordinator_query_id) :
+				errdetail_internal("Coordinator query %d/" UINT64_FORMAT ".",
+								   MyProcPid, coordinator_query_number)));
+}
@@ -0,0 +1,824 @@
+/*-------------------------------------------------------------------------
+ *
+ * remote_stats.c
+ *		Import of shard statistics into local foreign partitions
+ *
+ *		RemoteStatsWorker reads pg_class.reltuples/relpages and pg_stats of
+ *		the remote tables behind foreign partitions and installs them as
+ *		the statistics of the foreign tables, so that the planner gets
+ *		accurate estimates without use_remote_estimate and without
+ *		sampling rows through the coordinator.  All servers are queried
+ *		concurrently, one query per user mapping.
+ *
+ *		Only MCV lists, histograms and correlation are imported, since
+ *		their values have the type of the column; other statistic kinds
+ *		are left out.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "init.h"
+#include "pathman_workers.h"
+#include "relation_info.h"
+#include "remote_stats.h"
+#include "utils.h"
+#include "connection_pool.h"
+
+#include "access/heapam.h"
+#include "access/htup_details.h"
+#include "access/xact.h"
+#include "catalog/indexing.h"
+#include "catalog/pg_foreign_table.h"
+#include "catalog/pg_inherits.h"
+#if PG_VERSION_NUM < 110000
+#include "catalog/pg_inherits_fn.h"
+#endif
+#include "catalog/pg_statistic.h"
+#include "catalog/pg_type.h"
+#include "commands/defrem.h"
+#include "commands/vacuum.h"
+#include "foreign/foreign.h"
+#include "funcapi.h"
+#include "miscadmin.h"
+#include "parser/parse_oper.h"
+#include "pgstat.h"
+#include "postmaster/bgworker.h"
+#include "storage/ipc.h"
+#include "storage/latch.h"
+#include "storage/lmgr.h"
+#include "storage/shmem.h"
+#include "utils/array.h"
+#include "utils/builtins.h"
+#include "utils/fmgroids.h"
+#include "utils/lsyscache.h"
+#include "utils/memutils.h"
+#include "utils/rel.h"
+#include "utils/resowner.h"
+#include "utils/syscache.h"
+
+
+/* Declarations for RemoteStatsWorker */
+PG_FUNCTION_INFO_V1( import_remote_stats );
+PG_FUNCTION_INFO_V1( stop_remote_stats_import );
+PG_FUNCTION_INFO_V1( show_remote_stats_imports_internal );
+
+
+/*
+ * Dynamically resolve functions (for BGW API).
+ */
+extern PGDLLEXPORT void bgw_main_import_remote_stats(Datum main_arg);
+
+
+/*
+ * Foreign partition whose statistics are imported.
+ */
+typedef struct
+{
+	Oid			relid;
+	char	   *remote_name;	/* qualified remote table name */
+} RemoteStatsTarget;
+
+/* Columns of the query built by build_remote_stats_query() */
+enum
+{
+	RS_ORD = 0,
+	RS_RELTUPLES,
+	RS_RELPAGES,
+	RS_ATTNAME,
+	RS_NULL_FRAC,
+	RS_AVG_WIDTH,
+	RS_N_DISTINCT,
+	RS_MCV,
+	RS_MCF,
+	RS_HISTOGRAM,
+	RS_CORRELATION
+};
+
+
+/*
+ * Function context for show_remote_stats_imports_internal() SRF.
+ */
+typedef struct
+{
+	int cur_idx; /* current slot to be processed */
+} active_imports_cxt;
+
+
+/*
+ * Slots for statistics import.
+ */
+static RemoteStatsSlot	   *remote_stats_slots;
+
+static const char		   *remote_stats_bgw = "RemoteStatsWorker";
+
+
+static int64 import_remote_stats_round(Oid parent_relid);
+static void install_remote_stats(RemoteStatsTarget *target,
+								 PGresult *res, int first_row, int last_row);
+
+
+/*
+ * Estimate amount of shmem needed for statistics import.
+ */
+Size
+estimate_remote_stats_slots_size(void)
+{
+	/* NOTE: we suggest that max_worker_processes is in PGC_POSTMASTER */
+	return sizeof(RemoteStatsSlot) * REMOTE_STATS_SLOTS;
+}
+
+/*
+ * Initialize shared memory needed for statistics import.
+ */
+void
+init_remote_stats_slots(void)
+{
+	bool	found;
+	Size	size = estimate_remote_stats_slots_size();
+
+	remote_stats_slots = (RemoteStatsSlot *)
+			ShmemInitStruct("array of RemoteStatsSlots", size, &found);
+
+	/* Initialize 'remote_stats_slots' if needed */
+	if (!found)
+		init_worker_slots(&remote_stats_slots->head, sizeof(RemoteStatsSlot),
+						  REMOTE_STATS_SLOTS);
+}
+
+
+/*
+ * ------------------------------------
+ *  RemoteStatsWorker implementation
+ * ------------------------------------
+ */
+
+/*
+ * Entry point for RemoteStatsWorker's process.
+ */
+void
+bgw_main_import_remote_stats(Datum main_arg)
+{
+	RemoteStatsSlot	   *stats_slot;
+
+	/* Update statistics import slot */
+	stats_slot = &remote_stats_slots[DatumGetInt32(main_arg)];
+	attach_worker_slot(&stats_slot->head, remote_stats_bgw);
+
+	for (;;)
+	{
+		volatile int64	imported = 0;
+		volatile bool	failed = false;
+
+		ws_set_status(&stats_slot->head, WS_WORKING);
+
+		PG_TRY();
+		{
+			StartTransactionCommand();
+			bg_worker_load_config(remote_stats_bgw);
+			imported = import_remote_stats_round(stats_slot->head.relid);
+			CommitTransactionCommand();
+		}
+		PG_CATCH();
+		{
+			/* One-shot import simply fails */
+			if (stats_slot->period == 0)
+				PG_RE_THROW();
+
+			/* Periodic import reports the error and tries again later */
+			HOLD_INTERRUPTS();
+			EmitErrorReport();
+			FlushErrorState();
+			AbortCurrentTransaction();
+			RESUME_INTERRUPTS();
+
+			failed = true;
+		}
+		PG_END_TRY();
+
+		if (!failed)
+		{
+			SpinLockAcquire(&stats_slot->head.mutex);
+			stats_slot->imported = imported;
+			stats_slot->last_import = GetCurrentTimestamp();
+			SpinLockRelease(&stats_slot->head.mutex);
+
+			elog(LOG, "%s: imported statistics of " INT64_FORMAT " partitions",
+				 remote_stats_bgw, imported);
+		}
+
+		if (stats_slot->period == 0 ||
+			!sleep_worker_slot(&stats_slot->head, stats_slot->period))
+			break;
+	}
+}
+
+/*
+ * Add foreign partition 'relid' to its user mapping's group.
+ */
+static void
+add_remote_stats_target(Oid relid, List **users, List **groups)
+{
+	ForeignTable	   *ftable = GetForeignTable(relid);
+	UserMapping		   *user;
+	RemoteStatsTarget  *target;
+	const char		   *nspname,
+					   *relname;
+	ListCell		   *lc,
+					   *lc2;
+
+	GoguGetRemoteTableName(relid, &nspname, &relname);
+
+	target = (RemoteStatsTarget *) palloc(sizeof(RemoteStatsTarget));
+	target->relid = relid;
+	target->remote_name = quote_qualified_identifier(nspname, relname);
+
+	user = GetUserMapping(get_rel_owner(relid), ftable->serverid);
+
+	forboth(lc, *users, lc2, *groups)
+	{
+		if (((UserMapping *) lfirst(lc))->umid == user->umid)
+		{
+			lfirst(lc2) = lappend((List *) lfirst(lc2), target);
+			return;
+		}
+	}
+
+	*users = lappend(*users, user);
+	*groups = lappend(*groups, list_make1(target));
+}
+
+/*
+ * Build a query returning relation size and pg_stats of every target.
+ * Each row is tagged with the (1-based) position of its target.
+ */
+static char *
+build_remote_stats_query(List *targets)
+{
+	StringInfoData	sql;
+	ListCell	   *lc;
+	bool			first = true;
+
+	initStringInfo(&sql);
+	appendStringInfoString(&sql,
+						   "SELECT t.ord, c.reltuples, c.relpages, s.attname, "
+						   "s.null_frac, s.avg_width, s.n_distinct, "
+						   "s.most_common_vals::text, s.most_common_freqs::text, "
+						   "s.histogram_bounds::text, s.correlation "
+						   "FROM pg_catalog.unnest(ARRAY[");
+
+	foreach(lc, targets)
+	{
+		RemoteStatsTarget *target = (RemoteStatsTarget *) lfirst(lc);
+
+		if (!first)
+			appendStringInfoString(&sql, ", ");
+		first = false;
+
+		appendStringInfoString(&sql, quote_literal_cstr(target->remote_name));
+	}
+
+	appendStringInfoString(&sql,
+						   "]::text[]) WITH ORDINALITY AS t(name, ord) "
+						   "JOIN pg_catalog.pg_class c "
+						   "ON c.oid = pg_catalog.to_regclass(t.name) "
+						   "JOIN pg_catalog.pg_namespace n ON n.oid = c.relnamespace "
+						   "LEFT JOIN pg_catalog.pg_stats s "
+						   "ON s.schemaname = n.nspname AND s.tablename = c.relname "
+						   "AND NOT s.inherited "
+						   "ORDER BY t.ord");
+
+	return sql.data;
+}
+
+/*
+ * Import statistics of all foreign partitions of 'parent_relid' (or of
+ * every partitioned table), return the number of updated partitions.
+ * Must be called in a transaction.
+ */
+static int64
+import_remote_stats_round(Oid parent_relid)
+{
+	List		   *children = NIL,
+				   *users = NIL,
+				   *groups = NIL;
+	UserMapping	  **user_array;
+	const char	  **queries;
+	PGresult	  **volatile results = NULL;
+	ListCell	   *lc,
+				   *lc2;
+	int				ngroups,
+					i;
+	int64			imported = 0;
+
+	/* Collect foreign partitions */
+	if (OidIsValid(parent_relid))
+		children = find_inheritance_children(parent_relid, AccessShareLock);
+	else
+	{
+		Relation		ftrel;
+		HeapScanDesc	scan;
+		HeapTuple		htup;
+
+		ftrel = heap_open(ForeignTableRelationId, AccessShareLock);
+		scan = heap_beginscan_catalog(ftrel, 0, NULL);
+
+		while ((htup = heap_getnext(scan, ForwardScanDirection)) != NULL)
+		{
+			Oid relid = ((Form_pg_foreign_table) GETSTRUCT(htup))->ftrelid;
+
+			/* Only partitions of gogudb's tables */
+			if (OidIsValid(get_parent_of_partition(relid, NULL)))
+				children = lappend_oid(children, relid);
+		}
+
+		heap_endscan(scan);
+		heap_close(ftrel, AccessShareLock);
+	}
+
+	foreach(lc, children)
+	{
+		Oid relid = lfirst_oid(lc);
+
+		if (get_rel_relkind(relid) == RELKIND_FOREIGN_TABLE)
+			add_remote_stats_target(relid, &users, &groups);
+	}
+
+	ngroups = list_length(users);
+	if (ngroups == 0)
+		return 0;
+
+	user_array = (UserMapping **) palloc(sizeof(UserMapping *) * ngroups);
+	queries = (const char **) palloc(sizeof(char *) * ngroups);
+
+	i = 0;
+	forboth(lc, users, lc2, groups)
+	{
+		user_array[i] = (UserMapping *) lfirst(lc);
+		queries[i] = build_remote_stats_query((List *) lfirst(lc2));
+		i++;
+	}
+
+	/* In what follows, do not leak any PGresults */
+	PG_TRY();
+	{
+		/* Query all servers at once */
+		results = GoguExecParallel(user_array, queries, ngroups, NULL, false);
+
+		i = 0;
+		foreach(lc, groups)
+		{
+			List	   *targets = (List *) lfirst(lc);
+			PGresult   *res = results[i];
+			int			nrows,
+						row = 0;
+
+			if (res == NULL || PQresultStatus(res) != PGRES_TUPLES_OK)
+			{
+				ereport(WARNING,
+						(errmsg("%s: could not fetch statistics from server \"%s\"",
+								remote_stats_bgw,
+								GetForeignServer(user_array[i]->serverid)->servername),
+						 errdetail_internal("%s",
+											res ? PQresultErrorMessage(res) : "")));
+				i++;
+				continue;
+			}
+
+			/* Rows are ordered by target, install them table by table */
+			nrows = PQntuples(res);
+			while (row < nrows)
+			{
+				int		ord = atoi(PQgetvalue(res, row, RS_ORD)),
+						last = row;
+
+				while (last + 1 < nrows &&
+					   atoi(PQgetvalue(res, last + 1, RS_ORD)) == ord)
+					last++;
+
+				install_remote_stats((RemoteStatsTarget *) list_nth(targets, ord - 1),
+									 res, row, last);
+				imported++;
+
+				row = last + 1;
+			}
+
+			i++;
+		}
+	}
+	PG_CATCH();
+	{
+		if (results)
+			for (i = 0; i < ngroups; i++)
+				PQclear(results[i]);
+		PG_RE_THROW();
+	}
+	PG_END_TRY();
+
+	for (i = 0; i < ngroups; i++)
+		PQclear(results[i]);
+
+	return imported;
+}
+
+/* Parse array text produced by the remote server */
+static Datum
+remote_array_in(const char *str, Oid elemtype, int32 typmod)
+{
+	Oid		arraytype = get_array_type(elemtype),
+			typinput,
+			typioparam;
+
+	if (!OidIsValid(arraytype))
+		elog(ERROR, "no array type for type %u", elemtype);
+
+	getTypeInputInfo(arraytype, &typinput, &typioparam);
+
+	return OidInputFunctionCall(typinput, (char *) str, typioparam, typmod);
+}
+
+/*
+ * Store pg_stats row 'row' of 'res' as the statistics of column 'attnum'.
+ */
+static void
+store_remote_attstats(Relation rel, Form_pg_attribute attr,
+					  PGresult *res, int row)
+{
+	Relation	sd;
+	HeapTuple	stup,
+				oldtup;
+	Datum		values[Natts_pg_statistic];
+	bool		nulls[Natts_pg_statistic];
+	bool		replaces[Natts_pg_statistic];
+	Oid			ltopr,
+				eqopr;
+	int			slot = 0,
+				i;
+
+	get_sort_group_operators(attr->atttypid, false, false, false,
+							 &ltopr, &eqopr, NULL, NULL);
+
+	for (i = 0; i < Natts_pg_statistic; i++)
+	{
+		nulls[i] = false;
+		replaces[i] = true;
+	}
+
+	values[Anum_pg_statistic_starelid - 1] = ObjectIdGetDatum(RelationGetRelid(rel));
+	values[Anum_pg_statistic_staattnum - 1] = Int16GetDatum(attr->attnum);
+	values[Anum_pg_statistic_stainherit - 1] = BoolGetDatum(false);
+	values[Anum_pg_statistic_stanullfrac - 1] =
+		Float4GetDatum(strtod(PQgetvalue(res, row, RS_NULL_FRAC), NULL));
+	values[Anum_pg_statistic_stawidth - 1] =
+		Int32GetDatum(atoi(PQgetvalue(res, row, RS_AVG_WIDTH)));
+	values[Anum_pg_statistic_stadistinct - 1] =
+		Float4GetDatum(strtod(PQgetvalue(res, row, RS_N_DISTINCT), NULL));
+
+	for (i = 0; i < STATISTIC_NUM_SLOTS; i++)
+	{
+		values[Anum_pg_statistic_stakind1 - 1 + i] = Int16GetDatum(0);
+		values[Anum_pg_statistic_staop1 - 1 + i] = ObjectIdGetDatum(InvalidOid);
+		values[Anum_pg_statistic_stanumbers1 - 1 + i] = (Datum) 0;
+		nulls[Anum_pg_statistic_stanumbers1 - 1 + i] = true;
+		values[Anum_pg_statistic_stavalues1 - 1 + i] = (Datum) 0;
+		nulls[Anum_pg_statistic_stavalues1 - 1 + i] = true;
+	}
+
+	/* Most common values and their frequencies */
+	if (OidIsValid(eqopr) &&
+		!PQgetisnull(res, row, RS_MCV) && !PQgetisnull(res, row, RS_MCF))
+	{
+		values[Anum_pg_statistic_stakind1 - 1 + slot] =
+			Int16GetDatum(STATISTIC_KIND_MCV);
+		values[Anum_pg_statistic_staop1 - 1 + slot] = ObjectIdGetDatum(eqopr);
+		values[Anum_pg_statistic_stanumbers1 - 1 + slot] =
+			remote_array_in(PQgetvalue(res, row, RS_MCF), FLOAT4OID, -1);
+		nulls[Anum_pg_statistic_stanumbers1 - 1 + slot] = false;
+		values[Anum_pg_statistic_stavalues1 - 1 + slot] =
+			remote_array_in(PQgetvalue(res, row, RS_MCV),
+							attr->atttypid, attr->atttypmod);
+		nulls[Anum_pg_statistic_stavalues1 - 1 + slot] = false;
+		slot++;
+	}
+
+	/* Histogram bounds */
+	if (OidIsValid(ltopr) && !PQgetisnull(res, row, RS_HISTOGRAM))
+	{
+		values[Anum_pg_statistic_stakind1 - 1 + slot] =
+			Int16GetDatum(STATISTIC_KIND_HISTOGRAM);
+		values[Anum_pg_statistic_staop1 - 1 + slot] = ObjectIdGetDatum(ltopr);
+		values[Anum_pg_statistic_stavalues1 - 1 + slot] =
+			remote_array_in(PQgetvalue(res, row, RS_HISTOGRAM),
+							attr->atttypid, attr->atttypmod);
+		nulls[Anum_pg_statistic_stavalues1 - 1 + slot] = false;
+		slot++;
+	}
+
+	/* Physical order correlation */
+	if (OidIsValid(ltopr) && !PQgetisnull(res, row, RS_CORRELATION))
+	{
+		Datum corr = Float4GetDatum(strtod(PQgetvalue(res, row, RS_CORRELATION),
+										   NULL));
+
+		values[Anum_pg_statistic_stakind1 - 1 + slot] =
+			Int16GetDatum(STATISTIC_KIND_CORRELATION);
+		values[Anum_pg_statistic_staop1 - 1 + slot] = ObjectIdGetDatum(ltopr);
+		values[Anum_pg_statistic_stanumbers1 - 1 + slot] =
+			PointerGetDatum(construct_array(&corr, 1, FLOAT4OID,
+											sizeof(float4), FLOAT4PASSBYVAL, 'i'));
+		nulls[Anum_pg_statistic_stanumbers1 - 1 + slot] = false;
+		slot++;
+	}
+
+	/* Same as update_attstats() */
+	sd = heap_open(StatisticRelationId, RowExclusiveLock);
+
+	oldtup = SearchSysCache3(STATRELATTINH,
+							 ObjectIdGetDatum(RelationGetRelid(rel)),
+							 Int16GetDatum(attr->attnum),
+							 BoolGetDatum(false));
+
+	if (HeapTupleIsValid(oldtup))
+	{
+		stup = heap_modify_tuple(oldtup, RelationGetDescr(sd),
+								 values, nulls, replaces);
+		ReleaseSysCache(oldtup);
+		CatalogTupleUpdate(sd, &stup->t_self, stup);
+	}
+	else
+	{
+		stup = heap_form_tuple(RelationGetDescr(sd), values, nulls);
+		CatalogTupleInsert(sd, stup);
+	}
+
+	heap_freetuple(stup);
+	heap_close(sd, RowExclusiveLock);
+}
+
+/*
+ * Install rows [first_row, last_row] of 'res' as statistics of 'target'.
+ * A failure only skips this partition.
+ */
+static void
+install_remote_stats(RemoteStatsTarget *target,
+					 PGresult *res, int first_row, int last_row)
+{
+	MemoryContext	old_mcxt = CurrentMemoryContext;
+	ResourceOwner	old_owner = CurrentResourceOwner;
+
+	BeginInternalSubTransaction(NULL);
+	MemoryContextSwitchTo(old_mcxt);
+
+	PG_TRY();
+	{
+		Relation	rel;
+		TupleDesc	tupdesc;
+		int			row;
+
+		/* Same lock as ANALYZE */
+		rel = relation_open(target->relid, ShareUpdateExclusiveLock);
+		tupdesc = RelationGetDescr(rel);
+
+		vac_update_relstats(rel,
+							(BlockNumber) strtoul(PQgetvalue(res, first_row, RS_RELPAGES),
+												  NULL, 10),
+							strtod(PQgetvalue(res, first_row, RS_RELTUPLES), NULL),
+							0, false,
+							InvalidTransactionId, InvalidMultiXactId,
+							false);
+
+		for (row = first_row; row <= last_row; row++)
+		{
+			const char *attname;
+			int			i;
+
+			/* Remote table has not been analyzed */
+			if (PQgetisnull(res, row, RS_ATTNAME))
+				continue;
+
+			attname = PQgetvalue(res, row, RS_ATTNAME);
+
+			/* Find the column, remembering that it may be renamed */
+			for (i = 0; i < tupdesc->natts; i++)
+			{
+#if PG_VERSION_NUM >= 110000
+				Form_pg_attribute	attr = &(tupdesc->attrs[i]);
+#else
+				Form_pg_attribute	attr = tupdesc->attrs[i];
+#endif
+				const char		   *colname = NameStr(attr->attname);
+				ListCell		   *lc;
+
+				if (attr->attisdropped)
+					continue;
+
+				foreach(lc, GetForeignColumnOptions(target->relid, attr->attnum))
+				{
+					DefElem *def = (DefElem *) lfirst(lc);
+
+					if (strcmp(def->defname, "column_name") == 0)
+						colname = defGetString(def);
+				}
+
+				if (strcmp(colname, attname) == 0)
+				{
+					store_remote_attstats(rel, attr, res, row);
+					break;
+				}
+			}
+		}
+
+		relation_close(rel, NoLock);
+
+		ReleaseCurrentSubTransaction();
+		MemoryContextSwitchTo(old_mcxt);
+		CurrentResourceOwner = old_owner;
+	}
+	PG_CATCH();
+	{
+		ErrorData *edata;
+
+		MemoryContextSwitchTo(old_mcxt);
+		edata = CopyErrorData();
+		FlushErrorState();
+
+		RollbackAndReleaseCurrentSubTransaction();
+		MemoryContextSwitchTo(old_mcxt);
+		CurrentResourceOwner = old_owner;
+
+		ereport(WARNING,
+				(errmsg("%s: could not import statistics of \"%s\": %s",
+						remote_stats_bgw, get_rel_name_or_relid(target->relid),
+						edata->message)));
+		FreeErrorData(edata);
+	}
+	PG_END_TRY();
+}
+
+
+/*
+ * -------------------------------------------------
+ *  Public interface for the RemoteStatsWorker
+ * -------------------------------------------------
+ */
+
+/*
+ * Take a free slot and start RemoteStatsWorker.
+ * NOTE: this function returns immediately.
+ */
+Datum
+import_remote_stats(PG_FUNCTION_ARGS)
+{
+	Oid		relid = PG_ARGISNULL(0) ? InvalidOid : PG_GETARG_OID(0);
+	int32	period = PG_ARGISNULL(1) ? 0 : PG_GETARG_INT32(1);
+	int		empty_slot_idx;
+
+	if (!superuser())
+		ereport(ERROR, (errcode(ERRCODE_INSUFFICIENT_PRIVILEGE),
+						errmsg("must be superuser to import remote statistics")));
+
+	if (period < 0)
+		ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+						errmsg("'period' should not be less than 0")));
+
+	if (OidIsValid(relid) && !get_pathman_relation_info(relid))
+		ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+						errmsg("table \"%s\" is not partitioned",
+							   get_rel_name_or_relid(relid))));
+
+	empty_slot_idx = claim_worker_slot(&remote_stats_slots->head,
+									   sizeof(RemoteStatsSlot),
+									   REMOTE_STATS_SLOTS,
+									   GetUserId(), relid, WS_WORKING);
+	if (empty_slot_idx < 0)
+		ereport(ERROR, (errmsg("statistics of \"%s\" are already being imported",
+							   OidIsValid(relid) ?
+									get_rel_name(relid) : "all tables")));
+	else
+	{
+		RemoteStatsSlot *slot = &remote_stats_slots[empty_slot_idx];
+
+		InitRemoteStatsSlot(slot, period);
+
+		SpinLockRelease(&slot->head.mutex);
+	}
+
+	/* Start worker (we should not wait) */
+	launch_worker(&remote_stats_slots[empty_slot_idx].head, empty_slot_idx,
+				  remote_stats_bgw, CppAsString(bgw_main_import_remote_stats));
+
+	elog(NOTICE,
+		 "worker started, you can watch it in %s.gogudb_remote_stats_imports",
+		 get_namespace_name(get_pathman_schema()));
+
+	PG_RETURN_VOID();
+}
+
+/*
+ * Ask RemoteStatsWorker of 'relation' (NULL means all tables) to stop.
+ */
+Datum
+stop_remote_stats_import(PG_FUNCTION_ARGS)
+{
+	Oid		relid = PG_ARGISNULL(0) ? InvalidOid : PG_GETARG_OID(0);
+
+	if (stop_worker_slot(&remote_stats_slots->head, sizeof(RemoteStatsSlot),
+						 REMOTE_STATS_SLOTS, relid))
+	{
+		elog(NOTICE, "worker will stop after it finishes current round");
+		PG_RETURN_BOOL(true);
+	}
+	else
+	{
+		elog(ERROR, "cannot find worker for %s",
+			 OidIsValid(relid) ? get_rel_name_or_relid(relid) : "all tables");
+		PG_RETURN_BOOL(false); /* keep compiler happy */
+	}
+}
+
+/*
+ * Return list of active statistics imports.
+ * NOTE: this is a set-returning-function (SRF).
+ */
+Datum
+show_remote_stats_imports_internal(PG_FUNCTION_ARGS)
+{
+	FuncCallContext		   *funcctx;
+	active_imports_cxt	   *userctx;
+	RemoteStatsSlot			slot_copy;
+
+	/*
+	 * Initialize tuple descriptor & function call context.
+	 */
+	if (SRF_IS_FIRSTCALL())
+	{
+		TupleDesc			tupdesc;
+		MemoryContext		old_mcxt;
+
+		funcctx = SRF_FIRSTCALL_INIT();
+
+		old_mcxt = MemoryContextSwitchTo(funcctx->multi_call_memory_ctx);
+
+		userctx = (active_imports_cxt *) palloc(sizeof(active_imports_cxt));
+		userctx->cur_idx = 0;
+
+		/* Create tuple descriptor */
+		tupdesc = CreateTemplateTupleDesc(Natts_remote_stats_imports, false);
+
+		TupleDescInitEntry(tupdesc, Anum_remote_stats_imports_userid,
+						   "userid", REGROLEOID, -1, 0);
+		TupleDescInitEntry(tupdesc, Anum_remote_stats_imports_pid,
+						   "pid", INT4OID, -1, 0);
+		TupleDescInitEntry(tupdesc, Anum_remote_stats_imports_dbid,
+						   "dbid", OIDOID, -1, 0);
+		TupleDescInitEntry(tupdesc, Anum_remote_stats_imports_relid,
+						   "relid", REGCLASSOID, -1, 0);
+		TupleDescInitEntry(tupdesc, Anum_remote_stats_imports_period,
+						   "period", INT4OID, -1, 0);
+		TupleDescInitEntry(tupdesc, Anum_remote_stats_imports_imported,
+						   "imported", INT8OID, -1, 0);
+		TupleDescInitEntry(tupdesc, Anum_remote_stats_imports_last,
+						   "last_import", TIMESTAMPTZOID, -1, 0);
+		TupleDescInitEntry(tupdesc, Anum_remote_stats_imports_status,
+						   "status", TEXTOID, -1, 0);
+
+		funcctx->tuple_desc = BlessTupleDesc(tupdesc);
+		funcctx->user_fctx = (void *) userctx;
+
+		MemoryContextSwitchTo(old_mcxt);
+	}
+
+	funcctx = SRF_PERCALL_SETUP();
+	userctx = (active_imports_cxt *) funcctx->user_fctx;
+
+	/* Iterate through worker slots */
+	if (next_worker_slot(&remote_stats_slots->head, sizeof(RemoteStatsSlot),
+						 REMOTE_STATS_SLOTS, &userctx->cur_idx,
+						 &slot_copy.head))
+	{
+		Datum		values[Natts_remote_stats_imports];
+		bool		isnull[Natts_remote_stats_imports] = { 0 };
+		HeapTuple	htup;
+
+		values[Anum_remote_stats_imports_userid - 1]	= slot_copy.head.userid;
+		values[Anum_remote_stats_imports_pid - 1]		= slot_copy.head.pid;
+		values[Anum_remote_stats_imports_dbid - 1]		= slot_copy.head.dbid;
+		values[Anum_remote_stats_imports_relid - 1]		= slot_copy.head.relid;
+		values[Anum_remote_stats_imports_period - 1]	= Int32GetDatum(slot_copy.period);
+		values[Anum_remote_stats_imports_imported - 1]	=
+				Int64GetDatum(slot_copy.imported);
+		values[Anum_remote_stats_imports_last - 1]		=
+				TimestampTzGetDatum(slot_copy.last_import);
+		values[Anum_remote_stats_imports_status - 1]	=
+				CStringGetTextDatum(ws_print_status(slot_copy.head.worker_status));
+
+		isnull[Anum_remote_stats_imports_relid - 1] = !OidIsValid(slot_copy.head.relid);
+		isnull[Anum_remote_stats_imports_last - 1] = (slot_copy.last_import == 0);
+
+		/* Form output tuple */
+		htup = heap_form_tuple(funcctx->tuple_desc, values, isnull);
+
+		SRF_RETURN_NEXT(funcctx, HeapTupleGetDatum(htup));
+	}
+
+	SRF_RETURN_DONE(funcctx);
+}
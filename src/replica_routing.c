@@ -0,0 +1,527 @@
+/*-------------------------------------------------------------------------
+ *
+ * replica_routing.c
+ *		Routing of read-only transactions to replicas of the shards
+ *
+ *		Table server_replicas lists read-only replicas of every server of
+ *		server_map.  With gogudb.replica_routing enabled, a read-only
+ *		transaction scans each server through one of its replicas, chosen
+ *		either round-robin or by the least number of transactions routed
+ *		to it.  The choice is kept until the end of the transaction.
+ *
+ *		Replicas lagging behind more than gogudb.replica_max_lag are not
+ *		used.  The lag is stored in shmem and rechecked at most once per
+ *		REPLICA_LAG_RECHECK_MS by any backend.  Replicas marked down by
+ *		the circuit breaker of the connection layer are skipped as well.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "replica_routing.h"
+#include "connection_pool.h"
+#include "utils.h"
+
+#include "access/heapam.h"
+#include "access/htup_details.h"
+#include "access/xact.h"
+#include "foreign/foreign.h"
+#include "miscadmin.h"
+#include "storage/shmem.h"
+#include "utils/builtins.h"
+#include "utils/guc.h"
+#include "utils/lsyscache.h"
+#include "utils/memutils.h"
+#include "utils/rel.h"
+#include "utils/resowner.h"
+#include "utils/snapmgr.h"
+#include "utils/syscache.h"
+
+
+static const struct config_enum_entry replica_routing_options[] = {
+	{ "off",				REPLICA_ROUTING_OFF,				false },
+	{ "round_robin",		REPLICA_ROUTING_ROUND_ROBIN,		false },
+	{ "least_outstanding",	REPLICA_ROUTING_LEAST_OUTSTANDING,	false },
+	{ NULL,					0,									false }
+};
+
+
+int		gogudb_replica_routing = REPLICA_ROUTING_OFF;
+
+/* Max replication lag (ms) of a usable replica, 0 disables the check */
+int		gogudb_replica_max_lag = 0;
+
+static ReplicaRoutingState *replica_routing = NULL;
+
+/*
+ * Servers chosen by the current transaction (allocated in
+ * TopTransactionContext).
+ */
+typedef struct
+{
+	Oid		serverid;		/* primary server */
+	Oid		routed_to;		/* replica or the primary itself */
+	int		slot;			/* state of the replica, or -1 */
+} RoutedServer;
+
+static List	   *routed_servers = NIL;
+static bool		xact_callback_registered = false;
+
+
+static void replica_routing_xact_callback(XactEvent event, void *arg);
+static List *read_server_replicas(Oid serverid, Oid userid);
+static int find_replica_slot(Oid serverid, TimestampTz now);
+static int64 check_replica_lag(Oid serverid, Oid userid);
+
+
+Size
+estimate_replica_routing_size(void)
+{
+	return MAXALIGN(sizeof(ReplicaRoutingState));
+}
+
+/*
+ * Initialize shared memory needed for replica state.
+ */
+void
+init_replica_routing_state(void)
+{
+	bool	found;
+
+	replica_routing = ShmemInitStruct("gogudb replica routing",
+									  estimate_replica_routing_size(),
+									  &found);
+	if (!found)
+	{
+		memset(replica_routing, 0, sizeof(ReplicaRoutingState));
+		SpinLockInit(&replica_routing->mutex);
+	}
+}
+
+/*
+ * Define GUC variables of replica routing.
+ */
+void
+init_replica_routing_static_data(void)
+{
+	DefineCustomEnumVariable("gogudb.replica_routing",
+							 "Routes read-only transactions to replicas of the servers.",
+							 "Replicas are listed in table server_replicas.",
+							 &gogudb_replica_routing,
+							 REPLICA_ROUTING_OFF,
+							 replica_routing_options,
+							 PGC_USERSET,
+							 0,
+							 NULL,
+							 NULL,
+							 NULL);
+
+	DefineCustomIntVariable("gogudb.replica_max_lag",
+							"Sets the maximum replication lag of a replica used "
+							"by read-only transactions.",
+							"Zero disables the check.",
+							&gogudb_replica_max_lag,
+							0,
+							0, INT_MAX,
+							PGC_USERSET,
+							GUC_UNIT_MS,
+							NULL,
+							NULL,
+							NULL);
+}
+
+
+/*
+ * Return the server which should be scanned instead of 'serverid' by
+ * the current transaction: one of its replicas or 'serverid' itself.
+ */
+Oid
+replica_route_server(Oid serverid, Oid userid)
+{
+	List		   *replicas;
+	ListCell	   *lc;
+	RoutedServer   *routed;
+	MemoryContext	old_mcxt;
+	TimestampTz		now;
+	int			   *slots;
+	bool		   *recheck,
+				   *down;
+	int				nreplicas,
+					chosen = -1,
+					i;
+
+	if (gogudb_replica_routing == REPLICA_ROUTING_OFF || !XactReadOnly ||
+		replica_routing == NULL)
+		return serverid;
+
+	/* Has the transaction already chosen? */
+	foreach(lc, routed_servers)
+	{
+		routed = (RoutedServer *) lfirst(lc);
+		if (routed->serverid == serverid)
+			return routed->routed_to;
+	}
+
+	if (!xact_callback_registered)
+	{
+		RegisterXactCallback(replica_routing_xact_callback, NULL);
+		xact_callback_registered = true;
+	}
+
+	replicas = read_server_replicas(serverid, userid);
+	nreplicas = list_length(replicas);
+
+	slots = (int *) palloc(sizeof(int) * (nreplicas + 1));
+	recheck = (bool *) palloc0(sizeof(bool) * (nreplicas + 1));
+	down = (bool *) palloc0(sizeof(bool) * (nreplicas + 1));
+	now = GetCurrentTimestamp();
+
+	/* Don't bother with replicas the circuit breaker has given up on */
+	i = 0;
+	foreach(lc, replicas)
+		down[i++] = GoguServerIsDown(lfirst_oid(lc));
+
+	/* Find replica states, claim the stale ones for a lag check */
+	SpinLockAcquire(&replica_routing->mutex);
+	i = 0;
+	foreach(lc, replicas)
+	{
+		slots[i] = find_replica_slot(lfirst_oid(lc), now);
+
+		if (slots[i] >= 0 && !down[i] && gogudb_replica_max_lag > 0)
+		{
+			ReplicaState *state = &replica_routing->replicas[slots[i]];
+
+			if (TimestampDifferenceExceeds(state->checked_at, now,
+										   REPLICA_LAG_RECHECK_MS))
+			{
+				state->checked_at = now;
+				recheck[i] = true;
+			}
+		}
+		i++;
+	}
+	SpinLockRelease(&replica_routing->mutex);
+
+	i = 0;
+	foreach(lc, replicas)
+	{
+		if (recheck[i])
+		{
+			int64	lag = check_replica_lag(lfirst_oid(lc), userid);
+
+			/* The slot may have been reused meanwhile */
+			SpinLockAcquire(&replica_routing->mutex);
+			if (replica_routing->replicas[slots[i]].serverid == lfirst_oid(lc))
+				replica_routing->replicas[slots[i]].lag = lag;
+			SpinLockRelease(&replica_routing->mutex);
+		}
+		i++;
+	}
+
+	/* Pick one of the usable replicas */
+	SpinLockAcquire(&replica_routing->mutex);
+	if (nreplicas > 0)
+	{
+		uint32	start = replica_routing->next++;
+
+		for (i = 0; i < nreplicas; i++)
+		{
+			int				idx = (start + i) % nreplicas;
+			ReplicaState   *state;
+
+			if (slots[idx] < 0 || down[idx])
+				continue;
+
+			state = &replica_routing->replicas[slots[idx]];
+			if (state->serverid != list_nth_oid(replicas, idx))
+				continue;
+			if (state->lag < 0 ||
+				(gogudb_replica_max_lag > 0 && state->lag > gogudb_replica_max_lag))
+				continue;
+
+			if (chosen < 0)
+				chosen = idx;
+
+			if (gogudb_replica_routing == REPLICA_ROUTING_ROUND_ROBIN)
+				break;
+
+			if (state->outstanding <
+				replica_routing->replicas[slots[chosen]].outstanding)
+				chosen = idx;
+		}
+
+		if (chosen >= 0)
+			replica_routing->replicas[slots[chosen]].outstanding++;
+	}
+	SpinLockRelease(&replica_routing->mutex);
+
+	old_mcxt = MemoryContextSwitchTo(TopTransactionContext);
+	routed = (RoutedServer *) palloc(sizeof(RoutedServer));
+	routed->serverid = serverid;
+	routed->routed_to = (chosen >= 0) ? list_nth_oid(replicas, chosen) : serverid;
+	routed->slot = (chosen >= 0) ? slots[chosen] : -1;
+	routed_servers = lappend(routed_servers, routed);
+	MemoryContextSwitchTo(old_mcxt);
+
+	if (chosen >= 0)
+		elog(DEBUG1, "read-only transaction routed from server %u to replica %u",
+			 serverid, routed->routed_to);
+
+	pfree(slots);
+	pfree(recheck);
+	pfree(down);
+	list_free(replicas);
+
+	return routed->routed_to;
+}
+
+/*
+ * Forget the choices made by the transaction.
+ */
+static void
+replica_routing_xact_callback(XactEvent event, void *arg)
+{
+	ListCell   *lc;
+
+	switch (event)
+	{
+		case XACT_EVENT_COMMIT:
+		case XACT_EVENT_PARALLEL_COMMIT:
+		case XACT_EVENT_ABORT:
+		case XACT_EVENT_PARALLEL_ABORT:
+			break;
+
+		default:
+			return;
+	}
+
+	if (routed_servers == NIL)
+		return;
+
+	SpinLockAcquire(&replica_routing->mutex);
+	foreach(lc, routed_servers)
+	{
+		RoutedServer *routed = (RoutedServer *) lfirst(lc);
+
+		if (routed->slot >= 0 &&
+			replica_routing->replicas[routed->slot].outstanding > 0)
+			replica_routing->replicas[routed->slot].outstanding--;
+	}
+	SpinLockRelease(&replica_routing->mutex);
+
+	/* Memory is released together with TopTransactionContext */
+	routed_servers = NIL;
+}
+
+/*
+ * Read the replicas of 'serverid' which 'userid' is able to connect to.
+ */
+static List *
+read_server_replicas(Oid serverid, Oid userid)
+{
+	Oid				schema = get_pathman_schema(),
+					relid;
+	ForeignServer  *server;
+	Relation		rel;
+	HeapScanDesc	scan;
+	Snapshot		snapshot;
+	HeapTuple		htup;
+	List		   *result = NIL;
+
+	if (schema == InvalidOid)
+		return NIL;
+
+	relid = get_relname_relid(SERVER_REPLICAS, schema);
+	if (relid == InvalidOid)
+		return NIL;
+
+	server = GetForeignServer(serverid);
+
+	rel = heap_open(relid, AccessShareLock);
+
+	/* Check that number of columns == Natts_server_replicas */
+	Assert(RelationGetDescr(rel)->natts == Natts_server_replicas);
+
+	snapshot = RegisterSnapshot(GetLatestSnapshot());
+	scan = heap_beginscan(rel, snapshot, 0, NULL);
+
+	while ((htup = heap_getnext(scan, ForwardScanDirection)) != NULL)
+	{
+		Datum			values[Natts_server_replicas];
+		bool			isnull[Natts_server_replicas];
+		char		   *replica_name;
+		ForeignServer  *replica;
+
+		heap_deform_tuple(htup, RelationGetDescr(rel), values, isnull);
+
+		if (strcmp(TextDatumGetCString(values[Anum_server_replicas_srvname - 1]),
+				   server->servername) != 0)
+			continue;
+
+		replica_name = TextDatumGetCString(values[Anum_server_replicas_replica - 1]);
+		replica = GetForeignServerByName(replica_name, true);
+		if (replica == NULL)
+		{
+			elog(DEBUG1, "replica \"%s\" of server \"%s\" does not exist",
+				 replica_name, server->servername);
+			continue;
+		}
+
+		/* Skip replicas we have no user mapping for */
+		if (!SearchSysCacheExists2(USERMAPPINGUSERSERVER,
+								   ObjectIdGetDatum(userid),
+								   ObjectIdGetDatum(replica->serverid)) &&
+			!SearchSysCacheExists2(USERMAPPINGUSERSERVER,
+								   ObjectIdGetDatum(InvalidOid),
+								   ObjectIdGetDatum(replica->serverid)))
+			continue;
+
+		result = lappend_oid(result, replica->serverid);
+	}
+
+	heap_endscan(scan);
+	UnregisterSnapshot(snapshot);
+	heap_close(rel, AccessShareLock);
+
+	return result;
+}
+
+/*
+ * Find the state of a replica, take a free slot if it has none.  When all
+ * slots are taken, the least recently used one without transactions routed
+ * to it is reused, so that dropped replicas don't keep their slots forever.
+ * Caller must hold the mutex.
+ */
+static int
+find_replica_slot(Oid serverid, TimestampTz now)
+{
+	int		free_slot = -1,
+			idle_slot = -1,
+			i;
+
+	for (i = 0; i < REPLICA_STATE_SLOTS; i++)
+	{
+		ReplicaState *state = &replica_routing->replicas[i];
+
+		if (state->serverid == serverid)
+		{
+			state->used_at = now;
+			return i;
+		}
+
+		if (state->serverid == InvalidOid)
+		{
+			if (free_slot < 0)
+				free_slot = i;
+		}
+		else if (state->outstanding == 0 &&
+				 (idle_slot < 0 ||
+				  state->used_at < replica_routing->replicas[idle_slot].used_at))
+			idle_slot = i;
+	}
+
+	if (free_slot < 0)
+		free_slot = idle_slot;
+
+	if (free_slot >= 0)
+	{
+		ReplicaState *state = &replica_routing->replicas[free_slot];
+
+		state->serverid = serverid;
+		state->outstanding = 0;
+		state->lag = 0;
+		state->checked_at = 0;
+		state->used_at = now;
+	}
+
+	return free_slot;
+}
+
+/*
+ * Ask the replica how far behind it is (ms), -1 if it can't be reached.
+ *
+ * The lag is the age of the last replayed transaction.  A replica which has
+ * replayed everything it received is only up to date while its WAL receiver
+ * is streaming; its status is hidden from unprivileged roles, in which case
+ * a running receiver is enough.  The check uses the cached connection the
+ * routed transaction would use anyway, so no connection is opened for it.
+ */
+static int64
+check_replica_lag(Oid serverid, Oid userid)
+{
+	MemoryContext	old_mcxt = CurrentMemoryContext;
+	ResourceOwner	old_owner = CurrentResourceOwner;
+	PGconn *volatile conn = NULL;
+	volatile int64	lag = -1;
+
+	BeginInternalSubTransaction(NULL);
+	MemoryContextSwitchTo(old_mcxt);
+
+	PG_TRY();
+	{
+		const char *sql;
+		PGresult   *res;
+
+		conn = GoguGetConnection(GetUserMapping(userid, serverid), false, false);
+
+		if (PQserverVersion(conn) >= 100000)
+			sql = "SELECT CASE WHEN NOT pg_catalog.pg_is_in_recovery() THEN 0 "
+				  "WHEN pg_catalog.pg_last_wal_receive_lsn() = "
+				  "pg_catalog.pg_last_wal_replay_lsn() AND EXISTS "
+				  "(SELECT 1 FROM pg_catalog.pg_stat_wal_receiver "
+				  "WHERE COALESCE(status, 'streaming') = 'streaming') THEN 0 "
+				  "ELSE COALESCE(pg_catalog.date_part('epoch', pg_catalog.now() - "
+				  "pg_catalog.pg_last_xact_replay_timestamp()) * 1000, -1) "
+				  "END::bigint";
+		else
+			sql = "SELECT CASE WHEN NOT pg_catalog.pg_is_in_recovery() THEN 0 "
+				  "WHEN pg_catalog.pg_last_xlog_receive_location() = "
+				  "pg_catalog.pg_last_xlog_replay_location() AND EXISTS "
+				  "(SELECT 1 FROM pg_catalog.pg_stat_wal_receiver "
+				  "WHERE COALESCE(status, 'streaming') = 'streaming') THEN 0 "
+				  "ELSE COALESCE(pg_catalog.date_part('epoch', pg_catalog.now() - "
+				  "pg_catalog.pg_last_xact_replay_timestamp()) * 1000, -1) "
+				  "END::bigint";
+
+		res = Gogu_pgfdw_exec_query(conn, sql);
+		if (PQresultStatus(res) != PGRES_TUPLES_OK)
+			Gogu_pgfdw_report_error(ERROR, res, conn, true, sql);
+
+		lag = strtoll(PQgetvalue(res, 0, 0), NULL, 10);
+		PQclear(res);
+
+		GoguReleaseConnection(conn);
+		conn = NULL;
+
+		ReleaseCurrentSubTransaction();
+		MemoryContextSwitchTo(old_mcxt);
+		CurrentResourceOwner = old_owner;
+	}
+	PG_CATCH();
+	{
+		ErrorData  *error;
+
+		MemoryContextSwitchTo(old_mcxt);
+		error = CopyErrorData();
+		FlushErrorState();
+
+		if (conn != NULL)
+		{
+			GoguAbandonQuery(conn);
+			GoguReleaseConnection(conn);
+		}
+
+		RollbackAndReleaseCurrentSubTransaction();
+		MemoryContextSwitchTo(old_mcxt);
+		CurrentResourceOwner = old_owner;
+
+		elog(LOG, "could not check replication lag of server %u: %s",
+			 serverid, error->message);
+		FreeErrorData(error);
+
+		lag = -1;
+	}
+	PG_END_TRY();
+
+	return lag;
+}
@@ -0,0 +1,349 @@
+/*-------------------------------------------------------------------------
+ *
+ * stat_remote.c
+ *		Cumulative statistics of remote traffic per server
+ *
+ *		Statements completed through the connection layer, single-row
+ *		scans and fast-path statements are counted together with the rows
+ *		and bytes they moved, and their latency goes into a histogram.
+ *		Connection and transaction events are counted as well.  All
+ *		numbers live in shmem and are updated with atomics; they can be
+ *		read through the gogudb_stat_remote view.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "stat_remote.h"
+
+#include "access/htup_details.h"
+#include "catalog/pg_type.h"
+#include "funcapi.h"
+#include "miscadmin.h"
+#include "storage/shmem.h"
+#include "utils/array.h"
+#include "utils/builtins.h"
+
+
+/* Not defined by pg_type.h before 12 */
+#ifndef INT8ARRAYOID
+#define INT8ARRAYOID 1016
+#endif
+
+
+PG_FUNCTION_INFO_V1( show_stat_remote_internal );
+PG_FUNCTION_INFO_V1( stat_remote_reset );
+
+
+typedef struct
+{
+	slock_t			mutex;		/* protects assignment of slots */
+	StatRemoteEntry	servers[STAT_REMOTE_SLOTS];
+} StatRemoteState;
+
+static StatRemoteState *stat_remote = NULL;
+
+static const int latency_bounds[] = STAT_REMOTE_BUCKET_BOUNDS;
+
+/* Last entry found by this backend */
+static Oid				last_serverid = InvalidOid;
+static StatRemoteEntry *last_entry = NULL;
+
+
+static void reset_entry(StatRemoteEntry *entry, TimestampTz now);
+
+
+Size
+estimate_stat_remote_size(void)
+{
+	return MAXALIGN(sizeof(StatRemoteState));
+}
+
+/*
+ * Initialize shared memory needed for remote statistics.
+ */
+void
+init_stat_remote(void)
+{
+	bool	found;
+	int		i,
+			j;
+
+	StaticAssertStmt(lengthof(latency_bounds) + 1 == STAT_REMOTE_NBUCKETS,
+					 "wrong number of latency buckets");
+
+	stat_remote = ShmemInitStruct("gogudb remote statistics",
+								  estimate_stat_remote_size(),
+								  &found);
+	if (!found)
+	{
+		memset(stat_remote, 0, sizeof(StatRemoteState));
+		SpinLockInit(&stat_remote->mutex);
+
+		for (i = 0; i < STAT_REMOTE_SLOTS; i++)
+		{
+			StatRemoteEntry *entry = &stat_remote->servers[i];
+
+			for (j = 0; j < STAT_REMOTE_NCOUNTERS; j++)
+				pg_atomic_init_u64(&entry->counters[j], 0);
+			for (j = 0; j < STAT_REMOTE_NBUCKETS; j++)
+				pg_atomic_init_u64(&entry->latency[j], 0);
+		}
+	}
+}
+
+/*
+ * Find the statistics of a server of the current database, take a free
+ * slot if it has none.  Returns NULL if all slots are taken.
+ */
+StatRemoteEntry *
+stat_remote_entry(Oid serverid)
+{
+	StatRemoteEntry	   *entry = NULL;
+	TimestampTz			now;
+	int					i;
+
+	if (stat_remote == NULL || !OidIsValid(serverid))
+		return NULL;
+
+	if (serverid == last_serverid)
+		return last_entry;
+
+	now = GetCurrentTimestamp();
+
+	SpinLockAcquire(&stat_remote->mutex);
+	for (i = 0; i < STAT_REMOTE_SLOTS; i++)
+	{
+		StatRemoteEntry *cur = &stat_remote->servers[i];
+
+		if (cur->serverid == serverid && cur->dbid == MyDatabaseId)
+		{
+			entry = cur;
+			break;
+		}
+
+		if (cur->serverid == InvalidOid && entry == NULL)
+			entry = cur;
+	}
+
+	/* Take the free slot, its counters are zero since slots are never freed */
+	if (entry && entry->serverid == InvalidOid)
+	{
+		entry->dbid = MyDatabaseId;
+		entry->serverid = serverid;
+		entry->stats_reset = now;
+	}
+	SpinLockRelease(&stat_remote->mutex);
+
+	last_serverid = serverid;
+	last_entry = entry;
+
+	return entry;
+}
+
+/*
+ * Count a statement which took 'ms' milliseconds.
+ */
+void
+stat_remote_latency(StatRemoteEntry *entry, double ms)
+{
+	int		bucket;
+
+	if (entry == NULL)
+		return;
+
+	for (bucket = 0; bucket < lengthof(latency_bounds); bucket++)
+		if (ms < latency_bounds[bucket])
+			break;
+
+	pg_atomic_fetch_add_u64(&entry->latency[bucket], 1);
+	pg_atomic_fetch_add_u64(&entry->counters[STAT_REMOTE_TIME],
+							(uint64) (ms * 1000.0));
+}
+
+static void
+reset_entry(StatRemoteEntry *entry, TimestampTz now)
+{
+	int		i;
+
+	for (i = 0; i < STAT_REMOTE_NCOUNTERS; i++)
+		pg_atomic_write_u64(&entry->counters[i], 0);
+	for (i = 0; i < STAT_REMOTE_NBUCKETS; i++)
+		pg_atomic_write_u64(&entry->latency[i], 0);
+
+	SpinLockAcquire(&stat_remote->mutex);
+	entry->stats_reset = now;
+	SpinLockRelease(&stat_remote->mutex);
+}
+
+
+/*
+ * Reset statistics of a server of the current database (all servers of
+ * all databases if NULL).
+ */
+Datum
+stat_remote_reset(PG_FUNCTION_ARGS)
+{
+	Oid			serverid = PG_ARGISNULL(0) ? InvalidOid : PG_GETARG_OID(0);
+	TimestampTz	now = GetCurrentTimestamp();
+	int			i;
+
+	if (!superuser())
+		ereport(ERROR, (errcode(ERRCODE_INSUFFICIENT_PRIVILEGE),
+						errmsg("must be superuser to reset remote statistics")));
+
+	if (stat_remote == NULL)
+		PG_RETURN_VOID();
+
+	for (i = 0; i < STAT_REMOTE_SLOTS; i++)
+	{
+		StatRemoteEntry *entry = &stat_remote->servers[i];
+
+		if (entry->serverid == InvalidOid)
+			continue;
+
+		if (OidIsValid(serverid) &&
+			(entry->serverid != serverid || entry->dbid != MyDatabaseId))
+			continue;
+
+		reset_entry(entry, now);
+	}
+
+	PG_RETURN_VOID();
+}
+
+/*
+ * List statistics of all servers.
+ */
+Datum
+show_stat_remote_internal(PG_FUNCTION_ARGS)
+{
+	FuncCallContext	   *funcctx;
+	int				   *cur_idx;
+	int					i;
+
+	if (SRF_IS_FIRSTCALL())
+	{
+		TupleDesc			tupdesc;
+		MemoryContext		old_mcxt;
+
+		funcctx = SRF_FIRSTCALL_INIT();
+
+		old_mcxt = MemoryContextSwitchTo(funcctx->multi_call_memory_ctx);
+
+		cur_idx = (int *) palloc0(sizeof(int));
+
+		/* Create tuple descriptor */
+		tupdesc = CreateTemplateTupleDesc(Natts_stat_remote, false);
+
+		TupleDescInitEntry(tupdesc, Anum_stat_remote_dbid,
+						   "dbid", OIDOID, -1, 0);
+		TupleDescInitEntry(tupdesc, Anum_stat_remote_serverid,
+						   "serverid", OIDOID, -1, 0);
+		TupleDescInitEntry(tupdesc, Anum_stat_remote_queries,
+						   "queries", INT8OID, -1, 0);
+		TupleDescInitEntry(tupdesc, Anum_stat_remote_rows,
+						   "rows", INT8OID, -1, 0);
+		TupleDescInitEntry(tupdesc, Anum_stat_remote_bytes_in,
+						   "bytes_in", INT8OID, -1, 0);
+		TupleDescInitEntry(tupdesc, Anum_stat_remote_bytes_out,
+						   "bytes_out", INT8OID, -1, 0);
+		TupleDescInitEntry(tupdesc, Anum_stat_remote_total_time,
+						   "total_time", FLOAT8OID, -1, 0);
+		TupleDescInitEntry(tupdesc, Anum_stat_remote_latency,
+						   "latency", INT8ARRAYOID, -1, 0);
+		TupleDescInitEntry(tupdesc, Anum_stat_remote_latency_bounds,
+						   "latency_bounds", INT4ARRAYOID, -1, 0);
+		TupleDescInitEntry(tupdesc, Anum_stat_remote_errors,
+						   "errors", INT8OID, -1, 0);
+		TupleDescInitEntry(tupdesc, Anum_stat_remote_connects,
+						   "connects", INT8OID, -1, 0);
+		TupleDescInitEntry(tupdesc, Anum_stat_remote_reconnects,
+						   "reconnects", INT8OID, -1, 0);
+		TupleDescInitEntry(tupdesc, Anum_stat_remote_cursor_scans,
+						   "cursor_scans", INT8OID, -1, 0);
+		TupleDescInitEntry(tupdesc, Anum_stat_remote_single_row_scans,
+						   "single_row_scans", INT8OID, -1, 0);
+		TupleDescInitEntry(tupdesc, Anum_stat_remote_commits,
+						   "commits", INT8OID, -1, 0);
+		TupleDescInitEntry(tupdesc, Anum_stat_remote_aborts,
+						   "aborts", INT8OID, -1, 0);
+		TupleDescInitEntry(tupdesc, Anum_stat_remote_stats_reset,
+						   "stats_reset", TIMESTAMPTZOID, -1, 0);
+
+		funcctx->tuple_desc = BlessTupleDesc(tupdesc);
+		funcctx->user_fctx = (void *) cur_idx;
+
+		MemoryContextSwitchTo(old_mcxt);
+	}
+
+	funcctx = SRF_PERCALL_SETUP();
+	cur_idx = (int *) funcctx->user_fctx;
+
+	for (i = *cur_idx; stat_remote && i < STAT_REMOTE_SLOTS; i++)
+	{
+		StatRemoteEntry	   *entry = &stat_remote->servers[i];
+		Datum				values[Natts_stat_remote];
+		bool				isnull[Natts_stat_remote] = { 0 };
+		Datum				latency[STAT_REMOTE_NBUCKETS];
+		Datum				bounds[lengthof(latency_bounds)];
+		Oid					dbid,
+							serverid;
+		TimestampTz			stats_reset;
+		HeapTuple			htup;
+		int					j;
+
+		SpinLockAcquire(&stat_remote->mutex);
+		dbid = entry->dbid;
+		serverid = entry->serverid;
+		stats_reset = entry->stats_reset;
+		SpinLockRelease(&stat_remote->mutex);
+
+		if (serverid == InvalidOid)
+			continue;
+
+		for (j = 0; j < STAT_REMOTE_NBUCKETS; j++)
+			latency[j] = Int64GetDatum(pg_atomic_read_u64(&entry->latency[j]));
+		for (j = 0; j < lengthof(latency_bounds); j++)
+			bounds[j] = Int32GetDatum(latency_bounds[j]);
+
+#define COUNTER(c) \
+		Int64GetDatum(pg_atomic_read_u64(&entry->counters[(c)]))
+
+		values[Anum_stat_remote_dbid - 1]		= ObjectIdGetDatum(dbid);
+		values[Anum_stat_remote_serverid - 1]	= ObjectIdGetDatum(serverid);
+		values[Anum_stat_remote_queries - 1]	= COUNTER(STAT_REMOTE_QUERIES);
+		values[Anum_stat_remote_rows - 1]		= COUNTER(STAT_REMOTE_ROWS);
+		values[Anum_stat_remote_bytes_in - 1]	= COUNTER(STAT_REMOTE_BYTES_IN);
+		values[Anum_stat_remote_bytes_out - 1]	= COUNTER(STAT_REMOTE_BYTES_OUT);
+		values[Anum_stat_remote_total_time - 1]	=
+				Float8GetDatum(pg_atomic_read_u64(&entry->counters[STAT_REMOTE_TIME]) /
+							   1000.0);
+		values[Anum_stat_remote_latency - 1]	=
+				PointerGetDatum(construct_array(latency, STAT_REMOTE_NBUCKETS,
+												INT8OID, sizeof(int64),
+												FLOAT8PASSBYVAL, 'd'));
+		values[Anum_stat_remote_latency_bounds - 1] =
+				PointerGetDatum(construct_array(bounds, lengthof(latency_bounds),
+												INT4OID, sizeof(int32),
+												true, 'i'));
+		values[Anum_stat_remote_errors - 1]		= COUNTER(STAT_REMOTE_ERRORS);
+		values[Anum_stat_remote_connects - 1]	= COUNTER(STAT_REMOTE_CONNECTS);
+		values[Anum_stat_remote_reconnects - 1]	= COUNTER(STAT_REMOTE_RECONNECTS);
+		values[Anum_stat_remote_cursor_scans - 1] =
+				COUNTER(STAT_REMOTE_CURSOR_SCANS);
+		values[Anum_stat_remote_single_row_scans - 1] =
+				COUNTER(STAT_REMOTE_SINGLE_ROW_SCANS);
+		values[Anum_stat_remote_commits - 1]	= COUNTER(STAT_REMOTE_COMMITS);
+		values[Anum_stat_remote_aborts - 1]		= COUNTER(STAT_REMOTE_ABORTS);
+		values[Anum_stat_remote_stats_reset - 1] = TimestampTzGetDatum(stats_reset);
+
+#undef COUNTER
+
+		htup = heap_form_tuple(funcctx->tuple_desc, values, isnull);
+
+		*cur_idx = i + 1;
+		SRF_RETURN_NEXT(funcctx, HeapTupleGetDatum(htup));
+	}
+
+	SRF_RETURN_DONE(funcctx);
+}
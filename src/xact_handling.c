@@ -67,6 +67,17 @@ xact_bgw_conflicting_lock_exists(Oid relid)
 	/* We use locking groups for 9.6+ */
 	return false;
 #else
+	return xact_spawner_conflicting_lock_exists(relid);
+#endif
+}
+
+/*
+ * Check whether we already hold a lock that might conflict with
+ * partition spawning by a worker outside of our locking group.
+ */
+bool
+xact_spawner_conflicting_lock_exists(Oid relid)
+{
 	LOCKMODE	lockmode;
 
 	/* Try each lock >= ShareUpdateExclusiveLock */
@@ -79,7 +90,6 @@ xact_bgw_conflicting_lock_exists(Oid relid)
 	}
 
 	return false;
-#endif
 }
 
 
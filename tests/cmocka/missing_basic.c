@@ -15,6 +15,12 @@ repalloc(void *pointer, Size size)
 	return realloc(pointer, size);
 }
 
+void
+pfree(void *pointer)
+{
+	free(pointer);
+}
+
 
 void
 ExceptionalCondition(const char *conditionName,
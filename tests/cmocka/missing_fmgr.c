@@ -0,0 +1,32 @@
+#include <stdio.h>
+
+#include "postgres.h"
+#include "fmgr.h"
+
+
+Datum
+FunctionCall2Coll(FmgrInfo *flinfo, Oid collation, Datum arg1, Datum arg2)
+{
+	FunctionCallInfoData	fcinfo;
+	Datum					result;
+
+	InitFunctionCallInfoData(fcinfo, flinfo, 2, collation, NULL, NULL);
+
+	fcinfo.arg[0] = arg1;
+	fcinfo.arg[1] = arg2;
+	fcinfo.argnull[0] = false;
+	fcinfo.argnull[1] = false;
+
+	result = FunctionCallInvoke(&fcinfo);
+
+	if (fcinfo.isnull)
+	{
+		printf("FunctionCall2Coll(): function %u returned NULL\n",
+			   flinfo->fn_oid);
+		fflush(stdout);
+
+		abort();
+	}
+
+	return result;
+}
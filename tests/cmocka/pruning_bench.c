@@ -0,0 +1,329 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "init.h"
+#include "pathman.h"
+#include "rangeset.h"
+#include "relation_info.h"
+
+
+/*
+ * Microbenchmarks of the partition pruning and routing kernels.
+ *
+ * select_range_partitions() and walk_expr_tree() need the planner and
+ * the catalog, so they are measured through the code they spend their
+ * time in: binary search over RangeEntry bounds with cmp_bounds() calls
+ * through fmgr, and rangeset operations combining the results of
+ * AND/OR clauses and IN-lists.
+ */
+
+
+/* Number of RANGE partitions for bound search */
+#define NUM_BOUNDS			10000
+
+/* Number of IndexRanges in each operand of union\intersection */
+#define NUM_IRANGES			1000
+
+/* Number of values in IN-list and arguments of AND/OR */
+#define NUM_IN_VALUES		1000
+#define NUM_BOOL_ARGS		100
+
+/* Number of partitions of a HASH table */
+#define NUM_HASH_PARTS		64
+
+
+typedef void (*bench_func) (int iteration);
+
+static RangeEntry  *ranges;
+static RangeEntry	slot_ranges[NUM_HASH_PARTS];
+static FmgrInfo		cmp_finfo;
+static List		   *list_a,
+				   *list_b;
+static volatile uint32 sink;	/* keeps results alive */
+
+
+/*
+ * ---------
+ *  Helpers
+ * ---------
+ */
+
+/* Same as btint4cmp() */
+static Datum
+bench_int4cmp(PG_FUNCTION_ARGS)
+{
+	int32	a = PG_GETARG_INT32(0),
+			b = PG_GETARG_INT32(1);
+
+	if (a > b)
+		PG_RETURN_INT32(1);
+	else if (a == b)
+		PG_RETURN_INT32(0);
+	else
+		PG_RETURN_INT32(-1);
+}
+
+/* palloc() is malloc() here, so lists can be freed right away */
+static void
+free_irange_list(List *list)
+{
+	ListCell   *lc = list_head(list);
+
+	while (lc)
+	{
+		ListCell *next = lnext(lc);
+
+		free(lfirst(lc));
+		free(lc);
+		lc = next;
+	}
+
+	if (list)
+		free(list);
+}
+
+/* Ranges [start + i * step, start + i * step + width] */
+static List *
+make_irange_list(uint32 start, uint32 step, uint32 width, int count)
+{
+	List   *result = NIL;
+	int		i;
+
+	for (i = 0; i < count; i++)
+	{
+		uint32 lower = start + i * step;
+
+		result = lappend_irange(result,
+								make_irange(lower, lower + width,
+											(i % 3 == 0) ? IR_LOSSY : IR_COMPLETE));
+	}
+
+	return result;
+}
+
+/* Find partition of 'value', -1 if there's none */
+static int
+search_bounds(int32 value, const RangeEntry *entries, int nentries)
+{
+	Bound	value_bound = MakeBound(Int32GetDatum(value));
+	int		startidx = 0,
+			endidx = nentries - 1;
+
+	while (startidx <= endidx)
+	{
+		int i = startidx + (endidx - startidx) / 2;
+
+		if (cmp_bounds(&cmp_finfo, InvalidOid, &value_bound, &entries[i].min) < 0)
+			endidx = i - 1;
+		else if (cmp_bounds(&cmp_finfo, InvalidOid, &value_bound, &entries[i].max) >= 0)
+			startidx = i + 1;
+		else
+			return i;
+	}
+
+	return -1;
+}
+
+/* Integer mixer standing in for the type's hash function */
+static uint32
+mix_hash(uint32 value)
+{
+	value ^= value >> 16;
+	value *= 0x85ebca6b;
+	value ^= value >> 13;
+	value *= 0xc2b2ae35;
+	value ^= value >> 16;
+
+	return value;
+}
+
+static double
+now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (double) ts.tv_sec * 1e9 + (double) ts.tv_nsec;
+}
+
+static void
+run_bench(const char *name, bench_func func, int iterations)
+{
+	double	start,
+			elapsed;
+	int		i;
+
+	/* Warm up caches */
+	for (i = 0; i < iterations / 10 + 1; i++)
+		func(i);
+
+	start = now_ns();
+	for (i = 0; i < iterations; i++)
+		func(i);
+	elapsed = now_ns() - start;
+
+	printf("%-28s %12.1f ns/op %10d ops\n",
+		   name, elapsed / iterations, iterations);
+	fflush(stdout);
+}
+
+
+/*
+ * ------------
+ *  Benchmarks
+ * ------------
+ */
+
+/* Two interleaved lists of NUM_IRANGES ranges */
+static void
+bench_irange_list_union(int iteration)
+{
+	List *result = irange_list_union(list_a, list_b);
+
+	sink += list_length(result);
+	free_irange_list(result);
+}
+
+static void
+bench_irange_list_intersection(int iteration)
+{
+	List *result = irange_list_intersection(list_a, list_b);
+
+	sink += list_length(result);
+	free_irange_list(result);
+}
+
+/* Equality lookup among NUM_BOUNDS RANGE partitions */
+static void
+bench_range_bound_search(int iteration)
+{
+	sink += search_bounds((int32) (mix_hash(iteration) % (NUM_BOUNDS * 10)),
+						  ranges, NUM_BOUNDS);
+}
+
+/* Value -> hash slot -> partition owning the slot */
+static void
+bench_hash_slot_routing(int iteration)
+{
+	uint32 idx = hash_to_part_index(mix_hash(iteration), HASH_SLOT_SIZE);
+
+	sink += search_bounds((int32) idx, slot_ranges, NUM_HASH_PARTS);
+}
+
+/* "key IN (...)": one partition per value, merged one by one */
+static void
+bench_in_list(int iteration)
+{
+	List   *result = NIL;
+	int		i;
+
+	for (i = 0; i < NUM_IN_VALUES; i++)
+	{
+		int32	value = (int32) (mix_hash(iteration * NUM_IN_VALUES + i) %
+								 (NUM_BOUNDS * 10));
+		int		idx = search_bounds(value, ranges, NUM_BOUNDS);
+		List   *single,
+			   *merged;
+
+		if (idx < 0)
+			continue;
+
+		single = list_make1_irange(make_irange(idx, idx, IR_COMPLETE));
+		merged = irange_list_union(result, single);
+
+		free_irange_list(single);
+		free_irange_list(result);
+		result = merged;
+	}
+
+	sink += list_length(result);
+	free_irange_list(result);
+}
+
+/* "(a OR b OR ...) AND (c OR d OR ...)" over RANGE partitions */
+static void
+bench_and_or_tree(int iteration)
+{
+	List   *left = NIL,
+		   *right = NIL,
+		   *result;
+	int		i;
+
+	for (i = 0; i < NUM_BOOL_ARGS; i++)
+	{
+		List   *arg,
+			   *merged;
+		uint32	lower = mix_hash(iteration * NUM_BOOL_ARGS + i) % NUM_BOUNDS;
+
+		arg = make_irange_list(lower, 1, 50, 1);
+		merged = irange_list_union((i % 2) ? left : right, arg);
+		free_irange_list(arg);
+
+		if (i % 2)
+		{
+			free_irange_list(left);
+			left = merged;
+		}
+		else
+		{
+			free_irange_list(right);
+			right = merged;
+		}
+	}
+
+	result = irange_list_intersection(left, right);
+
+	sink += list_length(result);
+	free_irange_list(left);
+	free_irange_list(right);
+	free_irange_list(result);
+}
+
+
+/* Entrypoint */
+int
+main(int argc, char **argv)
+{
+	int		scale = (argc > 1) ? atoi(argv[1]) : 1;
+	int		i;
+
+	if (scale < 1)
+		scale = 1;
+
+	/* Comparison function of int4 keys */
+	memset(&cmp_finfo, 0, sizeof(cmp_finfo));
+	cmp_finfo.fn_addr = bench_int4cmp;
+	cmp_finfo.fn_nargs = 2;
+
+	/* Partitions [i * 10, i * 10 + 10) */
+	ranges = palloc(sizeof(RangeEntry) * NUM_BOUNDS);
+	for (i = 0; i < NUM_BOUNDS; i++)
+	{
+		ranges[i].child_oid = i + 1;
+		ranges[i].min = MakeBound(Int32GetDatum(i * 10));
+		ranges[i].max = MakeBound(Int32GetDatum(i * 10 + 10));
+	}
+
+	/* HASH partitions own equal ranges of hash slots */
+	for (i = 0; i < NUM_HASH_PARTS; i++)
+	{
+		slot_ranges[i].child_oid = i + 1;
+		slot_ranges[i].min = MakeBound(Int32GetDatum(i * HASH_SLOT_SIZE / NUM_HASH_PARTS));
+		slot_ranges[i].max = MakeBound(Int32GetDatum((i + 1) * HASH_SLOT_SIZE / NUM_HASH_PARTS));
+	}
+
+	list_a = make_irange_list(0, 10, 5, NUM_IRANGES);
+	list_b = make_irange_list(3, 10, 5, NUM_IRANGES);
+
+	run_bench("irange_list_union", bench_irange_list_union, 2000 * scale);
+	run_bench("irange_list_intersection", bench_irange_list_intersection, 2000 * scale);
+	run_bench("range_bound_search_10k", bench_range_bound_search, 1000000 * scale);
+	run_bench("hash_slot_routing", bench_hash_slot_routing, 1000000 * scale);
+	run_bench("in_list_1000", bench_in_list, 200 * scale);
+	run_bench("and_or_tree_100", bench_and_or_tree, 2000 * scale);
+
+	return 0;
+}
@@ -24,6 +24,8 @@ static void test_irange_list_union_intersecting(void **state);
 
 static void test_irange_list_intersection(void **state);
 
+static void test_irange_combiner(void **state);
+
 
 /* Entrypoint */
 int
@@ -38,6 +40,7 @@ main(void)
 		cmocka_unit_test(test_irange_list_union_complete_cov),
 		cmocka_unit_test(test_irange_list_union_intersecting),
 		cmocka_unit_test(test_irange_list_intersection),
+		cmocka_unit_test(test_irange_combiner),
 	};
 
 	/* Run series of tests */
@@ -465,3 +468,72 @@ test_irange_list_intersection(void **state)
 	assert_string_equal(rangeset_print(intersection_result),
 						"21L, [22-25]C");
 }
+
+/* Bitmaps and lists of IndexRanges should give the same results */
+static void
+test_irange_combiner(void **state)
+{
+	IndexRangeCombiner	combiner;
+	List			   *left_list,
+					   *right_list;
+	uint32				nchildren;
+
+
+	/* Subtest #0: bitmap and list forms of OR */
+	left_list = NIL;
+	left_list = lappend_irange(left_list, make_irange(0, 45, IR_COMPLETE));
+	left_list = lappend_irange(left_list, make_irange(64, 100, IR_COMPLETE));
+	right_list = list_make1_irange(make_irange(40, 65, IR_LOSSY));
+
+	/* 128 children use a bitmap, 4097 children use a list */
+	for (nchildren = 128; nchildren <= IRANGE_BITMAP_MAX_CHILDREN + 1;
+		 nchildren += IRANGE_BITMAP_MAX_CHILDREN - 127)
+	{
+		irange_combiner_init(&combiner, nchildren, true);
+		irange_combiner_add(&combiner, left_list);
+		irange_combiner_add(&combiner, right_list);
+
+		assert_int_equal(irange_combiner_length(&combiner), 101);
+		assert_string_equal(rangeset_print(irange_combiner_result(&combiner)),
+							"[0-45]C, [46-63]L, [64-100]C");
+	}
+
+	/* Subtest #1: bitmap and list forms of AND */
+	left_list = NIL;
+	left_list = lappend_irange(left_list, make_irange(0, 11, IR_LOSSY));
+	left_list = lappend_irange(left_list, make_irange(12, 20, IR_COMPLETE));
+	right_list = NIL;
+	right_list = lappend_irange(right_list, make_irange(1, 15, IR_COMPLETE));
+	right_list = lappend_irange(right_list, make_irange(16, 20, IR_LOSSY));
+
+	for (nchildren = 128; nchildren <= IRANGE_BITMAP_MAX_CHILDREN + 1;
+		 nchildren += IRANGE_BITMAP_MAX_CHILDREN - 127)
+	{
+		irange_combiner_init(&combiner, nchildren, false);
+		irange_combiner_add(&combiner, left_list);
+		irange_combiner_add(&combiner, right_list);
+
+		assert_false(irange_combiner_is_empty(&combiner));
+		assert_int_equal(irange_combiner_length(&combiner), 20);
+		assert_string_equal(rangeset_print(irange_combiner_result(&combiner)),
+							"[1-11]L, [12-15]C, [16-20]L");
+	}
+
+	/* Subtest #2: ranges crossing word boundaries */
+	irange_combiner_init(&combiner, 200, true);
+	irange_combiner_add(&combiner, list_make1_irange(make_irange(60, 130, IR_LOSSY)));
+	irange_combiner_add(&combiner, list_make1_irange(make_irange(64, 127, IR_COMPLETE)));
+
+	assert_int_equal(irange_combiner_length(&combiner), 71);
+	assert_string_equal(rangeset_print(irange_combiner_result(&combiner)),
+						"[60-63]L, [64-127]C, [128-130]L");
+
+	/* Subtest #3: empty intersection */
+	irange_combiner_init(&combiner, 200, false);
+	irange_combiner_add(&combiner, list_make1_irange(make_irange(0, 63, IR_COMPLETE)));
+	irange_combiner_add(&combiner, list_make1_irange(make_irange(64, 199, IR_COMPLETE)));
+
+	assert_true(irange_combiner_is_empty(&combiner));
+	assert_int_equal(irange_combiner_length(&combiner), 0);
+	assert_null(irange_combiner_result(&combiner));
+}
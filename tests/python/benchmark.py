@@ -0,0 +1,313 @@
+#!/usr/bin/env python3
+# coding: utf-8
+"""
+benchmark.py
+        Performance suite: one coordinator and several shards on localhost
+
+        Distributed tables are created via table_partition_rule, every
+        scenario is run with pgbench (COPY ingest is driven by psql) and
+        the results are printed as JSON, so that runs of different commits
+        can be compared with --compare.
+"""
+
+import argparse
+import glob
+import json
+import os
+import re
+import shutil
+import subprocess
+import tempfile
+import time
+
+from testgres import get_new_node, get_pg_version
+
+
+SCRIPTS_DIR = os.path.join(os.path.dirname(os.path.realpath(__file__)),
+                           'pgbench_scripts')
+
+# Scenarios run by pgbench, script names are 'bench_<scenario>.pgbench'
+PGBENCH_SCENARIOS = [
+    'point_select',
+    'point_update',
+    'multi_insert',
+    'full_scan_agg',
+    'order_limit',
+    'colocated_join',
+]
+
+ALL_SCENARIOS = PGBENCH_SCENARIOS + ['copy_ingest']
+
+# Hash partitions of every distributed table
+HASH_PARTITIONS = 8
+
+# Hash slots spread over the shards (see server_map)
+HASH_SLOTS = 128
+
+
+def percentile(values, pct):
+    """ Nearest-rank percentile of a non-empty list """
+    values = sorted(values)
+    rank = max(int(round(pct / 100.0 * len(values))) - 1, 0)
+    return values[min(rank, len(values) - 1)]
+
+
+def latency_summary(latencies_ms):
+    if not latencies_ms:
+        return {'latency_p50_ms': None, 'latency_p99_ms': None}
+
+    return {
+        'latency_p50_ms': round(percentile(latencies_ms, 50), 3),
+        'latency_p99_ms': round(percentile(latencies_ms, 99), 3),
+    }
+
+
+class Cluster(object):
+    """ Coordinator with gogudb and shards reachable via gogudb_fdw """
+
+    def __init__(self, shards):
+        self.coordinator = get_new_node()
+        self.shards = [get_new_node() for _ in range(shards)]
+
+    def __enter__(self):
+        for shard in self.shards:
+            shard.init().start()
+
+        self.coordinator.init()
+        self.coordinator.append_conf("shared_preload_libraries='gogudb'\n")
+        self.coordinator.start()
+        self.coordinator.safe_psql('create extension gogudb')
+
+        username = self.coordinator.execute('select current_user')[0][0]
+
+        for i, shard in enumerate(self.shards):
+            server = 'bench_shard_%d' % i
+            lo = i * HASH_SLOTS // len(self.shards)
+            hi = (i + 1) * HASH_SLOTS // len(self.shards)
+
+            self.coordinator.safe_psql("""
+                create server {0} foreign data wrapper gogudb_fdw
+                options (dbname 'postgres', host '127.0.0.1', port '{1}');
+                create user mapping for {2} server {0} options (user '{2}');
+                insert into _gogu.server_map values ('{0}', {3}, {4});
+            """.format(server, shard.port, username, lo, hi))
+
+        self.coordinator.safe_psql('select _gogu.reload_range_server_set()')
+
+        return self
+
+    def __exit__(self, *args):
+        for node in [self.coordinator] + self.shards:
+            node.cleanup()
+
+    def create_tables(self, rows):
+        """ Co-located hash tables and a range table, filled with 'rows' rows """
+
+        self.coordinator.safe_psql("""
+            insert into _gogu.table_partition_rule
+                (schema_name, table_name, part_expr, part_type, part_dist, remote_schema)
+            values
+                ('public', 'bench_hash', 'id', 1, {0}, 'public'),
+                ('public', 'bench_orders', 'id', 1, {0}, 'public'),
+                ('public', 'bench_copy', 'id', 1, {0}, 'public');
+
+            insert into _gogu.table_partition_rule
+                (schema_name, table_name, part_expr, part_type, part_dist, remote_schema,
+                 range_interval, range_start)
+            values
+                ('public', 'bench_range', 'id', 2, {1}, 'public', '{2}', '0');
+
+            create table bench_hash(id int not null, k int not null default 0, payload text);
+            create table bench_orders(id int not null, amount numeric not null);
+            create table bench_copy(id int not null, k int not null, payload text);
+            create table bench_range(id int not null, k int not null, created timestamp not null);
+        """.format(HASH_PARTITIONS, len(self.shards),
+                   max(rows // len(self.shards), 1) + 1))
+
+        self.coordinator.safe_psql("""
+            insert into bench_hash
+                select id, id % 1000, md5(id::text) from generate_series(1, {0}) id;
+            insert into bench_orders
+                select id, (id % 100) * 1.5 from generate_series(1, {0}) id;
+            insert into bench_range
+                select id, id % 1000, now() from generate_series(1, {0}) id;
+        """.format(rows))
+
+        for shard in self.shards:
+            shard.safe_psql('vacuum analyze')
+        self.coordinator.safe_psql('analyze')
+
+
+def run_pgbench(node, scenario, args, log_dir):
+    """ Run a pgbench scenario, return TPS and latency percentiles """
+
+    script = os.path.join(SCRIPTS_DIR, 'bench_%s.pgbench' % scenario)
+    prefix = os.path.join(log_dir, scenario)
+
+    options = [
+        '-n',
+        '-c', str(args.clients),
+        '-j', str(args.jobs),
+        '-T', str(args.duration),
+        '-M', args.protocol,
+        '-D', 'rows=%d' % args.rows,
+        '-f', script,
+        '-l', '--log-prefix=%s' % prefix,
+    ]
+
+    with open(os.devnull, 'w') as fnull:
+        proc = node.pgbench(stdout=subprocess.PIPE, stderr=fnull, options=options)
+        out, _ = proc.communicate()
+
+    out = out.decode('utf-8', 'replace')
+    if proc.returncode != 0:
+        raise RuntimeError('pgbench failed on %s:\n%s' % (scenario, out))
+
+    tps = re.search(r'tps = ([0-9.]+)', out)
+    transactions = re.search(r'number of transactions actually processed: (\d+)', out)
+
+    # Per-transaction log: client, transaction, latency (us), ...
+    latencies = []
+    for log in glob.glob(prefix + '.*'):
+        with open(log) as f:
+            for line in f:
+                fields = line.split()
+                if len(fields) >= 3 and fields[2].isdigit():
+                    latencies.append(int(fields[2]) / 1000.0)
+
+    result = {
+        'tps': float(tps.group(1)) if tps else None,
+        'transactions': int(transactions.group(1)) if transactions else None,
+    }
+    result.update(latency_summary(latencies))
+
+    return result
+
+
+def run_copy_ingest(node, args, log_dir):
+    """ Load batches of rows with COPY via psql for 'duration' seconds """
+
+    batch = os.path.join(log_dir, 'copy_batch.csv')
+    with open(batch, 'w') as f:
+        for i in range(args.copy_batch):
+            f.write('%d,%d,%s\n' % (i + 1, i % 1000, 'payload-%d' % i))
+
+    command = "\\copy bench_copy from '%s' with (format csv)" % batch
+
+    latencies = []
+    started = time.time()
+    while time.time() - started < args.duration:
+        t = time.time()
+        node.safe_psql(command)
+        latencies.append((time.time() - t) * 1000.0)
+
+    elapsed = time.time() - started
+
+    result = {
+        'tps': round(len(latencies) / elapsed, 3),
+        'transactions': len(latencies),
+        'rows_per_sec': round(len(latencies) * args.copy_batch / elapsed, 3),
+    }
+    result.update(latency_summary(latencies))
+
+    return result
+
+
+def git_commit():
+    try:
+        out = subprocess.check_output(['git', 'rev-parse', 'HEAD'],
+                                      cwd=SCRIPTS_DIR,
+                                      stderr=subprocess.DEVNULL)
+        return out.decode().strip()
+    except (OSError, subprocess.CalledProcessError):
+        return None
+
+
+def compare(baseline, current):
+    """ Print TPS and p99 changes against an earlier run """
+
+    print('%-16s %12s %12s %8s %12s %12s' %
+          ('scenario', 'tps (base)', 'tps', 'change', 'p99 (base)', 'p99'))
+
+    for name, res in sorted(current['scenarios'].items()):
+        base = baseline.get('scenarios', {}).get(name)
+        if not base or not base.get('tps') or res.get('tps') is None:
+            continue
+
+        change = (res['tps'] - base['tps']) / base['tps'] * 100.0
+        print('%-16s %12.1f %12.1f %+7.1f%% %12s %12s' %
+              (name, base['tps'], res['tps'], change,
+               base.get('latency_p99_ms'), res.get('latency_p99_ms')))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__,
+                                     formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('--shards', type=int, default=2)
+    parser.add_argument('--rows', type=int, default=100000,
+                        help='rows loaded into every table')
+    parser.add_argument('--clients', type=int, default=8)
+    parser.add_argument('--jobs', type=int, default=2,
+                        help='pgbench threads')
+    parser.add_argument('--duration', type=int, default=30,
+                        help='seconds per scenario')
+    parser.add_argument('--protocol', default='prepared',
+                        choices=['simple', 'extended', 'prepared'])
+    parser.add_argument('--copy-batch', type=int, default=10000,
+                        help='rows per COPY in copy_ingest')
+    parser.add_argument('--scenarios', default=','.join(ALL_SCENARIOS),
+                        help='comma-separated list of scenarios')
+    parser.add_argument('--output', help='write JSON here instead of stdout')
+    parser.add_argument('--compare', help='JSON of an earlier run')
+    args = parser.parse_args()
+
+    scenarios = [s.strip() for s in args.scenarios.split(',') if s.strip()]
+    for s in scenarios:
+        if s not in ALL_SCENARIOS:
+            parser.error('unknown scenario "%s"' % s)
+
+    results = {
+        'commit': git_commit(),
+        'pg_version': get_pg_version(),
+        'started': time.strftime('%Y-%m-%dT%H:%M:%S'),
+        'config': {
+            'shards': args.shards,
+            'rows': args.rows,
+            'clients': args.clients,
+            'jobs': args.jobs,
+            'duration': args.duration,
+            'protocol': args.protocol,
+            'copy_batch': args.copy_batch,
+        },
+        'scenarios': {},
+    }
+
+    log_dir = tempfile.mkdtemp(prefix='gogudb_bench_')
+    try:
+        with Cluster(args.shards) as cluster:
+            cluster.create_tables(args.rows)
+
+            for s in scenarios:
+                if s == 'copy_ingest':
+                    res = run_copy_ingest(cluster.coordinator, args, log_dir)
+                else:
+                    res = run_pgbench(cluster.coordinator, s, args, log_dir)
+
+                results['scenarios'][s] = res
+    finally:
+        shutil.rmtree(log_dir, ignore_errors=True)
+
+    text = json.dumps(results, indent=2, sort_keys=True)
+    if args.output:
+        with open(args.output, 'w') as f:
+            f.write(text + '\n')
+    else:
+        print(text)
+
+    if args.compare:
+        with open(args.compare) as f:
+            compare(json.load(f), results)
+
+
+if __name__ == '__main__':
+    main()